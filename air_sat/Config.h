@@ -6,10 +6,29 @@
 // SETUP FOR BLUETOOTH MODULE ( Adresse Mac 98:d3:71:fe:09:0f )
 #define COMM_BAUDRATE         115200
 #define CONF_BAUDRATE         38400
+// RTCM corrections are forwarded on the same UART: 9600 bauds carry MSM4
+// messages of a single base, MSM7 needs the F9P UART1 set to 38400 or more
 #define GNSS_BAUDRATE         9600
 // Pin used to set bluetooth module in config mode
 #define KEY_PIN 6
 
+// RTK CORRECTIONS
+// Memory added to the GNSS UART transmit buffer (a whole RTCM frame fits)
+#define GNSS_TX_EXTRA_BUFFER      1100
+// Memory added to the Bluetooth UART receive buffer (correction bursts)
+#define BLUETOOTH_RX_EXTRA_BUFFER 1024
+// Longest delay of a telemetry line during a correction burst (ms)
+#define TELEMETRY_MAX_DEFER       250
+
+// CHANGE FILTERS
+// Largest error of the values rebuilt by the gateway (Change_filter.h)
+#define CO2_TOLERANCE             10.0  // ppm
+#define TEMP_TOLERANCE            0.1   // °C
+#define HUM_TOLERANCE             0.5   // %RH
+#define PRES_TOLERANCE            10.0  // Pa
+// A value is sent at least every CF_HEARTBEAT samples (1 min at 5 s)
+#define CF_HEARTBEAT              12
+
 String btName, macAddr, UARTConf;
 
 #define SATELITE_NAME "AIR_SAT"
@@ -5,6 +5,10 @@
  * @brief:
  *    This program send over Bluetooth Air Temperature, Humidity, CO2 and Atmospheric pressure 
  *    using a mix of GNSS time and Teensy clock.
+ *    RTK corrections (RTCM 3) received from the gateway over Bluetooth are
+ *    forwarded to the GNSS module, orders are read from the same link.
+ *    Sensor values are sent on change (Change_filter.h): unchanged values
+ *    are replaced by a marker, lines are sent one sample late.
  *   
  * @board :
  *    Teensy 3.5
@@ -14,6 +18,7 @@
  *
  * @wiring:
  *      Teensy RX5       -> Drotek - DP0601 UART1 B3 (TX)
+ *      Teensy TX5       -> Drotek - DP0601 UART1 B2 (RX, RTCM corrections)
  *      Teensy Vin (5V)  -> Drotek - DP0601 UART1 B1 (5V)
  *      Teensy GND       -> Drotek - DP0601 UART1 B6 (GND)
  *      Teensy SCL  -> BME280 & I2CS CO2
@@ -42,12 +47,22 @@
 #include "SparkFunBME280.h"
 #include <TinyGPSPlus.h>
 #include "Config.h"
+#include "RTCM_demux.h"
+#include "Change_filter.h"
 
 // SENSORS
 SensirionI2CScd4x scd4x;
 BME280 sensorBME280;
 TinyGPSPlus gps;
 
+// RTK CORRECTIONS
+// Corrections and orders received from the gateway
+RtcmDemux btDemux;
+// Set once the Bluetooth module is configured (AT answers are read directly)
+volatile bool demuxEnabled = false;
+uint8_t gnssTxBuffer[GNSS_TX_EXTRA_BUFFER];
+uint8_t bluetoothRxBuffer[BLUETOOTH_RX_EXTRA_BUFFER];
+
 //Create variable to track time
 int start_log = 1;
 unsigned long updateTime = 0;
@@ -59,6 +74,30 @@ String logDir = "";
 String logFileName = "AIR.csv";
 File logFile, confFile;
 
+// CHANGE FILTERS
+// Channels sent on change, in the line order
+enum FilteredChannels : uint8_t {
+    F_CO2 = 0,
+    F_CO2_TEMP,
+    F_CO2_HUM,
+    F_BME_TEMP,
+    F_BME_HUM,
+    F_BME_PRES,
+    NB_FILTERED
+};
+const char* filteredKeys[NB_FILTERED] = {"Co2", "Co2_Temperature", "Co2_Humidity", "BME_Temperature", "BME_Humidity", "BME_Pressure"};
+const uint8_t filteredDecimals[NB_FILTERED] = {0, 2, 2, 2, 2, 2};
+ChangeFilter filters[NB_FILTERED] = {
+    ChangeFilter(CF_DEADBAND, CO2_TOLERANCE),
+    ChangeFilter(CF_SWINGING_DOOR, TEMP_TOLERANCE),
+    ChangeFilter(CF_SWINGING_DOOR, HUM_TOLERANCE),
+    ChangeFilter(CF_SWINGING_DOOR, TEMP_TOLERANCE),
+    ChangeFilter(CF_SWINGING_DOOR, HUM_TOLERANCE),
+    ChangeFilter(CF_SWINGING_DOOR, PRES_TOLERANCE)
+};
+// Start of the line waiting for the filter decisions (id, time, location), empty if none
+String pendingHead = "";
+
 void setup() {
   
     Serial.begin(115200);
@@ -138,6 +177,10 @@ void setup() {
 
     /*      GNSS From RX5       */
     Serial5.begin(GNSS_BAUDRATE);
+    // Room for a whole RTCM frame, and for a correction burst
+    Serial5.addMemoryForWrite(gnssTxBuffer, sizeof(gnssTxBuffer));
+    Serial1.addMemoryForRead(bluetoothRxBuffer, sizeof(bluetoothRxBuffer));
+    demuxEnabled = true;
 
     /* CONFIG SD CARD for local storage */
     setupSDCard();
@@ -156,9 +199,10 @@ void loop() {
       gps.encode(c);
     }
 
-    // Receiving order from Bluetooth
-    if (Serial1.available() > 0) {
-        String data = Serial1.readStringUntil('\n');
+    // Receiving order from Bluetooth (split from the corrections by serialEvent1())
+    if (btDemux.orderReady()) {
+        String data = btDemux.order();
+        btDemux.releaseOrder();
         Serial.println( " - message received : ");
         Serial.println(data);
         commandManager(data);
@@ -197,32 +241,111 @@ void loop() {
         } else if (co2 == 0) {
             Serial.println("Invalid sample detected, skipping.");
         } else {
-            String json = "{";
-            json += "\"id\":\"Air_"+ (String)macAddr + "\",";
-            json += "\"time\":\"" + (String)gps.date.year() + "/" + (String)gps.date.month() + "/" + (String)gps.date.day() + " ";
-            json += (String)gps.time.hour() + ":" + (String)gps.time.minute() + ":" + (String)gps.time.second() + "." +  (String)gps.time.centisecond() + "\",";
-            json += "\"lon\":" + String(gps.location.lng(),8) + ","; 
-            json += "\"lat\":" + String(gps.location.lat(),8) + ",";
-            json += "\"Co2\":" + (String)co2 + ",";
-            json += "\"Co2_Temperature\":" + (String)temperature + ",";
-            json += "\"Co2_Humidity\":" + (String)humidity + ",";
-            json += "\"BME_Temperature\":" + (String)sensorBME280.readTempC() + ",";
-            json += "\"BME_Humidity\":" + (String)sensorBME280.readFloatHumidity() + ",";
-            json += "\"BME_Pressure\":" + (String)sensorBME280.readFloatPressure();
-            json += "}";
-
-            Serial.println(json);
-
-            // Sending over Bluetooth
-            Serial1.println(json);
+            String head = "{";
+            head += "\"id\":\"Air_"+ (String)macAddr + "\",";
+            head += "\"time\":\"" + (String)gps.date.year() + "/" + (String)gps.date.month() + "/" + (String)gps.date.day() + " ";
+            head += (String)gps.time.hour() + ":" + (String)gps.time.minute() + ":" + (String)gps.time.second() + "." +  (String)gps.time.centisecond() + "\",";
+            head += "\"lon\":" + String(gps.location.lng(),8) + ","; 
+            head += "\"lat\":" + String(gps.location.lat(),8) + ",";
+            float values[NB_FILTERED] = {
+                (float)co2,
+                temperature,
+                humidity,
+                sensorBME280.readTempC(),
+                sensorBME280.readFloatHumidity(),
+                sensorBME280.readFloatPressure()
+            };
+            logRecord(head, values);
             previousLogTime = millis(); 
-
-            // Save Log on SD Card
-            logToSD(logFile, json);
         }
     }
 }
 
+/********************************/
+/* Change filters               */
+/********************************/
+/*
+ * @brief:
+ *    Sends a line over Bluetooth and saves it on the SD card.
+ * @params:
+ *    head: Start of the line (id, time, location).
+ *    values: Filtered channels, marker instead if not sent ('\0' if sent).
+ */
+void sendLine(const String& head, const float* values, const char* markers) {
+    String json = head;
+    for (uint8_t c = 0; c < NB_FILTERED; c++) {
+        json += "\"" + String(filteredKeys[c]) + "\":";
+        if (markers[c])
+            json += "\"" + String(markers[c]) + "\"";
+        else
+            json += String(values[c], filteredDecimals[c]);
+        json += (c < NB_FILTERED - 1) ? "," : "}";
+    }
+
+    Serial.println(json);
+
+    // Sending over Bluetooth, after the correction burst being received
+    uint32_t deferStart = millis();
+    while (btDemux.busy(micros()) && millis() - deferStart < TELEMETRY_MAX_DEFER)
+        yield();
+    Serial1.println(json);
+
+    // Save Log on SD Card
+    logToSD(logFile, json);
+}
+
+/*
+ * @brief:
+ *    Adds a sample to the change filters, sends the previous line with
+ *    their decisions and keeps this one pending.
+ */
+void logRecord(const String& head, const float* values) {
+    float sent[NB_FILTERED];
+    char markers[NB_FILTERED];
+    for (uint8_t c = 0; c < NB_FILTERED; c++) {
+        markers[c] = filters[c].add(values[c]) ? '\0' : filters[c].marker();
+        sent[c] = filters[c].value();
+    }
+    if (pendingHead.length() > 0)
+        sendLine(pendingHead, sent, markers);
+    pendingHead = head;
+}
+
+/*
+ * @brief:
+ *    Sends the pending line with all its values and ends the filter
+ *    series (logging stopped).
+ */
+void flushRecord() {
+    if (pendingHead.length() == 0)
+        return;
+    float sent[NB_FILTERED];
+    char markers[NB_FILTERED];
+    for (uint8_t c = 0; c < NB_FILTERED; c++) {
+        filters[c].flush();
+        sent[c] = filters[c].value();
+        markers[c] = '\0';
+    }
+    sendLine(pendingHead, sent, markers);
+    pendingHead = "";
+}
+
+/********************************/
+/* Bluetooth stream             */
+/********************************/
+/*
+ * @brief:
+ *    Called by yield() (after loop(), during delay()) when Bluetooth bytes
+ *    are available: RTCM frames to the GNSS module, orders to loop().
+ *    Bytes are read only while the GNSS UART has room, it never blocks.
+ */
+void serialEvent1() {
+  if (!demuxEnabled)
+    return;
+  while (Serial1.available() && Serial5.availableForWrite() > RTCM_DEMUX_HOLD)
+    btDemux.feed(Serial1.read(), Serial5, micros());
+}
+
 /********************************/
 /* Management Command order     */
 /********************************/
@@ -264,6 +387,7 @@ void commandManager(String message) {
   else if (jsonDoc["order"] == "stopLog") {
     Serial.println( " - StopLog received ");
     start_log = 0;
+    flushRecord();
   }
 }
 
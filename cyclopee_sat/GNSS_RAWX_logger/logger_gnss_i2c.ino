@@ -41,6 +41,13 @@ const int dwell = 250;
 // Displays a "Max bufAvail:" message each time SerialBuffer.available reaches a new maximum
 //#define DEBUGserialBuffer // Comment this to disable serial buffer maximum available debugging
 
+// UBX message filtering (see UBX_filter.h)
+// Only the messages enabled by setRAWXon are logged, duplicate SFRBX subframes are dropped
+// and NAV messages are decimated to one every NAV_INTERVAL msec
+// This reduces the SD write rate so that higher RAWX rates can be logged
+#define FILTER_UBX // Comment this line out to log every received message
+const uint32_t NAV_INTERVAL = 1000; // Keep one NAV_PVT and one NAV_STATUS message every NAV_INTERVAL msec (0 to keep them all)
+
 // Connect modePin to GND to select base mode. Leave open for rover mode.
 #define modePin 14 // A0 / Digital Pin 14
 
@@ -108,10 +115,14 @@ bool survey_in_mode = false; // Flag to indicate if the code is in survey_in mod
 // Timer to indicate if an ExtInt has been received
 volatile unsigned long ExtIntTimer; // Load this with millis plus white_flash to show when the ExtInt LED should be switched off
 
-// Define packet size, buffer and buffer pointer for SD card writes
+// Define packet size, double buffer and buffer pointer for SD card writes
+// serBuffer[fillBuffer] is filled from SerialBuffer while the other packet (if packetPending) waits to be written
+// The pending packet is only written once SerialBuffer has been drained, so a slow SD write never delays the drain
 const size_t SDpacket = 512;
-uint8_t serBuffer[SDpacket];
+uint8_t serBuffer[2][SDpacket];
+uint8_t fillBuffer = 0; // Index of the packet being filled
 size_t bufferPointer = 0;
+bool packetPending = false; // Flag to indicate that serBuffer[fillBuffer ^ 1] is full and waiting to be written
 int numBytes;
 
 // Battery voltage
@@ -134,8 +145,10 @@ bool stop_pressed = false; // Flag to indicate if stop switch was pressed to sto
 // Actual Serial1 receive data will be copied into SerialBuffer by a timer interrupt
 // https://gist.github.com/jdneo/43be30d85080b175cb5aed3500d3f989
 // That way, we do not need to increase the size of the Serial1 receive buffer (by editing RingBuffer.h)
+// loop() reads SerialBuffer by blocks straight into serBuffer (see Block_ring_buffer.h)
 // You can use DEBUGserialBuffer to determine how big the buffer should be. Increase it if you see bufAvail get close to or reach the buffer size.
-RingBufferN<16384> SerialBuffer; // Define SerialBuffer as a RingBuffer of size 16k bytes
+#include <Block_ring_buffer.h>
+BlockRingBuffer<16384> SerialBuffer; // Define SerialBuffer as a RingBuffer of size 16k bytes
 
 // Loop Steps
 #define init          0
@@ -147,41 +160,22 @@ RingBufferN<16384> SerialBuffer; // Define SerialBuffer as a RingBuffer of size
 #define restart_file  6
 int loop_step = init;
 
-// UBX and NMEA Parse State
-#define looking_for_B5_dollar   0
-#define looking_for_62          1
-#define looking_for_class       2
-#define looking_for_ID          3
-#define looking_for_length_LSB  4
-#define looking_for_length_MSB  5
-#define processing_payload      6
-#define looking_for_checksum_A  7
-#define looking_for_checksum_B  8
-#define sync_lost               9
-#define looking_for_asterix     10
-#define looking_for_csum1       11
-#define looking_for_csum2       12
-#define looking_for_term1       13
-#define looking_for_term2       14
-int ubx_nmea_state = looking_for_B5_dollar;
-int ubx_length = 0;
-int ubx_class = 0;
-int ubx_ID = 0;
-int ubx_checksum_A = 0;
-int ubx_checksum_B = 0;
-int ubx_expected_checksum_A = 0;
-int ubx_expected_checksum_B = 0;
-int nmea_char_1 = '0'; // e.g. G
-int nmea_char_2 = '0'; // e.g. P
-int nmea_char_3 = '0'; // e.g. G
-int nmea_char_4 = '0'; // e.g. G
-int nmea_char_5 = '0'; // e.g. A
-int nmea_csum = 0;
-int nmea_csum1 = '0';
-int nmea_csum2 = '0';
-int nmea_expected_csum1 = '0';
-int nmea_expected_csum2 = '0';
-#define max_nmea_len 100 // Maximum length for an NMEA message: use this to detect if we have lost sync while receiving an NMEA message
+// UBX and NMEA framing
+// The UART stream is split into UBX and NMEA frames and their checksums are checked by UbxFramer (UBX_framer.h)
+// Only allow a new file to be opened when a complete frame has been processed (framer.idle())
+// Or when a data error is detected (sync_lost)
+#include <UBX_framer.h>
+UbxFramer framer;
+UbxFramer::Frame ubxFrame;
+bool sync_lost = false; // Set when the framer reports a sync or checksum error
+
+// Frames are assembled in frameBuffer and only copied into serBuffer if the filter keeps them
+// Frames longer than frameBuffer (very large RXM_RAWX) are always kept and copied as they arrive
+#include <UBX_filter.h>
+UbxFilter ubxFilter;
+uint8_t frameBuffer[4096];
+size_t framePointer = 0; // Number of bytes in frameBuffer
+bool frameOversized = false; // Flag to indicate that the start of the current frame has already been copied into serBuffer
 
 // Definitions for u-blox F9P UBX-format (binary) messages
 
@@ -471,7 +465,7 @@ void TC3_Handler() {
     TC->INTFLAG.bit.MC0 = 1;
     int available1 = Serial1.available(); // Check if there is any data waiting in the Serial1 RX buffer
     while (available1 > 0) { 
-        SerialBuffer.store_char(Serial1.read()); // If there is, copy it into our RingBuffer
+        SerialBuffer.store(Serial1.read()); // If there is, copy it into our RingBuffer
         available1--;
     }
   }
@@ -555,9 +549,249 @@ void setLED(int color) // Set NeoPixel color
 
 #endif
 
+// Process a frame reported by the framer
+// RXM_RAWX is class 0x02 ID 0x15
+// RXM_SFRBF is class 0x02 ID 0x13
+// TIM_TM2 is class 0x0d ID 0x03
+// NAV_POSLLH is class 0x01 ID 0x02
+// NAV_PVT is class 0x01 ID 0x07
+// NAV-STATUS is class 0x01 ID 0x03
+void processFrame(const UbxFramer::Frame& frame) {
+  if (frame.type == UbxFramer::FRAME_ERROR) {
+    switch (frame.error) {
+      case UbxFramer::ERR_SYNC: Serial.println("Panic!! Was expecting Sync Char 0xB5 or an NMEA $ but did not receive one!"); break;
+      case UbxFramer::ERR_SYNC_62: Serial.println("Panic!! Was expecting Sync Char 0x62 but did not receive one!"); break;
+      case UbxFramer::ERR_UBX_CHECKSUM: Serial.println("Panic!! UBX checksum error!"); break;
+      case UbxFramer::ERR_NMEA_LENGTH: Serial.println("Panic!! Excessive NMEA message length!"); break;
+      case UbxFramer::ERR_NMEA_CHECKSUM: Serial.println("Panic!! NMEA checksum error!"); break;
+      case UbxFramer::ERR_NMEA_CR: Serial.println("Panic!! NMEA CR not found!"); break;
+      case UbxFramer::ERR_NMEA_LF: Serial.println("Panic!! NMEA LF not found!"); break;
+      default: break;
+    }
+    sync_lost = true;
+    return;
+  }
+
+  if (frame.type == UbxFramer::FRAME_NMEA) {
+#ifdef DEBUG
+    Serial.print("NMEA message type is: ");
+    Serial.println(frame.nmeaType);
+#endif
+    return;
+  }
+
+#ifdef DEBUG
+  // Class and ID syntax checking
+  if ((frame.cls != 0x02) and (frame.cls != 0x0d) and (frame.cls != 0x01)) {
+    Serial.println("Panic!! Was expecting Class of 0x02 or 0x0d or 0x01 but did not receive one!");
+    sync_lost = true;
+  }
+  else if ((frame.cls == 0x02) and ((frame.id != 0x15) and (frame.id != 0x13))) {
+    Serial.println("Panic!! Was expecting ID of 0x15 or 0x13 but did not receive one!");
+    sync_lost = true;
+  }
+  else if ((frame.cls == 0x0d) and (frame.id != 0x03)) {
+    Serial.println("Panic!! Was expecting ID of 0x03 but did not receive one!");
+    sync_lost = true;
+  }
+  else if ((frame.cls == 0x01) and ((frame.id != 0x02) and (frame.id != 0x07) and (frame.id != 0x03))) {
+    Serial.println("Panic!! Was expecting ID of 0x02 or 0x07 or 0x03 but did not receive one!");
+    sync_lost = true;
+  }
+#endif
+
+  // If this is a NAV_PVT message, check the flags byte (byte offset 21) and report the carrSoln
+  if ((frame.cls == 0x01) and (frame.id == 0x07) and (frame.headLength > 21)) {
+    uint8_t c = frame.head[21];
+#ifdef DEBUG
+    Serial.print("NAV_PVT carrSoln: ");
+    if ((c & 0xc0) == 0x00) {
+      Serial.println("none");
+    }
+    else if ((c & 0xc0) == 0x40) {
+      Serial.println("floating");
+    }
+    else if ((c & 0xc0) == 0x80) {
+      Serial.println("fixed");
+    }
+#endif
+    if ((c & 0xc0) == 0x80) { // Have we got a fixed carrier solution?
+#ifndef NoLED
+#ifdef NeoPixel
+      if (write_color == green) { // Check that write_color is green before changing it to yellow, to give magenta priority
+        write_color = yellow; // Change the SD write color to yellow to indicate fixed carrSoln
+      }
+#else
+#ifndef NoLogLED
+      digitalWrite(GreenLED, !digitalRead(GreenLED)); // Toggle the green LED
+#endif
+#endif
+#endif
+    }
+    else { // carrSoln is not fixed
+#ifndef NoLED
+#ifdef NeoPixel
+      if (write_color == yellow) {
+        write_color = green; // Reset the SD write color to green only if it was yellow previously
+      }
+#else
+#ifndef NoLogLED
+      digitalWrite(GreenLED, HIGH); // If the fix is not TIME, leave the green LED on
+#endif
+#endif
+#endif
+    }
+  }
+  // If this is a NAV_STATUS message, check the gpsFix byte (byte offset 4) and flash the green LED (or make the NeoPixel magenta) if the fix is TIME
+  if ((frame.cls == 0x01) and (frame.id == 0x03) and (frame.headLength > 4)) {
+    uint8_t c = frame.head[4];
+#ifdef DEBUG
+    Serial.print("NAV_STATUS gpsFix: ");
+    if (c == 0x00) {
+      Serial.println("no fix");
+    }
+    else if (c == 0x01) {
+      Serial.println("dead reckoning");
+    }
+    else if (c == 0x02) {
+      Serial.println("2D-fix");
+    }
+    else if (c == 0x03) {
+      Serial.println("3D-fix");
+    }
+    else if (c == 0x04) {
+      Serial.println("GPS + dead reckoning");
+    }
+    else if (c == 0x05) {
+      Serial.println("time");
+    }
+    else {
+      Serial.println("reserved");
+    }
+#endif
+    if (c == 0x05) { // Have we got a TIME fix?
+#ifndef NoLED
+#ifdef NeoPixel
+      write_color = magenta; // Change the SD write color to magenta to indicate time fix (trumps yellow!)
+#else
+#ifndef NoLogLED
+      digitalWrite(GreenLED, !digitalRead(GreenLED)); // Toggle the green LED
+#endif
+#endif
+#endif
+    }
+    else {
+#ifndef NoLED
+#ifdef NeoPixel
+      if (write_color == magenta) {
+        write_color = green; // Reset the SD write color to green only if it was magenta previously (not yellow)
+      }
+#else
+#ifndef NoLogLED
+      digitalWrite(GreenLED, HIGH); // If the fix is not TIME, leave the green LED on
+#endif
+#endif
+#endif
+    }
+  }
+}
+
+// Configure the UBX filter: allow the messages enabled by setRAWXon
+void setupUbxFilter() {
+#ifdef FILTER_UBX
+  ubxFilter.allowUbx(0x02, 0x15); // RXM_RAWX
+  ubxFilter.allowUbx(0x02, 0x13); // RXM_SFRBX
+  ubxFilter.allowUbx(0x0d, 0x03); // TIM_TM2
+  ubxFilter.allowUbx(0x01, 0x07); // NAV_PVT
+  ubxFilter.allowUbx(0x01, 0x03); // NAV_STATUS
+  ubxFilter.allowNmea("GGA");
+  ubxFilter.setSfrbxDedupe(true);
+  ubxFilter.setNavInterval(NAV_INTERVAL);
+#endif
+}
+
+// Copy bytes into serBuffer, swapping packets each time one is full
+void appendToPacket(const uint8_t* data, size_t len) {
+  while (len > 0) {
+    size_t n = SDpacket - bufferPointer;
+    if (n > len) n = len;
+    memcpy(&serBuffer[fillBuffer][bufferPointer], data, n);
+    bufferPointer += n;
+    data += n;
+    len -= n;
+    if (bufferPointer == SDpacket) {
+      // Both packets are full: SerialBuffer could not be drained, write the older one now
+      if (packetPending == true) writePendingPacket();
+      // Swap packets
+      packetPending = true;
+      fillBuffer ^= 1;
+      bufferPointer = 0;
+    }
+  }
+}
+
+// Copy any partial frame left in frameBuffer into serBuffer (before closing a file)
+void flushFrameBuffer() {
+  appendToPacket(frameBuffer, framePointer);
+  framePointer = 0;
+  frameOversized = false;
+}
+
+// Write the pending packet (serBuffer[fillBuffer ^ 1]) to the SD card
+void writePendingPacket() {
+  // Flash the red LED to indicate an SD write
+  // or flash the NeoPixel green
+#ifndef NoLED
+#ifdef NeoPixel
+#ifndef NoLogLED
+  if (this_color != white) { // If the NeoPixel is not currently white
+    setLED(write_color); // Set the NeoPixel
+  }
+  else { // If the NeoPixel is white, set last_color to write_color so it will revert to that when the white flash is complete
+    last_color = write_color;
+  }
+#endif
+#else
+#ifndef NoLogLED
+  digitalWrite(RedLED, HIGH); // Turn the red LED on to indicate SD card write
+#endif
+#endif
+#endif
+  numBytes = rawx_dataFile.write(serBuffer[fillBuffer ^ 1], SDpacket);
+  //rawx_dataFile.sync(); // Sync the file system
+  bytes_written += SDpacket;
+#ifndef NoLED
+#ifdef NeoPixel
+#ifndef NoLogLED
+  if (this_color != white) { // If the NeoPixel is not currently white
+    setLED(write_color + to_dim); // Set the NeoPixel
+  }
+  else { // If the NeoPixel is white, set last_color to dim_write_color so it will revert to that when the white flash is complete
+    last_color = write_color + to_dim;
+  }
+#endif
+#else
+#ifndef NoLogLED
+  digitalWrite(RedLED, LOW); // Turn the red LED off to indicate SD card write is complete
+#endif
+#endif
+#endif
+#ifdef DEBUG
+  if (numBytes != SDpacket) {
+    Serial.print("SD write error! Write size was ");
+    Serial.print(SDpacket);
+    Serial.print(". ");
+    Serial.print(numBytes);
+    Serial.println(" were written.");
+  }
+#endif
+  packetPending = false;
+}
+
 // SerialBuffer DEBUG
 #ifdef DEBUGserialBuffer
 int maxSerialBufferAvailable = 0;
+uint32_t serialBufferOverflows = 0;
 #endif
 
 void setup()
@@ -748,6 +982,8 @@ void setup()
       write_color = green; // Reset the write color to green
 #endif
           
+  setupUbxFilter();
+
   Serial.println("Waiting for GNSS fix...");
 }
 
@@ -881,6 +1117,9 @@ void loop() // run over and over again
       setRAWXon(); // (Re)Start the UBX and NMEA messages
 
       bufferPointer = 0; // (Re)initialise bufferPointer
+      packetPending = false;
+      framePointer = 0;
+      frameOversized = false;
 
       loop_step = open_file; // start logging rawx data
     }
@@ -999,14 +1238,15 @@ void loop() // run over and over again
 
       bytes_written = 0; // Clear bytes_written
 
-      ubx_nmea_state = looking_for_B5_dollar; // set ubx_nmea_state to expect B5 or $
-      ubx_length = 0; // set ubx_length to zero
+      framer.reset(); // expect B5 or $
+      sync_lost = false;
+      ubxFilter.reset(); // Each file holds its own SFRBX subframes
 
       loop_step = write_file; // start logging rawx data
     }
     break;
 
-    // Stuff bytes into serBuffer and write when we have reached SDpacket
+    // Move blocks of bytes into frameBuffer, copy the kept frames into serBuffer and write when we have reached SDpacket
     case write_file: {
       
 #ifndef NoLED
@@ -1037,390 +1277,55 @@ void loop() // run over and over again
           Serial.print("Max bufAvail: ");
           Serial.println(maxSerialBufferAvailable);
         }
+        if (SerialBuffer.overflowCount() != serialBufferOverflows) {
+          serialBufferOverflows = SerialBuffer.overflowCount();
+          Serial.print("SerialBuffer overflow! Bytes lost: ");
+          Serial.println(serialBufferOverflows);
+        }
 #endif  
-        uint8_t c = SerialBuffer.read_char();
-        serBuffer[bufferPointer] = c;
-        bufferPointer++;
-        if (bufferPointer == SDpacket) {
-          bufferPointer = 0;
-          // Flash the red LED to indicate an SD write
-          // or flash the NeoPixel green
-#ifndef NoLED
-#ifdef NeoPixel
-#ifndef NoLogLED
-          if (this_color != white) { // If the NeoPixel is not currently white
-            setLED(write_color); // Set the NeoPixel
-          }
-          else { // If the NeoPixel is white, set last_color to write_color so it will revert to that when the white flash is complete
-            last_color = write_color;
-          }
-#endif
-#else
-#ifndef NoLogLED
-          digitalWrite(RedLED, HIGH); // Turn the red LED on to indicate SD card write
-#endif
-#endif
-#endif
-          numBytes = rawx_dataFile.write(&serBuffer, SDpacket);
-          //rawx_dataFile.sync(); // Sync the file system
-          bytes_written += SDpacket;
-#ifndef NoLED
-#ifdef NeoPixel
-#ifndef NoLogLED
-          if (this_color != white) { // If the NeoPixel is not currently white
-            setLED(write_color + to_dim); // Set the NeoPixel
-          }
-          else { // If the NeoPixel is white, set last_color to dim_write_color so it will revert to that when the white flash is complete
-            last_color = write_color + to_dim;
-          }
-#endif
-#else
-#ifndef NoLogLED
-          digitalWrite(RedLED, LOW); // Turn the red LED off to indicate SD card write is complete
-#endif
-#endif
-#endif
-#ifdef DEBUG
-          if (numBytes != SDpacket) {
-            Serial.print("SD write error! Write size was ");
-            Serial.print(SDpacket);
-            Serial.print(". ");
-            Serial.print(numBytes);
-            Serial.println(" were written.");
-          }
-#endif
+        // frameBuffer is full and the frame is still incomplete: keep it, copy what we have into serBuffer
+        if (framePointer == sizeof(frameBuffer)) {
+          flushFrameBuffer();
+          frameOversized = true;
         }
-        // Process data bytes according to ubx_nmea_state
-        // For UBX messages:
-        // Sync Char 1: 0xB5
-        // Sync Char 2: 0x62
-        // Class byte
-        // ID byte
-        // Length: two bytes, little endian
-        // Payload: length bytes
-        // Checksum: two bytes
-        // For NMEA messages:
-        // Starts with a '$'
-        // The next five characters indicate the message type (stored in nmea_char_1 to nmea_char_5)
-        // Message fields are comma-separated
-        // Followed by an '*'
-        // Then a two character checksum (the logical exclusive-OR of all characters between the $ and the * as ASCII hex)
-        // Ends with CR LF
-        // Only allow a new file to be opened when a complete packet has been processed and ubx_nmea_state has returned to "looking_for_B5_dollar"
-        // Or when a data error is detected (sync_lost)
-        switch (ubx_nmea_state) {
-          case (looking_for_B5_dollar): {
-            if (c == 0xB5) { // Have we found Sync Char 1 (0xB5) if we were expecting one?
-              ubx_nmea_state = looking_for_62; // Now look for Sync Char 2 (0x62)
-            }
-            else if (c == '$') { // Have we found an NMEA '$' if we were expecting one?
-              ubx_nmea_state = looking_for_asterix; // Now keep going until we receive an asterix
-              ubx_length = 0; // Reset ubx_length then use it to track which character has arrived
-              nmea_csum = 0; // Reset the nmea_csum. Update it as each character arrives
-              nmea_char_1 = '0'; // Reset the first five NMEA chars to something invalid
-              nmea_char_2 = '0';
-              nmea_char_3 = '0';
-              nmea_char_4 = '0';
-              nmea_char_5 = '0';
-            }
-            else {
-              Serial.println("Panic!! Was expecting Sync Char 0xB5 or an NMEA $ but did not receive one!");
-              ubx_nmea_state = sync_lost;
-            }
-          }
-          break;
-          case (looking_for_62): {
-            if (c == 0x62) { // Have we found Sync Char 2 (0x62) when we were expecting one?
-              ubx_expected_checksum_A = 0; // Reset the expected checksum
-              ubx_expected_checksum_B = 0;
-              ubx_nmea_state = looking_for_class; // Now look for Class byte
-            }
-            else {
-              Serial.println("Panic!! Was expecting Sync Char 0x62 but did not receive one!");
-              ubx_nmea_state = sync_lost;
-            }
-          }
-          break;
-          // RXM_RAWX is class 0x02 ID 0x15
-          // RXM_SFRBF is class 0x02 ID 0x13
-          // TIM_TM2 is class 0x0d ID 0x03
-          // NAV_POSLLH is class 0x01 ID 0x02
-          // NAV_PVT is class 0x01 ID 0x07
-          // NAV-STATUS is class 0x01 ID 0x03
-          case (looking_for_class): {
-            ubx_class = c;
-            ubx_expected_checksum_A = ubx_expected_checksum_A + c; // Update the expected checksum
-            ubx_expected_checksum_B = ubx_expected_checksum_B + ubx_expected_checksum_A;
-            ubx_nmea_state = looking_for_ID; // Now look for ID byte
-#ifdef DEBUG
-            // Class syntax checking
-            if ((ubx_class != 0x02) and (ubx_class != 0x0d) and (ubx_class != 0x01)) {
-              Serial.println("Panic!! Was expecting Class of 0x02 or 0x0d or 0x01 but did not receive one!");
-              ubx_nmea_state = sync_lost;
-            }
-#endif
-          }
-          break;
-          case (looking_for_ID): {
-            ubx_ID = c;
-            ubx_expected_checksum_A = ubx_expected_checksum_A + c; // Update the expected checksum
-            ubx_expected_checksum_B = ubx_expected_checksum_B + ubx_expected_checksum_A;
-            ubx_nmea_state = looking_for_length_LSB; // Now look for length LSB
-#ifdef DEBUG
-            // ID syntax checking
-            if ((ubx_class == 0x02) and ((ubx_ID != 0x15) and (ubx_ID != 0x13))) {
-              Serial.println("Panic!! Was expecting ID of 0x15 or 0x13 but did not receive one!");
-              ubx_nmea_state = sync_lost;
-            }
-            else if ((ubx_class == 0x0d) and (ubx_ID != 0x03)) {
-              Serial.println("Panic!! Was expecting ID of 0x03 but did not receive one!");
-              ubx_nmea_state = sync_lost;
-            }
-            else if ((ubx_class == 0x01) and ((ubx_ID != 0x02) and (ubx_ID != 0x07) and (ubx_ID != 0x03))) {
-              Serial.println("Panic!! Was expecting ID of 0x02 or 0x07 or 0x03 but did not receive one!");
-              ubx_nmea_state = sync_lost;
-            }
-#endif
-          }
-          break;
-          case (looking_for_length_LSB): {
-            ubx_length = c; // Store the length LSB
-            ubx_expected_checksum_A = ubx_expected_checksum_A + c; // Update the expected checksum
-            ubx_expected_checksum_B = ubx_expected_checksum_B + ubx_expected_checksum_A;
-            ubx_nmea_state = looking_for_length_MSB; // Now look for length MSB
-          }
-          break;
-          case (looking_for_length_MSB): {
-            ubx_length = ubx_length + (c * 256); // Add the length MSB
-            ubx_expected_checksum_A = ubx_expected_checksum_A + c; // Update the expected checksum
-            ubx_expected_checksum_B = ubx_expected_checksum_B + ubx_expected_checksum_A;
-            ubx_nmea_state = processing_payload; // Now look for payload bytes (length: ubx_length)
-          }
-          break;
-          case (processing_payload): {
-            // If this is a NAV_PVT message, check the flags byte (byte offset 21) and report the carrSoln
-            if ((ubx_class == 0x01) and (ubx_ID == 0x07)) { // Is this a NAV_PVT message (class 0x01 ID 0x07)?
-              if (ubx_length == 71) { // Is this byte offset 21? (ubx_length will be 92 for byte offset 0, so will be 71 for byte offset 21)
-#ifdef DEBUG
-                Serial.print("NAV_PVT carrSoln: ");
-                if ((c & 0xc0) == 0x00) {
-                  Serial.println("none");
-                }
-                else if ((c & 0xc0) == 0x40) {
-                  Serial.println("floating");
-                }
-                else if ((c & 0xc0) == 0x80) {
-                  Serial.println("fixed");
-                }
-#endif
-                if ((c & 0xc0) == 0x80) { // Have we got a fixed carrier solution?
-#ifndef NoLED
-#ifdef NeoPixel
-                  if (write_color == green) { // Check that write_color is green before changing it to yellow, to give magenta priority
-                    write_color = yellow; // Change the SD write color to yellow to indicate fixed carrSoln
-                  }
-#else
-#ifndef NoLogLED
-                  digitalWrite(GreenLED, !digitalRead(GreenLED)); // Toggle the green LED
-#endif
-#endif
-#endif         
-                }
-                else { // carrSoln is not fixed
-#ifndef NoLED
-#ifdef NeoPixel
-                  if (write_color == yellow) {
-                    write_color = green; // Reset the SD write color to green only if it was yellow previously
-                  }
-#else
-#ifndef NoLogLED
-                  digitalWrite(GreenLED, HIGH); // If the fix is not TIME, leave the green LED on
-#endif
-#endif
-#endif
-                }
-              }
-            }
-            // If this is a NAV_STATUS message, check the gpsFix byte (byte offset 4) and flash the green LED (or make the NeoPixel magenta) if the fix is TIME
-            if ((ubx_class == 0x01) and (ubx_ID == 0x03)) { // Is this a NAV_STATUS message (class 0x01 ID 0x03)?
-              if (ubx_length == 12) { // Is this byte offset 4? (ubx_length will be 16 for byte offset 0, so will be 12 for byte offset 4)
-#ifdef DEBUG
-                Serial.print("NAV_STATUS gpsFix: ");
-                if (c == 0x00) {
-                  Serial.println("no fix");
-                }
-                else if (c == 0x01) {
-                  Serial.println("dead reckoning");
-                }
-                else if (c == 0x02) {
-                  Serial.println("2D-fix");
-                }
-                else if (c == 0x03) {
-                  Serial.println("3D-fix");
-                }
-                else if (c == 0x04) {
-                  Serial.println("GPS + dead reckoning");
-                }
-                else if (c == 0x05) {
-                  Serial.println("time");
-                }
-                else {
-                  Serial.println("reserved");
-                }
-#endif
-                if (c == 0x05) { // Have we got a TIME fix?
-#ifndef NoLED
-#ifdef NeoPixel
-                  write_color = magenta; // Change the SD write color to magenta to indicate time fix (trumps yellow!)
-#else
-#ifndef NoLogLED
-                  digitalWrite(GreenLED, !digitalRead(GreenLED)); // Toggle the green LED
-#endif
-#endif
-#endif            
-                }
-                else {
-#ifndef NoLED
-#ifdef NeoPixel
-                  if (write_color == magenta) {
-                    write_color = green; // Reset the SD write color to green only if it was magenta previously (not yellow)
-                  }
-#else
-#ifndef NoLogLED
-                  digitalWrite(GreenLED, HIGH); // If the fix is not TIME, leave the green LED on
-#endif
-#endif
-#endif
-                }
-              }
-            }
-            ubx_length = ubx_length - 1; // Decrement length by one
-            ubx_expected_checksum_A = ubx_expected_checksum_A + c; // Update the expected checksum
-            ubx_expected_checksum_B = ubx_expected_checksum_B + ubx_expected_checksum_A;
-            if (ubx_length == 0) {
-              ubx_expected_checksum_A = ubx_expected_checksum_A & 0xff; // Limit checksums to 8-bits
-              ubx_expected_checksum_B = ubx_expected_checksum_B & 0xff;
-              ubx_nmea_state = looking_for_checksum_A; // If we have received length payload bytes, look for checksum bytes
-            }
-          }
-          break;
-          case (looking_for_checksum_A): {
-            ubx_checksum_A = c;
-            ubx_nmea_state = looking_for_checksum_B;
+        // Move a block of bytes from SerialBuffer to the end of frameBuffer
+        // Move them one at a time after an RTC alarm, so the new file is opened right on a frame boundary
+        size_t maxLen = (alarmFlag == true) ? 1 : sizeof(frameBuffer) - framePointer;
+        if (maxLen > SDpacket) maxLen = SDpacket;
+        uint8_t* block = &frameBuffer[framePointer];
+        size_t n = SerialBuffer.read(block, maxLen);
+        // Process data bytes through the framer, in place
+        size_t frameStart = 0; // Start of the current frame in frameBuffer
+        size_t off = 0;
+        while (off < n) {
+          off += framer.parse(block + off, n - off, ubxFrame);
+          if (ubxFrame.type != UbxFramer::FRAME_NONE) {
+            processFrame(ubxFrame);
+            // Frame ends on the last parsed byte. Bad data is always written, as it was received
+            size_t frameEnd = framePointer + off;
+#ifdef FILTER_UBX
+            if ((ubxFrame.type == UbxFramer::FRAME_ERROR) or (frameOversized == true) or (ubxFilter.keep(ubxFrame)))
+#endif
+              appendToPacket(&frameBuffer[frameStart], frameEnd - frameStart);
+            frameStart = frameEnd;
+            frameOversized = false;
           }
-          break;
-          case (looking_for_checksum_B): {
-            ubx_checksum_B = c;
-            ubx_nmea_state = looking_for_B5_dollar; // All bytes received so go back to looking for a new Sync Char 1 unless there is a checksum error
-            if ((ubx_expected_checksum_A != ubx_checksum_A) or (ubx_expected_checksum_B != ubx_checksum_B)) {
-              Serial.println("Panic!! UBX checksum error!");
-              ubx_nmea_state = sync_lost;
-            }
-          }
-          break;
-          // NMEA messages
-          case (looking_for_asterix): {
-            ubx_length++; // Increase the message length count
-            if (ubx_length > max_nmea_len) { // If the length is greater than max_nmea_len, something bad must have happened (sync_lost)
-              Serial.println("Panic!! Excessive NMEA message length!");
-              ubx_nmea_state = sync_lost;
-              break;
-            }
-            // If this is one of the first five characters, store it
-            // May be useful for on-the-fly message parsing or DEBUG
-            if (ubx_length <= 5) {
-              if (ubx_length == 1) {
-                nmea_char_1 = c;
-              }
-              else if (ubx_length == 2) {
-                nmea_char_2 = c;
-              }
-              else if (ubx_length == 3) {
-                nmea_char_3 = c;
-              }
-              else if (ubx_length == 4) {
-                nmea_char_4 = c;
-              }
-              else { // ubx_length == 5
-                nmea_char_5 = c;
-#ifdef DEBUG
-                Serial.print("NMEA message type is: ");
-                Serial.print(char(nmea_char_1));
-                Serial.print(char(nmea_char_2));
-                Serial.print(char(nmea_char_3));
-                Serial.print(char(nmea_char_4));
-                Serial.println(char(nmea_char_5));
-#endif              
-              }
-            }
-            // Now check if this is an '*'
-            if (c == '*') {
-              // Asterix received
-              // Don't exOR it into the checksum
-              // Instead calculate what the expected checksum should be (nmea_csum in ASCII hex)
-              nmea_expected_csum1 = ((nmea_csum & 0xf0) >> 4) + '0'; // Convert MS nibble to ASCII hex
-              if (nmea_expected_csum1 >= ':') { nmea_expected_csum1 += 7; } // : follows 9 so add 7 to convert to A-F
-              nmea_expected_csum2 = (nmea_csum & 0x0f) + '0'; // Convert LS nibble to ASCII hex
-              if (nmea_expected_csum2 >= ':') { nmea_expected_csum2 += 7; } // : follows 9 so add 7 to convert to A-F
-              // Next, look for the first csum character
-              ubx_nmea_state = looking_for_csum1;
-              break; // Don't include the * in the checksum
-            }
-            // Now update the checksum
-            // The checksum is the exclusive-OR of all characters between the $ and the *
-            nmea_csum = nmea_csum ^ c;
-          }
-          break;
-          case (looking_for_csum1): {
-            // Store the first NMEA checksum character
-            nmea_csum1 = c;
-            ubx_nmea_state = looking_for_csum2;
-          }
-          break;
-          case (looking_for_csum2): {
-            // Store the second NMEA checksum character
-            nmea_csum2 = c;
-            // Now check if the checksum is correct
-            if ((nmea_csum1 != nmea_expected_csum1) or (nmea_csum2 != nmea_expected_csum2)) {
-              // The checksum does not match so sync_lost
-              Serial.println("Panic!! NMEA checksum error!");
-              ubx_nmea_state = sync_lost;
-            }
-            else {
-              // Checksum was valid so wait for the terminators
-              ubx_nmea_state = looking_for_term1;
-            }
-          }
-          break;
-          case (looking_for_term1): {
-            // Check if this is CR
-            if (c != '\r') {
-              Serial.println("Panic!! NMEA CR not found!");
-              ubx_nmea_state = sync_lost;
-            }
-            else {
-              ubx_nmea_state = looking_for_term2;
-            }
-          }
-          break;
-          case (looking_for_term2): {
-            // Check if this is LF
-            if (c != '\n') {
-              Serial.println("Panic!! NMEA LF not found!");
-              ubx_nmea_state = sync_lost;
-            }
-            else {
-              // LF was received so go back to looking for B5 or a $
-              ubx_nmea_state = looking_for_B5_dollar;
-            }
-          }
-          break;
+        }
+        framePointer += n;
+        // Move the start of the next frame to the beginning of frameBuffer
+        if (frameStart > 0) {
+          memmove(frameBuffer, &frameBuffer[frameStart], framePointer - frameStart);
+          framePointer -= frameStart;
         }
       }
       else {
         // read battery voltage
         vbat = analogRead(A7) * (2.0 * 3.3 / 1023.0);
       }
+      // Write the full packet once SerialBuffer is (almost) drained
+      if ((packetPending == true) and (SerialBuffer.available() < SDpacket)) {
+        writePendingPacket();
+      }
       // Check if the stop button has been pressed or battery is low
       // or if there has been an RTC alarm and it is time to open a new file
       if (digitalRead(swPin) == LOW) stop_pressed = true;
@@ -1428,11 +1333,11 @@ void loop() // run over and over again
         loop_step = close_file; // now close the file
         break;
       }
-      else if ((alarmFlag == true) and (ubx_nmea_state == looking_for_B5_dollar)) {
+      else if ((alarmFlag == true) and (framer.idle())) {
         loop_step = new_file; // now close the file and open a new one
         break;
       }
-      else if (ubx_nmea_state == sync_lost) {
+      else if (sync_lost == true) {
         loop_step = restart_file; // Sync has been lost so stop RAWX messages and open a new file before restarting RAWX
       }
     }
@@ -1451,9 +1356,11 @@ void loop() // run over and over again
 #endif
 #endif
 #endif
-      // If there is any data left in serBuffer, write it to file
+      // If there is a pending packet or any data left in serBuffer, write it to file
+      flushFrameBuffer();
+      if (packetPending == true) writePendingPacket();
       if (bufferPointer > 0) {
-        numBytes = rawx_dataFile.write(&serBuffer, bufferPointer); // Write remaining data
+        numBytes = rawx_dataFile.write(serBuffer[fillBuffer], bufferPointer); // Write remaining data
         rawx_dataFile.sync(); // Sync the file system
         bytes_written += bufferPointer;
 #ifdef DEBUG
@@ -1506,6 +1413,13 @@ void loop() // run over and over again
       Serial.println(filesize);
       Serial.print("File size should be ");
       Serial.println(bytes_written);
+#ifdef FILTER_UBX
+      Serial.print("Frames dropped by the filter: ");
+      Serial.print(ubxFilter.droppedFrames);
+      Serial.print(" (");
+      Serial.print(ubxFilter.droppedBytes);
+      Serial.println(" bytes)");
+#endif
 #endif
       Serial.println("File closed!");
       // An RTC alarm was detected, so set the RTC alarm time to the next INTERVAL and loop back to open_file.
@@ -1532,11 +1446,12 @@ void loop() // run over and over again
     // Disable RAWX messages, save any residual data and close the file, possibly for the last time
     case close_file: {
       setRAWXoff(); // Disable RAWX messages
+      flushFrameBuffer(); // Copy any partial frame into serBuffer
+      if (packetPending == true) writePendingPacket(); // Write the pending packet first
       int waitcount = 0;
       while (waitcount < dwell) { // Wait for residual data
         while (SerialBuffer.available()) {
-          serBuffer[bufferPointer] = SerialBuffer.read_char(); // Put extra bytes into serBuffer
-          bufferPointer++;
+          bufferPointer += SerialBuffer.read(&serBuffer[fillBuffer][bufferPointer], SDpacket - bufferPointer); // Put extra bytes into serBuffer
           if (bufferPointer == SDpacket) { // Write a full packet
             bufferPointer = 0;
 #ifndef NoLED
@@ -1550,7 +1465,7 @@ void loop() // run over and over again
 #endif
 #endif
 #endif
-            numBytes = rawx_dataFile.write(&serBuffer, SDpacket);
+            numBytes = rawx_dataFile.write(serBuffer[fillBuffer], SDpacket);
             //rawx_dataFile.sync(); // Sync the file system
 #ifndef NoLED
 #ifdef NeoPixel
@@ -1576,7 +1491,8 @@ void loop() // run over and over again
         waitcount++;
         delay(1);
       }
-      // If there is any data left in serBuffer, write it to file
+      // If there is a pending packet or any data left in serBuffer, write it to file
+      if (packetPending == true) writePendingPacket();
       if (bufferPointer > 0) {
 #ifndef NoLED
 #ifdef NeoPixel
@@ -1589,7 +1505,7 @@ void loop() // run over and over again
 #endif
 #endif
 #endif
-        numBytes = rawx_dataFile.write(&serBuffer, bufferPointer); // Write remaining data
+        numBytes = rawx_dataFile.write(serBuffer[fillBuffer], bufferPointer); // Write remaining data
         rawx_dataFile.sync(); // Sync the file system
         bytes_written += bufferPointer;
 #ifndef NoLED
@@ -1722,11 +1638,12 @@ void loop() // run over and over again
     // Don't update the next RTC alarm - leave it as it is
     case restart_file: {
       setRAWXoff(); // Disable RAWX messages
+      flushFrameBuffer(); // Copy any partial frame into serBuffer
+      if (packetPending == true) writePendingPacket(); // Write the pending packet first
       int waitcount = 0;
       while (waitcount < dwell) { // Wait for residual data
         while (SerialBuffer.available()) {
-          serBuffer[bufferPointer] = SerialBuffer.read_char(); // Put extra bytes into serBuffer
-          bufferPointer++;
+          bufferPointer += SerialBuffer.read(&serBuffer[fillBuffer][bufferPointer], SDpacket - bufferPointer); // Put extra bytes into serBuffer
           if (bufferPointer == SDpacket) { // Write a full packet
             bufferPointer = 0;
 #ifndef NoLED
@@ -1740,7 +1657,7 @@ void loop() // run over and over again
 #endif
 #endif
 #endif
-            numBytes = rawx_dataFile.write(&serBuffer, SDpacket);
+            numBytes = rawx_dataFile.write(serBuffer[fillBuffer], SDpacket);
             //rawx_dataFile.sync(); // Sync the file system
 #ifndef NoLED
 #ifdef NeoPixel
@@ -1766,7 +1683,8 @@ void loop() // run over and over again
         waitcount++;
         delay(1);
       }
-      // If there is any data left in serBuffer, write it to file
+      // If there is a pending packet or any data left in serBuffer, write it to file
+      if (packetPending == true) writePendingPacket();
       if (bufferPointer > 0) {
 #ifndef NoLED
 #ifdef NeoPixel
@@ -1779,7 +1697,7 @@ void loop() // run over and over again
 #endif
 #endif
 #endif
-        numBytes = rawx_dataFile.write(&serBuffer, bufferPointer); // Write remaining data
+        numBytes = rawx_dataFile.write(serBuffer[fillBuffer], bufferPointer); // Write remaining data
         rawx_dataFile.sync(); // Sync the file system
         bytes_written += bufferPointer;
 #ifndef NoLED
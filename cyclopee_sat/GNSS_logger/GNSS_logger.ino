@@ -7,6 +7,14 @@
  *    This program logs distance and temperature readings into a log file on the SD card 
  *    using GNSS time. GNSS signal quality is logged as well.
  *    Log file segmentation and new day file creation are handled.
+ *    RTK corrections (RTCM 3) received from the gateway over Bluetooth are
+ *    forwarded to the GNSS module, orders are read from the same link.
+ *    Each sensor is sampled at its own rate (Sensor_scheduler.h), records
+ *    carry the channels refreshed.
+ *    Wave bursts: every distance frame is kept for WAVE_BURST_SAMPLES frames,
+ *    the sea state statistics (Wave_stats.h) are sent over Bluetooth.
+ *    Samples can be aggregated over time windows (Window_aggregate.h): SD
+ *    and Bluetooth each take the raw samples, the aggregates or both.
  *   
  * @board :
  *    Teensy 3.5
@@ -21,6 +29,8 @@
  *      Teensy RX2       -> GNSS_MODULE UART1 B3 (TX)
  *      Teensy Vin (5V)  -> GNSS_MODULE UART1 B1 (5V)
  *      Teensy GND       -> GNSS_MODULE UART1 B6 (GND)
+ *      Teensy 22        -> GNSS_MODULE TIMEPULSE (PPS)
+ *      Teensy TX5       -> GNSS_MODULE UART1 B2 (RX, RTCM corrections)
  *      Teensy TX4  -> RS485 RX
  *      Teensy RX4  -> RS485 TX 
  *      Teensy 30   -> RS485 DE 
@@ -50,24 +60,43 @@
 #define BLUETOOTH_SERIAL  Serial1
  
 /************** TIMER INTERRUPTS INTERVALS *****************/
-// Sensor acquisition interval
-// Check sensor reading interrupt duration before setting the value
-// 71s maximum
-#define READ_INTERVAL 1000/*ms*/ * 1000/*µs/ms*/
+// Sensor acquisition periods: GNSS_NMEA_INTERVAL, DIST_PERIOD and
+// TEMP_PERIOD (sensor modules), changed with the update_interval order.
+// The sensor timer runs at the GCD of the periods (Sensor_scheduler.h).
 
 // GNSS refresh interval
 // Minimal refresh rate to get 20ms GNSS time resolution
 #define GNSS_REFRESH_INTERVAL 1/*ms*/ * 1000/*ms/µs*/
 // Logging segmentation interval
 #define LOG_SEG_INTERVAL  30/*s*/ * 1000/*ms/s*/
+// Raw samples segments compressed by blocks and journaled (.csz, about 6.6 kB of RAM), 0: text segments (.csv)
+#define LOG_COMPRESS      0
 // Digital I.O. refresh interval
 #define IO_REFRESH_INTERVAL 50/*ms*/ * 1000/*µs/ms*/
 
+/************** AGGREGATES *****************/
+// Aggregation window (divides the day), changed with the aggregate order
+#define AGG_WINDOW  60//s
+// Streams of each sink: STREAM_RAW, STREAM_AGGREGATE or STREAM_BOTH
+#define SD_STREAMS  STREAM_RAW
+#define BT_STREAMS  STREAM_RAW
+
+/************** WAVE BURSTS *****************/
+// Wave burst interval, 0: bursts on wave_burst order only
+#define WAVE_BURST_INTERVAL 30/*min*/ * 60/*s/min*/ * 1000/*ms/s*/
+// Distance frames of a burst: 4096 frames at 10Hz (about 7 min), 32 kB of RAM
+#define WAVE_BURST_SAMPLES  4096
+// Longest distance period during a burst: frames waiting in the UART buffer
+// (64 bytes: 16 frames) are all read
+#define WAVE_MAX_POLL       1000//ms
+
 /************** TEENSY PINS *****************/
 // Logging LED
 #define LOG_LED       13
 // Disable logging button
 #define BUTTON_PIN    14
+// SD card detect pin (LOG_SEG_NO_PIN: builtin slot without detect switch)
+#define SD_DETECT_PIN LOG_SEG_NO_PIN
 
 /************** BLUETOOTH MODULE *****************/
 // Bluetooth module key (AT mode) pin
@@ -79,16 +108,22 @@
 #define BLUETOOTH_UART_CONF "115200,1,0"
 #define BLUETOOTH_NRG_MODE  ""
 
+/************** RTK CORRECTIONS *****************/
+// Memory added to the GNSS UART transmit buffer (a whole RTCM frame fits)
+#define GNSS_TX_EXTRA_BUFFER      1100//bytes
+// Memory added to the Bluetooth UART receive buffer (correction bursts)
+#define BLUETOOTH_RX_EXTRA_BUFFER 1024//bytes
+// Longest delay of a telemetry line during a correction burst
+#define TELEMETRY_MAX_DEFER       250//ms
+
 /************** GNSS module *****************/
 // GNSS commuiation baudrate
 #define GNSS_BAUDRATE 115200//bauds
-// Time value if GNSS module disconnected
-#define NO_GNSS_TIME      24606099 // HH:MM:SS.CC
-// Longitude/latitude value if GNSS module disconnected
-#define NO_GNSS_LOCATION  91//°
-// Altitude value if GNSS module disconnected
+// Elevation value (mm) if GNSS module disconnected
+// Longitude/latitude not received are GnssCoord::none() (GNSS_fixed.h)
 #define NO_GNSS_ALTITUDE  INT32_MAX
 // NMEA messages inteval
+// Samples are timestamped with the PPS timebase between NMEA sentences
 #define GNSS_NMEA_INTERVAL  250//ms
 
 /************** BLUETOOTH *****************/
@@ -118,7 +153,16 @@ enum Devices : uint8_t  {
   TEMPERATURE,
   DISTANCE,
   GNSS_MODULE,
-  BLUETOOTH
+  BLUETOOTH,
+  PPS
+};
+// Sensor channels (bit of the freshness flags)
+enum Channels : uint8_t  {
+
+  CH_GNSS = 0,
+  CH_DISTANCE,
+  CH_TEMPERATURE,
+  NB_CHANNELS
 };
 
 /************** DEBUG *****************/
@@ -148,26 +192,59 @@ enum Devices : uint8_t  {
  * #   FUNCTION PROTOTYPES   #
  * ###########################
  */
+// System module types (modules included below)
+struct GnssCoord;
+struct WaveStats;
+class LogSegmenter;
 // Sd card setup
 void setupSDCard(volatile bool& deviceConnected);
 // Log file setup
-void handleLogFile(File& file, String& dirName, String& fileName, TinyGPSPlus& gnss, Metro& logSegCountdown, volatile bool& deviceConnected);
-bool logToSD(File& file, const uint32_t& timeVal, const double& lng_deg, const double& lat_deg, const double& elv_m, const float& dist_mm, const float& temp_C);
+bool logToSD(LogSegmenter& seg, const uint64_t& time_us, const uint8_t& fresh, const GnssCoord& lng_deg, const GnssCoord& lat_deg, const int32_t& elv_mm, const char* fixMode, const char* pdop, const float& dist_mm, const float& temp_C);
 void dumpFileToSerial(File& file);
 // GNSS setup
 void setupGNSS(TinyGPSPlus& gnss, volatile bool& deviceConnected);
 void gnssRefresh();
 // Bluetooth communication
 void setupBluetooth(String& satelliteID, volatile bool& deviceConnected);
-void sendDataToBluetooth(TinyGPSDate& gnssDate, const uint32_t& timeVal, const double& lng_deg, const double& lat_deg, const double& elv_m, const char* fixMode, const char* pdop, const float& dist_mm, const float& temp_C);
+void sendDataToBluetooth(TinyGPSDate& gnssDate, const uint64_t& time_us, const uint8_t& fresh, const GnssCoord& lng_deg, const GnssCoord& lat_deg, const int32_t& elv_mm, const char* fixMode, const char* pdop, const float& dist_mm, const float& temp_C);
 void readBluetoothOrders();
+void flushTelemetry(bool force);
 // Sensor reading interrupt
 void readSensors();
+uint64_t sampleTimeUs();
+// Sensor channels
+bool readGnssChannel();
+bool readDistChannel();
+bool readTempChannel();
+void printTimetable();
+// Wave bursts
+void startWaveBurst();
+void waveFrame(float dist_mm);
+void sendWaveStats();
+void json_waveStr(String& str, const String& satelliteID, const WaveStats& stats);
+// Aggregates
+void aggregateSample(const uint64_t& time_us, const uint8_t& fresh, const GnssCoord& lng_deg, const GnssCoord& lat_deg, const int32_t& elv_mm, const float& dist_mm, const float& temp_C);
+void closeAggregateWindow();
+void json_statStr(String& str, const char* name, uint32_t count, const char* mean, const char* min, const char* max, const String& std);
+void json_aggregateStr(String& str, const String& satelliteID);
 // Digital IO update interrupt
 void handleDigitalIO();
 // Handling errors
 void waitForReboot(const String& msg);
 
+/* ######################
+ * #   SYSTEM MODULES   #
+ * ######################
+ */
+#include "PPS_timebase.h"
+#include "RTCM_demux.h"
+#include "GNSS_fixed.h"
+#include "Log_segment.h"
+#include "Sensor_scheduler.h"
+#include "Wave_stats.h"
+#include "JSON_order.h"
+#include "Window_aggregate.h"
+
 /* ######################
  * #   SENSOR MODULES   #
  * ######################
@@ -181,13 +258,19 @@ void waitForReboot(const String& msg);
  */
 /************** GLOBALS *****************/
 // Array to store devices connection state
-volatile bool connectedDevices[4] = {false, false, false, false};
+volatile bool connectedDevices[6] = {false, false, false, false, false, false};
 
 // LOGGING
-// Log file
-String logDir = "";
-String logFileName = "";
-File logFile;
+// Log segments (YYYY_MM_DD/HH_MM_SS.csv, or .csz compressed)
+#if LOG_COMPRESS
+BlockCompressor logCompressor;
+#define LOG_COMPRESSOR  &logCompressor
+#else
+#define LOG_COMPRESSOR  NULL
+#endif
+LogSegmenter logSeg("Time (HH:MM:SS.ssssss),Longitude (°),Latitude (°),Altitude (cm),Fix Mode,PDOP,Distance (mm),External temperature (°C),Fresh", LOG_SEG_INTERVAL, "", LOG_COMPRESSOR);
+// Aggregate segments (YYYY_MM_DD/HH_MM_SS_agg.csv), JSON lines as sent over Bluetooth
+LogSegmenter aggSeg(NULL, LOG_SEG_INTERVAL, "_agg");
 // Log state (enabled/disabled)
 volatile bool enLog = false;
 
@@ -197,23 +280,68 @@ TinyGPSPlus gnss;
 TinyGPSCustom gnssGeoidElv(gnss, "GNGGA", 11);
 TinyGPSCustom gnssFixMode(gnss, "GNGGA", 6);
 TinyGPSCustom gnssPDOP(gnss, "GNGSA", 15);
+// NMEA epoch time used to label PPS edges
+TinyGPSCustom gnssEpochTime(gnss, "GNGGA", 1);
 
 // Bluetooth
 String satelliteID;
+// Corrections and orders received from the gateway
+RtcmDemux btDemux;
+// Telemetry line waiting for the end of a correction burst
+String telemetryLine = "";
+uint32_t telemetryQueued_ms = 0;
+// UART buffer extensions
+uint8_t gnssTxBuffer[GNSS_TX_EXTRA_BUFFER];
+uint8_t bluetoothRxBuffer[BLUETOOTH_RX_EXTRA_BUFFER];
 
 // Timer interrputs
 IntervalTimer sensorRead_timer, gnssRefresh_timer, ioRefresh_timer;
 
+// SENSOR CHANNELS
+// Name (orders), period, lowest period, latency, start, read
+SchedChannel sensorChannels[NB_CHANNELS] = {
+  {"gnss", GNSS_NMEA_INTERVAL, GNSS_NMEA_INTERVAL, 0, NULL, readGnssChannel},
+  {"dist", DIST_PERIOD, DIST_MIN_PERIOD, 0, NULL, readDistChannel},
+  {"temp", TEMP_PERIOD, TEMP_MIN_PERIOD, TEMP_LATENCY, startTempConversion, readTempChannel}
+};
+SensorScheduler scheduler(sensorChannels, NB_CHANNELS);
+// Last channel values, logged with the freshness flags
+GnssCoord gnssLng_deg, gnssLat_deg;
+int32_t gnssElv_mm = NO_GNSS_ALTITUDE;
+const char *gnssFixMode_str = "", *gnssPDOP_str = "";
+float lastDist_mm = DIST_NO_VALUE, lastTemp_C = TEMP_NO_VALUE;
+// Last NMEA time, sample time without PPS
+uint64_t nmeaTime_us = PPS_NO_TIME;
+uint32_t nmeaTime_ms = 0;
+
+// WAVE BURSTS
+// Distance frames of the running burst
+WaveBurst waveBurst;
+// Burst start, time of the statistics line
+uint64_t waveStart_us = PPS_NO_TIME;
+String waveDate_str = "";
+
+// AGGREGATES
+// Streams of each sink (STREAM_RAW, STREAM_AGGREGATE)
+uint8_t sdStreams = SD_STREAMS, btStreams = BT_STREAMS;
+AggregateWindow aggWindow(AGG_WINDOW);
+// Date of the open window (DDMMYY)
+uint32_t aggDate = 0;
+// Statistics of each channel over the open window
+RunningStats<int64_t> lngStats, latStats;
+RunningStats<int32_t> elvStats;
+RunningStats<float> distStats, tempStats;
+
 // LED timers
 Metro logLEDCountdown = Metro(1500);
 Metro noLogLEDCountdown = Metro(600);
 Metro errorLEDCountdown = Metro(150);
 
 // Metro timers
-// Timer to manage log segmentation time
-Metro logSegCountdown = Metro(LOG_SEG_INTERVAL);
 // Timer to dump log file every 1s
 Metro fileDumpCountdown = Metro(1000);
+// Wave burst timer
+Metro waveBurstCountdown = Metro(WAVE_BURST_INTERVAL);
 
 /*
  *  @brief:
@@ -254,8 +382,18 @@ void setup() {
   SERIAL_DBG("## GNSS MODULE\n")
   setupGNSS(gnss, connectedDevices[GNSS_MODULE]);
   SERIAL_DBG('\n')
+  // PPS timebase set up
+  SERIAL_DBG("## PPS TIMEBASE\n")
+  setupPPS(connectedDevices[PPS]);
+  SERIAL_DBG('\n')
+  // Sensor timetable
+  SERIAL_DBG("## SENSOR TIMETABLE\n")
+  if (!scheduler.build())
+    waitForReboot("Invalid sensor periods, check sensor module config.");
+  printTimetable();
+  SERIAL_DBG('\n')
   // Setting up timer interrupts
-  sensorRead_timer.begin(readSensors, READ_INTERVAL);
+  sensorRead_timer.begin(readSensors, scheduler.tickUs());
   sensorRead_timer.priority(200);
   gnssRefresh_timer.begin(gnssRefresh, GNSS_REFRESH_INTERVAL);
   gnssRefresh_timer.priority(190);
@@ -270,14 +408,18 @@ void setup() {
 
 /************** LOOP() GLOBAL VARS *****************/
 // Buffers to store values to log
-RingBuf <uint32_t, MAX_BUFFER_SIZE> time_buf;
-RingBuf <double, MAX_BUFFER_SIZE> lng_buf, lat_buf, elv_buf;
+RingBuf <uint64_t, MAX_BUFFER_SIZE> time_buf;
+RingBuf <uint8_t, MAX_BUFFER_SIZE> fresh_buf;
+RingBuf <GnssCoord, MAX_BUFFER_SIZE> lng_buf, lat_buf;
+RingBuf <int32_t, MAX_BUFFER_SIZE> elv_buf;
 RingBuf <const char*, MAX_BUFFER_SIZE> fixMode_buf, pdop_buf;
 RingBuf <float, MAX_BUFFER_SIZE> extTemp_buf, dist_buf;
 
 // Variables to store buffer readings
-uint32_t time_ms;
-double lng_deg, lat_deg, elv_m;
+uint64_t time_us;
+uint8_t fresh;
+GnssCoord lng_deg, lat_deg;
+int32_t elv_mm;
 const char *fixMode, *pdop;
 float extTemp_C, dist_mm;
 
@@ -286,8 +428,9 @@ float extTemp_C, dist_mm;
  *    Prints devices connection state.
  *    If logging enabled (enLog) :
  *      - Prints open log file name;
- *      - Handles the log file (segementation, new day);
+ *      - Handles the log file (segementation, new day) with Log_segment.h;
  *      - Logs data;
+ *      - Creates the next log segment while buffers are empty;
  *      - Dumps log file to Serial (if FILE_DUMP).
  *    Else :
  *      - Empty buffers into log file;
@@ -299,30 +442,55 @@ void loop() {
   // Loop execution time
   //long t = micros();
   
-  //readBluetoothOrders();
+  readBluetoothOrders();
+  flushTelemetry(false);
+
+  // Wave bursts, statistics computed once the burst is full
+  if (WAVE_BURST_INTERVAL && waveBurstCountdown.check())
+    startWaveBurst();
+  if (waveBurst.full())
+    sendWaveStats();
 
   // File management and data storage
   // If buffers are empty
   if (time_buf.isEmpty()) {
-    if (!enLog)
-      logFile.close();
+    if (!enLog)  {
+      // Last window sent as it is, a window does not span two logging sessions
+      closeAggregateWindow();
+      logSeg.close();
+      aggSeg.close();
+    }
+    // Next log segments created while there is nothing to log
+    else  {
+      logSeg.idle();
+      aggSeg.idle();
+    }
   }
   else {
-    // Handling log file management
-    handleLogFile(logFile, logDir, logFileName, gnss, logSegCountdown, connectedDevices[SD_CARD]);
     // Create function for this
-    time_buf.pop(time_ms);
+    time_buf.pop(time_us);
+    fresh_buf.pop(fresh);
     extTemp_buf.pop(extTemp_C);
     lng_buf.pop(lng_deg);
     lat_buf.pop(lat_deg);
-    elv_buf.pop(elv_m);
+    elv_buf.pop(elv_mm);
     fixMode_buf.pop(fixMode);
     pdop_buf.pop(pdop);
     dist_buf.pop(dist_mm);
     // -----------------
-    if ( !logToSD(logFile, time_ms, lng_deg, lat_deg, elv_m, fixMode, pdop, dist_mm, extTemp_C) )
-      SERIAL_DBG("Logging failed...\n")
-    sendDataToBluetooth(satelliteID, gnss.date, time_ms, lng_deg, lat_deg, elv_m, fixMode, pdop, dist_mm, extTemp_C);
+    // Raw samples
+    if (sdStreams & STREAM_RAW)  {
+      // Log segment of the sample (new day, segment interval elapsed, card inserted)
+      logSeg.update(gnss.date.value(), (time_us != PPS_NO_TIME) ? time_us / 1000000 : 0);
+      connectedDevices[SD_CARD] = logSeg.cardPresent();
+      if ( !logToSD(logSeg, time_us, fresh, lng_deg, lat_deg, elv_mm, fixMode, pdop, dist_mm, extTemp_C) )
+        SERIAL_DBG("Logging failed...\n")
+    }
+    if (btStreams & STREAM_RAW)
+      sendDataToBluetooth(satelliteID, gnss.date, time_us, fresh, lng_deg, lat_deg, elv_mm, fixMode, pdop, dist_mm, extTemp_C);
+    // Window statistics, sent when the sample closes a window
+    if ((sdStreams | btStreams) & STREAM_AGGREGATE)
+      aggregateSample(time_us, fresh, lng_deg, lat_deg, elv_mm, dist_mm, extTemp_C);
   }
 
   // Debug serial output
@@ -343,15 +511,32 @@ void loop() {
   SERIAL_DBG(connectedDevices[GNSS_MODULE])
   SERIAL_DBG("\n\n")
 
+  // Print RTK corrections state
+  const RtcmDemux::Stats& rtcm = btDemux.stats();
+  SERIAL_DBG("### RTCM\n\n")
+  SERIAL_DBG("Frames :\t")
+  SERIAL_DBG(rtcm.frames)
+  SERIAL_DBG("\nCRC errors :\t")
+  SERIAL_DBG(rtcm.crcErrors)
+  SERIAL_DBG("\nLast type :\t")
+  SERIAL_DBG(rtcm.lastType)
+  SERIAL_DBG("\nLatency (us) :\t")
+  SERIAL_DBG(rtcm.lastLatency_us)
+  SERIAL_DBG(" (max ")
+  SERIAL_DBG(rtcm.maxLatency_us)
+  SERIAL_DBG(")\nOrders :\t")
+  SERIAL_DBG(rtcm.orders)
+  SERIAL_DBG(" (dropped ")
+  SERIAL_DBG(rtcm.ordersDropped)
+  SERIAL_DBG(")\n\n")
+
   // If logging enabled
   if (enLog) {
     // Print log file info
     SERIAL_DBG("### LOG FILE\n\n")
-    if (logFile) {
+    if (logSeg.file()) {
       SERIAL_DBG("File : ")
-      SERIAL_DBG(logDir)
-      SERIAL_DBG("/")
-      SERIAL_DBG(logFileName)
+      SERIAL_DBG(logSeg.path())
       SERIAL_DBG('\n')
       SERIAL_DBG("\n###\n")
     }
@@ -363,7 +548,7 @@ void loop() {
 
   // Dumping log file to Serial
   if (FILE_DUMP && fileDumpCountdown.check())
-    dumpFileToSerial(logFile);
+    dumpFileToSerial(logSeg.file());
 
   SERIAL_DBG("\n\n")
 
@@ -379,52 +564,250 @@ void loop() {
 /* ##############   TIMER INTERRUPT    ################ */
 /*
  * @brief: 
- *    Interrupts loop() to read sensors.
+ *    Interrupts loop() every timetable tick to run the sensor channels due
+ *    (Sensor_scheduler.h). A record is buffered if a channel was refreshed:
+ *    last value of every channel and freshness flags.
  * @exec time:
- *     Long and mostly depends on temperature resolution config.
+ *    Reads due on the tick, conversions are started ahead (latency).
  */
 void readSensors()  {
   // Interrupt execution time
-  //long t = millis();
-  
-  // If logging enabled and logFile open
-  if (enLog) {
-    // If buffer not full
-    if ( !time_buf.isFull() ) {
-
-      // Interrupt safe GNSS data push into buffers
-      if (gnss.time.isUpdated())
-        time_buf.lockedPush(gnss.time.value());
-      else
-        time_buf.push(NO_GNSS_TIME);
-      if (gnss.location.isUpdated()) {
-        lng_buf.lockedPush(gnss.location.lng());
-        lat_buf.lockedPush(gnss.location.lat());
-      }
-      else  {
-        lng_buf.push(NO_GNSS_LOCATION);
-        lat_buf.push(NO_GNSS_LOCATION);
-      }
-
-      if (gnss.altitude.isUpdated())
-        elv_buf.lockedPush(gnss.altitude.meters() + strtod(gnssGeoidElv.value(), NULL));
-      else
-        elv_buf.push(NO_GNSS_ALTITUDE);
-
-      pdop_buf.lockedPush(gnssPDOP.value());
-      fixMode_buf.lockedPush(gnssFixMode.value());
-
-      // Acquire temperature
-      extTemp_buf.push(readTemperature(connectedDevices[TEMPERATURE]));
-      // Acquire distance
-      dist_buf.push(readDistance(extTemp_buf[extTemp_buf.size()-1], connectedDevices[DISTANCE]));
-    }
-    else
-      SERIAL_DBG("Buffer is full!\n")
+  //long t = micros();
+
+  // Sample time
+  uint64_t sampleTime_us;
+  // Channels refreshed on this tick
+  uint8_t freshMask;
+
+  // Timetable runs while logging is disabled, phases are kept
+  if (!scheduler.tick(freshMask) || !freshMask || !enLog)
+    return;
+  // If buffer not full
+  if ( !time_buf.isFull() ) {
+    sampleTime_us = sampleTimeUs();
+
+    lng_buf.push(gnssLng_deg);
+    lat_buf.push(gnssLat_deg);
+    elv_buf.push(gnssElv_mm);
+    fixMode_buf.push(gnssFixMode_str);
+    pdop_buf.push(gnssPDOP_str);
+    dist_buf.push(lastDist_mm);
+    extTemp_buf.push(lastTemp_C);
+    fresh_buf.push(freshMask);
+    // Time pushed last, loop() pops samples once time buffer is not empty
+    time_buf.push(sampleTime_us);
   }
+  else
+    SERIAL_DBG("Buffer is full!\n")
 
   // Interrupt execution time
-  //Serial.println(millis() - t);
+  //Serial.println(micros() - t);
+}
+
+/*
+ * @brief: 
+ *    Sample time: PPS timebase, NMEA time and elapsed time if not locked.
+ * @return:
+ *    µs since midnight UTC, PPS_NO_TIME before the first NMEA time.
+ */
+uint64_t sampleTimeUs()  {
+
+  if (ppsLocked())
+    return ppsTimeUs();
+  if (nmeaTime_us != PPS_NO_TIME)
+    return (nmeaTime_us + (uint64_t)(millis() - nmeaTime_ms) * 1000) % US_PER_DAY;
+  return PPS_NO_TIME;
+}
+
+/*
+ * @brief: 
+ *    GNSS channel: position of the last NMEA epoch (fixed point, no double
+ *    emulation in the interrupt).
+ * @return:
+ *    True if a new epoch was received.
+ */
+bool readGnssChannel()  {
+
+  if (!gnss.location.isUpdated())
+    return false;
+  gnssLng_deg = GnssCoord::fromRaw(gnss.location.rawLng());
+  gnssLat_deg = GnssCoord::fromRaw(gnss.location.rawLat());
+  // Altitude above mean sea level (cm) + geoid separation: ellipsoidal height (mm)
+  if (gnss.altitude.isUpdated())
+    gnssElv_mm = gnss.altitude.value() * 10 + gnssStrToMilli(gnssGeoidElv.value());
+  else
+    gnssElv_mm = NO_GNSS_ALTITUDE;
+  gnssPDOP_str = gnssPDOP.value();
+  gnssFixMode_str = gnssFixMode.value();
+  // NMEA time used if PPS timebase is not locked
+  if (gnss.time.isUpdated())  {
+    nmeaTime_us = nmeaTimeValToUs(gnss.time.value());
+    nmeaTime_ms = millis();
+  }
+  return true;
+}
+
+/*
+ * @brief: 
+ *    Distance channel: last frame sent by the sensor. During a wave burst
+ *    every frame received since the last read is added to the burst.
+ */
+bool readDistChannel()  {
+
+  float dist;
+  if (!pollDistance(dist, connectedDevices[DISTANCE], waveFrame))
+    return false;
+  lastDist_mm = dist;
+  // Burst dropped if the sensor is lost, missing frames would not be counted
+  if (!connectedDevices[DISTANCE] && waveBurst.active())  {
+    waveBurst.abort();
+    SERIAL_DBG("Wave burst aborted, no distance sensor...\n")
+  }
+  return true;
+}
+
+/*
+ * @brief: 
+ *    Temperature channel: conversion started TEMP_LATENCY before.
+ */
+bool readTempChannel()  {
+
+  lastTemp_C = readTempConversion(connectedDevices[TEMPERATURE]);
+  return true;
+}
+
+/*
+ * @brief: 
+ *    Prints the sensor timetable (tick, then channels in rate-monotonic order).
+ */
+void printTimetable()  {
+
+  SERIAL_DBG("Tick (ms) :\t")
+  SERIAL_DBG(scheduler.tickMs())
+  SERIAL_DBG('\n')
+  for (uint8_t k = 0; k < scheduler.size(); k++)  {
+    uint8_t i = scheduler.rank(k);
+    SERIAL_DBG(scheduler.channel(i).name)
+    SERIAL_DBG(" :\tperiod ")
+    SERIAL_DBG(scheduler.channel(i).period_ms)
+    SERIAL_DBG(" ms, latency ")
+    SERIAL_DBG(scheduler.channel(i).latency_ms)
+    SERIAL_DBG(" ms, phase ")
+    SERIAL_DBG(scheduler.phase(i) * scheduler.tickMs())
+    SERIAL_DBG(" ms\n")
+  }
+}
+
+/* ##############   WAVE BURSTS    ################ */
+/*
+ * @brief: 
+ *    Starts a wave burst: distance frames kept at the sensor output rate
+ *    (DIST_MIN_PERIOD). Not started if the distance channel is read less
+ *    often than WAVE_MAX_POLL (frames lost in the UART buffer).
+ */
+void startWaveBurst()  {
+
+  if (waveBurst.active())
+    return;
+  if (!connectedDevices[DISTANCE] || sensorChannels[CH_DISTANCE].period_ms > WAVE_MAX_POLL)  {
+    SERIAL_DBG("Wave burst not started, distance not read at sensor rate...\n")
+    return;
+  }
+  waveStart_us = sampleTimeUs();
+  dateToStr(gnss.date, waveDate_str);
+  waveBurst.start(1000.0f / DIST_MIN_PERIOD);
+  SERIAL_DBG("Wave burst started.\n")
+}
+
+/*
+ * @brief: 
+ *    Distance frame callback (pollDistance()), NAN for a corrupted frame.
+ */
+void waveFrame(float dist_mm)  {
+
+  waveBurst.add(dist_mm);
+}
+
+/*
+ * @brief: 
+ *    Computes the statistics of the full burst and sends them with the
+ *    telemetry lines. Nothing is sent if too many frames were lost.
+ */
+void sendWaveStats()  {
+
+  WaveStats stats;
+  if (!waveBurst.compute(stats))  {
+    SERIAL_DBG("Wave burst dropped, valid frames : ")
+    SERIAL_DBG(stats.valid)
+    SERIAL_DBG('\n')
+    return;
+  }
+  flushTelemetry(true);
+  json_waveStr(telemetryLine, satelliteID, stats);
+  telemetryQueued_ms = millis();
+  flushTelemetry(false);
+}
+
+/* ##############   AGGREGATES    ################ */
+/*
+ * @brief: 
+ *    Adds the refreshed channels of a sample to the window statistics.
+ *    A sample of the next window closes the open one first. Samples
+ *    without time are not aggregated.
+ */
+void aggregateSample(const uint64_t& time_us, const uint8_t& fresh, const GnssCoord& lng_deg, const GnssCoord& lat_deg, const int32_t& elv_mm, const float& dist_mm, const float& temp_C)  {
+
+  if (time_us == PPS_NO_TIME)
+    return;
+  if (aggWindow.isNew(time_us))  {
+    closeAggregateWindow();
+    aggWindow.begin(time_us);
+    aggDate = gnss.date.value();
+  }
+  // Stale values are not counted twice, disconnected sensors not at all
+  if (fresh & (1 << CH_GNSS))  {
+    if (lng_deg.isValid())
+      lngStats.add(lng_deg.nanodeg());
+    if (lat_deg.isValid())
+      latStats.add(lat_deg.nanodeg());
+    if (elv_mm != NO_GNSS_ALTITUDE)
+      elvStats.add(elv_mm);
+  }
+  if ((fresh & (1 << CH_DISTANCE)) && dist_mm != DIST_NO_VALUE)
+    distStats.add(dist_mm);
+  if ((fresh & (1 << CH_TEMPERATURE)) && temp_C != TEMP_NO_VALUE)
+    tempStats.add(temp_C);
+}
+
+/*
+ * @brief: 
+ *    Sends the statistics of the open window to the sinks taking
+ *    aggregates, then clears them.
+ */
+void closeAggregateWindow()  {
+
+  if (!aggWindow.isOpen())
+    return;
+  aggWindow.end();
+  String line;
+  json_aggregateStr(line, satelliteID);
+  if (sdStreams & STREAM_AGGREGATE)  {
+    aggSeg.update(aggDate, aggWindow.start_us() / 1000000);
+    connectedDevices[SD_CARD] = aggSeg.cardPresent();
+    if (!aggSeg.println(line))
+      SERIAL_DBG("Logging failed...\n")
+  }
+  if (btStreams & STREAM_AGGREGATE)  {
+    flushTelemetry(true);
+    telemetryLine = line;
+    telemetryQueued_ms = millis();
+    flushTelemetry(false);
+  }
+  lngStats.clear();
+  latStats.clear();
+  elvStats.clear();
+  distStats.clear();
+  tempStats.clear();
 }
 
 /* ##############   BLUETOOTH    ################ */
@@ -534,17 +917,22 @@ void setupBluetooth(String& satelliteID, volatile bool& deviceConnected)  {
 
   // Configure Bluetooth for data comunication
   BLUETOOTH_SERIAL.begin(BLUETOOTH_COMM_BAUDRATE);
+  // Room for a correction burst while the GNSS UART is busy
+  BLUETOOTH_SERIAL.addMemoryForRead(bluetoothRxBuffer, sizeof(bluetoothRxBuffer));
   
   deviceConnected = true;
 
   SERIAL_DBG("Done.\n")
 } 
 
-void json_logStr(String& str, const String& satelliteID, TinyGPSDate& gnssDate, const uint32_t& timeVal, const double& lng_deg, const double& lat_deg, const double& elv_m, const char* fixMode, const char* pdop, const float& dist_mm, const float& temp_C) {
+void json_logStr(String& str, const String& satelliteID, TinyGPSDate& gnssDate, const uint64_t& time_us, const uint8_t& fresh, const GnssCoord& lng_deg, const GnssCoord& lat_deg, const int32_t& elv_mm, const char* fixMode, const char* pdop, const float& dist_mm, const float& temp_C) {
 
-  String timeVal_str = "", date_str = "";
+  String time_str = "", date_str = "";
+  char num_str[GNSS_COORD_STR_LEN];
+  // Values of channels not refreshed are null
+  bool gnssFresh = fresh & (1 << CH_GNSS);
   str = "" ;
-  timeValToStr(timeVal, timeVal_str);
+  timeUsToStr(time_us, time_str);
   dateToStr(gnssDate, date_str);
   
   str += '{';
@@ -552,65 +940,231 @@ void json_logStr(String& str, const String& satelliteID, TinyGPSDate& gnssDate,
   str += "\"id\":\"" + satelliteID + "\",";
   // Inserting date and time
   str += "\"time\":";
-  if (timeVal != NO_GNSS_TIME)
-    str += "\"" + date_str.replace('_', '/') + " " + timeVal_str + "\"";
+  if (time_us != PPS_NO_TIME)
+    str += "\"" + date_str.replace('_', '/') + " " + time_str + "\"";
   else
     str += "null";
   str += ',';
   // Inserting longitude
   str += "\"lon\":";
-  if (lng_deg != NO_GNSS_LOCATION)
-    str += String(lng_deg, LOC_DECIMALS);
+  if (gnssFresh && lng_deg.isValid())  {
+    lng_deg.format(num_str, LOC_DECIMALS);
+    str += num_str;
+  }
   else
     str += "null";
   str += ',';
   // Inserting latitude
   str += "\"lat\":";
-  if (lat_deg != NO_GNSS_LOCATION)
-    str += String(lat_deg, LOC_DECIMALS);
+  if (gnssFresh && lat_deg.isValid())  {
+    lat_deg.format(num_str, LOC_DECIMALS);
+    str += num_str;
+  }
   else
     str += "null";
   str += ',';
   // Inserting elevation
   str += "\"elv\":";
-  if (elv_m != NO_GNSS_ALTITUDE)
-    str += String(elv_m, ELV_DECIMALS);
+  if (gnssFresh && elv_mm != NO_GNSS_ALTITUDE)  {
+    gnssFormatMilli(num_str, elv_mm, ELV_DECIMALS);
+    str += num_str;
+  }
   else
     str += "null";
   str += ',';
   // Inserting GNSS fix mode
-  str += "\"fix\":" + String(fixMode) + ',';
+  str += "\"fix\":" + String(gnssFresh && *fixMode ? fixMode : "null") + ',';
   // inserting GNSS PDOP value
-  str += "\"pdop\":" + String(pdop) + ',';
+  str += "\"pdop\":" + String(gnssFresh && *pdop ? pdop : "null") + ',';
   // Inserting distance
   str += "\"dist\":";
-  if (dist_mm != DIST_NO_VALUE)
+  if ((fresh & (1 << CH_DISTANCE)) && dist_mm != DIST_NO_VALUE)
     str += String(dist_mm, DIST_DECIMALS);
   else
     str += "null";
   str += ',';
   // Inserting temperature
   str += "\"temp\":";
-  if (temp_C != TEMP_NO_VALUE)
+  if ((fresh & (1 << CH_TEMPERATURE)) && temp_C != TEMP_NO_VALUE)
     str += String(temp_C, TEMP_DECIMALS);
   else
     str += "null";
+  str += ',';
+  // Inserting freshness flags (bit i: channel i)
+  str += "\"fresh\":" + String(fresh);
   str += '}';
 }
 
-void sendDataToBluetooth(const String& satelliteID, TinyGPSDate& gnssDate, const uint32_t& timeVal, const double& lng_deg, const double& lat_deg, const double& elv_m, const char* fixMode, const char* pdop, const float& dist_mm, const float& temp_C)  {
+/*
+ * @brief: 
+ *    Generates the statistics line of a wave burst (time: burst start).
+ * @params:
+ *    str : String to store the line.
+ *    stats : Burst statistics, psd_00 to psd_15 are the mean spectral
+ *            densities of the WAVE_BAND_WIDTH bands.
+ */
+void json_waveStr(String& str, const String& satelliteID, const WaveStats& stats)  {
 
-  String str = "";
-  json_logStr(str, satelliteID, gnssDate, timeVal, lng_deg, lat_deg, elv_m, fixMode, pdop, dist_mm, temp_C);
-  BLUETOOTH_SERIAL.println(str);
-  
+  String time_str = "", date_str = waveDate_str;
+  char key[12];
+
+  timeUsToStr(waveStart_us, time_str);
+  str = "{\"id\":\"" + satelliteID + "\",\"time\":";
+  if (waveStart_us != PPS_NO_TIME)
+    str += "\"" + date_str.replace('_', '/') + " " + time_str + "\"";
+  else
+    str += "null";
+  str += ",\"mean_dist\":" + String(stats.meanDist_mm, DIST_DECIMALS);
+  str += ",\"hm0\":" + String(stats.hm0_mm, DIST_DECIMALS);
+  str += ",\"tp\":" + (isnan(stats.tp_s) ? String("null") : String(stats.tp_s, 2));
+  str += ",\"tm01\":" + (isnan(stats.tm01_s) ? String("null") : String(stats.tm01_s, 2));
+  str += ",\"valid\":" + String(stats.valid, 3);
+  for (uint8_t b = 0; b < WAVE_BANDS; b++)  {
+    snprintf(key, sizeof(key), ",\"psd_%02u\":", b);
+    str += key;
+    str += isnan(stats.psd[b]) ? String("null") : String(stats.psd[b], 1);
+  }
+  str += '}';
+}
+
+/*
+ * @brief: 
+ *    Appends the statistics of a channel: "<name>_n", then "<name>_mean",
+ *    "_min", "_max" and "_std" (null without sample).
+ */
+void json_statStr(String& str, const char* name, uint32_t count, const char* mean, const char* min, const char* max, const String& std)  {
+
+  const char* members[4] = {"_mean", "_min", "_max", "_std"};
+  const char* values[4] = {mean, min, max, std.c_str()};
+  str += ",\"" + String(name) + "_n\":" + String(count);
+  for (uint8_t i = 0; i < 4; i++)
+    str += ",\"" + String(name) + members[i] + "\":" + (count ? values[i] : "null");
+}
+
+/*
+ * @brief: 
+ *    Generates the aggregate line of the closed window (time: window
+ *    start, "window": length in s).
+ * @params:
+ *    str : String to store the line.
+ */
+void json_aggregateStr(String& str, const String& satelliteID)  {
+
+  String time_str = "";
+  char date_str[12], mean_str[GNSS_COORD_STR_LEN], min_str[GNSS_COORD_STR_LEN], max_str[GNSS_COORD_STR_LEN];
+
+  timeUsToStr(aggWindow.start_us(), time_str);
+  snprintf(date_str, sizeof(date_str), "%04lu/%02lu/%02lu", 2000 + aggDate % 100, (aggDate / 100) % 100, aggDate / 10000);
+  str = "{\"id\":\"" + satelliteID + "\",\"time\":\"" + date_str + " " + time_str + "\"";
+  str += ",\"window\":" + String(aggWindow.length());
+  // Coordinates in degrees, standard deviations too
+  GnssCoord::fromNanodeg(lngStats.mean()).format(mean_str, LOC_DECIMALS);
+  GnssCoord::fromNanodeg(lngStats.min()).format(min_str, LOC_DECIMALS);
+  GnssCoord::fromNanodeg(lngStats.max()).format(max_str, LOC_DECIMALS);
+  json_statStr(str, "lon", lngStats.count(), mean_str, min_str, max_str, String(lngStats.std() * 1e-9f, LOC_DECIMALS));
+  GnssCoord::fromNanodeg(latStats.mean()).format(mean_str, LOC_DECIMALS);
+  GnssCoord::fromNanodeg(latStats.min()).format(min_str, LOC_DECIMALS);
+  GnssCoord::fromNanodeg(latStats.max()).format(max_str, LOC_DECIMALS);
+  json_statStr(str, "lat", latStats.count(), mean_str, min_str, max_str, String(latStats.std() * 1e-9f, LOC_DECIMALS));
+  // Elevation in m
+  gnssFormatMilli(mean_str, elvStats.mean(), ELV_DECIMALS);
+  gnssFormatMilli(min_str, elvStats.min(), ELV_DECIMALS);
+  gnssFormatMilli(max_str, elvStats.max(), ELV_DECIMALS);
+  json_statStr(str, "elv", elvStats.count(), mean_str, min_str, max_str, String(elvStats.std() / 1000, ELV_DECIMALS));
+  json_statStr(str, "dist", distStats.count(), String(distStats.mean(), DIST_DECIMALS).c_str(), String(distStats.min(), DIST_DECIMALS).c_str(),
+               String(distStats.max(), DIST_DECIMALS).c_str(), String(distStats.std(), DIST_DECIMALS));
+  json_statStr(str, "temp", tempStats.count(), String(tempStats.mean(), TEMP_DECIMALS).c_str(), String(tempStats.min(), TEMP_DECIMALS).c_str(),
+               String(tempStats.max(), TEMP_DECIMALS).c_str(), String(tempStats.std(), TEMP_DECIMALS));
+  str += '}';
+}
+
+void sendDataToBluetooth(const String& satelliteID, TinyGPSDate& gnssDate, const uint64_t& time_us, const uint8_t& fresh, const GnssCoord& lng_deg, const GnssCoord& lat_deg, const int32_t& elv_mm, const char* fixMode, const char* pdop, const float& dist_mm, const float& temp_C)  {
+
+  // Previous line still waiting: sent now, lines are not dropped
+  flushTelemetry(true);
+  json_logStr(telemetryLine, satelliteID, gnssDate, time_us, fresh, lng_deg, lat_deg, elv_mm, fixMode, pdop, dist_mm, temp_C);
+  telemetryQueued_ms = millis();
+  flushTelemetry(false);
+}
+
+/*
+ * @brief:
+ *    Sends the waiting telemetry line, unless RTCM corrections are being
+ *    received: they go first, the line waits TELEMETRY_MAX_DEFER at most.
+ * @params:
+ *    force: Sends the line even during a correction burst.
+ */
+void flushTelemetry(bool force)  {
+
+  if (telemetryLine.length() == 0)
+    return;
+  if (!force && btDemux.busy(micros()) && millis() - telemetryQueued_ms < TELEMETRY_MAX_DEFER)
+    return;
+  BLUETOOTH_SERIAL.println(telemetryLine);
+  telemetryLine = "";
 }
 
+/*
+ * @brief:
+ *    Handles the last order received from the gateway (the Bluetooth
+ *    stream is read by gnssRefresh()).
+ *    update_interval changes sensor periods: the sensor timer is stopped
+ *    while the timetable is rebuilt, the new periods are answered.
+ *    wave_burst starts a wave burst now.
+ *    aggregate changes the window and the streams of each sink, the open
+ *    window is closed first. The new configuration is answered.
+ */
 void readBluetoothOrders()  {
 
-  char c = BLUETOOTH_SERIAL.read();
-  if (c != (char) -1)
-    Serial.print(c);
+  int16_t channel;
+  uint32_t period_ms, window_s = aggWindow.length();
+  uint8_t sd = sdStreams, bt = btStreams;
+
+  if (!btDemux.orderReady())
+    return;
+  SERIAL_DBG("Order received : ")
+  SERIAL_DBG(btDemux.order())
+  SERIAL_DBG('\n')
+  // {"order":"update_interval", "channel":"dist", "value":100}
+  if (scheduler.parseIntervalOrder(btDemux.order(), channel, period_ms))  {
+    sensorRead_timer.end();
+    if (!scheduler.setPeriod(channel, period_ms))
+      SERIAL_DBG("Interval not accepted...\n")
+    sensorRead_timer.begin(readSensors, scheduler.tickUs());
+    printTimetable();
+    // Answer sent with the next telemetry line
+    flushTelemetry(true);
+    BLUETOOTH_SERIAL.print("{\"update_intervalAnswer\":{\"newInterval\":{");
+    for (uint8_t i = 0; i < scheduler.size(); i++)  {
+      BLUETOOTH_SERIAL.print(i ? ",\"" : "\"");
+      BLUETOOTH_SERIAL.print(scheduler.channel(i).name);
+      BLUETOOTH_SERIAL.print("\":");
+      BLUETOOTH_SERIAL.print(scheduler.channel(i).period_ms);
+    }
+    BLUETOOTH_SERIAL.println("}}}");
+  }
+  // {"order":"wave_burst"}
+  else if (jsonMemberIs(btDemux.order(), "order", "wave_burst"))
+    startWaveBurst();
+  // {"order":"aggregate", "window":60, "sd":"raw", "bt":"agg"}
+  else if (parseAggregateOrder(btDemux.order(), window_s, sd, bt))  {
+    closeAggregateWindow();
+    if (aggWindow.setLength(window_s))  {
+      sdStreams = sd;
+      btStreams = bt;
+    }
+    else
+      SERIAL_DBG("Window not accepted...\n")
+    flushTelemetry(true);
+    BLUETOOTH_SERIAL.print("{\"aggregateAnswer\":{\"window\":");
+    BLUETOOTH_SERIAL.print(aggWindow.length());
+    BLUETOOTH_SERIAL.print(",\"sd\":\"");
+    BLUETOOTH_SERIAL.print(streamName(sdStreams));
+    BLUETOOTH_SERIAL.print("\",\"bt\":\"");
+    BLUETOOTH_SERIAL.print(streamName(btStreams));
+    BLUETOOTH_SERIAL.println("\"}}");
+  }
+  btDemux.releaseOrder();
 }
 
 /* ##############   GNSS    ################ */
@@ -630,6 +1184,8 @@ void setupGNSS(TinyGPSPlus& gnss, volatile bool& deviceConnected) {
 
   // GNSS module Serial port
   GNSS_SERIAL.begin(GNSS_BAUDRATE);
+  // Room for a whole RTCM frame, forwarded without blocking
+  GNSS_SERIAL.addMemoryForWrite(gnssTxBuffer, sizeof(gnssTxBuffer));
 
   // Wait 7s for GNSS signal before timeout
   SERIAL_DBG("Waiting for GNSS signal... ")
@@ -651,6 +1207,8 @@ void setupGNSS(TinyGPSPlus& gnss, volatile bool& deviceConnected) {
  * @brief:  
  *    Interrupts loop() to refresh TinyGPSPlus object with NMEA data.
  *    Checks if GNSS module still connected by checking the number of caraters received during NMEA intervals
+ *    Forwards the RTK corrections received over Bluetooth to the GNSS module: at this
+ *    priority, they are not delayed by loop() (SD writes, telemetry).
  */
 void gnssRefresh() {
 
@@ -672,11 +1230,16 @@ void gnssRefresh() {
     nbCharsProcessed = gnss.charsProcessed();
   }
   // Feed TinyGPSPlus object with NMEA data
-  while (GNSS_SERIAL.available())
-     gnss.encode(GNSS_SERIAL.read());
+  // Label PPS edges with each new NMEA epoch
+  while (GNSS_SERIAL.available())  {
+    if (gnss.encode(GNSS_SERIAL.read()) && gnssEpochTime.isUpdated())
+      ppsTagEpoch(gnssEpochTime.value());
+  }
 
-  while (BLUETOOTH_SERIAL.available())
-    GNSS_SERIAL.write((char)BLUETOOTH_SERIAL.read());
+  // Gateway stream: RTCM frames to the GNSS module, orders to readBluetoothOrders()
+  // Bytes are read only while the GNSS UART has room, the interrupt never blocks
+  while (BLUETOOTH_SERIAL.available() && GNSS_SERIAL.availableForWrite() > RTCM_DEMUX_HOLD)
+    btDemux.feed(BLUETOOTH_SERIAL.read(), GNSS_SERIAL, micros());
 }
 
 
@@ -695,6 +1258,8 @@ void setupSDCard(volatile bool& deviceConnected)  {
     waitForReboot("Failed.");
   else
     SERIAL_DBG("Done.\n")
+  logSeg.begin(SD_DETECT_PIN);
+  aggSeg.begin(SD_DETECT_PIN);
   deviceConnected = true;
 }
 
@@ -715,242 +1280,126 @@ void dateToStr(TinyGPSDate& gnssDate, String& str) {
   
 /*
  * @brief:
- *    Convert and write TinyGPSTime time obj into a string.      
+ *    Convert and write time in microseconds since midnight into a string.
  * @params:
- *    gnssTime : TinyGPSTime obj to convert and write.
+ *    time_us : Time value to convert and write.
  *    str : String to write time into.
  */
-void timeToStr(TinyGPSTime& gnssTime, String& str) {
+void timeUsToStr(const uint64_t& time_us, String& str) {
 
-  str = ( (gnssTime.hour() < 10) ? '0' + String(gnssTime.hour()) : String(gnssTime.hour()) ) + '_' + 
-        ( (gnssTime.minute() < 10) ? '0' + String(gnssTime.minute()) : String(gnssTime.minute()) ) + '_' + 
-        ( (gnssTime.second() < 10) ? '0' + String(gnssTime.second()) : String(gnssTime.second()) );
-}
+  char buf[16];
+  uint32_t s = time_us / 1000000;
+  uint32_t us = time_us % 1000000;
 
-/*
- * @brief:
- *    Convert and write time value from TinyGPSPlus obj into a string.    
- * @params:
- *    timeVal : Time value to convert and write.
- *    str : String to write time into.
- */
-void timeValToStr(const uint32_t& timeVal, String& str) {
-
-  uint32_t tmp = timeVal;
-  int h = tmp/1000000;
-  tmp %= 1000000;
-  int m = tmp/10000;
-  tmp %= 10000;
-  int s = tmp/100;
-  tmp %= 100;
-  int ms = tmp;
-  
-  str = ( (h < 10) ? '0' + String(h) : String(h) ) + ':' + 
-        ( (m < 10) ? '0' + String(m) : String(m) ) + ':' + 
-        ( (s < 10) ? '0' + String(s) : String(s) ) + '.' +
-        ( (ms < 10) ? '0' + String(ms) : String(ms) );
+  snprintf(buf, sizeof(buf), "%02lu:%02lu:%02lu.%06lu", s / 3600, (s / 60) % 60, s % 60, us);
+  str = buf;
 }
-/*
- * @brief: 
- *    Create new log dir 'dirName' if does not already exist.
- * @params:
- *    dirName : New dir name.
- */
-void newLogDir(String& dirName)  {
-
-  if (SD.exists(dirName.c_str()))  {
-    SERIAL_DBG("Dir '")
-    SERIAL_DBG(dirName)
-    SERIAL_DBG("' already exists...\n")
-  }
-  else  {
-    if (!SD.mkdir(dirName.c_str()))  {
-      SERIAL_DBG("Could not create dir '")
-      SERIAL_DBG(dirName)
-      SERIAL_DBG("'...\n")
-    }
-  }
-}
-
-/*
- * @brief: 
- *    Create and open a new log file 'dirName/fileName' if does not already exist
- * @params:
- *    file: File object.
- *    dirName: Directory name in which file will be created.
- *    fileName : New file name.
- */
-bool newLogFile(File& file, const String& dirName, String& fileName)  {
-
-  String file_path = "";
-
-  file_path += dirName + '/' + fileName;
-
-  if (SD.exists(file_path.c_str()))  {
-    SERIAL_DBG("File '")
-    SERIAL_DBG(file_path)
-    SERIAL_DBG("' already exists...\n")
-    return false;
-  }
-
-  file = SD.open(file_path.c_str(), FILE_WRITE);
-  if (!file)  {
-    SERIAL_DBG("Could not create new log file...\n")
-    return false;
-  }
-  file.print("Date:,"); file.println(dirName);
-  file.println("Time (HH:MM:SS.CC),Longitude (°),Latitude (°),Altitude (cm),Fix Mode,PDOP,Distance (mm),External temperature (°C)");
-  return true;
-}
-
-/*
- * @brief: 
- *    Handle log file segmentation and dir/file creation every day.
- * @params:
- *    File : Log file object.
- *    dirName : Log dir name.
- *    fileName : Log file name.
- *    gnss : TinyGPSPlus obj to get current date from.
- *    logSegCountdown : Timer for log segmentation.
- */
-void handleLogFile(File& file, String& dirName, String& fileName, TinyGPSPlus& gnss, Metro& logSegCountdown, volatile bool& deviceConnected)  {
-
-  SERIAL_DBG("---> handleLogFile()\n")
-
-  if (SD.mediaPresent()) {
-    String currDate;
-    dateToStr(gnss.date, currDate);
-  
-    if ( !file || dirName != currDate)  {
-      file.close();
-      dirName = currDate;
-      timeToStr(gnss.time, fileName);
-      fileName += ".csv";
-    }
-    // Create new log segment
-    else if (logSegCountdown.check()) {
-      file.close();
-      timeToStr(gnss.time, fileName);
-      fileName += ".csv";
-    }
-    SERIAL_DBG("Creating new log dir '")
-    SERIAL_DBG(dirName)
-    SERIAL_DBG("'...\n")
-    newLogDir(dirName);
-    SERIAL_DBG("Done.\n")
-    
-    SERIAL_DBG("Creating and opening new log file '")
-    SERIAL_DBG(dirName)
-    SERIAL_DBG('/')
-    SERIAL_DBG(fileName)
-    SERIAL_DBG('\n')
-    if (newLogFile(file, dirName, fileName))  {
-      logSegCountdown.reset();
-      SERIAL_DBG("Done.\n")
-    }
-    deviceConnected = true;
-  }
-  else  {
-    SERIAL_DBG("No SD card detected...\n")
-    deviceConnected = false;
-    file.close();
-  }
-}
-
 /*
  * @brief: 
  *    Generates a string to log into SD card.
  * @params:
  *    log_str : String to store the log.
- *    timeVal : Time value to log.
+ *    time_us : Time value to log (µs since midnight UTC).
+ *    fresh : Channels refreshed (bit i: channel i), values of the others are left empty.
  *    lng_deg : Longitude in ° to log.
  *    lat_deg : Latitude in ° to log.
- *    elv_m : Longitude in cm to log.
+ *    elv_mm : Elevation in mm to log (written in m).
  *    dist_mm : Distance in mm to log.
  *    temp_C : Temperature in °C to log.
  */
-void csv_logStr(String& log_str, const uint32_t& timeVal, const double& lng_deg, const double& lat_deg, const double& elv_m, const char* fixMode, const char* pdop, const float& dist_mm, const float& temp_C)  {
+void csv_logStr(String& log_str, const uint64_t& time_us, const uint8_t& fresh, const GnssCoord& lng_deg, const GnssCoord& lat_deg, const int32_t& elv_mm, const char* fixMode, const char* pdop, const float& dist_mm, const float& temp_C)  {
 
   SERIAL_DBG("\n---> csv_logStr()\n") 
+
+  char num_str[GNSS_COORD_STR_LEN];
+  // Values of channels not refreshed are left empty
+  bool gnssFresh = fresh & (1 << CH_GNSS);
   
   // Inserting GNSS time into log string
-  if (timeVal != NO_GNSS_TIME)
-    timeValToStr(timeVal, log_str);
+  if (time_us != PPS_NO_TIME)
+    timeUsToStr(time_us, log_str);
   else  {
     SERIAL_DBG("No GNSS time response...\n")
     log_str += "NaN";
   }
   log_str += ',';
   // Inserting GNSS longitude into log string
-  if (lng_deg != NO_GNSS_LOCATION)
-    log_str += String(lng_deg, LOC_DECIMALS);
-  else  {
+  if (gnssFresh && lng_deg.isValid())  {
+    lng_deg.format(num_str, LOC_DECIMALS);
+    log_str += num_str;
+  }
+  else if (gnssFresh)  {
     SERIAL_DBG("No GNSS location response, check wiring...\n")
     log_str += "NaN";
   }
   log_str += ',';
   // Inserting GNSS latitude into log string
-  if (lat_deg != NO_GNSS_LOCATION)
-    log_str += String(lat_deg, LOC_DECIMALS);
-  else  {
+  if (gnssFresh && lat_deg.isValid())  {
+    lat_deg.format(num_str, LOC_DECIMALS);
+    log_str += num_str;
+  }
+  else if (gnssFresh)  {
     SERIAL_DBG("No GNSS location response, check wiring...\n")
     log_str += "NaN";
   }
   log_str += ',';
   // Inserting GNSS altitude into log string
-  if (elv_m != NO_GNSS_ALTITUDE)
-    log_str += String (elv_m, ELV_DECIMALS);
-  else  {
+  if (gnssFresh && elv_mm != NO_GNSS_ALTITUDE)  {
+    gnssFormatMilli(num_str, elv_mm, ELV_DECIMALS);
+    log_str += num_str;
+  }
+  else if (gnssFresh)  {
     SERIAL_DBG("No GNSS location response, check wiring...\n")
     log_str += "NaN";
   }
   log_str += ',';
   // Inserting GNSS fix mode value
-  log_str += String(fixMode);
+  if (gnssFresh)
+    log_str += String(fixMode);
   log_str += ',';
   // Inserting GNSS PDOP value
-  log_str += String(pdop);
+  if (gnssFresh)
+    log_str += String(pdop);
   log_str += ',';
   // Inserting distance into log string
-  if (dist_mm != DIST_NO_VALUE)
+  if ((fresh & (1 << CH_DISTANCE)) && dist_mm != DIST_NO_VALUE)
     log_str += String(dist_mm, DIST_DECIMALS);
-  else  {
+  else if (fresh & (1 << CH_DISTANCE))  {
     SERIAL_DBG("No distance response, check wiring...\n")
     log_str += "NaN";
   }
   log_str += ',';
   // Inserting external temperature into log string
-  if (extTemp_C != TEMP_NO_VALUE)
-    log_str += String(extTemp_C, TEMP_DECIMALS);
-  else  {
+  if ((fresh & (1 << CH_TEMPERATURE)) && temp_C != TEMP_NO_VALUE)
+    log_str += String(temp_C, TEMP_DECIMALS);
+  else if (fresh & (1 << CH_TEMPERATURE))  {
     SERIAL_DBG("No temperature response, check wiring...\n")
     log_str += "NaN";
   }
+  log_str += ',';
+  // Inserting freshness flags (bit i: channel i)
+  log_str += String(fresh);
 }
 
 /*
  * @brief: 
  *    Logs a log string into a file.
  * @params:
- *    fileName: Log file name.
- *    timeVal : Time value to log.
+ *    seg : Log segments (text or compressed).
+ *    time_us : Time value to log (µs since midnight UTC).
+ *    fresh : Channels refreshed (bit i: channel i), values of the others are left empty.
  *    lng_deg : Longitude in ° to log.
  *    lat_deg : Latitude in ° to log.
- *    elv_m : Longitude in cm to log.
+ *    elv_mm : Elevation in mm to log (written in m).
  *    dist_mm : Distance in mm to log.
  *    temp_C : Temperature in °C to log.
  */
-bool logToSD(File& file, const uint32_t& timeVal, const double& lng_deg, const double& lat_deg, const double& elv_m, const char* fixMode, const char* pdop, const float& dist_mm, const float& temp_C) {
+bool logToSD(LogSegmenter& seg, const uint64_t& time_us, const uint8_t& fresh, const GnssCoord& lng_deg, const GnssCoord& lat_deg, const int32_t& elv_mm, const char* fixMode, const char* pdop, const float& dist_mm, const float& temp_C) {
 
   String log_str;
-  csv_logStr(log_str, timeVal, lng_deg, lat_deg, elv_m, fixMode, pdop, dist_mm, temp_C);
-  // Check if log file is open
-  if (!file)
-    return false;
-  // Log into log file
-  file.println(log_str);
-
-  return true;
+  csv_logStr(log_str, time_us, fresh, lng_deg, lat_deg, elv_mm, fixMode, pdop, dist_mm, temp_C);
+  // Log into log file (false if not open)
+  return seg.println(log_str);
 }
 
 /*
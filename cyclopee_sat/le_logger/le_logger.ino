@@ -7,6 +7,10 @@
  *    This program logs distance and temperature readings into a log file on the SD card 
  *    using a mix of GNSS time and Teensy clock.
  *    Log file segmentation and new day file creation are handled.
+ *    Low energy duty cycle: the Teensy sleeps between samples, samples are kept
+ *    in RAM and written to SD every LOG_FLUSH_SAMPLES samples, the GNSS receiver
+ *    is put in software backup and woken for a hot start just before the sample
+ *    (if it saves energy at this interval, see LE_energy.h).
  *   
  * @board :
  *    Teensy 3.5
@@ -19,6 +23,7 @@
  *
  * @wiring:
  *      Teensy RX5       -> DP0601 UART1 B3 (TX)
+ *      Teensy TX5       -> DP0601 UART1 (RX)
  *      Teensy Vin (5V)  -> DP0601 UART1 B1 (5V)
  *      Teensy GND       -> DP0601 UART1 B6 (GND)
  *      Teensy TX4  -> RS485 RX
@@ -55,12 +60,24 @@
 #define READ_INTERVAL_HOURS 0
 #define READ_INTERVAL_MINUTES 0
 #define READ_INTERVAL_SECONDS 2
+#define READ_INTERVAL_MS  ((READ_INTERVAL_HOURS * 3600UL + READ_INTERVAL_MINUTES * 60UL + READ_INTERVAL_SECONDS) * 1000UL)
 /* GNSS refresh interval */
 // Minimal refresh rate to get 20ms GNSS time resolution
 #define GNSS_REFRESH_INTERVAL   5000/*µs*/
 /* Logging segmentation interval */
 // max 2³² - 1
 #define LOG_SEG_INTERVAL   6000/*s*/ * 1000/*ms/s*/
+/* Low energy mode */
+// Samples kept in RAM between two SD card writes
+#define LOG_FLUSH_SAMPLES  30
+// RAM for the samples kept (written earlier if full)
+#define LOG_BATCH_SIZE     4096//bytes
+// Longest log line
+#define LOG_LINE_MAX       96//bytes
+// Time to get a GNSS epoch after wake up (hot start after backup)
+#define GNSS_FIX_TIMEOUT   (LE_GNSS_LEAD_MS + 2000)//ms
+// Battery capacity for the battery life estimate
+#define BATTERY_CAPACITY   20000//mAh
 
 /* Teensy pins */
 // Logging LED
@@ -97,8 +114,7 @@
 /* GNSS Module */
 // Time value if GNSS module disconnected
 #define NO_GNSS_TIME      24606099 // HH:MM:SS.CC
-// Longitude/latitude value if GNSS module disconnected
-#define NO_GNSS_LOCATION  91 //°
+// Longitude/latitude not received are GnssCoord::none() (GNSS_fixed.h)
 // Altitude value if GNSS module disconnected
 #define NO_GNSS_ALTITUDE  INT32_MAX
 
@@ -142,9 +158,9 @@ enum Devices : uint8_t  {
  */
 // Sd card setup
 void setupSDCard(bool& deviceConnected);
-// Log file setup
-void handleLogFile(File& file, String& dirName, String& fileName, TinyGPSPlus& gps, Metro& logSegCountdown,   volatile bool& SDConnected);
-bool logToSD(File& file, const uint32_t& timeVal, const double& lng_deg, const double& lat_deg, const int32_t& alt_cm, const uint16_t& dist_mm, const float& temp_C);
+// Samples kept in RAM and written to SD
+bool addLogLine(const uint32_t& timeVal, const GnssCoord& lng_deg, const GnssCoord& lat_deg, const int32_t& alt_cm, const uint16_t& dist_mm, const float& temp_C);
+bool flushLogBatch();
 void dumpFileToSerial(File& file);
 // OneWire communication with DS18B20
 void setupDS18B20(DallasTemperature& sensorNetwork, bool& deviceConnected);
@@ -154,12 +170,21 @@ void postTrans() {  digitalWrite(DE_PIN, LOW);  }
 void setupURM14(ModbusMaster& sensor, const uint16_t& sensorID, const long& sensorBaudrate, void (*preTransCbk)(), void (*postTransCbk)(),  volatile bool& deviceConnected);
 // GNSS setup
 void setupGNSS(TinyGPSPlus& gps, bool& deviceConnected);
-void gnssRefresh(TinyGPSPlus& gps, bool& deviceConnected);
-// Sensor reading interrupt
-void readSensors();
+void gnssRefresh(TinyGPSPlus& gps, bool& deviceConnected, uint32_t timeout_ms);
+// Sensor reading
+void readSensors(uint32_t& gnssTime, GnssCoord& gnssLng, GnssCoord& gnssLat, int32_t& gnssAlt, float& extTemp, uint16_t& dist, uint32_t conversionStart_ms);
 // Button update
 void handleDigitalIO(bool& enLog, const bool* connectedDevices);
 
+/* ######################
+ * #   SYSTEM MODULES   #
+ * ######################
+ */
+#include "GNSS_fixed.h"
+#include "GNSS_power.h"
+#include "Log_segment.h"
+#include "LE_energy.h"
+
 /* ##################
  * #    PROGRAM     #
  * ##################
@@ -174,12 +199,19 @@ SnoozeBlock config(wakeUpAlarm, logButton, usb, sdCard);
 /* Array to store devices connection state */
 bool connectedDevices[4] = {false, false, false, false};
 /* Logging */
-// Log file
-String logDir = "";
-String logFileName = "";
-File logFile;
+// Log segments (YYYY_MM_DD/HH_MM_SS.csv)
+LogSegmenter logSeg("Time (HH:MM:SS.CC),Longitude (°),Latitude (°),Altitude (cm),Distance (mm),External temperature (°C)", LOG_SEG_INTERVAL);
+// Log lines kept in RAM (kept during deep sleep), one day at most
+char logBatch[LOG_BATCH_SIZE];
+size_t logBatchLen = 0;
+uint16_t logBatchLines = 0;
+// Date (DDMMYY) and time (s since midnight) of the first line kept
+uint32_t logBatchDate = 0;
+uint32_t logBatchSeconds = 0;
 // Log state (enabled/disabled)
 bool enLog = false;
+// GNSS receiver in backup between samples
+bool gnssBackupMode = false;
 
 /* DS18B20 */
 // OneWire bus
@@ -205,9 +237,6 @@ Metro logLEDCountdown = Metro(1500);
 Metro noLogLEDCountdown = Metro(600);
 Metro errorLEDCountdown = Metro(150);
 
-/* Ohter timers */
-// Metro object to manage log segmentation time
-Metro logSegCountdown = Metro(LOG_SEG_INTERVAL);
 
 /*
    @brief:
@@ -240,6 +269,8 @@ void setup() {
   
   /* Setting up DS18B20 */
   setupDS18B20(sensors, connectedDevices[DS18B20]);
+  // Conversion started at wake up, read after the GNSS epoch
+  sensors.setWaitForConversion(false);
   SERIAL_DBG('\n')
 
   /* Setting up URM14 */
@@ -252,6 +283,20 @@ void setup() {
 
   /* Sensor reading interval config */
   wakeUpAlarm.setRtcTimer(READ_INTERVAL_HOURS, READ_INTERVAL_MINUTES, READ_INTERVAL_SECONDS); 
+
+  /* Low energy mode */
+  // GNSS backup only if the hot start costs less than tracking during sleep
+  gnssBackupMode = leGnssBackupSaves(READ_INTERVAL_MS, LOG_FLUSH_SAMPLES);
+  float current_mA = leMeanCurrent_mA(LE_MODE_LOW_ENERGY, READ_INTERVAL_MS, LOG_FLUSH_SAMPLES, gnssBackupMode);
+  SERIAL_DBG("GNSS backup between samples : ")
+  SERIAL_DBG(gnssBackupMode ? "yes\n" : "no\n")
+  SERIAL_DBG("Estimated current (mA) : ")
+  SERIAL_DBG(current_mA)
+  SERIAL_DBG("\nEstimated battery life (days) : ")
+  SERIAL_DBG(leBatteryDays(BATTERY_CAPACITY, current_mA))
+  SERIAL_DBG(" (legacy mode ")
+  SERIAL_DBG(leBatteryDays(BATTERY_CAPACITY, leMeanCurrent_mA(LE_MODE_LEGACY, READ_INTERVAL_MS, 1, false)))
+  SERIAL_DBG(")\n")
   
   SERIAL_DBG("\n\n")
 
@@ -262,7 +307,7 @@ void setup() {
 /**** Global variables for loop() ****/
 // Variables to store snesor readings
 uint32_t time_ms;
-double lng_deg, lat_deg;
+GnssCoord lng_deg, lat_deg;
 int32_t alt_cm;
 float extTemp_C;
 uint16_t dist_mm;
@@ -273,11 +318,14 @@ long loopDuration;
  * @brief:
  *    If logging enabled (enLog) :
  *      - Prints open log file name;
- *      - Handles the log file (segementation, new day);
- *      - Logs data;
- *      - Dumps log file to Serial (if FILE_DUMP).
+ *      - Wakes the GNSS receiver, starts the temperature conversion;
+ *      - Reads sensors once the GNSS epoch is received;
+ *      - Keeps the sample in RAM, writes samples every LOG_FLUSH_SAMPLES
+ *        (segmentation, new day);
+ *      - Dumps log file to Serial (if FILE_DUMP);
+ *      - Puts the GNSS receiver in backup and sleeps.
  *    Else :
- *      - Closes log file if open;
+ *      - Writes samples kept and closes log file if open;
  *      - Prints "Logging disabled...".
  *    Reads button to update enLog.
  */
@@ -309,39 +357,47 @@ void loop() {
     digitalWrite(LOG_LED, LOW);
     
     SERIAL_DBG("### LOG FILE\n\n")
-    if (logFile) {
+    if (logSeg.file()) {
       SERIAL_DBG("File : ")
-      SERIAL_DBG(logDir)
-      SERIAL_DBG("/")
-      SERIAL_DBG(logFileName)
+      SERIAL_DBG(logSeg.path())
       SERIAL_DBG('\n')
     }
     else
       SERIAL_DBG("No log file open.\n")
       SERIAL_DBG("\n###\n")
 
-    /* Read sensors */
-    gnssRefresh(gps, connectedDevices[DP0601]);
-    readSensors(time_ms, lng_deg, lat_deg, alt_cm, extTemp_C, dist_mm);
+    /* Wake up */
+    // Receiver back from backup (already awake if woken by its own timer)
+    if (gnssBackupMode)
+      gnssWake(GNSS_SERIAL);
+    // DS18B20 conversion runs while waiting for the GNSS epoch
+    sensors.requestTemperatures();
+    uint32_t conversionStart_ms = millis();
 
-    /* Handling log file management */
-    handleLogFile(logFile, logDir, logFileName, gps, logSegCountdown, connectedDevices[SD_CARD]);
+    /* Read sensors */
+    gnssRefresh(gps, connectedDevices[DP0601], GNSS_FIX_TIMEOUT);
+    readSensors(time_ms, lng_deg, lat_deg, alt_cm, extTemp_C, dist_mm, conversionStart_ms);
 
-    /* Logging into file */
-    if ( !logToSD(logFile, time_ms, lng_deg, lat_deg, alt_cm, dist_mm, extTemp_C) )
+    /* Logging into RAM, written to file every LOG_FLUSH_SAMPLES */
+    if ( !addLogLine(time_ms, lng_deg, lat_deg, alt_cm, dist_mm, extTemp_C) )
       SERIAL_DBG("Logging failed...\n") 
         
     /* Dumping log file to Serial */
     if (FILE_DUMP)
-      dumpFileToSerial(logFile);
+      dumpFileToSerial(logSeg.file());
 
     /* Going to sleep */
-    delay(50);
+    // Receiver wakes by itself LE_GNSS_LEAD_MS before the next sample
+    if (gnssBackupMode)
+      gnssBackup(GNSS_SERIAL, READ_INTERVAL_MS - LE_GNSS_LEAD_MS);
+    // UART stopped in deep sleep: command sent first
+    GNSS_SERIAL.flush();
     Snooze.deepSleep(config);
   }
   else  {
-    if (logFile)
-        logFile.close();
+    if (!flushLogBatch())
+      SERIAL_DBG("Logging failed...\n")
+    logSeg.close();
     SERIAL_DBG("Logging disabled...\n")
     /* LED blink if logging disabled */
     digitalWrite(LOG_LED, !digitalRead(LOG_LED));
@@ -356,104 +412,99 @@ void loop() {
  */
 /* ##############   TIMER INTERRUPT    ################ */
 /*
- * @brief: Reads sensor values
- * @exec time : long and depends on DS18B20 resolution config
+ * @brief:
+ *    Reads sensor values, GNSS values received by gnssRefresh().
+ * @params:
+ *    conversionStart_ms: Start of the DS18B20 conversion, waited for if not complete.
+ * @exec time : URM14 Modbus exchanges and the end of the DS18B20 conversion
  */
-void readSensors(uint32_t& gnssTime, double& gnssLng, double& gnssLat, int32_t& gnssAlt, float& extTemp, uint16_t& dist)  {
-  // Interrupt duration
-  //long t = millis();
+void readSensors(uint32_t& gnssTime, GnssCoord& gnssLng, GnssCoord& gnssLat, int32_t& gnssAlt, float& extTemp, uint16_t& dist, uint32_t conversionStart_ms)  {
   
   // Modbus communication errors
   uint8_t mbError;
-  
-  // If logging enabled and logFile open
-  if (enLog && logFile) {
-    // If buffer not full
-
-    // Interrupt safe GNSS data push into buffers
-    //if (gps.time.isUpdated() && gps.location.isUpdated() && gps.altitude.isUpdated()) {
-      gnssTime = gps.time.value();
-      gnssLng = gps.location.lng();
-      gnssLat = gps.location.lat();
-      gnssAlt = gps.altitude.value();
-      connectedDevices[DP0601] = true;
-    /*}
-     * TODO : fix gnssRefresh() ->  isUpdated() forced to false
-    else {
-      gnssTime = NO_GNSS_TIME;
-      gnssLng = NO_GNSS_LOCATION;
-      gnssLat = NO_GNSS_LOCATION;
-      gnssAlt = NO_GNSS_ALTITUDE;
-      connectedDevices[DP0601] = false;
-    }*/
- 
-// DS18B20 convertion takes time (depends on sensor resolution config)
-    // Read DS18B20 temperature
-    sensors.requestTemperatures();
-    extTemp = sensors.getTempC(ds18b20_addr);
-    // Check for OneWire errors
-    if (extTemp == DEVICE_DISCONNECTED_C) {
-      SERIAL_DBG("OneWire : DS18B20 disconnected...")
-      connectedDevices[DS18B20] = false;
-    }
-    else
-      connectedDevices[DS18B20] = true;
-// -------------
-
-    // External compensation : Updade external URM14 temperature register
-    if (!TEMP_CPT_ENABLE_BIT && TEMP_CPT_SEL_BIT)  {
-      mbError = urm14.writeSingleRegister(URM14_EXT_TEMP_REG, (uint16_t)(extTemp * 10.0));
-      // Check for Modbus errors
-      if (mbError != ModbusMaster::ku8MBSuccess)  {
-        dist = URM14_DISCONNECTED;
-        connectedDevices[URM14] = false;
-      }
-      else
-        connectedDevices[URM14] = true;
-      }
-
-      // Trigger mode : Set trigger bit to request one measurement
-    if (MEASURE_MODE_BIT) {
-      mbError = urm14.writeSingleRegister(URM14_CONTROL_REG, urm14_controlBits); //Writes the setting value to the control register
-      if (mbError != ModbusMaster::ku8MBSuccess)  {
-        dist = URM14_DISCONNECTED;
-        connectedDevices[URM14] = false;
-      }
-      else
-        connectedDevices[URM14] = true;
-    }
-    // Readng distance input register at 0x05
-    // Should use readInputRegisters() but somehow doesn't work
-    // Trhow ku8MBIllegalDataAddress error (0x02)
-    // ToDo : understand error (might be manufacturer who did not follow Modbus standard)
-    mbError = urm14.readHoldingRegisters(URM14_DISTANCE_REG, 1);
+
+  // GNSS values of the epoch, missing ones not logged
+  gnssTime = gps.time.isUpdated() ? gps.time.value() : NO_GNSS_TIME;
+  if (gps.location.isUpdated())  {
+    gnssLng = GnssCoord::fromRaw(gps.location.rawLng());
+    gnssLat = GnssCoord::fromRaw(gps.location.rawLat());
+  }
+  else  {
+    gnssLng = GnssCoord::none();
+    gnssLat = GnssCoord::none();
+  }
+  gnssAlt = gps.altitude.isUpdated() ? gps.altitude.value() : NO_GNSS_ALTITUDE;
+
+  // Read DS18B20 temperature once converted (started at wake up)
+  while (millis() - conversionStart_ms < (uint32_t)sensors.millisToWaitForConversion(11));
+  extTemp = sensors.getTempC(ds18b20_addr);
+  // Check for OneWire errors
+  if (extTemp == DEVICE_DISCONNECTED_C) {
+    SERIAL_DBG("OneWire : DS18B20 disconnected...")
+    connectedDevices[DS18B20] = false;
+  }
+  else
+    connectedDevices[DS18B20] = true;
+
+  // External compensation : Updade external URM14 temperature register
+  if (!TEMP_CPT_ENABLE_BIT && TEMP_CPT_SEL_BIT)  {
+    mbError = urm14.writeSingleRegister(URM14_EXT_TEMP_REG, (uint16_t)(extTemp * 10.0));
     // Check for Modbus errors
     if (mbError != ModbusMaster::ku8MBSuccess)  {
       dist = URM14_DISCONNECTED;
       connectedDevices[URM14] = false;
     }
-    else  {
-      dist = urm14.getResponseBuffer(0);
+    else
       connectedDevices[URM14] = true;
+  }
+
+  // Trigger mode : Set trigger bit to request one measurement
+  if (MEASURE_MODE_BIT) {
+    mbError = urm14.writeSingleRegister(URM14_CONTROL_REG, urm14_controlBits); //Writes the setting value to the control register
+    if (mbError != ModbusMaster::ku8MBSuccess)  {
+      dist = URM14_DISCONNECTED;
+      connectedDevices[URM14] = false;
     }
+    else
+      connectedDevices[URM14] = true;
+  }
+  // Readng distance input register at 0x05
+  // Should use readInputRegisters() but somehow doesn't work
+  // Trhow ku8MBIllegalDataAddress error (0x02)
+  // ToDo : understand error (might be manufacturer who did not follow Modbus standard)
+  mbError = urm14.readHoldingRegisters(URM14_DISTANCE_REG, 1);
+  // Check for Modbus errors
+  if (mbError != ModbusMaster::ku8MBSuccess)  {
+    dist = URM14_DISCONNECTED;
+    connectedDevices[URM14] = false;
+  }
+  else  {
+    dist = urm14.getResponseBuffer(0);
+    connectedDevices[URM14] = true;
   }
-    //Serial.println(millis() - t);
 }
 
 /* ##############   GNSS    ################ */
 
-void gnssRefresh(TinyGPSPlus& gps, bool& deviceConnected) {
+/*
+ * @brief:
+ *    Reads NMEA sentences until time, date, location and altitude of a new
+ *    epoch are received.
+ * @params:
+ *    timeout_ms: Time to wait for the epoch (hot start after backup).
+ */
+void gnssRefresh(TinyGPSPlus& gps, bool& deviceConnected, uint32_t timeout_ms) {
 
-  uint8_t watchdog = millis();
-  GNSS_SERIAL.flush();
+  uint32_t watchdog = millis();
+  // Bytes received before sleeping are stale
+  while (GNSS_SERIAL.available())
+    GNSS_SERIAL.read();
   while (!gps.time.isUpdated() || !gps.date.isUpdated() || !gps.location.isUpdated() || !gps.altitude.isUpdated())  {
     // If could not update gnsss data in a while    
-    if (millis() - watchdog > 700) {
+    if (millis() - watchdog > timeout_ms) {
       deviceConnected = false;
       return;
     }
-    // Wait for NMEA data
-    while(!GNSS_SERIAL.available());
     // Read data
     while (GNSS_SERIAL.available())
        gps.encode(GNSS_SERIAL.read());
@@ -474,7 +525,7 @@ void setupGNSS(TinyGPSPlus& gps, bool& deviceConnected) {
   
   SERIAL_DBG("Acquiring GNSS date and time...\n")
   while (gps.date.value() == 0 || gps.time.value() == 0)
-    gnssRefresh(gps, deviceConnected);
+    gnssRefresh(gps, deviceConnected, GNSS_FIX_TIMEOUT);
   SERIAL_DBG("Done.\n")
 }
 
@@ -492,262 +543,110 @@ void setupSDCard( volatile bool& deviceConnected)  {
   }
   else
     SERIAL_DBG("Done.\n")
+  logSeg.begin();
   deviceConnected = true;
 }
 
 /* ##############   FILE MANAGEMENT    ################ */
 /*
- * @brief:
- *    convert and write TinyGPSDate date obj into a string.      
- * @params:
- *    gnssDate : TinyGPSDate obj to convert and write
- *    str : String to write date into
- */
-void date_to_str(TinyGPSDate& gnssDate, String& str) {
-  
-  str = "";
-  str.concat(gnssDate.year());
-  str.concat('_');
-  str.concat(gnssDate.month());
-  str.concat('_');
-  str.concat(gnssDate.day());
-}
-  
-/*
- * @brief:
- *    convert and write TinyGPSTime time obj into a string.      
- * @params:
- *    gnssTime : TinyGPSTime obj to convert and write
- *    str : String to write time into
- */
-void time_to_str(TinyGPSTime& gnssTime, String& str) {
-
-  str = "";
-  str.concat(gnssTime.hour());
-  str.concat('_');
-  str.concat(gnssTime.minute());
-  str.concat('_');
-  str.concat(gnssTime.second());
-}
-
-/*
- * @brief:
- *    convert and write time value from TinyGPSPlus obj into a string.    
+ * @brief: writes a sample as a CSV log line
  * @params:
- *    timeVal : time value to convert and write
- *    str : String to write time into
- */
-void timeValToStr(const uint32_t& timeVal, String& str) {
-
-  uint32_t tmp = timeVal;
-
-  str = "";
-  str.concat(tmp/1000000);
-  str.concat(':');
-  tmp %= 1000000;
-  str.concat(tmp/10000);
-  str.concat(':');
-  tmp %= 10000;
-  str.concat(tmp/100);
-  str.concat('.');
-  tmp %= 100;
-  str.concat(tmp);
-}
-
-/*
- * @brief: create new log dir 'dirName' if it does not already exist
- * @params:
- *    dirName : new dir name
- */
-void new_logDir(String& dirName)  {
-
-  if (SD.exists(dirName.c_str()))  {
-    SERIAL_DBG("Dir '")
-    SERIAL_DBG(dirName)
-    SERIAL_DBG("' already exists...\n")
-  }
-  else  {
-    if (!SD.mkdir(dirName.c_str()))  {
-      SERIAL_DBG("Could not create dir '")
-      SERIAL_DBG(dirName)
-      SERIAL_DBG("'...\n")
-    }
-  }
-}
-
-/*
- * @brief: create and open a new log file 'dirName/fileName' if it does not already exist
- * @params:
- *    file: File object
- *    dirName: directory name in which file will be created
- *    fileName : new file name
- */
-bool new_logFile(File& file, const String& dirName, String& fileName)  {
-
-  String file_path = "";
-
-  file_path.concat(dirName);
-  file_path.concat('/');
-  file_path.concat(fileName);
-
-  if (SD.exists(file_path.c_str()))  {
-    SERIAL_DBG("File '")
-    SERIAL_DBG(file_path)
-    SERIAL_DBG("' already exists...\n")
-    return false;
-  }
-
-  file = SD.open(file_path.c_str(), FILE_WRITE);
-  if (!file)  {
-    SERIAL_DBG("Could not create new log file...\n")
-    return false;
-  }
-  file.print("Date:,"); file.println(dirName);
-  file.println("Time (HH:MM:SS.CC),Longitude (°),Latitude (°),Altitude (cm),Distance (mm),External temperature (°C)");
-  return true;
-}
-
-/*
- * @brief: handle log file segmentation and dir/file creation every day
- * @params:
- *    File : log file object
- *    dirName : log dir name
- *    fileName : log file name
- *    gps : TinyGPSPlus obj to get current date from
- *    logSegCountdown : timer for log segmentation
- */
-void handleLogFile(File& file, String& dirName, String& fileName, TinyGPSPlus& gps, Metro& logSegCountdown, volatile bool& SDConnected)  {
-
-  SERIAL_DBG("---> handleLogFile()\n")
-
-  if (SD.mediaPresent()) {
-    String currDate;
-    date_to_str(gps.date, currDate);
-  
-    if ( !file || dirName != currDate)  {
-      file.close();
-      dirName = currDate;
-      time_to_str(gps.time, fileName);
-      fileName.concat(".csv");
-      logSegCountdown.reset();
-    }
-    // Create new log segment
-    else if (logSegCountdown.check()) {
-      file.close();
-      time_to_str(gps.time, fileName);
-      fileName.concat(".csv");
-      logSegCountdown.reset();
-    }
-    SERIAL_DBG("Creating new log dir '")
-    SERIAL_DBG(dirName)
-    SERIAL_DBG("'...\n")
-    new_logDir(dirName);
-  
-    SERIAL_DBG("Done.\n")
-    SERIAL_DBG("Creating and opening new log file '")
-    SERIAL_DBG(dirName)
-    SERIAL_DBG('/')
-    SERIAL_DBG(fileName)
-    SERIAL_DBG('\n')
-    if (new_logFile(file, dirName, fileName))  {
-      logSegCountdown.reset();
-      SERIAL_DBG("Done.\n")
-    }
-    SDConnected = true;
-  }
-  else  {
-    SERIAL_DBG("No SD card detected...\n")
-    SDConnected = false;
-    file.close();
-  }
-}
-
-/*
- * @brief: generates a string to log into SD card
- * @params:
- *    log_str : string to store the log
- *    timeVal : time value to log
+ *    line : buffer of LOG_LINE_MAX bytes
+ *    timeVal : time value to log (HHMMSSCC)
  *    lng_deg : Longitude in ° to log
  *    lat_deg : Latitude in ° to log
- *    alt_cm : Longitude in cm to log
- *    dist_mm : distance in mm to log
+ *    alt_cm : Altitude in cm to log
+ *    dist_mm : distance in 0.1 mm to log (written in mm)
  *    temp_C : temperature in °C to log
+ * @return: line length
  */
-void csv_log_string(String& log_str, const uint32_t& timeVal, const double& lng_deg, const double& lat_deg, const int32_t& alt_cm, const uint16_t& dist_mm, const float& temp_C)  {
+size_t csvLogLine(char* line, const uint32_t& timeVal, const GnssCoord& lng_deg, const GnssCoord& lat_deg, const int32_t& alt_cm, const uint16_t& dist_mm, const float& temp_C)  {
 
-  SERIAL_DBG("\n---> csv_log_string()\n") 
-  
-  // Inserting GNSS time into log string
+  char* p = line;
+  // Inserting GNSS time into log line
   if (timeVal != NO_GNSS_TIME)
-    timeValToStr(timeVal, log_str);
-  else  {
-    SERIAL_DBG("No GNSS time response...\n")
-    log_str.concat("Nan");
-  }
-  log_str.concat(',');
-  // Inserting GNSS longitude into log string
-  if (lng_deg != NO_GNSS_LOCATION)
-    log_str.concat(lng_deg);
-  else  {
-    SERIAL_DBG("No GNSS location response, check wiring...\n")
-    log_str.concat("Nan");
-  }
-  log_str.concat(',');
-  // Inserting GNSS latitude into log string
-  if (lat_deg != NO_GNSS_LOCATION)
-    log_str.concat(lat_deg);
-  else  {
-    SERIAL_DBG("No GNSS location response, check wiring...\n")
-    log_str.concat("Nan");
-  }
-  log_str.concat(',');
-  // Inserting GNSS altitude into log string
-  if (alt_cm != NO_GNSS_ALTITUDE)
-    log_str.concat(alt_cm);
-  else  {
-    SERIAL_DBG("No GNSS location response, check wiring...\n")
-    log_str.concat("Nan");
-  }
-  log_str.concat(',');
-  // Inserting distance into log string
-  if (dist_mm != URM14_DISCONNECTED)
-    log_str.concat(dist_mm/10.0);
-  else  {
-    SERIAL_DBG("No URM14 response, check wiring...\n")
-    log_str.concat("Nan");
-  }
-  log_str.concat(',');
-  // Inserting external temperature into log string
-  if (extTemp_C != DEVICE_DISCONNECTED_C)
-    log_str.concat(extTemp_C);
-  else  {
-    SERIAL_DBG("No DS18B20 response, check wiring...\n")
-    log_str.concat("Nan");
+    p += sprintf(p, "%02lu:%02lu:%02lu.%02lu", timeVal / 1000000, (timeVal / 10000) % 100, (timeVal / 100) % 100, timeVal % 100);
+  else
+    p += sprintf(p, "NaN");
+  *p++ = ',';
+  // Inserting GNSS longitude and latitude into log line
+  p += lng_deg.isValid() ? lng_deg.format(p) : sprintf(p, "NaN");
+  *p++ = ',';
+  p += lat_deg.isValid() ? lat_deg.format(p) : sprintf(p, "NaN");
+  *p++ = ',';
+  // Inserting GNSS altitude into log line
+  p += (alt_cm != NO_GNSS_ALTITUDE) ? sprintf(p, "%ld", alt_cm) : sprintf(p, "NaN");
+  *p++ = ',';
+  // Inserting distance into log line
+  p += (dist_mm != URM14_DISCONNECTED) ? sprintf(p, "%u.%u", dist_mm / 10, dist_mm % 10) : sprintf(p, "NaN");
+  *p++ = ',';
+  // Inserting external temperature into log line
+  if (temp_C != DEVICE_DISCONNECTED_C)  {
+    dtostrf(temp_C, 0, 2, p);
+    p += strlen(p);
   }
+  else
+    p += sprintf(p, "NaN");
+  *p = '\0';
+  return p - line;
 }
 
 /*
- * @brief: logs a log string into a file
+ * @brief: keeps a sample in RAM, writes the samples kept every LOG_FLUSH_SAMPLES,
+ *         on date change and when RAM is full
  * @params:
- *    fileName: log file name
- *    timeVal : time value to log
+ *    timeVal : time value to log (HHMMSSCC)
  *    lng_deg : Longitude in ° to log
  *    lat_deg : Latitude in ° to log
- *    alt_cm : Longitude in cm to log
- *    dist_mm : distance in mm to log
+ *    alt_cm : Altitude in cm to log
+ *    dist_mm : distance in 0.1 mm to log
  *    temp_C : temperature in °C to log
+ * @return: false if samples could not be written
  */
-bool logToSD(File& file, const uint32_t& timeVal, const double& lng_deg, const double& lat_deg, const int32_t& alt_cm, const uint16_t& dist_mm, const float& temp_C) {
-
-  String log_str;
-  csv_log_string(log_str, timeVal, lng_deg, lat_deg, alt_cm, dist_mm, temp_C);
-  // Check if log file is open
-  if (!file)
-    return false;
-  // Log into log file
-  file.println(log_str);
+bool addLogLine(const uint32_t& timeVal, const GnssCoord& lng_deg, const GnssCoord& lat_deg, const int32_t& alt_cm, const uint16_t& dist_mm, const float& temp_C) {
+
+  bool written = true;
+  char line[LOG_LINE_MAX];
+  size_t len = csvLogLine(line, timeVal, lng_deg, lat_deg, alt_cm, dist_mm, temp_C);
+  uint32_t date = gps.date.value();
+
+  // Samples kept belong to one log segment day
+  if (logBatchLines && (date != logBatchDate || logBatchLen + len + 2 > LOG_BATCH_SIZE))
+    written = flushLogBatch();
+  if (logBatchLines == 0)  {
+    logBatchDate = date;
+    logBatchSeconds = (timeVal != NO_GNSS_TIME) ? timeVal / 1000000 * 3600 + (timeVal / 10000) % 100 * 60 + (timeVal / 100) % 100 : 0;
+  }
+  memcpy(logBatch + logBatchLen, line, len);
+  logBatchLen += len;
+  logBatch[logBatchLen++] = '\r';
+  logBatch[logBatchLen++] = '\n';
+  logBatchLines++;
+
+  if (logBatchLines >= LOG_FLUSH_SAMPLES)
+    written = flushLogBatch() && written;
+  return written;
+}
 
-  return true;
+/*
+ * @brief: writes the samples kept into the log segment of their day (one SD
+ *         card access for LOG_FLUSH_SAMPLES samples)
+ * @return: false if no log file could be open, samples are dropped
+ */
+bool flushLogBatch()  {
+
+  if (logBatchLines == 0)
+    return true;
+  SERIAL_DBG("---> flushLogBatch()\n")
+  bool written = logSeg.update(logBatchDate, logBatchSeconds);
+  connectedDevices[SD_CARD] = logSeg.cardPresent();
+  if (written)  {
+    written = logSeg.file().write(logBatch, logBatchLen) == logBatchLen;
+    logSeg.file().flush();
+  }
+  logBatchLen = 0;
+  logBatchLines = 0;
+  return written;
 }
 
 /*
@@ -5,13 +5,16 @@
  * @brief:
  *    This module is loaded to handle A01NYUB sensor setup and 
  *    distance acquisition.
+ *    Driver type A01NYUB for Sensor_set.h ("a01"), single sensor API
+ *    (setupDistSensor(), readDistance(), pollDistance()) unless SENSOR_SET
+ *    is defined.
  */
 /*
  ****************
  *  LIBRARIES   *
  ****************
  */
-// None required
+#include "Sensor_set.h"
 
 /*
  **************************
@@ -19,9 +22,9 @@
  **************************
  */
 // A01NYUB read value when sensor disconnected
-#define DIST_NO_VALUE  -257/10.0
+#define A01NYUB_NO_VALUE  -257/10.0
 // A01YUB response time
-#define RESP_TIME   150/*ms*/
+#define A01NYUB_RESP_TIME 150/*ms*/
 
 /*
  *********************
@@ -34,20 +37,55 @@
 #define A01NYUB_BAUDRATE 9600
 // Sensor TX pin
 #define A01NYUB_TX_PIN  9
+// Sampling (Sensor_scheduler.h)
+// Frames sent by the sensor every A01NYUB_MIN_PERIOD (RX pin low: processed value)
+#define A01NYUB_MIN_PERIOD  100/*ms*/
+#define A01NYUB_PERIOD      100/*ms*/
+// No frame received for A01NYUB_TIMEOUT: sensor disconnected
+#define A01NYUB_TIMEOUT     500/*ms*/
+// Values emitted (Sensor_set.h)
+#define A01NYUB_DECIMALS    1
+
+#ifndef SENSOR_SET
+#define DIST_NO_VALUE     A01NYUB_NO_VALUE
+#define DIST_MIN_PERIOD   A01NYUB_MIN_PERIOD
+#define DIST_PERIOD       A01NYUB_PERIOD
+#define DIST_TIMEOUT      A01NYUB_TIMEOUT
+#endif
 
 /*
  ***********************
  *   GLOBAL VARIBLES   *
  ***********************
  */
+// Last frame bytes (0xFF, high, low, checksum)
+uint8_t a01nyubFrame[4];
+uint8_t a01nyubFrameLen = 0;
+// Last valid frame time
+uint32_t a01nyubFrame_ms = 0;
 
 /*
  ***************************
  *   FUNCTION PROTOTYPES   *
  ***************************
  */
+// Sensor_set.h driver
+struct A01NYUB {
+  static constexpr SensorDesc desc = {"a01", "A01NYUB distance (mm)", A01NYUB_PERIOD, A01NYUB_MIN_PERIOD, 0,
+                                      A01NYUB_NO_VALUE, A01NYUB_DECIMALS};
+  static void setup(volatile bool& deviceConnected);
+  static void start()  {}
+  static bool read(float& dist_mm, volatile bool& deviceConnected)  { return poll(dist_mm, deviceConnected, NULL); }
+  static float readBlocking(volatile bool& deviceConnected);
+  static bool poll(float& dist_mm, volatile bool& deviceConnected, void (*onFrame)(float));
+};
+constexpr SensorDesc A01NYUB::desc;
+#ifndef SENSOR_SET
+// Single sensor API
 void setupDistSensor(volatile bool& deviceConnected);
 float readDistance(const float& extTemp_C, volatile bool& deviceConnected);
+bool pollDistance(float& dist_mm, volatile bool& deviceConnected, void (*onFrame)(float) = NULL);
+#endif
 /*
  ****************************
  *   FUNCTION DEFINITIONS   *
@@ -59,12 +97,12 @@ float readDistance(const float& extTemp_C, volatile bool& deviceConnected);
  * @params:
  *    deviceConnected: Bool to store if A01NYUB is connected or not.
  */
-void setupDistSensor(volatile bool& deviceConnected)  {
+void A01NYUB::setup(volatile bool& deviceConnected)  {
 
   A01NYUB_SERIAL.begin(A01NYUB_BAUDRATE);
   digitalWrite(A01NYUB_TX_PIN, LOW);
 
-  readDistance(25, deviceConnected);
+  readBlocking(deviceConnected);
 
   if (!deviceConnected)
     waitForReboot("No A01NYUB distance sensor detected, check wiring...");
@@ -72,16 +110,14 @@ void setupDistSensor(volatile bool& deviceConnected)  {
 
 /*
  * @brief: 
- *    returns distance read in URM14 sensor.
+ *    returns distance read in A01NYUB sensor, waiting A01NYUB_RESP_TIME.
  * @params:
- *    deviceConnected: bool to store if URM14 is connected or not.
- * @retrun:
- *    extTemp_C: temperature to use for compensation.
+ *    deviceConnected: bool to store if A01NYUB is connected or not.
  */
-float readDistance(const float& extTemp_C, volatile bool& deviceConnected)   {
+float A01NYUB::readBlocking(volatile bool& deviceConnected)   {
 
     A01NYUB_SERIAL.clear();
-    delay(RESP_TIME);   
+    delay(A01NYUB_RESP_TIME);   
 
     if(A01NYUB_SERIAL.read() == 0xFF)   {
         deviceConnected = true;
@@ -89,5 +125,61 @@ float readDistance(const float& extTemp_C, volatile bool& deviceConnected)   {
     }
     else
         deviceConnected = false;
-    return DIST_NO_VALUE;   
-}
\ No newline at end of file
+    return A01NYUB_NO_VALUE;   
+}
+
+/*
+ * @brief: 
+ *    Reads the frames received since the last call, without waiting.
+ * @params:
+ *    dist_mm: Distance of the last valid frame, A01NYUB_NO_VALUE if none
+ *             received for A01NYUB_TIMEOUT.
+ *    deviceConnected: bool to store if A01NYUB is connected or not.
+ *    onFrame: Called for every frame (NAN if its checksum is wrong), the
+ *             frames are the sensor samples at its own rate.
+ * @retrun:
+ *    True if dist_mm was updated.
+ */
+bool A01NYUB::poll(float& dist_mm, volatile bool& deviceConnected, void (*onFrame)(float))  {
+
+  bool updated = false;
+  while (A01NYUB_SERIAL.available())  {
+    uint8_t c = A01NYUB_SERIAL.read();
+    // Frames start on 0xFF
+    if (a01nyubFrameLen == 0 && c != 0xFF)
+      continue;
+    a01nyubFrame[a01nyubFrameLen++] = c;
+    if (a01nyubFrameLen < 4)
+      continue;
+    a01nyubFrameLen = 0;
+    if (((a01nyubFrame[0] + a01nyubFrame[1] + a01nyubFrame[2]) & 0xFF) != a01nyubFrame[3])  {
+      if (onFrame)
+        onFrame(NAN);
+      continue;
+    }
+    dist_mm = a01nyubFrame[1] * 256 + a01nyubFrame[2];
+    if (onFrame)
+      onFrame(dist_mm);
+    a01nyubFrame_ms = millis();
+    updated = true;
+  }
+  if (updated)
+    deviceConnected = true;
+  else if (millis() - a01nyubFrame_ms > A01NYUB_TIMEOUT && deviceConnected)  {
+    dist_mm = A01NYUB_NO_VALUE;
+    deviceConnected = false;
+    updated = true;
+  }
+  return updated;
+}
+
+#ifndef SENSOR_SET
+/*
+ * @brief: 
+ *    Single sensor API, see A01NYUB::setup(), A01NYUB::readBlocking() and
+ *    A01NYUB::poll().
+ */
+void setupDistSensor(volatile bool& deviceConnected)  {  A01NYUB::setup(deviceConnected); }
+float readDistance(const float& extTemp_C, volatile bool& deviceConnected)  {  return A01NYUB::readBlocking(deviceConnected); }
+bool pollDistance(float& dist_mm, volatile bool& deviceConnected, void (*onFrame)(float))  {  return A01NYUB::poll(dist_mm, deviceConnected, onFrame); }
+#endif
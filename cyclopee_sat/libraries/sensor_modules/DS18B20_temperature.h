@@ -5,6 +5,7 @@
  * @brief:
  *    This module is loaded to handle DS18B20 sensor setup and 
  *    temperature acquisition.
+ *    Driver type DS18B20 for Sensor_set.h ("temp").
  */
 /*
  *****************
@@ -13,6 +14,7 @@
  */
 #include <OneWire.h>
 #include <DallasTemperature.h>
+#include "Sensor_set.h"
 
 /*
  **************************
@@ -33,6 +35,15 @@
 #define DS18B20_RES   11/*bits*/
 // Teensy temperature data wire pin
 #define TEMPERATURE_PIN  24
+// Sampling (Sensor_scheduler.h)
+// Temperature changes slowly, sampled every TEMP_PERIOD
+#define TEMP_PERIOD       10000/*ms*/
+// Conversion time at DS18B20_RES (750ms at 12 bits)
+#define TEMP_LATENCY      (750 >> (12 - DS18B20_RES))/*ms*/
+// One conversion in flight: period above the conversion time
+#define TEMP_MIN_PERIOD   (2 * TEMP_LATENCY)/*ms*/
+// Values emitted (Sensor_set.h)
+#define DS18B20_DECIMALS 3
 
 /*
  ***********************
@@ -53,6 +64,17 @@ byte ds18b20_addr[8];
  */
 void setupTempSensor(volatile bool& deviceConnected);
 float readTemperature(volatile bool& deviceConnected);
+void startTempConversion();
+float readTempConversion(volatile bool& deviceConnected);
+// Sensor_set.h driver, conversion started TEMP_LATENCY before the read
+struct DS18B20 {
+  static constexpr SensorDesc desc = {"temp", "External temperature (°C)", TEMP_PERIOD, TEMP_MIN_PERIOD, TEMP_LATENCY,
+                                      TEMP_NO_VALUE, DS18B20_DECIMALS};
+  static void setup(volatile bool& deviceConnected)  {  setupTempSensor(deviceConnected); }
+  static void start()  {  startTempConversion(); }
+  static bool read(float& temp_C, volatile bool& deviceConnected)  {  temp_C = readTempConversion(deviceConnected); return true; }
+};
+constexpr SensorDesc DS18B20::desc;
 /*
  ****************************
  *   FUNCTION DEFINITIONS   *
@@ -105,4 +127,39 @@ float readTemperature(volatile bool& deviceConnected)	{
     deviceConnected = true;
 
 	return temp_C;
-}
\ No newline at end of file
+}
+
+/*
+ * @brief: 
+ *    Starts a temperature conversion without waiting for it.
+ *    Read it TEMP_LATENCY later with readTempConversion().
+ */
+void startTempConversion()  {
+
+  sensors.setWaitForConversion(false);
+  sensors.requestTemperaturesByAddress(ds18b20_addr);
+  // readTemperature() still waits
+  sensors.setWaitForConversion(true);
+}
+
+/*
+ * @brief: 
+ *    returns temperature converted since startTempConversion().
+ * @params:
+ *    deviceConnected: bool to store if DS18B20 is connected or not.
+ * @retrun:
+ *    temp_C: read temperature.
+ */
+float readTempConversion(volatile bool& deviceConnected)  {
+
+  float temp_C = sensors.getTempC(ds18b20_addr);
+  // Check for OneWire errors
+  if (temp_C == DEVICE_DISCONNECTED_C) {
+    SERIAL_DBG("DS18B20 disconnected...")
+    deviceConnected = false;
+  }
+  else
+    deviceConnected = true;
+
+  return temp_C;
+}
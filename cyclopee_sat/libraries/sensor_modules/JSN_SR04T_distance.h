@@ -5,13 +5,17 @@
  * @brief:
  *    This module is loaded to handle URN14 sensor setup and 
  *    distance acquisition.
+ *    Driver type JSN_SR04T for Sensor_set.h ("dist"), single sensor API
+ *    (setupDistSensor(), readDistance()) unless SENSOR_SET is defined.
+ * @note:
+ *    A read waits for the echo (10ms at most).
  */
 /*
  ****************
  *  LIBRARIES   *
  ****************
  */
-// None
+#include "Sensor_set.h"
 
 /*
  **************************
@@ -19,7 +23,7 @@
  **************************
  */
 // JSN SR04T sensor disconnection value
-#define DIST_NO_VALUE  0
+#define JSN_SR04T_NO_VALUE  0
 
 /*
  *********************
@@ -27,8 +31,19 @@
  *********************
  */
 // Teensy pins
-#define TRIG_PIN 32
-#define ECHO_PIN 31
+#define JSN_SR04T_TRIG_PIN 32
+#define JSN_SR04T_ECHO_PIN 31
+// Sampling (Sensor_scheduler.h), echoes of the previous ping fade out
+#define JSN_SR04T_MIN_PERIOD  100/*ms*/
+#define JSN_SR04T_PERIOD      100/*ms*/
+// Values emitted (Sensor_set.h)
+#define JSN_SR04T_DECIMALS    1
+
+#ifndef SENSOR_SET
+#define DIST_NO_VALUE  JSN_SR04T_NO_VALUE
+#define TRIG_PIN       JSN_SR04T_TRIG_PIN
+#define ECHO_PIN       JSN_SR04T_ECHO_PIN
+#endif
 
 /*
  ***********************
@@ -41,8 +56,21 @@
  *   FUNCTION PROTOTYPES   *
  ***************************
  */
+// Sensor_set.h driver
+struct JSN_SR04T {
+  static constexpr SensorDesc desc = {"dist", "JSN SR04T distance (mm)", JSN_SR04T_PERIOD, JSN_SR04T_MIN_PERIOD, 0,
+                                      JSN_SR04T_NO_VALUE, JSN_SR04T_DECIMALS};
+  static void setup(volatile bool& deviceConnected);
+  static void start()  {}
+  static bool read(float& dist_mm, volatile bool& deviceConnected)  {  dist_mm = measure(deviceConnected); return true; }
+  static float measure(volatile bool& deviceConnected);
+};
+constexpr SensorDesc JSN_SR04T::desc;
+#ifndef SENSOR_SET
+// Single sensor API
 void setupDistSensor(volatile bool& deviceConnected);
 float readDistance(const float& extTemp_C, volatile bool& deviceConnected);
+#endif
 
 /*
  ****************************
@@ -56,12 +84,12 @@ float readDistance(const float& extTemp_C, volatile bool& deviceConnected);
  *    deviceConnected: bool to store if JSN SR04T is connected or not.
  */
 
-void setupDistSensor(volatile bool& deviceConnected) {
+void JSN_SR04T::setup(volatile bool& deviceConnected) {
 
-  pinMode(TRIG_PIN, OUTPUT);
-  pinMode(ECHO_PIN, INPUT);
+  pinMode(JSN_SR04T_TRIG_PIN, OUTPUT);
+  pinMode(JSN_SR04T_ECHO_PIN, INPUT);
  
-  if (readDistance(TEMP_NO_VALUE, deviceConnected) == DIST_NO_VALUE)
+  if (measure(deviceConnected) == JSN_SR04T_NO_VALUE)
     waitForReboot("Distance sensor JSN SR04T not responding.");
   else
     SERIAL_DBG("JSN SR04T sensor found.")
@@ -71,33 +99,41 @@ void setupDistSensor(volatile bool& deviceConnected) {
  * @brief: 
  *      returns distance computed from JSN SR04T sensor data.
  * @params:
- *      extTemp_C: temperature used for compensation.
  *      deviceConnected: bool to store if JSN SR04T is connected or not.
  * @retrun:
  *      dist: computed distance.
  */
-float readDistance(const float& extTemp_C, volatile bool& deviceConnected)  {
+float JSN_SR04T::measure(volatile bool& deviceConnected)  {
 
 
     unsigned long travelTime;
     float soundVelocity = 331.1 + 24.0*0.606;//( extTemp_C == TEMP_NO_VALUE ? 0 : (0.606 * extTemp_C) );
     float dist;
 
-    digitalWrite(TRIG_PIN, HIGH);   // Set trigger pin HIGH 
-    delayMicroseconds(20);          // Hold pin HIGH for 20 uSec
-    digitalWrite(TRIG_PIN, LOW);    // Return trigger pin back to LOW again.
+    digitalWrite(JSN_SR04T_TRIG_PIN, HIGH);   // Set trigger pin HIGH 
+    delayMicroseconds(20);                    // Hold pin HIGH for 20 uSec
+    digitalWrite(JSN_SR04T_TRIG_PIN, LOW);    // Return trigger pin back to LOW again.
   
     // Measure time in µs for echo to come back.
     // 10 000µs timeout
-    travelTime = pulseIn(ECHO_PIN, HIGH, 10000) / 2;
+    travelTime = pulseIn(JSN_SR04T_ECHO_PIN, HIGH, 10000) / 2;
     // Compute distance
     dist = (soundVelocity * 1000.0/*mm/m*/ / 1000000.0/*µs/s*/) * travelTime;
 
     // Update sensor connection state
-    if (dist == DIST_NO_VALUE)
+    if (dist == JSN_SR04T_NO_VALUE)
         deviceConnected = false;
     else
         deviceConnected = true;
     
     return dist;
 }
+
+#ifndef SENSOR_SET
+/*
+ * @brief: 
+ *    Single sensor API, see JSN_SR04T::setup() and JSN_SR04T::measure().
+ */
+void setupDistSensor(volatile bool& deviceConnected)  {  JSN_SR04T::setup(deviceConnected); }
+float readDistance(const float& extTemp_C, volatile bool& deviceConnected)  {  return JSN_SR04T::measure(deviceConnected); }
+#endif
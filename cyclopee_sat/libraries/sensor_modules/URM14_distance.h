@@ -5,6 +5,11 @@
  * @brief:
  *    This module is loaded to handle URN14 sensor setup and 
  *    distance acquisition.
+ *    Driver type URM14 for Sensor_set.h ("urm"), single sensor API
+ *    (setupDistSensor(), readDistance()) unless SENSOR_SET is defined.
+ * @note:
+ *    A read is a Modbus transaction (about 20ms at 9600 bauds, the
+ *    ModbusMaster timeout if the sensor does not answer).
  */
 /*
  ****************
@@ -12,6 +17,7 @@
  ****************
  */
 #include <ModbusMaster.h>
+#include "Sensor_set.h"
 
 /*
  **************************
@@ -19,7 +25,7 @@
  **************************
  */
 // URM14 read value when sensor disconnected
-#define DIST_NO_VALUE  UINT16_MAX / 10.0
+#define URM14_NO_VALUE  UINT16_MAX / 10.0
 
 /*
  *********************
@@ -43,7 +49,17 @@
 #define MEASURE_MODE_BIT      ((uint16_t)0x00 << 2) // Passive(1)/auto(0) measure mode
 #define MEASURE_TRIG_BIT      ((uint16_t)0x00 << 3) // Request mesure in passive mode. Unused in auto mode
 // Modbus DE & RE pins
-#define DE_PIN  30 // RE = ~DE => Wired to pin 30 as well
+#define URM14_DE_PIN  30 // RE = ~DE => Wired to pin 30 as well
+// Sampling (Sensor_scheduler.h), one Modbus read per period
+#define URM14_MIN_PERIOD  100/*ms*/
+#define URM14_PERIOD      100/*ms*/
+// Values emitted (Sensor_set.h)
+#define URM14_DECIMALS    1
+
+#ifndef SENSOR_SET
+#define DIST_NO_VALUE     URM14_NO_VALUE
+#define DE_PIN            URM14_DE_PIN
+#endif
 
 /*
  ***********************
@@ -60,10 +76,23 @@ uint16_t urm14_config_bits = MEASURE_TRIG_BIT | MEASURE_MODE_BIT | TEMP_CPT_ENAB
  *   FUNCTION PROTOTYPES   *
  ***************************
  */
-void preTransCbk()  {  digitalWrite(DE_PIN, HIGH); }
-void postTransCbk() {  digitalWrite(DE_PIN, LOW);  }
+// Sensor_set.h driver
+struct URM14 {
+  static constexpr SensorDesc desc = {"urm", "URM14 distance (mm)", URM14_PERIOD, URM14_MIN_PERIOD, 0,
+                                      URM14_NO_VALUE, URM14_DECIMALS};
+  static void setup(volatile bool& deviceConnected);
+  static void start()  {}
+  static bool read(float& dist_mm, volatile bool& deviceConnected)  {  dist_mm = measure(NAN, deviceConnected); return true; }
+  static float measure(float extTemp_C, volatile bool& deviceConnected);
+  static void preTransCbk()  {  digitalWrite(URM14_DE_PIN, HIGH); }
+  static void postTransCbk() {  digitalWrite(URM14_DE_PIN, LOW);  }
+};
+constexpr SensorDesc URM14::desc;
+#ifndef SENSOR_SET
+// Single sensor API
 void setupDistSensor(volatile bool& deviceConnected);
 float readDistance(const float& extTemp_C, volatile bool& deviceConnected);
+#endif
 /*
  ****************************
  *   FUNCTION DEFINITIONS   *
@@ -80,14 +109,14 @@ float readDistance(const float& extTemp_C, volatile bool& deviceConnected);
  *    postTransCbk: Callback called after modbus tansmission to set RS485 interface back in reception mode.
  *    deviceConnected: Bool to store if URM14 is connected or not.
  */
-void setupDistSensor(volatile bool& deviceConnected)  {
+void URM14::setup(volatile bool& deviceConnected)  {
 
   // Modbus communication errors
   uint8_t mbError;
 
   // RS485 DE pin setup
-  pinMode(DE_PIN, OUTPUT);
-  digitalWrite(DE_PIN, LOW);
+  pinMode(URM14_DE_PIN, OUTPUT);
+  digitalWrite(URM14_DE_PIN, LOW);
 
   // Set Modbus communication
   URM14_SERIAL.begin(URM14_BAUDRATE);
@@ -112,11 +141,10 @@ void setupDistSensor(volatile bool& deviceConnected)  {
  * @brief: 
  *    returns distance read in URM14 sensor.
  * @params:
+ *    extTemp_C: temperature to use for compensation, NAN if none.
  *    deviceConnected: bool to store if URM14 is connected or not.
- * @retrun:
- *    extTemp_C: temperature to use for compensation.
  */
-float readDistance(const float& extTemp_C, volatile bool& deviceConnected)   {
+float URM14::measure(float extTemp_C, volatile bool& deviceConnected)   {
 
     // Store Modbus communication errors
     uint8_t mbError;
@@ -124,11 +152,11 @@ float readDistance(const float& extTemp_C, volatile bool& deviceConnected)   {
     float dist;
 
     // External compensation: Updade external URM14 temperature register
-    if (!TEMP_CPT_ENABLE_BIT && TEMP_CPT_SEL_BIT && extTemp_C != TEMP_NO_VALUE)  {
+    if (!TEMP_CPT_ENABLE_BIT && TEMP_CPT_SEL_BIT && !isnan(extTemp_C))  {
         mbError = urm14.writeSingleRegister(URM14_EXT_TEMP_REG, (uint16_t)extTemp_C * 10.0);
         // Check for Modbus errors
         if (mbError != ModbusMaster::ku8MBSuccess)  {
-          dist = DIST_NO_VALUE;
+          dist = URM14_NO_VALUE;
           deviceConnected = false;
         }
         else
@@ -139,7 +167,7 @@ float readDistance(const float& extTemp_C, volatile bool& deviceConnected)   {
     if (MEASURE_MODE_BIT) {
         mbError = urm14.writeSingleRegister(URM14_CONTROL_REG, urm14_config_bits); //Writes the setting value to the control register
         if (mbError != ModbusMaster::ku8MBSuccess)  {
-            dist = DIST_NO_VALUE;
+            dist = URM14_NO_VALUE;
             deviceConnected = false;
         }
         else
@@ -153,7 +181,7 @@ float readDistance(const float& extTemp_C, volatile bool& deviceConnected)   {
     mbError = urm14.readHoldingRegisters(URM14_DISTANCE_REG, 1);
     // Check for Modbus errors
     if (mbError != ModbusMaster::ku8MBSuccess)  {
-        dist = DIST_NO_VALUE;
+        dist = URM14_NO_VALUE;
         deviceConnected = false;
     }
     else  {
@@ -161,4 +189,13 @@ float readDistance(const float& extTemp_C, volatile bool& deviceConnected)   {
         deviceConnected = true;
     }
     return dist;
-}
\ No newline at end of file
+}
+
+#ifndef SENSOR_SET
+/*
+ * @brief: 
+ *    Single sensor API, see URM14::setup() and URM14::measure().
+ */
+void setupDistSensor(volatile bool& deviceConnected)  {  URM14::setup(deviceConnected); }
+float readDistance(const float& extTemp_C, volatile bool& deviceConnected)  {  return URM14::measure(extTemp_C == TEMP_NO_VALUE ? NAN : extTemp_C, deviceConnected); }
+#endif
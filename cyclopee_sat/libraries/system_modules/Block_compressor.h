@@ -0,0 +1,381 @@
+/*
+ ****************************
+ * BLOCK COMPRESSOR MODULE  *
+ ****************************
+ * @brief:
+ *    This module is loaded to compress the log lines into blocks of one SD
+ *    card sector (LZB_BLOCK_SIZE bytes), each block decodable on its own:
+ *      - Lines are added whole: a line that does not fit ends the block.
+ *      - LZ77 coding of the block (LZ4 like sequences: literals, then a
+ *        copy of LZB_MIN_MATCH bytes or more from the lines already in the
+ *        block), matches found with a hash table of the block positions.
+ *      - Literals made of digits and separators only (the noisy part of
+ *        the numbers) are packed 2 per byte.
+ *      - Block header: "LB", lengths, segment id, sequence number and a
+ *        CRC-16: a block torn by a power loss is detected, a block left by
+ *        an older file in a preallocated segment is not taken.
+ *      - Segment header sector ("LJ", segment id, blocks written at the last
+ *        checkpoint), before the blocks of a segment: recovery only scans
+ *        the blocks after the checkpoint (Log_segment.h).
+ *    decodeLogBlock() is shared with the gateway importer (mpcimport), so
+ *    that both ends use the same format.
+ * @note:
+ *    No board specific code, no allocation: about 6.6 kB of RAM per
+ *    compressor (raw lines of the block, hash table, output sector).
+ *    Block format, little endian:
+ *      0  'L' 'B'
+ *      2  payload length (bytes after the header)
+ *      4  raw length (decoded bytes)
+ *      6  segment id
+ *      10 sequence number in the segment (from 0)
+ *      12 CRC-16/CCITT of bytes 0 to 11 and of the payload
+ *      14 payload, zero padding up to LZB_BLOCK_SIZE
+ *    Segment header: 'L' 'J', segment id, blocks (4 bytes), CRC-16 of
+ *    bytes 0 to 9, zero padding up to LZB_BLOCK_SIZE.
+ *    Payload sequence: token (packed flag << 7 | literal count << 4 |
+ *    match code), extra literal count bytes if count is 7, literals, then
+ *    if match code > 0: offset (2 bytes), extra match code bytes if code is
+ *    15. Match length is code + 3. Extra bytes are added until one is below
+ *    255. Packed literals: index in LZB_NIBBLES, high nibble first.
+ */
+#ifndef BLOCK_COMPRESSOR_H
+#define BLOCK_COMPRESSOR_H
+
+/*
+ ****************
+ *  LIBRARIES   *
+ ****************
+ */
+#include <stdint.h>
+#include <string.h>
+
+/*
+ *********************
+ *   MODULE CONFIG   *
+ *********************
+ */
+// Raw bytes of a block (ratio above 8 is rare on log lines)
+#ifndef LZB_MAX_RAW
+#define LZB_MAX_RAW       4096
+#endif
+// Hash table size (2^LZB_HASH_BITS positions)
+#ifndef LZB_HASH_BITS
+#define LZB_HASH_BITS     10
+#endif
+// SD card sector
+#define LZB_BLOCK_SIZE    512
+#define LZB_HEADER_SIZE   14
+#define LZB_PAYLOAD_SIZE  (LZB_BLOCK_SIZE - LZB_HEADER_SIZE)
+// Longest line: always fits an empty block
+#define LZB_MAX_LINE      256
+#define LZB_MIN_MATCH     4
+// Packed literals (15 characters at most)
+#define LZB_NIBBLES       "0123456789,.-:\n"
+
+/*
+ **********************
+ *  BLOCK COMPRESSOR  *
+ **********************
+ */
+inline void lzbWrite16(uint8_t* p, uint16_t v)  {
+
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+}
+
+inline void lzbWrite32(uint8_t* p, uint32_t v)  {
+
+  lzbWrite16(p, v & 0xFFFF);
+  lzbWrite16(p + 2, v >> 16);
+}
+
+inline uint16_t lzbRead16(const uint8_t* p)  { return p[0] | p[1] << 8; }
+inline uint32_t lzbRead32(const uint8_t* p)  { return lzbRead16(p) | (uint32_t)lzbRead16(p + 2) << 16; }
+
+// CRC-16/CCITT (0x1021), crc 0xFFFF to start
+inline uint16_t lzbCrc16(uint16_t crc, const uint8_t* data, uint16_t len)  {
+
+  while (len--)  {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (uint8_t b = 0; b < 8; b++)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+// Nibble of a packed literal, 15 if it cannot be packed
+inline uint8_t lzbNibble(uint8_t c)  {
+
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  const char* p = strchr(LZB_NIBBLES + 10, c);
+  return c && p ? p - LZB_NIBBLES : 15;
+}
+
+class BlockCompressor {
+
+public:
+  BlockCompressor()  { reset(); }
+
+  /*
+   * @brief:
+   *    Adds a line to the block, '\n' appended.
+   * @return:
+   *    False if it does not fit: write the block (finish()) and add the
+   *    line again. Always false for lines longer than LZB_MAX_LINE.
+   */
+  bool addLine(const char* line, uint16_t len)  {
+
+    if (len > LZB_MAX_LINE || rawLen + len + 1 > LZB_MAX_RAW)
+      return false;
+    memcpy(raw + rawLen, line, len);
+    raw[rawLen + len] = '\n';
+    if (!encode(rawLen, rawLen + len + 1))
+      return false;
+    rawLen += len + 1;
+    return true;
+  }
+
+  /*
+   * @brief:
+   *    Closes the block: header and padding written, the compressor is
+   *    ready for the next block.
+   * @params:
+   *    segment: Id of the segment written.
+   *    seq: Block number in the segment.
+   * @return:
+   *    The block (LZB_BLOCK_SIZE bytes), valid until the next addLine().
+   */
+  const uint8_t* finish(uint32_t segment, uint16_t seq)  {
+
+    out[0] = 'L';
+    out[1] = 'B';
+    lzbWrite16(out + 2, outLen);
+    lzbWrite16(out + 4, rawLen);
+    lzbWrite32(out + 6, segment);
+    lzbWrite16(out + 10, seq);
+    lzbWrite16(out + 12, lzbCrc16(lzbCrc16(0xFFFF, out, 12), out + LZB_HEADER_SIZE, outLen));
+    memset(out + LZB_HEADER_SIZE + outLen, 0, LZB_PAYLOAD_SIZE - outLen);
+    reset();
+    return out;
+  }
+
+  // Drops the open block
+  void clear()  { reset(); }
+
+  bool empty() const  { return rawLen == 0; }
+  // Raw and compressed bytes of the open block
+  uint16_t rawSize() const  { return rawLen; }
+  uint16_t payloadSize() const  { return outLen; }
+
+private:
+  uint8_t raw[LZB_MAX_RAW];
+  uint8_t out[LZB_BLOCK_SIZE];
+  // Last position + 1 of each hash, 0 if none
+  uint16_t table[1 << LZB_HASH_BITS];
+  uint16_t rawLen, outLen;
+
+  void reset()  {
+
+    rawLen = 0;
+    outLen = 0;
+    memset(table, 0, sizeof(table));
+  }
+
+  static uint32_t read32(const uint8_t* p)  {
+
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+  }
+
+  static uint16_t hash(const uint8_t* p)  { return (read32(p) * 2654435761u) >> (32 - LZB_HASH_BITS); }
+
+  // Bytes to write a length from its field maximum (then 255 runs)
+  static uint16_t extraBytes(uint16_t n, uint16_t max)  { return n < max ? 0 : (n - max) / 255 + 1; }
+
+  static uint8_t* writeExtra(uint8_t* p, uint16_t n, uint16_t max)  {
+
+    for (n -= max; n >= 255; n -= 255)
+      *p++ = 255;
+    *p++ = n;
+    return p;
+  }
+
+  // Appends a sequence to the payload, false if it does not fit
+  bool sequence(uint16_t& o, uint16_t literals, uint16_t litLen, uint16_t matchLen, uint16_t offset)  {
+
+    uint16_t code = matchLen ? matchLen - 3 : 0;
+    bool packed = litLen > 1;
+    for (uint16_t i = 0; i < litLen && packed; i++)
+      packed = lzbNibble(raw[literals + i]) < 15;
+    uint16_t litBytes = packed ? (litLen + 1) / 2 : litLen;
+    uint16_t need = 1 + extraBytes(litLen, 7) + litBytes + (matchLen ? 2 + extraBytes(code, 15) : 0);
+    if (o + need > LZB_PAYLOAD_SIZE)
+      return false;
+    uint8_t* p = out + LZB_HEADER_SIZE + o;
+    *p++ = packed << 7 | (litLen < 7 ? litLen : 7) << 4 | (code < 15 ? code : 15);
+    if (litLen >= 7)
+      p = writeExtra(p, litLen, 7);
+    if (packed)  {
+      for (uint16_t i = 0; i < litLen; i += 2)
+        *p++ = lzbNibble(raw[literals + i]) << 4 | (i + 1 < litLen ? lzbNibble(raw[literals + i + 1]) : 15);
+    }
+    else  {
+      memcpy(p, raw + literals, litLen);
+      p += litLen;
+    }
+    if (matchLen)  {
+      *p++ = offset & 0xFF;
+      *p++ = offset >> 8;
+      if (code >= 15)
+        p = writeExtra(p, code, 15);
+    }
+    o += need;
+    return true;
+  }
+
+  // Codes raw[start, end) after the payload, payload left unchanged if it does not fit
+  bool encode(uint16_t start, uint16_t end)  {
+
+    uint16_t o = outLen, anchor = start, i = start;
+    while (i + LZB_MIN_MATCH <= end)  {
+      uint16_t h = hash(raw + i);
+      uint16_t candidate = table[h];
+      table[h] = i + 1;
+      // Positions of a dropped line may remain: matches are checked
+      if (candidate == 0 || candidate - 1 >= i || read32(raw + candidate - 1) != read32(raw + i))  {
+        i++;
+        continue;
+      }
+      uint16_t from = candidate - 1, len = LZB_MIN_MATCH;
+      while (i + len < end && raw[from + len] == raw[i + len])
+        len++;
+      if (!sequence(o, anchor, i - anchor, len, i - from))
+        return false;
+      // Positions within the match
+      for (uint16_t j = i + 1; j < i + len && j + LZB_MIN_MATCH <= end; j++)
+        table[hash(raw + j)] = j + 1;
+      i += len;
+      anchor = i;
+    }
+    if (anchor < end && !sequence(o, anchor, end - anchor, 0, 0))
+      return false;
+    outLen = o;
+    return true;
+  }
+};
+
+/*
+ * @brief:
+ *    Checks a block header and its CRC.
+ * @params:
+ *    block: LZB_BLOCK_SIZE bytes.
+ *    segment, seq: Receive the segment id and the block number.
+ * @return:
+ *    False if it is not a block or it was torn.
+ */
+inline bool checkLogBlock(const uint8_t* block, uint32_t& segment, uint16_t& seq)  {
+
+  uint16_t payload = lzbRead16(block + 2);
+  if (block[0] != 'L' || block[1] != 'B' || payload > LZB_PAYLOAD_SIZE || lzbRead16(block + 4) > LZB_MAX_RAW)
+    return false;
+  if (lzbCrc16(lzbCrc16(0xFFFF, block, 12), block + LZB_HEADER_SIZE, payload) != lzbRead16(block + 12))
+    return false;
+  segment = lzbRead32(block + 6);
+  seq = lzbRead16(block + 10);
+  return true;
+}
+
+/*
+ * @brief:
+ *    Decodes a block.
+ * @params:
+ *    block: LZB_BLOCK_SIZE bytes.
+ *    text: Receives the raw lines (LZB_MAX_RAW bytes).
+ *    len: Raw length.
+ *    segment, seq: Receive the segment id and the block number.
+ * @return:
+ *    False if it is not a valid block (no header, CRC error, bad
+ *    sequence).
+ */
+inline bool decodeLogBlock(const uint8_t* block, uint8_t* text, uint16_t& len, uint32_t& segment, uint16_t& seq)  {
+
+  if (!checkLogBlock(block, segment, seq))
+    return false;
+  uint16_t rawLen = lzbRead16(block + 4);
+  const uint8_t* p = block + LZB_HEADER_SIZE;
+  const uint8_t* end = p + lzbRead16(block + 2);
+
+  uint16_t o = 0;
+  while (p < end)  {
+    uint8_t token = *p++;
+    uint16_t n = (token >> 4) & 7;
+    if (n == 7)
+      do  {
+        if (p >= end)
+          return false;
+        n += *p;
+      } while (*p++ == 255);
+    bool packed = token & 0x80;
+    uint16_t bytes = packed ? (n + 1) / 2 : n;
+    if (bytes > end - p || o + n > rawLen)
+      return false;
+    if (packed)  {
+      for (uint16_t i = 0; i < n; i++)  {
+        uint8_t nibble = i & 1 ? p[i / 2] & 0x0F : p[i / 2] >> 4;
+        if (nibble == 15)
+          return false;
+        text[o + i] = LZB_NIBBLES[nibble];
+      }
+    }
+    else
+      memcpy(text + o, p, n);
+    p += bytes;
+    o += n;
+    uint16_t code = token & 0x0F;
+    if (code == 0)
+      continue;
+    if (end - p < 2)
+      return false;
+    uint16_t offset = p[0] | p[1] << 8;
+    p += 2;
+    if (code == 15)
+      do  {
+        if (p >= end)
+          return false;
+        code += *p;
+      } while (*p++ == 255);
+    uint16_t matchLen = code + 3;
+    if (offset == 0 || offset > o || o + matchLen > rawLen)
+      return false;
+    // Byte by byte: the copy may overlap its source
+    for (uint16_t k = 0; k < matchLen; k++, o++)
+      text[o] = text[o - offset];
+  }
+  len = o;
+  return o == rawLen;
+}
+
+// Segment header sector (LZB_BLOCK_SIZE bytes): id and blocks written at the last checkpoint
+inline void writeSegmentHeader(uint8_t* sector, uint32_t segment, uint32_t blocks)  {
+
+  memset(sector, 0, LZB_BLOCK_SIZE);
+  sector[0] = 'L';
+  sector[1] = 'J';
+  lzbWrite32(sector + 2, segment);
+  lzbWrite32(sector + 6, blocks);
+  lzbWrite16(sector + 10, lzbCrc16(0xFFFF, sector, 10));
+}
+
+// False if the sector is not a segment header, or it was torn
+inline bool readSegmentHeader(const uint8_t* sector, uint32_t& segment, uint32_t& blocks)  {
+
+  if (sector[0] != 'L' || sector[1] != 'J' || lzbCrc16(0xFFFF, sector, 10) != lzbRead16(sector + 10))
+    return false;
+  segment = lzbRead32(sector + 2);
+  blocks = lzbRead32(sector + 6);
+  return true;
+}
+
+#endif
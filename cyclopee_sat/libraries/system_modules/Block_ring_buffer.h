@@ -0,0 +1,115 @@
+/*
+ ******************************
+ *  BLOCK RING BUFFER MODULE  *
+ ******************************
+ * @brief:
+ *    This module is loaded to buffer a byte stream between an interrupt
+ *    (producer) and loop() (consumer), the consumer reading bytes by
+ *    blocks with at most two memcpy() instead of one call per byte.
+ *    One producer and one consumer only, no lock needed.
+ * @note:
+ *    No board specific code. Size must be a power of two.
+ */
+#ifndef BLOCK_RING_BUFFER_H
+#define BLOCK_RING_BUFFER_H
+
+/*
+ ****************
+ *  LIBRARIES   *
+ ****************
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Compiler barrier: data must be written before indexes are published
+#define RING_BARRIER() __asm__ volatile("" ::: "memory")
+
+/*
+ *************************
+ *   BLOCK RING BUFFER   *
+ *************************
+ */
+template <size_t N>
+class BlockRingBuffer {
+
+  static_assert((N & (N - 1)) == 0, "BlockRingBuffer size must be a power of two");
+
+public:
+  BlockRingBuffer()  { clear(); }
+
+  /*
+   * @brief:
+   *    Empties the buffer. Producer must be stopped.
+   */
+  void clear()  {
+    head = tail = 0;
+    overflows = 0;
+  }
+
+  /*
+   * @brief:
+   *    Stores a byte (producer side). Byte is dropped if buffer is full.
+   * @return:
+   *    False if buffer was full.
+   */
+  bool store(uint8_t c)  {
+
+    uint32_t h = head;
+    if (h - tail == N)  {
+      overflows++;
+      return false;
+    }
+    data[h & (N - 1)] = c;
+    RING_BARRIER();
+    head = h + 1;
+    return true;
+  }
+
+  /*
+   * @brief:
+   *    Returns number of bytes available for reading.
+   */
+  size_t available() const  { return head - tail; }
+
+  /*
+   * @brief:
+   *    Reads up to maxLen bytes (consumer side).
+   * @params:
+   *    dst: Destination buffer.
+   *    maxLen: Maximum number of bytes to read.
+   * @return:
+   *    Number of bytes read.
+   */
+  size_t read(uint8_t* dst, size_t maxLen)  {
+
+    uint32_t t = tail;
+    size_t n = head - t;
+    RING_BARRIER();
+    if (n > maxLen)
+      n = maxLen;
+    // Copy up to the end of storage, then from its start
+    size_t start = t & (N - 1);
+    size_t first = (n < N - start) ? n : N - start;
+    memcpy(dst, data + start, first);
+    memcpy(dst + first, data, n - first);
+    RING_BARRIER();
+    tail = t + n;
+    return n;
+  }
+
+  /*
+   * @brief:
+   *    Returns number of bytes dropped because buffer was full.
+   */
+  uint32_t overflowCount() const  { return overflows; }
+
+private:
+  uint8_t data[N];
+  // Free running indexes, wrapped on access
+  volatile uint32_t head;
+  volatile uint32_t tail;
+  volatile uint32_t overflows;
+};
+
+#endif
@@ -0,0 +1,211 @@
+/*
+ ****************************
+ *    GNSS FIXED MODULE     *
+ ****************************
+ * @brief:
+ *    This module is loaded to carry GNSS positions from the NMEA parser to
+ *    the log lines without floating point:
+ *      - Longitude/latitude are kept as TinyGPSPlus parses them (RawDegrees:
+ *        degrees + billionths of degree + sign) instead of lng()/lat()
+ *        doubles.
+ *      - Elevations are int32 millimetres (altitude in cm from
+ *        altitude.value(), geoid separation read from its NMEA string).
+ *      - Log strings are written with integer divisions only, up to 9
+ *        decimals for coordinates and 3 for millimetres.
+ * @note:
+ *    The Teensy 3.5 FPU is single precision: every double operation (lng(),
+ *    comparisons with a sentinel, String(double, decimals)) is a software
+ *    library call. Values formatted here are identical to the double ones
+ *    at the same number of decimals (rounded half up), without the double
+ *    rounding of lng() on the 9th decimal.
+ *    Binary records may store a coordinate as int64 nanodegrees (nanodeg()).
+ */
+#ifndef GNSS_FIXED_H
+#define GNSS_FIXED_H
+
+/*
+ ****************
+ *  LIBRARIES   *
+ ****************
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <TinyGPSPlus.h>
+
+/*
+ *********************
+ *   MODULE CONFIG   *
+ *********************
+ */
+// Degrees of a coordinate not received
+#define GNSS_COORD_NO_DEG     UINT16_MAX
+// Decimals of a coordinate (billionths of degree)
+#define GNSS_COORD_DECIMALS   9
+// Decimals of a millimetre value in its unit (m)
+#define GNSS_MILLI_DECIMALS   3
+// Formatted coordinate length, NUL included ("-180.123456789")
+#define GNSS_COORD_STR_LEN    16
+// Formatted millimetre value length, NUL included ("-2147483.647")
+#define GNSS_MILLI_STR_LEN    16
+
+/*
+ *******************
+ *   GNSS FIXED    *
+ *******************
+ */
+// Powers of 10 up to 10^9
+static const uint32_t GNSS_POW10[10] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+/*
+ * @brief:
+ *    Writes a fixed point value: sign, integer part, then decimals rounded
+ *    half up (a carry goes to the integer part). "-0" is written "0".
+ * @params:
+ *    str: Buffer, 16 bytes are enough for every value of this module.
+ *    negative: Sign of the value.
+ *    whole: Integer part.
+ *    frac: Fractional part, in 10^-fracDigits units.
+ *    fracDigits: Digits of frac (9 max).
+ *    decimals: Decimals written (fracDigits max).
+ * @return:
+ *    String length.
+ */
+inline size_t gnssFormatFixed(char* str, bool negative, uint32_t whole, uint32_t frac, uint8_t fracDigits, uint8_t decimals)  {
+
+  if (decimals > fracDigits)
+    decimals = fracDigits;
+  if (decimals < fracDigits)  {
+    uint32_t div = GNSS_POW10[fracDigits - decimals];
+    frac = frac / div + (frac % div >= div / 2 ? 1 : 0);
+    if (frac >= GNSS_POW10[decimals])  {
+      frac -= GNSS_POW10[decimals];
+      whole++;
+    }
+  }
+
+  char* p = str;
+  if (negative && (whole || frac))
+    *p++ = '-';
+  // Integer part, digits reversed in place
+  char* first = p;
+  do  {
+    *p++ = '0' + whole % 10;
+    whole /= 10;
+  } while (whole);
+  for (char *a = first, *b = p - 1; a < b; a++, b--)  {
+    char c = *a;
+    *a = *b;
+    *b = c;
+  }
+  // Decimals, leading zeros kept
+  if (decimals)  {
+    *p++ = '.';
+    for (uint8_t i = decimals; i > 0; i--)  {
+      p[i - 1] = '0' + frac % 10;
+      frac /= 10;
+    }
+    p += decimals;
+  }
+  *p = '\0';
+  return p - str;
+}
+
+/*
+ * @brief:
+ *    Writes a value in thousandths (mm as m), GNSS_MILLI_DECIMALS decimals
+ *    at most.
+ * @return:
+ *    String length.
+ */
+inline size_t gnssFormatMilli(char* str, int32_t value_milli, uint8_t decimals = GNSS_MILLI_DECIMALS)  {
+
+  uint32_t abs_milli = value_milli < 0 ? 0u - (uint32_t)value_milli : (uint32_t)value_milli;
+  return gnssFormatFixed(str, value_milli < 0, abs_milli / 1000, abs_milli % 1000, GNSS_MILLI_DECIMALS, decimals);
+}
+
+/*
+ * @brief:
+ *    Reads a decimal string ("47.1", "-3.25") in thousandths, rounded half
+ *    up on the 4th decimal. Reading stops at the first other character.
+ * @return:
+ *    Value in thousandths, 0 if str has no digit (as strtod()).
+ */
+inline int32_t gnssStrToMilli(const char* str)  {
+
+  bool negative = false;
+  if (*str == '-' || *str == '+')
+    negative = *str++ == '-';
+  int32_t value = 0;
+  while (*str >= '0' && *str <= '9')
+    value = value * 10 + (*str++ - '0');
+  value *= 1000;
+  if (*str == '.')  {
+    str++;
+    for (int32_t scale = 100; *str >= '0' && *str <= '9'; str++)  {
+      if (scale)
+        value += (*str - '0') * scale;
+      else if (*str >= '5')  {
+        value++;
+        break;
+      }
+      else
+        break;
+      scale /= 10;
+    }
+  }
+  return negative ? -value : value;
+}
+
+/*
+ * @brief:
+ *    Longitude or latitude in fixed point, as parsed by TinyGPSPlus.
+ *    Trivially copyable: fits ring buffers and binary records.
+ */
+struct GnssCoord {
+
+  uint32_t billionths;
+  uint16_t deg;
+  bool negative;
+
+  // Coordinate not received
+  static GnssCoord none()  {
+    GnssCoord c = {0, GNSS_COORD_NO_DEG, false};
+    return c;
+  }
+
+  // Coordinate of a TinyGPSPlus location (rawLng(), rawLat())
+  static GnssCoord fromRaw(const RawDegrees& raw)  {
+    GnssCoord c = {raw.billionths, raw.deg, raw.negative};
+    return c;
+  }
+
+  bool isValid() const  { return deg != GNSS_COORD_NO_DEG; }
+
+  // Signed nanodegrees (binary records)
+  int64_t nanodeg() const  {
+    int64_t v = (int64_t)deg * 1000000000LL + billionths;
+    return negative ? -v : v;
+  }
+
+  // Coordinate of signed nanodegrees (computed means)
+  static GnssCoord fromNanodeg(int64_t v)  {
+    uint64_t a = v < 0 ? -v : v;
+    GnssCoord c = {(uint32_t)(a % 1000000000ULL), (uint16_t)(a / 1000000000ULL), v < 0};
+    return c;
+  }
+
+  /*
+   * @brief:
+   *    Writes the coordinate in degrees.
+   * @params:
+   *    str: Buffer of GNSS_COORD_STR_LEN bytes.
+   *    decimals: Decimals written (GNSS_COORD_DECIMALS max).
+   * @return:
+   *    String length.
+   */
+  size_t format(char* str, uint8_t decimals = GNSS_COORD_DECIMALS) const  {
+    return gnssFormatFixed(str, negative, deg, billionths, GNSS_COORD_DECIMALS, decimals);
+  }
+};
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ ****************************
+ *    GNSS POWER MODULE     *
+ ****************************
+ * @brief:
+ *    This module is loaded to put the u-blox receiver in software backup
+ *    between two samples of a duty cycled logger:
+ *      - gnssBackup() sends UBX-RXM-PMREQ: the receiver stops tracking and
+ *        wakes by itself after the given duration, or on UART RX activity.
+ *        RTC, ephemerides and last position are kept: next fix is a hot
+ *        start (about 2s on the F9P, ephemerides valid for about 4h).
+ *      - gnssWake() wakes the receiver early (logger woken by the button).
+ * @note:
+ *    The ZED-F9P has no power save mode (UBX-CFG-PMS): software backup is
+ *    its only low power state. The receiver RX pin must be wired (UART1 RX
+ *    on the DP0601). No board specific code: Port is any class with
+ *    write(uint8_t) (HardwareSerial).
+ *
+ * @UBX-RXM-PMREQ (version 0):
+ *    0xB5 0x62 | 0x02 0x41 | 16 | version (0), reserved (3) | duration (ms, U4)
+ *    | flags (X4: backup, force) | wakeupSources (X4: uartrx, extint0, ...) | CK_A CK_B
+ */
+#ifndef GNSS_POWER_H
+#define GNSS_POWER_H
+
+/*
+ ****************
+ *  LIBRARIES   *
+ ****************
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *********************
+ *   MODULE CONFIG   *
+ *********************
+ */
+// Bytes sent to wake the receiver (UART RX activity), lost by the receiver
+#ifndef GNSS_WAKE_BYTES
+#define GNSS_WAKE_BYTES         8
+#endif
+#define UBX_CLASS_RXM           0x02
+#define UBX_ID_RXM_PMREQ        0x41
+#define UBX_PMREQ_BACKUP        0x00000002
+#define UBX_PMREQ_FORCE         0x00000004
+#define UBX_PMREQ_WAKE_UARTRX   0x00000008
+
+/*
+ *******************
+ *   GNSS POWER    *
+ *******************
+ */
+/*
+ * @brief:
+ *    Sends a UBX message with its Fletcher checksum.
+ */
+template <class Port>
+void ubxSend(Port& port, uint8_t msgClass, uint8_t msgId, const uint8_t* payload, uint16_t length)  {
+
+  uint8_t header[4] = {msgClass, msgId, (uint8_t)(length & 0xFF), (uint8_t)(length >> 8)};
+  uint8_t ckA = 0, ckB = 0;
+  port.write((uint8_t)0xB5);
+  port.write((uint8_t)0x62);
+  for (uint8_t i = 0; i < 4; i++)  {
+    port.write(header[i]);
+    ckA += header[i];
+    ckB += ckA;
+  }
+  for (uint16_t i = 0; i < length; i++)  {
+    port.write(payload[i]);
+    ckA += payload[i];
+    ckB += ckA;
+  }
+  port.write(ckA);
+  port.write(ckB);
+}
+
+/*
+ * @brief:
+ *    Puts the receiver in software backup.
+ * @params:
+ *    port: Receiver UART.
+ *    duration_ms: Backup duration, 0 for an unlimited backup (UART wake only).
+ */
+template <class Port>
+void gnssBackup(Port& port, uint32_t duration_ms)  {
+
+  uint32_t flags = UBX_PMREQ_BACKUP | UBX_PMREQ_FORCE;
+  uint32_t wakeup = UBX_PMREQ_WAKE_UARTRX;
+  uint8_t payload[16] = {0};
+  for (uint8_t i = 0; i < 4; i++)  {
+    payload[4 + i] = (duration_ms >> (8 * i)) & 0xFF;
+    payload[8 + i] = (flags >> (8 * i)) & 0xFF;
+    payload[12 + i] = (wakeup >> (8 * i)) & 0xFF;
+  }
+  ubxSend(port, UBX_CLASS_RXM, UBX_ID_RXM_PMREQ, payload, sizeof(payload));
+}
+
+/*
+ * @brief:
+ *    Wakes the receiver from backup (no effect if it is running).
+ *    Tracking resumes after a hot start.
+ */
+template <class Port>
+void gnssWake(Port& port)  {
+
+  for (uint8_t i = 0; i < GNSS_WAKE_BYTES; i++)
+    port.write((uint8_t)0xFF);
+}
+
+#endif
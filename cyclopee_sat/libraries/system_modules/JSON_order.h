@@ -0,0 +1,67 @@
+/*
+ ****************************
+ *    JSON ORDER MODULE     *
+ ****************************
+ * @brief:
+ *    This module is loaded to read the members of the one line JSON orders
+ *    sent by the gateway (mpcd -o), e.g.
+ *      {"order":"update_interval","channel":"dist","value":100}
+ *    Orders are flat: no nested object, no escaped quote.
+ * @note:
+ *    No board specific code, no allocation: members are read in place.
+ */
+#ifndef JSON_ORDER_H
+#define JSON_ORDER_H
+
+/*
+ ****************
+ *  LIBRARIES   *
+ ****************
+ */
+#include <stddef.h>
+#include <string.h>
+
+/*
+ *******************
+ *   JSON ORDER    *
+ *******************
+ */
+/*
+ * @brief:
+ *    Finds a member of an order line.
+ * @params:
+ *    json: Order line.
+ *    key: Member name, without quotes.
+ * @return:
+ *    Start of the member value ("key": value), NULL if absent.
+ */
+inline const char* jsonMember(const char* json, const char* key)  {
+
+  size_t len = strlen(key);
+  for (const char* p = strstr(json, key); p; p = strstr(p + 1, key))  {
+    if (p == json || p[-1] != '"' || p[len] != '"')
+      continue;
+    p += len + 1;
+    while (*p == ' ')
+      p++;
+    if (*p++ != ':')
+      continue;
+    while (*p == ' ')
+      p++;
+    return p;
+  }
+  return NULL;
+}
+
+/*
+ * @brief:
+ *    Tells if a member is a given string ("key": "value").
+ */
+inline bool jsonMemberIs(const char* json, const char* key, const char* value)  {
+
+  const char* p = jsonMember(json, key);
+  size_t len = strlen(value);
+  return p && *p == '"' && strncmp(p + 1, value, len) == 0 && p[len + 1] == '"';
+}
+
+#endif
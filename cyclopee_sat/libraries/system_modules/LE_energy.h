@@ -0,0 +1,192 @@
+/*
+ ****************************
+ *    LE ENERGY MODULE      *
+ ****************************
+ * @brief:
+ *    This module is loaded to estimate the battery life of the low energy
+ *    logger (le_logger) from the time spent in each state of a sample
+ *    cycle and the current drawn in each state:
+ *      - LE_MODE_LEGACY: receiver always tracking, SD log file checked,
+ *        opened and written for every sample, DS18B20 conversion waited.
+ *      - LE_MODE_LOW_ENERGY: receiver in software backup between samples
+ *        (woken LE_GNSS_LEAD_MS before the sample for a hot start),
+ *        samples kept in RAM and written to SD every N samples, DS18B20
+ *        conversion run while waiting for the GNSS epoch.
+ *    The logger sleeps a fixed interval after each sample (Snooze RTC
+ *    alarm): a cycle lasts the interval plus the time awake.
+ *    The same model is used on the logger (setup estimate, receiver backup
+ *    decision) and on the host (gateway/mpcd/tools/le_energy.cpp).
+ * @note:
+ *    No board specific code. Currents are battery side estimates from the
+ *    datasheets, to be replaced by measurements of the deployed hardware.
+ */
+#ifndef LE_ENERGY_H
+#define LE_ENERGY_H
+
+/*
+ ****************
+ *  LIBRARIES   *
+ ****************
+ */
+#include <stdint.h>
+
+/*
+ *********************
+ *   MODULE CONFIG   *
+ *********************
+ */
+// Currents
+// Teensy 3.5 in Snooze deep sleep
+#ifndef LE_SLEEP_MA
+#define LE_SLEEP_MA           0.3f/*mA*/
+#endif
+// Teensy 3.5 running
+#ifndef LE_AWAKE_MA
+#define LE_AWAKE_MA           35.0f/*mA*/
+#endif
+// DP0601 (ZED-F9P) tracking
+#ifndef LE_GNSS_ON_MA
+#define LE_GNSS_ON_MA         80.0f/*mA*/
+#endif
+// DP0601 in software backup
+#ifndef LE_GNSS_BACKUP_MA
+#define LE_GNSS_BACKUP_MA     1.5f/*mA*/
+#endif
+// URM14 and DS18B20, always powered
+#ifndef LE_SENSORS_MA
+#define LE_SENSORS_MA         10.0f/*mA*/
+#endif
+// SD card writing (added to the Teensy current)
+#ifndef LE_SD_WRITE_MA
+#define LE_SD_WRITE_MA        50.0f/*mA*/
+#endif
+// Durations
+// Receiver woken before the sample: hot start and margin
+#ifndef LE_GNSS_LEAD_MS
+#define LE_GNSS_LEAD_MS       3000/*ms*/
+#endif
+// Wait for a new NMEA epoch once awake (half the epoch interval)
+#ifndef LE_GNSS_EPOCH_MS
+#define LE_GNSS_EPOCH_MS      500/*ms*/
+#endif
+// DS18B20 conversion (11 bits)
+#ifndef LE_TEMP_CONVERSION_MS
+#define LE_TEMP_CONVERSION_MS 375/*ms*/
+#endif
+// URM14 Modbus exchanges and line formatting
+#ifndef LE_MEASURE_MS
+#define LE_MEASURE_MS         50/*ms*/
+#endif
+// SD card access: card check, directory and file lookups, open
+#ifndef LE_SD_OPEN_MS
+#define LE_SD_OPEN_MS         30/*ms*/
+#endif
+// SD write of one log line
+#ifndef LE_SD_LINE_MS
+#define LE_SD_LINE_MS         1/*ms*/
+#endif
+// delay() before sleeping in legacy mode
+#ifndef LE_LEGACY_DELAY_MS
+#define LE_LEGACY_DELAY_MS    50/*ms*/
+#endif
+// Part of the battery capacity used
+#ifndef LE_BATTERY_USABLE
+#define LE_BATTERY_USABLE     0.8f
+#endif
+
+/*
+ *******************
+ *   LE ENERGY     *
+ *******************
+ */
+enum LeMode : uint8_t {
+  LE_MODE_LEGACY = 0,
+  LE_MODE_LOW_ENERGY
+};
+
+// Sample cycle
+struct LeCycle {
+  // Cycle duration (sleep interval + time awake)
+  uint32_t period_ms;
+  uint32_t awake_ms;
+  // Receiver tracking, SD card writing
+  uint32_t gnssOn_ms;
+  uint32_t sd_ms;
+  // Charge drawn from the battery
+  float charge_mAms;
+};
+
+/*
+ * @brief:
+ *    Time and charge of one sample cycle.
+ * @params:
+ *    mode: Logger mode.
+ *    sleep_ms: Sleep interval after the sample.
+ *    flushLines: Lines written to SD at the end of this sample (0: kept in
+ *                RAM). Ignored in legacy mode (one line per sample).
+ *    gnssBackup: Receiver in backup while the logger sleeps (low energy mode).
+ */
+inline LeCycle leCycle(LeMode mode, uint32_t sleep_ms, uint16_t flushLines, bool gnssBackup)  {
+
+  LeCycle c;
+  if (mode == LE_MODE_LEGACY)  {
+    c.sd_ms = LE_SD_OPEN_MS + LE_SD_LINE_MS;
+    c.awake_ms = LE_GNSS_EPOCH_MS + LE_TEMP_CONVERSION_MS + LE_MEASURE_MS + c.sd_ms + LE_LEGACY_DELAY_MS;
+    gnssBackup = false;
+  }
+  else  {
+    c.sd_ms = flushLines ? LE_SD_OPEN_MS + flushLines * LE_SD_LINE_MS : 0;
+    c.awake_ms = (LE_GNSS_EPOCH_MS > LE_TEMP_CONVERSION_MS ? LE_GNSS_EPOCH_MS : LE_TEMP_CONVERSION_MS) + LE_MEASURE_MS + c.sd_ms;
+  }
+  c.period_ms = sleep_ms + c.awake_ms;
+  c.gnssOn_ms = gnssBackup ? LE_GNSS_LEAD_MS + c.awake_ms : c.period_ms;
+  if (c.gnssOn_ms > c.period_ms)
+    c.gnssOn_ms = c.period_ms;
+
+  c.charge_mAms = LE_SLEEP_MA * (c.period_ms - c.awake_ms) + LE_AWAKE_MA * c.awake_ms
+                + LE_GNSS_ON_MA * c.gnssOn_ms + LE_GNSS_BACKUP_MA * (c.period_ms - c.gnssOn_ms)
+                + LE_SENSORS_MA * c.period_ms + LE_SD_WRITE_MA * c.sd_ms;
+  return c;
+}
+
+/*
+ * @brief:
+ *    Mean current over a flush period (flushSamples cycles).
+ */
+inline float leMeanCurrent_mA(LeMode mode, uint32_t sleep_ms, uint16_t flushSamples, bool gnssBackup)  {
+
+  if (mode == LE_MODE_LEGACY || flushSamples == 0)
+    flushSamples = 1;
+  LeCycle kept = leCycle(mode, sleep_ms, 0, gnssBackup);
+  LeCycle flushed = leCycle(mode, sleep_ms, flushSamples, gnssBackup);
+  float charge = kept.charge_mAms * (flushSamples - 1) + flushed.charge_mAms;
+  float period = (float)kept.period_ms * (flushSamples - 1) + flushed.period_ms;
+  return charge / period;
+}
+
+/*
+ * @brief:
+ *    Tells if the receiver backup saves energy at this sleep interval
+ *    (hot start lead shorter than the interval, backup current paid back).
+ */
+inline bool leGnssBackupSaves(uint32_t sleep_ms, uint16_t flushSamples)  {
+
+  return sleep_ms > LE_GNSS_LEAD_MS &&
+         leMeanCurrent_mA(LE_MODE_LOW_ENERGY, sleep_ms, flushSamples, true) < leMeanCurrent_mA(LE_MODE_LOW_ENERGY, sleep_ms, flushSamples, false);
+}
+
+/*
+ * @brief:
+ *    Battery life.
+ * @params:
+ *    capacity_mAh: Battery capacity.
+ *    current_mA: Mean current.
+ * @return:
+ *    Days of logging on LE_BATTERY_USABLE of the capacity.
+ */
+inline float leBatteryDays(float capacity_mAh, float current_mA)  {
+
+  return capacity_mAh * LE_BATTERY_USABLE / current_mA / 24.0f;
+}
+
+#endif
@@ -0,0 +1,581 @@
+/*
+ ****************************
+ *   LOG SEGMENT MODULE     *
+ ****************************
+ * @brief:
+ *    This module is loaded to manage the log segments of the SD card
+ *    (YYYY_MM_DD/HH_MM_SS.csv, a "Date:,YYYY_MM_DD" line then a header)
+ *    without touching the FAT directory on every sample:
+ *      - Directory and file state are cached: update() only compares the
+ *        date and the segment timer while the segment is open.
+ *      - A segment is started on date change or every segment interval.
+ *      - The next segment file is created ahead, from loop() while the
+ *        buffers are empty (idle()): a rotation only swaps two open files.
+ *      - Card presence is read on the card detect pin interrupt, or, without
+ *        pin, checked every LOG_SEG_CARD_CHECK_INTERVAL.
+ *      - Several streams can be logged side by side: each segmenter has its
+ *        own file name suffix (YYYY_MM_DD/HH_MM_SS_agg.csv). Without header,
+ *        segments hold JSON lines only (no Date line).
+ *      - Text segments are flushed (file size written in the directory)
+ *        every LOG_SEG_CHECKPOINT_INTERVAL: a power loss loses the lines
+ *        written since.
+ *      - With a block compressor (Block_compressor.h), segments are
+ *        journaled, YYYY_MM_DD/HH_MM_SS.csz: a segment header sector, then
+ *        the lines (Date line and header included) by blocks of one sector,
+ *        each one decodable on its own and numbered. A block is written when
+ *        full, at the end of the segment or after LOG_SEG_BLOCK_MAX_AGE.
+ * @note:
+ *    The next segment is named after the expected start of the segment
+ *    (current start + interval). It is dropped and the segment opened on
+ *    rotation if the sample time is more than LOG_SEG_NAME_TOLERANCE away
+ *    (time jump, GNSS time received after the first segment).
+ *    The Teensy 3.5 builtin slot has no card detect switch and
+ *    SD.mediaPresent() reads the card status over SDIO: it is no longer
+ *    called per sample.
+ *    Journaled segments are preallocated (LOG_SEG_JOURNAL_SIZE, contiguous):
+ *    writing a block writes one sector, no FAT update. Preallocation does
+ *    not set the file size in the directory (FAT32): every
+ *    LOG_SEG_CHECKPOINT_BLOCKS the count of blocks is written in the
+ *    segment header and the file flushed, which writes its size. The
+ *    journal file (LOG<suffix>.JNL) names the open segments: at begin(),
+ *    the open segment left by a power loss is scanned from its last
+ *    checkpoint and cut after its last valid block, the segment created
+ *    ahead is removed. A power loss loses the blocks written since the
+ *    last checkpoint (at most LOG_SEG_CHECKPOINT_BLOCKS) and the open one.
+ *    Compressed segments are decoded by the gateway importer (mpcimport).
+ *    SERIAL_DBG must be defined by the sketch.
+ */
+#ifndef LOG_SEGMENT_H
+#define LOG_SEGMENT_H
+
+/*
+ ****************
+ *  LIBRARIES   *
+ ****************
+ */
+#include <SD.h>
+#include "Block_compressor.h"
+
+/*
+ *********************
+ *   MODULE CONFIG   *
+ *********************
+ */
+// Card presence check interval without card detect pin
+#ifndef LOG_SEG_CARD_CHECK_INTERVAL
+#define LOG_SEG_CARD_CHECK_INTERVAL 1000/*ms*/
+#endif
+// Flush interval of the text segments
+#ifndef LOG_SEG_CHECKPOINT_INTERVAL
+#define LOG_SEG_CHECKPOINT_INTERVAL 10/*s*/ * 1000/*ms/s*/
+#endif
+// Longest time a line waits in the open compressed block
+#ifndef LOG_SEG_BLOCK_MAX_AGE
+#define LOG_SEG_BLOCK_MAX_AGE       10/*s*/ * 1000/*ms/s*/
+#endif
+// Blocks between two checkpoints of a journaled segment (blocks lost on power loss)
+#ifndef LOG_SEG_CHECKPOINT_BLOCKS
+#define LOG_SEG_CHECKPOINT_BLOCKS   16
+#endif
+// Space preallocated for a journaled segment, cut to its blocks when closed
+#ifndef LOG_SEG_JOURNAL_SIZE
+#define LOG_SEG_JOURNAL_SIZE        128/*kB*/ * 1024/*B/kB*/
+#endif
+// Largest gap between the name of a created ahead segment and the sample time
+#ifndef LOG_SEG_NAME_TOLERANCE
+#define LOG_SEG_NAME_TOLERANCE      5/*s*/
+#endif
+// No card detect pin
+#define LOG_SEG_NO_PIN              0xFF
+// File name suffix, e.g. "_agg"
+#define LOG_SEG_SUFFIX_LEN          4
+// "YYYY_MM_DD/HH_MM_SS<suffix>.csv" (or .csz) and NUL
+#define LOG_SEG_PATH_LEN            (24 + LOG_SEG_SUFFIX_LEN)
+// Length of the directory part
+#define LOG_SEG_DIR_LEN             10
+// "LOG<suffix>.JNL" and NUL
+#define LOG_SEG_JOURNAL_PATH_LEN    (8 + LOG_SEG_SUFFIX_LEN)
+
+/*
+ *******************
+ *   LOG SEGMENT   *
+ *******************
+ */
+class LogSegmenter {
+
+public:
+  /*
+   * @params:
+   *    header: Column header line written in every segment, NULL for JSON
+   *            lines segments.
+   *    interval_ms: Segment duration.
+   *    suffix: Appended to the segment names (LOG_SEG_SUFFIX_LEN max).
+   *    compressor: Compresses and journals the segments (.csz), NULL for
+   *                text segments.
+   */
+  LogSegmenter(const char* header, uint32_t interval_ms, const char* suffix = "", BlockCompressor* compressor = NULL)
+    : header(header), interval_ms(interval_ms), suffix(suffix), compressor(compressor)  {
+
+    snprintf(journalPath, LOG_SEG_JOURNAL_PATH_LEN, "LOG%.*s.JNL", LOG_SEG_SUFFIX_LEN, suffix);
+  }
+
+  /*
+   * @brief:
+   *    Starts card presence detection and recovers the journaled segment
+   *    left open by a power loss. SD card must be set up.
+   * @params:
+   *    cdPin: Card detect pin, LOG_SEG_NO_PIN to poll SD.mediaPresent().
+   *    presentLevel: Pin level when a card is inserted.
+   */
+  void begin(uint8_t cdPin = LOG_SEG_NO_PIN, uint8_t presentLevel = LOW)  {
+
+    detectPin = cdPin;
+    detectLevel = presentLevel;
+    present = true;
+    lastCheck_ms = millis();
+    if (detectPin != LOG_SEG_NO_PIN)  {
+      pinMode(detectPin, presentLevel == LOW ? INPUT_PULLUP : INPUT_PULLDOWN);
+      attachInterrupt(digitalPinToInterrupt(detectPin), cardDetectISR, CHANGE);
+    }
+    if (compressor)
+      recover();
+  }
+
+  /*
+   * @brief:
+   *    Called before logging each sample: starts a segment if the date
+   *    changed, the segment interval elapsed or the card was inserted.
+   *    Constant time while the segment goes on.
+   * @params:
+   *    nmeaDate: Date as DDMMYY (TinyGPSDate::value()).
+   *    daySeconds: Sample time in seconds since midnight, names new segments.
+   * @return:
+   *    True if file() is open.
+   */
+  bool update(uint32_t nmeaDate, uint32_t daySeconds)  {
+
+    if (!checkCard())
+      return false;
+    if (!current || nmeaDate != currentDate)
+      startSegment(nmeaDate, daySeconds);
+    else if (millis() - segStart_ms >= interval_ms)
+      rotate(nmeaDate, daySeconds);
+    return (bool)current;
+  }
+
+  /*
+   * @brief:
+   *    Creates the next segment of the day ahead, once per segment, writes
+   *    the compressed block older than LOG_SEG_BLOCK_MAX_AGE.
+   *    Called from loop() while there is nothing to log.
+   */
+  void idle()  {
+
+    // Open block of a segment receiving few lines
+    if (compressor && !compressor->empty() && current && millis() - blockStart_ms >= LOG_SEG_BLOCK_MAX_AGE)
+      writeBlock();
+    if (!current || next || nextTried || !present)
+      return;
+    nextTried = true;
+    nextSeconds = currentSeconds + interval_ms / 1000;
+    // Next segment on the next day: created on date change
+    if (nextSeconds >= 86400)
+      return;
+    segmentPath(nextPath, currentDate, nextSeconds);
+    if (SD.exists(nextPath))
+      return;
+    if (compressor)  {
+      // Header of a compressed segment written in its first block on rotation
+      nextId = segmentId(currentDate, nextSeconds);
+      createJournaled(nextPath, next, nextId);
+      writeJournal();
+      return;
+    }
+    next = SD.open(nextPath, FILE_WRITE);
+    if (next)  {
+      writeHeader(next);
+      next.flush();
+    }
+  }
+
+  /*
+   * @brief:
+   *    Writes a line to the open segment.
+   * @return:
+   *    False if no segment is open or the line could not be written.
+   */
+  bool println(const char* line, size_t len)  {
+
+    if (!current)
+      return false;
+    if (!compressor)  {
+      bool written = current.write(line, len) == len && current.println() > 0;
+      if (millis() - checkpoint_ms >= LOG_SEG_CHECKPOINT_INTERVAL)  {
+        current.flush();
+        checkpoint_ms = millis();
+      }
+      return written;
+    }
+    if (compressor->empty())
+      blockStart_ms = millis();
+    if (!compressor->addLine(line, len))  {
+      if (compressor->empty() || !writeBlock() || !compressor->addLine(line, len))
+        return false;
+      blockStart_ms = millis();
+    }
+    return millis() - blockStart_ms < LOG_SEG_BLOCK_MAX_AGE || writeBlock();
+  }
+
+  bool println(const String& line)  { return println(line.c_str(), line.length()); }
+
+  /*
+   * @brief:
+   *    Closes the segment (logging disabled, card removed). The segment
+   *    created ahead is removed.
+   */
+  void close()  {
+
+    closeCurrent();
+    dropNext();
+    if (compressor)
+      writeJournal();
+  }
+
+  // Open segment, written directly only if not compressed
+  File& file()  { return current; }
+  // "YYYY_MM_DD/HH_MM_SS<suffix>.csv" (or .csz) of the open segment
+  const char* path() const  { return currentPath; }
+  bool cardPresent() const  { return present; }
+
+private:
+  const char* header;
+  uint32_t interval_ms;
+  const char* suffix;
+  BlockCompressor* compressor;
+  // First line of the open block
+  uint32_t blockStart_ms = 0;
+  // Last flush of a text segment
+  uint32_t checkpoint_ms = 0;
+
+  File current, next;
+  char currentPath[LOG_SEG_PATH_LEN] = "";
+  char nextPath[LOG_SEG_PATH_LEN] = "";
+  // DDMMYY of the open segment and of the last directory checked
+  uint32_t currentDate = 0;
+  uint32_t dirDate = 0;
+  uint32_t currentSeconds = 0, nextSeconds = 0;
+  uint32_t segStart_ms = 0;
+  bool nextTried = false;
+
+  // Journaled segments: ids, blocks written and at the last checkpoint
+  char journalPath[LOG_SEG_JOURNAL_PATH_LEN];
+  uint32_t currentId = 0, nextId = 0;
+  uint16_t blocks = 0, checkpointBlocks = 0;
+
+  // Card presence
+  uint8_t detectPin = LOG_SEG_NO_PIN;
+  uint8_t detectLevel = LOW;
+  bool present = false;
+  uint32_t lastCheck_ms = 0;
+  // Detect pin changes, counted for every segmenter
+  uint32_t detectSeen = 0;
+  static volatile uint32_t detectChanges;
+
+  static void cardDetectISR()  { detectChanges++; }
+
+  // Card presence, read again on a detect pin change or every check interval
+  bool checkCard()  {
+
+    bool check;
+    if (detectPin != LOG_SEG_NO_PIN)  {
+      check = detectChanges != detectSeen;
+      detectSeen = detectChanges;
+    }
+    else  {
+      check = millis() - lastCheck_ms >= LOG_SEG_CARD_CHECK_INTERVAL;
+    }
+    if (check)  {
+      lastCheck_ms = millis();
+      bool wasPresent = present;
+      present = (detectPin == LOG_SEG_NO_PIN || digitalRead(detectPin) == detectLevel) && SD.mediaPresent();
+      if (!present && wasPresent)  {
+        SERIAL_DBG("No SD card detected...\n")
+        close();
+        // Card may come back reformatted or replaced
+        dirDate = 0;
+      }
+    }
+    return present;
+  }
+
+  // Writes "YYYY_MM_DD" and, with daySeconds, "/HH_MM_SS<suffix>.csv"
+  void segmentPath(char* path, uint32_t nmeaDate, uint32_t daySeconds) const  {
+
+    int n = snprintf(path, LOG_SEG_PATH_LEN, "%04lu_%02lu_%02lu", 2000 + nmeaDate % 100, (nmeaDate / 100) % 100, nmeaDate / 10000);
+    if (daySeconds != UINT32_MAX)
+      snprintf(path + n, LOG_SEG_PATH_LEN - n, "/%02lu_%02lu_%02lu%.*s.%s", daySeconds / 3600, (daySeconds / 60) % 60, daySeconds % 60, LOG_SEG_SUFFIX_LEN, suffix, compressor ? "csz" : "csv");
+  }
+
+  // Header of a text segment, or in the first block of the open compressed segment
+  void writeHeader(File& file)  {
+
+    if (!header)
+      return;
+    char date[LOG_SEG_DIR_LEN + 7] = "Date:,";
+    memcpy(date + 6, currentPath, LOG_SEG_DIR_LEN);
+    date[LOG_SEG_DIR_LEN + 6] = '\0';
+    if (compressor)  {
+      println(date, LOG_SEG_DIR_LEN + 6);
+      println(header, strlen(header));
+      return;
+    }
+    file.println(date);
+    file.println(header);
+  }
+
+  // Id of a journaled segment: blocks left by an older file are not taken
+  static uint32_t segmentId(uint32_t nmeaDate, uint32_t daySeconds)  {
+
+    return (nmeaDate * 86400u + daySeconds) ^ (micros() * 2654435761u);
+  }
+
+  // Segment header sector, blocks written at the checkpoint
+  static bool writeSegmentHeader(File& file, uint32_t id, uint32_t count)  {
+
+    uint8_t sector[LZB_BLOCK_SIZE];
+    ::writeSegmentHeader(sector, id, count);
+    return file.write(sector, LZB_BLOCK_SIZE) == LZB_BLOCK_SIZE;
+  }
+
+  /*
+   * @brief:
+   *    Creates a journaled segment, preallocated if the card has contiguous
+   *    space, and writes its header, flushed: the segment holds its header
+   *    on the card from the start.
+   */
+  static bool createJournaled(const char* path, File& file, uint32_t id)  {
+
+    FsFile f = SD.sdfs.open(path, O_RDWR | O_CREAT);
+    if (f)
+      f.preAllocate(LOG_SEG_JOURNAL_SIZE);
+    f.close();
+    file = SD.open(path, FILE_WRITE_BEGIN);
+    if (!file || !writeSegmentHeader(file, id, 0))
+      return false;
+    file.flush();
+    return true;
+  }
+
+  /*
+   * @brief:
+   *    Cuts a journaled segment after its last valid block: blocks after
+   *    the checkpoint are read until one is torn, from an older file or
+   *    missing. A torn segment header is written again.
+   * @params:
+   *    id, count: Receive the segment id and its blocks.
+   * @return:
+   *    False if the file holds no block.
+   */
+  static bool recoverSegment(const char* path, uint32_t& id, uint16_t& count)  {
+
+    File f = SD.open(path, FILE_WRITE_BEGIN);
+    if (!f)
+      return false;
+    uint8_t sector[LZB_BLOCK_SIZE];
+    uint32_t checkpoint = 0, blockId;
+    uint16_t seq;
+    if (f.read(sector, LZB_BLOCK_SIZE) != LZB_BLOCK_SIZE || !readSegmentHeader(sector, id, checkpoint))  {
+      // Torn header: id of the first block, scanned from the start
+      checkpoint = 0;
+      if (f.read(sector, LZB_BLOCK_SIZE) != LZB_BLOCK_SIZE || !checkLogBlock(sector, id, seq) || seq != 0)  {
+        f.close();
+        return false;
+      }
+    }
+    count = checkpoint;
+    while (count < UINT16_MAX && f.seek((uint64_t)(count + 1) * LZB_BLOCK_SIZE) && f.read(sector, LZB_BLOCK_SIZE) == LZB_BLOCK_SIZE
+           && checkLogBlock(sector, blockId, seq) && blockId == id && seq == count)
+      count++;
+    f.truncate((uint64_t)(count + 1) * LZB_BLOCK_SIZE);
+    f.seek(0);
+    writeSegmentHeader(f, id, count);
+    f.close();
+    return true;
+  }
+
+  // Journal: open and created ahead segments (empty names if none)
+  void writeJournal()  {
+
+    char paths[2 * LOG_SEG_PATH_LEN] = "";
+    if (current)
+      memcpy(paths, currentPath, LOG_SEG_PATH_LEN);
+    if (next)
+      memcpy(paths + LOG_SEG_PATH_LEN, nextPath, LOG_SEG_PATH_LEN);
+    File journal = SD.open(journalPath, FILE_WRITE_BEGIN);
+    if (!journal)
+      return;
+    journal.write(paths, sizeof(paths));
+    journal.close();
+  }
+
+  // Segments left open by a power loss
+  void recover()  {
+
+    char paths[2 * LOG_SEG_PATH_LEN] = "";
+    File journal = SD.open(journalPath);
+    if (!journal)
+      return;
+    journal.read(paths, sizeof(paths));
+    journal.close();
+    paths[LOG_SEG_PATH_LEN - 1] = '\0';
+    paths[2 * LOG_SEG_PATH_LEN - 1] = '\0';
+    if (paths[0])  {
+      uint32_t id;
+      uint16_t count;
+      SERIAL_DBG("Recovering log file '")
+      SERIAL_DBG(paths)
+      SERIAL_DBG("'...\n")
+      if (recoverSegment(paths, id, count))  {
+        SERIAL_DBG(count)
+        SERIAL_DBG(" blocks kept.\n")
+      }
+      else
+        SD.remove(paths);
+    }
+    if (paths[LOG_SEG_PATH_LEN])
+      SD.remove(paths + LOG_SEG_PATH_LEN);
+    writeJournal();
+  }
+
+  // Writes the open block: one sector, checkpoint every LOG_SEG_CHECKPOINT_BLOCKS
+  bool writeBlock()  {
+
+    bool written = current.write(compressor->finish(currentId, blocks), LZB_BLOCK_SIZE) == LZB_BLOCK_SIZE;
+    blocks++;
+    if (blocks - checkpointBlocks >= LOG_SEG_CHECKPOINT_BLOCKS)
+      checkpoint();
+    return written;
+  }
+
+  // Count of blocks in the segment header, file size in the directory
+  void checkpoint()  {
+
+    checkpointBlocks = blocks;
+    current.seek(0);
+    writeSegmentHeader(current, currentId, blocks);
+    current.seek((uint64_t)(blocks + 1) * LZB_BLOCK_SIZE);
+    current.flush();
+  }
+
+  void closeCurrent()  {
+
+    if (compressor)  {
+      if (!current)  {
+        compressor->clear();
+      }
+      else  {
+        if (!compressor->empty())
+          writeBlock();
+        // Preallocated space not used
+        current.truncate((uint64_t)(blocks + 1) * LZB_BLOCK_SIZE);
+        checkpoint();
+      }
+    }
+    current.close();
+  }
+
+  void dropNext()  {
+
+    if (next)  {
+      next.close();
+      SD.remove(nextPath);
+    }
+    nextTried = false;
+  }
+
+  // Segment becomes the open one: header in its first block, journal updated
+  void openJournaled(uint32_t id, uint16_t count)  {
+
+    currentId = id;
+    blocks = count;
+    checkpointBlocks = count;
+    if (count == 0)
+      writeHeader(current);
+    writeJournal();
+  }
+
+  // Opens the segment starting at daySeconds, directory created once a day
+  void startSegment(uint32_t nmeaDate, uint32_t daySeconds)  {
+
+    closeCurrent();
+    dropNext();
+    if (nmeaDate != dirDate)  {
+      segmentPath(currentPath, nmeaDate, UINT32_MAX);
+      if (!SD.exists(currentPath) && !SD.mkdir(currentPath))  {
+        SERIAL_DBG("Could not create dir '")
+        SERIAL_DBG(currentPath)
+        SERIAL_DBG("'...\n")
+      }
+      dirDate = nmeaDate;
+    }
+    currentDate = nmeaDate;
+    currentSeconds = daySeconds;
+    segStart_ms = millis();
+    checkpoint_ms = millis();
+    segmentPath(currentPath, nmeaDate, daySeconds);
+    SERIAL_DBG("Opening log file '")
+    SERIAL_DBG(currentPath)
+    SERIAL_DBG("'...\n")
+    if (compressor)  {
+      uint32_t id;
+      uint16_t count = 0;
+      // Existing segment (restart within the same second): cut after its
+      // last block and appended to, not preallocated
+      if (SD.exists(currentPath) && recoverSegment(currentPath, id, count))
+        current = SD.open(currentPath, FILE_WRITE);
+      else  {
+        SD.remove(currentPath);
+        id = segmentId(nmeaDate, daySeconds);
+        createJournaled(currentPath, current, id);
+      }
+      if (!current)  {
+        SERIAL_DBG("Could not create new log file...\n")
+        return;
+      }
+      openJournaled(id, count);
+      return;
+    }
+    // Existing segment (restart within the same second) is appended to
+    current = SD.open(currentPath, FILE_WRITE);
+    if (!current)  {
+      SERIAL_DBG("Could not create new log file...\n")
+      return;
+    }
+    if (current.size() == 0)
+      writeHeader(current);
+  }
+
+  // Next segment of the day, the one created ahead if its name fits
+  void rotate(uint32_t nmeaDate, uint32_t daySeconds)  {
+
+    uint32_t gap = daySeconds > nextSeconds ? daySeconds - nextSeconds : nextSeconds - daySeconds;
+    if (!next || gap > LOG_SEG_NAME_TOLERANCE)  {
+      startSegment(nmeaDate, daySeconds);
+      return;
+    }
+    closeCurrent();
+    current = next;
+    next = File();
+    nextTried = false;
+    memcpy(currentPath, nextPath, LOG_SEG_PATH_LEN);
+    currentSeconds = nextSeconds;
+    segStart_ms = millis();
+    checkpoint_ms = millis();
+    if (compressor)
+      openJournaled(nextId, 0);
+  }
+};
+
+volatile uint32_t LogSegmenter::detectChanges = 0;
+
+#endif
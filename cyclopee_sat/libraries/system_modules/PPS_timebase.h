@@ -0,0 +1,224 @@
+/*
+ ****************************
+ *   PPS TIMEBASE MODULE    *
+ ****************************
+ * @brief:
+ *    This module is loaded to timestamp samples against the GNSS PPS edge.
+ *    Each PPS rising edge is captured on the CPU cycle counter, and the
+ *    counter rate is disciplined on the measured PPS period. The UTC second
+ *    of each edge is labelled from the NMEA epoch time, so that a
+ *    sub-millisecond UTC time can be read at any moment, even between
+ *    NMEA sentences.
+ * @note:
+ *    The edge is captured in the pin interrupt rather than with an FTM
+ *    input capture channel, FTM timers being used by analogWrite().
+ *    The interrupt latency is constant and well under a microsecond at 120MHz.
+ */
+/*
+ ****************
+ *  LIBRARIES   *
+ ****************
+ */
+// None required
+
+/*
+ **************************
+ *   GLOBAL DEFINITIONS   *
+ **************************
+ */
+// Time value if PPS timebase is not locked
+#define PPS_NO_TIME     UINT64_MAX
+// PPS edge label value while no NMEA epoch has been received
+#define PPS_NO_LABEL    UINT32_MAX
+// Microseconds in a day
+#define US_PER_DAY      86400000000ULL
+// Seconds in a day
+#define S_PER_DAY       86400UL
+
+/*
+ *********************
+ *   MODULE CONFIG   *
+ *********************
+ */
+// Teensy PPS input pin (GNSS module TIMEPULSE output)
+#define PPS_PIN           22
+// Maximum PPS period deviation from nominal CPU frequency to discipline the counter
+#define PPS_MAX_DEV_PPM   500
+// Discipline filter weight (new period weighs 1/2^PPS_FILTER_SHIFT)
+#define PPS_FILTER_SHIFT  3
+// Time without PPS edge after which timebase is considered unlocked
+// Must stay below the cycle counter wrap period (2^32 / F_CPU = 35s at 120MHz)
+#define PPS_HOLDOVER      10000/*ms*/
+// Time to wait for a first PPS edge during setup
+#define PPS_SETUP_TIMEOUT 3000/*ms*/
+
+/*
+ ***********************
+ *   GLOBAL VARIBLES   *
+ ***********************
+ */
+// Cycle counter value at last PPS edge
+volatile uint32_t ppsEdge_cyc = 0;
+// millis() value at last PPS edge
+volatile uint32_t ppsEdge_ms = 0;
+// Disciplined cycle counter rate
+volatile uint32_t ppsCyclesPerSec = F_CPU;
+// UTC second of day of last PPS edge
+volatile uint32_t ppsEdgeSec = PPS_NO_LABEL;
+// Number of PPS edges received
+volatile uint32_t ppsEdgeCount = 0;
+
+/*
+ ***************************
+ *   FUNCTION PROTOTYPES   *
+ ***************************
+ */
+void setupPPS(volatile bool& deviceConnected);
+void ppsEdgeISR();
+void ppsTagEpoch(const char* nmeaTime);
+uint64_t ppsTimeUs();
+bool ppsLocked();
+uint64_t nmeaTimeValToUs(const uint32_t& timeVal);
+
+/*
+ ****************************
+ *   FUNCTION DEFINITIONS   *
+ ****************************
+ */
+/*
+ * @brief:
+ *    Enables the cycle counter and attaches the PPS edge interrupt.
+ *    Waits PPS_SETUP_TIMEOUT for a first edge.
+ * @params:
+ *    deviceConnected: Bool to store if PPS signal is present or not.
+ */
+void setupPPS(volatile bool& deviceConnected)  {
+
+  // Enable CPU cycle counter
+  ARM_DEMCR |= ARM_DEMCR_TRCENA;
+  ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+
+  // PPS pin setup
+  pinMode(PPS_PIN, INPUT);
+  attachInterrupt(digitalPinToInterrupt(PPS_PIN), ppsEdgeISR, RISING);
+
+  // Wait for a first PPS edge
+  SERIAL_DBG("Waiting for PPS edge... ")
+  uint32_t startTime = millis();
+  while (ppsEdgeCount == 0 && millis() - startTime < PPS_SETUP_TIMEOUT);
+  if (ppsEdgeCount == 0)  {
+    SERIAL_DBG("No PPS signal, samples will be timestamped with NMEA time.\n")
+    deviceConnected = false;
+    return;
+  }
+  SERIAL_DBG("Done.\n")
+  deviceConnected = true;
+}
+
+/*
+ * @brief:
+ *    PPS rising edge interrupt.
+ *    Captures the cycle counter, disciplines the counter rate on the
+ *    PPS period and moves the edge label forward.
+ */
+void ppsEdgeISR()  {
+
+  uint32_t now_cyc = ARM_DWT_CYCCNT;
+  uint32_t now_ms = millis();
+  uint32_t period_cyc = now_cyc - ppsEdge_cyc;
+  uint32_t maxDev_cyc = F_CPU / 1000000 * PPS_MAX_DEV_PPM;
+  // Number of seconds elapsed since previous edge (missed edges included)
+  uint32_t nbSec = (now_ms - ppsEdge_ms + 500) / 1000;
+
+  // Ignore spurious edges
+  if (ppsEdgeCount > 0 && nbSec == 0)
+    return;
+
+  // Discipline counter rate on consecutive edges only
+  if (ppsEdgeCount > 0 && nbSec == 1 &&
+      period_cyc > F_CPU - maxDev_cyc && period_cyc < F_CPU + maxDev_cyc)
+    ppsCyclesPerSec += ((int32_t)(period_cyc - ppsCyclesPerSec)) >> PPS_FILTER_SHIFT;
+
+  // Move edge label forward
+  if (ppsEdgeSec != PPS_NO_LABEL)
+    ppsEdgeSec = (ppsEdgeSec + nbSec) % S_PER_DAY;
+
+  ppsEdge_cyc = now_cyc;
+  ppsEdge_ms = now_ms;
+  ppsEdgeCount++;
+}
+
+/*
+ * @brief:
+ *    Labels the last PPS edge with the UTC second of a NMEA epoch.
+ *    NMEA sentences are sent after their epoch, so the epoch belongs to
+ *    the last edge if its fraction of second has already elapsed since
+ *    that edge, otherwise the next edge has already been captured.
+ * @params:
+ *    nmeaTime: NMEA time field ("hhmmss.ss").
+ */
+void ppsTagEpoch(const char* nmeaTime)  {
+
+  // Check NMEA time field
+  if (strlen(nmeaTime) < 6)
+    return;
+  uint32_t h = (nmeaTime[0] - '0') * 10 + (nmeaTime[1] - '0');
+  uint32_t m = (nmeaTime[2] - '0') * 10 + (nmeaTime[3] - '0');
+  uint32_t s = (nmeaTime[4] - '0') * 10 + (nmeaTime[5] - '0');
+  uint32_t frac_ms = (nmeaTime[6] == '.') ? strtoul(nmeaTime + 7, NULL, 10) * 10 : 0;
+  uint32_t epochSec = h * 3600 + m * 60 + s;
+
+  noInterrupts();
+  if (ppsEdgeCount > 0 && millis() - ppsEdge_ms < PPS_HOLDOVER)  {
+    uint32_t sinceEdge_ms = (ARM_DWT_CYCCNT - ppsEdge_cyc) / (ppsCyclesPerSec / 1000);
+    ppsEdgeSec = (sinceEdge_ms >= frac_ms) ? epochSec : (epochSec + 1) % S_PER_DAY;
+  }
+  interrupts();
+}
+
+/*
+ * @brief:
+ *    Returns current UTC time from the PPS disciplined timebase.
+ * @return:
+ *    Microseconds since midnight UTC, PPS_NO_TIME if timebase not locked.
+ */
+uint64_t ppsTimeUs()  {
+
+  noInterrupts();
+  uint32_t now_cyc = ARM_DWT_CYCCNT;
+  uint32_t edge_cyc = ppsEdge_cyc;
+  uint32_t edge_ms = ppsEdge_ms;
+  uint32_t rate = ppsCyclesPerSec;
+  uint32_t edgeSec = ppsEdgeSec;
+  interrupts();
+
+  if (edgeSec == PPS_NO_LABEL || millis() - edge_ms >= PPS_HOLDOVER)
+    return PPS_NO_TIME;
+
+  uint64_t sinceEdge_us = (uint64_t)(now_cyc - edge_cyc) * 1000000ULL / rate;
+  return ((uint64_t)edgeSec * 1000000ULL + sinceEdge_us) % US_PER_DAY;
+}
+
+/*
+ * @brief:
+ *    Returns true if PPS edges are labelled and recent.
+ */
+bool ppsLocked()  {
+
+  return ppsEdgeSec != PPS_NO_LABEL && millis() - ppsEdge_ms < PPS_HOLDOVER;
+}
+
+/*
+ * @brief:
+ *    Converts a TinyGPSPlus time value to microseconds since midnight.
+ *    Used as fallback when the PPS timebase is not locked.
+ * @params:
+ *    timeVal: TinyGPSPlus time value (HHMMSSCC).
+ * @return:
+ *    Microseconds since midnight UTC.
+ */
+uint64_t nmeaTimeValToUs(const uint32_t& timeVal)  {
+
+  uint32_t sec = (timeVal / 1000000) * 3600 + ((timeVal / 10000) % 100) * 60 + (timeVal / 100) % 100;
+  return (uint64_t)sec * 1000000ULL + (timeVal % 100) * 10000ULL;
+}
@@ -0,0 +1,281 @@
+/*
+ ****************************
+ *    RTCM DEMUX MODULE     *
+ ****************************
+ * @brief:
+ *    This module is loaded to split the Bluetooth stream received from the
+ *    gateway (mpcd -N) into RTK corrections and orders:
+ *      - RTCM 3 frames (0xD3 preamble) are forwarded to the GNSS module
+ *        UART as their bytes arrive, there is no frame buffer: only the
+ *        3 bytes header is held until it is checked. The CRC-24Q is
+ *        computed on the way to count bad frames (the receiver drops them).
+ *      - Other bytes are gathered into order lines ('\n' terminated JSON,
+ *        e.g. {"order":"getConfig"}), handed over one at a time.
+ *    Each frame latency (first byte read to last byte queued on the GNSS
+ *    UART) is measured.
+ * @note:
+ *    No board specific code: Sink is any class with write(uint8_t)
+ *    (HardwareSerial). The caller feeds a byte only if the GNSS UART has
+ *    room for RTCM_DEMUX_HOLD + 1 bytes, so that feed() never blocks and
+ *    may run in an interrupt.
+ *
+ * @RTCM 3 frame:
+ *    0xD3 | 6 bits 0, 10 bits length | Payload (length bytes) | CRC-24Q (3 bytes)
+ *    The message type is the first 12 bits of the payload.
+ */
+#ifndef RTCM_DEMUX_H
+#define RTCM_DEMUX_H
+
+/*
+ ****************
+ *  LIBRARIES   *
+ ****************
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ *********************
+ *   MODULE CONFIG   *
+ *********************
+ */
+// Longest order line, longer lines are dropped
+#ifndef RTCM_DEMUX_MAX_ORDER_LEN
+#define RTCM_DEMUX_MAX_ORDER_LEN  128
+#endif
+// Silence after a frame before the correction burst of an epoch is considered over
+#ifndef RTCM_DEMUX_QUIET_US
+#define RTCM_DEMUX_QUIET_US       20000
+#endif
+// Bytes held before being forwarded (frame header)
+#define RTCM_DEMUX_HOLD           3
+#define RTCM_PREAMBLE             0xD3
+
+/*
+ *******************
+ *   RTCM DEMUX    *
+ *******************
+ */
+class RtcmDemux {
+
+public:
+  // Feed results
+  enum Event : uint8_t {
+    EVENT_NONE = 0,   // Byte consumed, nothing completed
+    EVENT_RTCM,       // Frame forwarded with a valid CRC
+    EVENT_ORDER       // Order line ready, see order()
+  };
+
+  // Counters
+  struct Stats {
+    uint32_t frames;
+    uint32_t crcErrors;
+    uint32_t bytesForwarded;
+    uint32_t orders;
+    // Orders lost: too long, or received before the previous one was read
+    uint32_t ordersDropped;
+    // Type and latency of the last valid frame
+    uint16_t lastType;
+    uint32_t lastLatency_us;
+    uint32_t maxLatency_us;
+    uint64_t sumLatency_us;
+  };
+
+  RtcmDemux()  { reset(); }
+
+  /*
+   * @brief:
+   *    Resets demux and counters.
+   */
+  void reset()  {
+    state = IDLE;
+    orderLen = 0;
+    orderOverflow = false;
+    pending = false;
+    lastFrameEnd_us = 0;
+    memset(&counters, 0, sizeof(counters));
+  }
+
+  /*
+   * @brief:
+   *    Consumes a byte from the gateway link.
+   * @params:
+   *    c: Byte read.
+   *    gnss: GNSS UART the frames are forwarded to.
+   *    now_us: Current time (micros()).
+   * @return:
+   *    Event completed by this byte.
+   */
+  template <typename Sink>
+  Event feed(uint8_t c, Sink& gnss, uint32_t now_us)  {
+
+    switch (state)  {
+      case IDLE:
+        if (c == RTCM_PREAMBLE)  {
+          hold[0] = c;
+          frameStart_us = now_us;
+          state = LOOKING_FOR_LENGTH_MSB;
+          return EVENT_NONE;
+        }
+        return orderByte(c);
+
+      case LOOKING_FOR_LENGTH_MSB:
+        // 6 reserved bits must be 0, otherwise 0xD3 was not a preamble
+        if (c & 0xFC)  {
+          state = IDLE;
+          return orderByte(c);
+        }
+        hold[1] = c;
+        state = LOOKING_FOR_LENGTH_LSB;
+        return EVENT_NONE;
+
+      case LOOKING_FOR_LENGTH_LSB:
+        hold[2] = c;
+        remaining = ((uint16_t)(hold[1] & 0x03) << 8) | c;
+        // A message holds at least its 12 bits type
+        if (remaining < 2)  {
+          state = IDLE;
+          return EVENT_NONE;
+        }
+        crc = 0;
+        for (uint8_t i = 0; i < RTCM_DEMUX_HOLD; i++)  {
+          crcUpdate(hold[i]);
+          gnss.write(hold[i]);
+        }
+        counters.bytesForwarded += RTCM_DEMUX_HOLD;
+        payloadIndex = 0;
+        state = PROCESSING_PAYLOAD;
+        return EVENT_NONE;
+
+      case PROCESSING_PAYLOAD:
+        gnss.write(c);
+        counters.bytesForwarded++;
+        crcUpdate(c);
+        if (payloadIndex == 0)
+          type = (uint16_t)c << 4;
+        else if (payloadIndex == 1)
+          type |= c >> 4;
+        payloadIndex++;
+        if (--remaining == 0)  {
+          rxCrc = 0;
+          crcIndex = 0;
+          state = LOOKING_FOR_CRC;
+        }
+        return EVENT_NONE;
+
+      case LOOKING_FOR_CRC:
+        gnss.write(c);
+        counters.bytesForwarded++;
+        rxCrc = (rxCrc << 8) | c;
+        if (++crcIndex < 3)
+          return EVENT_NONE;
+        state = IDLE;
+        lastFrameEnd_us = now_us;
+        if (rxCrc != (crc & 0xFFFFFF))  {
+          counters.crcErrors++;
+          return EVENT_NONE;
+        }
+        counters.frames++;
+        counters.lastType = type;
+        counters.lastLatency_us = now_us - frameStart_us;
+        counters.sumLatency_us += counters.lastLatency_us;
+        if (counters.lastLatency_us > counters.maxLatency_us)
+          counters.maxLatency_us = counters.lastLatency_us;
+        return EVENT_RTCM;
+    }
+    return EVENT_NONE;
+  }
+
+  /*
+   * @brief:
+   *    Returns true while a frame is being received, and for
+   *    RTCM_DEMUX_QUIET_US after it: the following frames of the epoch
+   *    are expected. Outgoing telemetry may wait meanwhile.
+   */
+  bool busy(uint32_t now_us) const  {
+    return state != IDLE || (lastFrameEnd_us != 0 && now_us - lastFrameEnd_us < RTCM_DEMUX_QUIET_US);
+  }
+
+  /*
+   * @brief:
+   *    Order line ready (without its line ending), valid until
+   *    releaseOrder(). The next order is dropped until then.
+   */
+  bool orderReady() const  { return pending; }
+  const char* order() const  { return orderOut; }
+  void releaseOrder()  { pending = false; }
+
+  const Stats& stats() const  { return counters; }
+
+private:
+  // Parse states
+  enum State : uint8_t {
+    IDLE = 0,
+    LOOKING_FOR_LENGTH_MSB,
+    LOOKING_FOR_LENGTH_LSB,
+    PROCESSING_PAYLOAD,
+    LOOKING_FOR_CRC
+  };
+
+  volatile State state;
+  Stats counters;
+  // Frame header held until checked
+  uint8_t hold[RTCM_DEMUX_HOLD];
+  uint16_t remaining;
+  uint16_t payloadIndex;
+  uint16_t type;
+  uint32_t crc, rxCrc;
+  uint8_t crcIndex;
+  uint32_t frameStart_us;
+  volatile uint32_t lastFrameEnd_us;
+  // Order line being received, and last complete order
+  char orderIn[RTCM_DEMUX_MAX_ORDER_LEN + 1];
+  char orderOut[RTCM_DEMUX_MAX_ORDER_LEN + 1];
+  uint16_t orderLen;
+  bool orderOverflow;
+  volatile bool pending;
+
+  // CRC-24Q (polynomial 0x1864CFB), one byte
+  void crcUpdate(uint8_t c)  {
+
+    crc ^= (uint32_t)c << 16;
+    for (uint8_t b = 0; b < 8; b++)  {
+      crc <<= 1;
+      if (crc & 0x1000000)
+        crc ^= 0x1864CFB;
+    }
+  }
+
+  Event orderByte(uint8_t c)  {
+
+    if (c == '\r')
+      return EVENT_NONE;
+    if (c != '\n')  {
+      if (orderLen < RTCM_DEMUX_MAX_ORDER_LEN)
+        orderIn[orderLen++] = (char)c;
+      else
+        orderOverflow = true;
+      return EVENT_NONE;
+    }
+
+    // End of line: empty lines are ignored
+    uint16_t len = orderLen;
+    bool overflow = orderOverflow;
+    orderLen = 0;
+    orderOverflow = false;
+    if (len == 0)
+      return EVENT_NONE;
+    if (overflow || pending)  {
+      counters.ordersDropped++;
+      return EVENT_NONE;
+    }
+    memcpy(orderOut, orderIn, len);
+    orderOut[len] = '\0';
+    counters.orders++;
+    pending = true;
+    return EVENT_ORDER;
+  }
+};
+
+#endif
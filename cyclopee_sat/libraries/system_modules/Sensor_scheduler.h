@@ -0,0 +1,296 @@
+/*
+ ****************************
+ *  SENSOR SCHEDULER MODULE *
+ ****************************
+ * @brief:
+ *    This module is loaded to sample each sensor at its own rate from a
+ *    single timer interrupt:
+ *      - Each channel declares its period, the lowest period the sensor
+ *        allows and its latency (time between start(), e.g. a DS18B20
+ *        conversion request, and read()).
+ *      - build() computes the timetable: the timer tick is the GCD of all
+ *        periods and latencies, and channels get a phase in rate-monotonic
+ *        order (shortest period first) so that their starts and reads
+ *        share as few ticks as possible with the channels already placed.
+ *        The timetable only depends on the channel configuration.
+ *      - tick(), called from the timer interrupt, runs the starts and
+ *        reads due and returns the channels read. read() returns true if
+ *        the channel value was refreshed: the sketch stores it as the
+ *        freshness flags of the record.
+ *      - Periods can be changed at runtime (Bluetooth order, see
+ *        parseIntervalOrder()), the timetable is then rebuilt.
+ * @note:
+ *    No board specific code: the sketch runs tick() on an IntervalTimer of
+ *    tickUs() and stops the timer while setPeriod() rebuilds the timetable.
+ *    Two events of periods Pi, Pj and offsets a, b meet on some tick iff
+ *    (a - b) is a multiple of GCD(Pi, Pj): phases are searched over the
+ *    LCM of these GCDs, not over the whole hyperperiod.
+ *
+ * @Order:
+ *    {"order":"update_interval","channel":"dist","value":100}
+ *    Without "channel", every channel is set to the value (or its lowest
+ *    period).
+ */
+#ifndef SENSOR_SCHEDULER_H
+#define SENSOR_SCHEDULER_H
+
+/*
+ ****************
+ *  LIBRARIES   *
+ ****************
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "JSON_order.h"
+
+/*
+ *********************
+ *   MODULE CONFIG   *
+ *********************
+ */
+// Channels of a scheduler (one bit each in the masks)
+#ifndef SCHED_MAX_CHANNELS
+#define SCHED_MAX_CHANNELS  8
+#endif
+// Longest period
+#ifndef SCHED_MAX_PERIOD
+#define SCHED_MAX_PERIOD    3600000/*ms*/
+#endif
+// Channel argument of setPeriod() for every channel
+#define SCHED_ALL_CHANNELS  -1
+
+/*
+ ************************
+ *   SENSOR SCHEDULER   *
+ ************************
+ */
+// Sensor channel, declared by the sketch from the sensor module definitions
+struct SchedChannel {
+  // Name used in orders
+  const char* name;
+  uint32_t period_ms;
+  // Sensor maximum rate
+  uint32_t minPeriod_ms;
+  // Time between start() and read() (0: read only)
+  uint32_t latency_ms;
+  // Starts an acquisition, NULL if none
+  void (*start)();
+  // Reads the channel value, returns true if it was refreshed
+  bool (*read)();
+};
+
+class SensorScheduler {
+
+public:
+  SensorScheduler(SchedChannel* channels, uint8_t count) : channels(channels), count(count) {}
+
+  /*
+   * @brief:
+   *    Computes the timer tick and the channel phases.
+   * @return:
+   *    False if a channel configuration is invalid (period below the
+   *    sensor minimum or above SCHED_MAX_PERIOD, latency not below the
+   *    period), the previous timetable is kept.
+   */
+  bool build()  {
+
+    if (count == 0 || count > SCHED_MAX_CHANNELS)
+      return false;
+    uint32_t tick = 0;
+    for (uint8_t i = 0; i < count; i++)  {
+      const SchedChannel& c = channels[i];
+      if (c.period_ms == 0 || c.period_ms < c.minPeriod_ms || c.period_ms > SCHED_MAX_PERIOD || c.latency_ms >= c.period_ms)
+        return false;
+      tick = gcd(tick, c.period_ms);
+      tick = gcd(tick, c.latency_ms);
+    }
+    tick_ms = tick;
+
+    // Rate-monotonic order, stable for equal periods
+    for (uint8_t i = 0; i < count; i++)  {
+      uint8_t j = i;
+      while (j > 0 && channels[order[j - 1]].period_ms > channels[i].period_ms)  {
+        order[j] = order[j - 1];
+        j--;
+      }
+      order[j] = i;
+    }
+
+    for (uint8_t k = 0; k < count; k++)  {
+      uint8_t i = order[k];
+      periodTicks[i] = channels[i].period_ms / tick_ms;
+      latencyTicks[i] = channels[i].latency_ms / tick_ms;
+      phaseTicks[i] = bestPhase(i, k);
+      startCountdown[i] = phaseTicks[i];
+      readCountdown[i] = phaseTicks[i] + latencyTicks[i];
+    }
+    return true;
+  }
+
+  /*
+   * @brief:
+   *    Runs the starts and reads due on this tick, channels in
+   *    rate-monotonic order. Called from the timer interrupt.
+   * @params:
+   *    freshMask: Channels whose value was refreshed (bit i: channel i).
+   * @return:
+   *    Channels read on this tick.
+   */
+  uint8_t tick(uint8_t& freshMask)  {
+
+    uint8_t readMask = 0;
+    freshMask = 0;
+    for (uint8_t k = 0; k < count; k++)  {
+      uint8_t i = order[k];
+      if (channels[i].start)  {
+        if (startCountdown[i] == 0)  {
+          channels[i].start();
+          startCountdown[i] = periodTicks[i];
+        }
+        startCountdown[i]--;
+      }
+      if (readCountdown[i] == 0)  {
+        readMask |= 1 << i;
+        if (channels[i].read())
+          freshMask |= 1 << i;
+        readCountdown[i] = periodTicks[i];
+      }
+      readCountdown[i]--;
+    }
+    return readMask;
+  }
+
+  /*
+   * @brief:
+   *    Changes channel periods and rebuilds the timetable. Stop the timer
+   *    before, and restart it at tickUs().
+   * @params:
+   *    channel: Channel index, SCHED_ALL_CHANNELS for every channel (the
+   *             period is raised to each sensor minimum).
+   * @return:
+   *    False if the period is not accepted, periods are left unchanged.
+   */
+  bool setPeriod(int16_t channel, uint32_t period_ms)  {
+
+    if (channel >= count)
+      return false;
+    uint32_t previous[SCHED_MAX_CHANNELS];
+    for (uint8_t i = 0; i < count; i++)  {
+      previous[i] = channels[i].period_ms;
+      if (channel == SCHED_ALL_CHANNELS)
+        channels[i].period_ms = period_ms > channels[i].minPeriod_ms ? period_ms : channels[i].minPeriod_ms;
+    }
+    if (channel != SCHED_ALL_CHANNELS)
+      channels[channel].period_ms = period_ms;
+    if (build())
+      return true;
+    for (uint8_t i = 0; i < count; i++)
+      channels[i].period_ms = previous[i];
+    build();
+    return false;
+  }
+
+  /*
+   * @brief:
+   *    Reads an update_interval order.
+   * @params:
+   *    order: Order line received from the gateway.
+   *    channel: Channel index, SCHED_ALL_CHANNELS without "channel".
+   *    period_ms: "value" member.
+   * @return:
+   *    False if it is another order, the channel is unknown or the value
+   *    is missing.
+   */
+  bool parseIntervalOrder(const char* order, int16_t& channel, uint32_t& period_ms) const  {
+
+    if (!strstr(order, "\"update_interval\""))
+      return false;
+    const char* value = jsonMember(order, "value");
+    if (!value || *value < '0' || *value > '9')
+      return false;
+    period_ms = strtoul(value, NULL, 10);
+    channel = SCHED_ALL_CHANNELS;
+    const char* name = jsonMember(order, "channel");
+    if (!name)
+      return true;
+    if (*name++ != '"')
+      return false;
+    for (uint8_t i = 0; i < count; i++)  {
+      size_t len = strlen(channels[i].name);
+      if (strncmp(name, channels[i].name, len) == 0 && name[len] == '"')  {
+        channel = i;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  uint32_t tickUs() const  { return tick_ms * 1000; }
+  uint32_t tickMs() const  { return tick_ms; }
+  uint8_t size() const  { return count; }
+  const SchedChannel& channel(uint8_t i) const  { return channels[i]; }
+  // Ticks between the timetable start and the first read of a channel
+  uint32_t phase(uint8_t i) const  { return phaseTicks[i]; }
+  // Channel in the rate-monotonic order
+  uint8_t rank(uint8_t k) const  { return order[k]; }
+
+private:
+  SchedChannel* channels;
+  uint8_t count;
+  uint32_t tick_ms = 0;
+  uint8_t order[SCHED_MAX_CHANNELS];
+  uint32_t periodTicks[SCHED_MAX_CHANNELS], latencyTicks[SCHED_MAX_CHANNELS], phaseTicks[SCHED_MAX_CHANNELS];
+  uint32_t startCountdown[SCHED_MAX_CHANNELS], readCountdown[SCHED_MAX_CHANNELS];
+
+  static uint32_t gcd(uint32_t a, uint32_t b)  {
+
+    while (b)  {
+      uint32_t t = a % b;
+      a = b;
+      b = t;
+    }
+    return a;
+  }
+
+  // Events of a channel at phase p: start at p (if any), read at p + latency
+  uint8_t events(uint8_t i, uint32_t p, uint32_t* offsets) const  {
+
+    uint8_t n = 0;
+    if (channels[i].start)
+      offsets[n++] = p;
+    offsets[n++] = p + latencyTicks[i];
+    return n;
+  }
+
+  // Phase of the k-th channel (rate-monotonic) meeting the fewest events of the channels placed before
+  uint32_t bestPhase(uint8_t i, uint8_t k) const  {
+
+    // Meetings with a placed channel j only depend on p modulo GCD(Pi, Pj)
+    uint32_t span = 1;
+    for (uint8_t m = 0; m < k; m++)  {
+      uint32_t g = gcd(periodTicks[i], periodTicks[order[m]]);
+      span = span / gcd(span, g) * g;
+    }
+    uint32_t best = 0, bestMeetings = UINT32_MAX;
+    for (uint32_t p = 0; p < span && bestMeetings > 0; p++)  {
+      uint32_t mine[2], theirs[2], meetings = 0;
+      uint8_t nMine = events(i, p, mine);
+      for (uint8_t m = 0; m < k; m++)  {
+        uint8_t j = order[m];
+        uint32_t g = gcd(periodTicks[i], periodTicks[j]);
+        uint8_t nTheirs = events(j, phaseTicks[j], theirs);
+        for (uint8_t a = 0; a < nMine; a++)
+          for (uint8_t b = 0; b < nTheirs; b++)
+            meetings += (mine[a] % g) == (theirs[b] % g);
+      }
+      if (meetings < bestMeetings)  {
+        best = p;
+        bestMeetings = meetings;
+      }
+    }
+    return best;
+  }
+};
+
+#endif
@@ -0,0 +1,251 @@
+/*
+ ****************************
+ *    SENSOR SET MODULE     *
+ ****************************
+ * @brief:
+ *    This module is loaded to run several sensors of the same kind in one
+ *    build, e.g. the URM14, A01NYUB and JSN SR04T distance sensors side by
+ *    side (Grafana "urm", "a01" and "dist" panels):
+ *      - Each sensor module declares a driver type: a static descriptor
+ *        (SensorDesc: name, CSV header, sampling, value when disconnected,
+ *        decimals) and static setup(), start() and read() functions.
+ *      - SensorSet<URM14, A01NYUB, DS18B20> generates at compile time the
+ *        setup of every sensor, their scheduler channels
+ *        (Sensor_scheduler.h), the record layout (one value per sensor, in
+ *        the set order) and the CSV and JSON emitters.
+ *    Calls are resolved at compile time: no virtual function, no table of
+ *    names searched at runtime.
+ * @note:
+ *    Sketches using a set define SENSOR_SET before including the sensor
+ *    modules: modules then only declare their driver type, without the
+ *    shared setupDistSensor()/readDistance()/DIST_NO_VALUE API of the
+ *    single sensor sketches.
+ *    The set state is static (the scheduler reads are plain functions):
+ *    one set per sensor list. Reads run in the sensor timer interrupt, the
+ *    sketch copies the values with sample() interrupts off.
+ *
+ * @Usage:
+ *    #define SENSOR_SET
+ *    #include "URM14_distance.h" ...
+ *    typedef SensorSet<URM14, A01NYUB, JSN_SR04T, DS18B20> Sensors;
+ *    Sensors::setup();
+ *    Sensors::channels(sensorChannels + CH_FIRST_SENSOR);
+ *    Sensors::values[Sensors::indexOf<A01NYUB>()]
+ */
+#ifndef SENSOR_SET_H
+#define SENSOR_SET_H
+
+/*
+ ****************
+ *  LIBRARIES   *
+ ****************
+ */
+#include <Arduino.h>
+#include <stdint.h>
+#include "Sensor_scheduler.h"
+
+/*
+ *************************
+ *   SENSOR DESCRIPTOR   *
+ *************************
+ */
+// Static descriptor of a driver type (constexpr member desc)
+struct SensorDesc {
+  // Name used in orders and JSON members
+  const char* name;
+  // CSV column header
+  const char* header;
+  // Sampling (Sensor_scheduler.h)
+  uint32_t period_ms;
+  uint32_t minPeriod_ms;
+  uint32_t latency_ms;
+  // Value read when the sensor is disconnected, not emitted
+  float noValue;
+  // Decimals of the emitted values
+  uint8_t decimals;
+};
+
+/*
+ ******************
+ *   SENSOR SET   *
+ ******************
+ */
+// Index of T in a sensor list (size of the list if absent)
+template <class T, class... Sensors>
+struct SensorIndex;
+template <class T>
+struct SensorIndex<T>  {
+  static constexpr uint8_t value = 0;
+};
+template <class T, class... Rest>
+struct SensorIndex<T, T, Rest...>  {
+  static constexpr uint8_t value = 0;
+};
+template <class T, class First, class... Rest>
+struct SensorIndex<T, First, Rest...>  {
+  static constexpr uint8_t value = 1 + SensorIndex<T, Rest...>::value;
+};
+
+// True if no driver type is listed twice
+template <class... Sensors>
+struct SensorsDistinct;
+template <>
+struct SensorsDistinct<>  {
+  static constexpr bool value = true;
+};
+template <class First, class... Rest>
+struct SensorsDistinct<First, Rest...>  {
+  static constexpr bool value = SensorIndex<First, Rest...>::value == sizeof...(Rest) && SensorsDistinct<Rest...>::value;
+};
+
+template <class... Sensors>
+class SensorSet {
+
+public:
+  static constexpr uint8_t size = sizeof...(Sensors);
+  static_assert(size > 0 && size <= SCHED_MAX_CHANNELS, "SensorSet: 1 to SCHED_MAX_CHANNELS sensors");
+  static_assert(SensorsDistinct<Sensors...>::value, "SensorSet: sensor listed twice");
+
+  // Sampled values, one per sensor in the set order
+  struct Record {
+    // Sensors refreshed (bit i: sensor i), others are not emitted
+    uint8_t fresh;
+    float values[sizeof...(Sensors)];
+  };
+
+  // Last values read, disconnection flags
+  static volatile float values[sizeof...(Sensors)];
+  static volatile bool connected[sizeof...(Sensors)];
+
+  // Index of a sensor in the set, its channel and record value
+  template <class T>
+  static constexpr uint8_t indexOf()  {
+
+    static_assert(SensorIndex<T, Sensors...>::value < sizeof...(Sensors), "SensorSet: sensor not in the set");
+    return SensorIndex<T, Sensors...>::value;
+  }
+
+  /*
+   * @brief:
+   *    Sets up the sensors in the set order, values start disconnected.
+   */
+  static void setup()  { Each<0, Sensors...>::setup(); }
+
+  /*
+   * @brief:
+   *    Writes the scheduler channels of the sensors.
+   * @params:
+   *    out: First of size channels, in the set order (fresh bits of the
+   *         scheduler start at the same offset).
+   * @return:
+   *    Channels written.
+   */
+  static uint8_t channels(SchedChannel* out)  {
+
+    Each<0, Sensors...>::channel(out);
+    return size;
+  }
+
+  /*
+   * @brief:
+   *    Copies the last values. Call with interrupts off.
+   * @params:
+   *    fresh: Sensors refreshed since the last record (bit i: sensor i).
+   */
+  static void sample(Record& rec, uint8_t fresh)  {
+
+    rec.fresh = fresh;
+    for (uint8_t i = 0; i < size; i++)
+      rec.values[i] = values[i];
+  }
+
+  // ",header" of every sensor
+  static void csvHeader(String& str)  { Each<0, Sensors...>::csvHeader(str); }
+
+  /*
+   * @brief:
+   *    Appends ",value" of every sensor, empty if not refreshed or
+   *    disconnected.
+   */
+  static void csvValues(String& str, const Record& rec)  { Each<0, Sensors...>::csvValues(str, rec); }
+
+  /*
+   * @brief:
+   *    Appends ,"name":value of the sensors refreshed and connected.
+   */
+  static void jsonValues(String& str, const Record& rec)  { Each<0, Sensors...>::jsonValues(str, rec); }
+
+private:
+  // Unrolled over the sensor list, I: index of First
+  template <uint8_t I, class... List>
+  struct Each  {
+    static void setup()  {}
+    static void channel(SchedChannel* out)  {}
+    static void csvHeader(String& str)  {}
+    static void csvValues(String& str, const Record& rec)  {}
+    static void jsonValues(String& str, const Record& rec)  {}
+  };
+  template <uint8_t I, class First, class... Rest>
+  struct Each<I, First, Rest...>  {
+
+    static void setup()  {
+
+      values[I] = First::desc.noValue;
+      First::setup(connected[I]);
+      Each<I + 1, Rest...>::setup();
+    }
+
+    // Scheduler read of the sensor, true if the value was refreshed
+    static bool read()  {
+
+      float value = values[I];
+      bool fresh = First::read(value, connected[I]);
+      values[I] = value;
+      return fresh;
+    }
+
+    static void channel(SchedChannel* out)  {
+
+      out[I] = {First::desc.name, First::desc.period_ms, First::desc.minPeriod_ms, First::desc.latency_ms,
+                First::desc.latency_ms ? First::start : NULL, read};
+      Each<I + 1, Rest...>::channel(out);
+    }
+
+    static bool valid(const Record& rec)  { return (rec.fresh & (1 << I)) && rec.values[I] != First::desc.noValue; }
+
+    static void csvHeader(String& str)  {
+
+      str += ',';
+      str += First::desc.header;
+      Each<I + 1, Rest...>::csvHeader(str);
+    }
+
+    static void csvValues(String& str, const Record& rec)  {
+
+      str += ',';
+      if (valid(rec))
+        str += String(rec.values[I], First::desc.decimals);
+      Each<I + 1, Rest...>::csvValues(str, rec);
+    }
+
+    static void jsonValues(String& str, const Record& rec)  {
+
+      if (valid(rec))  {
+        str += ",\"";
+        str += First::desc.name;
+        str += "\":";
+        str += String(rec.values[I], First::desc.decimals);
+      }
+      Each<I + 1, Rest...>::jsonValues(str, rec);
+    }
+  };
+};
+
+template <class... Sensors>
+constexpr uint8_t SensorSet<Sensors...>::size;
+template <class... Sensors>
+volatile float SensorSet<Sensors...>::values[sizeof...(Sensors)];
+template <class... Sensors>
+volatile bool SensorSet<Sensors...>::connected[sizeof...(Sensors)];
+
+#endif
@@ -0,0 +1,253 @@
+/*
+ ****************************
+ *    UBX FILTER MODULE     *
+ ****************************
+ * @brief:
+ *    This module is loaded to decide which frames reported by the UBX
+ *    framer (UBX_framer.h) are worth logging:
+ *      - UBX class/ID and NMEA sentence allow lists;
+ *      - RXM-SFRBX deduplication: a subframe already seen for the same
+ *        SV (same data words, e.g. decoded on another signal) is dropped;
+ *      - NAV class decimation: one message per ID per navInterval_ms,
+ *        based on the message iTOW.
+ *    Frames that do not match any rule are dropped. An empty allow list
+ *    keeps every frame of its kind.
+ * @note:
+ *    No board specific code. Call reset() when a new log file is opened
+ *    so that each file holds its own SFRBX subframes.
+ */
+#ifndef UBX_FILTER_H
+#define UBX_FILTER_H
+
+/*
+ ****************
+ *  LIBRARIES   *
+ ****************
+ */
+#include "UBX_framer.h"
+
+/*
+ **************************
+ *   GLOBAL DEFINITIONS   *
+ **************************
+ */
+#define UBX_CLASS_NAV     0x01
+#define UBX_CLASS_RXM     0x02
+#define UBX_ID_RXM_SFRBX  0x13
+// SFRBX payload: gnssId, svId, reserved, freqId, numWords, chn, version, reserved, words...
+#define SFRBX_HEADER_SIZE 8
+
+/*
+ *********************
+ *   MODULE CONFIG   *
+ *********************
+ */
+// Maximum number of entries in each allow list
+#ifndef UBX_FILTER_MAX_ALLOWED
+#define UBX_FILTER_MAX_ALLOWED  16
+#endif
+// Number of recent SFRBX subframes remembered for deduplication
+#ifndef UBX_FILTER_SFRBX_HISTORY
+#define UBX_FILTER_SFRBX_HISTORY 64
+#endif
+// Maximum number of decimated NAV IDs
+#ifndef UBX_FILTER_MAX_NAV_IDS
+#define UBX_FILTER_MAX_NAV_IDS  8
+#endif
+
+/*
+ *******************
+ *   UBX FILTER    *
+ *******************
+ */
+class UbxFilter {
+
+public:
+  UbxFilter()  {
+    nbAllowedUbx = nbAllowedNmea = 0;
+    sfrbxDedupe = false;
+    navInterval_ms = 0;
+    reset();
+  }
+
+  /*
+   * @brief:
+   *    Adds a UBX class/ID to the allow list.
+   * @return:
+   *    False if allow list is full.
+   */
+  bool allowUbx(uint8_t cls, uint8_t id)  {
+    if (nbAllowedUbx == UBX_FILTER_MAX_ALLOWED)
+      return false;
+    allowedUbx[nbAllowedUbx++] = (cls << 8) | id;
+    return true;
+  }
+
+  /*
+   * @brief:
+   *    Adds a NMEA sentence type (talker ID excluded, e.g. "GGA") to the allow list.
+   * @return:
+   *    False if allow list is full.
+   */
+  bool allowNmea(const char* type)  {
+    if (nbAllowedNmea == UBX_FILTER_MAX_ALLOWED)
+      return false;
+    memcpy(allowedNmea[nbAllowedNmea++], type, 3);
+    return true;
+  }
+
+  // Enables RXM-SFRBX deduplication
+  void setSfrbxDedupe(bool enable)  { sfrbxDedupe = enable; }
+
+  // Keeps one NAV message per ID every interval_ms (0 to keep all)
+  void setNavInterval(uint32_t interval_ms)  { navInterval_ms = interval_ms; }
+
+  /*
+   * @brief:
+   *    Forgets SFRBX subframes and NAV epochs seen, resets statistics.
+   */
+  void reset()  {
+    memset(sfrbxHistory, 0, sizeof(sfrbxHistory));
+    sfrbxNext = 0;
+    nbNavIds = 0;
+    keptFrames = droppedFrames = droppedBytes = 0;
+  }
+
+  /*
+   * @brief:
+   *    Decides if a completed frame is logged.
+   * @params:
+   *    frame: Frame reported by the framer (UBX or NMEA).
+   * @return:
+   *    True if frame has to be logged.
+   */
+  bool keep(const UbxFramer::Frame& frame)  {
+
+    bool kept = (frame.type == UbxFramer::FRAME_UBX) ? keepUbx(frame) : keepNmea(frame);
+    if (kept)
+      keptFrames++;
+    else  {
+      droppedFrames++;
+      droppedBytes += frame.length;
+    }
+    return kept;
+  }
+
+  // Statistics since last reset()
+  uint32_t keptFrames;
+  uint32_t droppedFrames;
+  uint32_t droppedBytes;
+
+private:
+  // SFRBX subframe fingerprint
+  struct SfrbxEntry {
+    uint8_t gnssId;
+    uint8_t svId;
+    uint16_t used;
+    uint32_t hash;
+  };
+  // Last kept NAV epoch per ID
+  struct NavEntry {
+    uint8_t id;
+    uint32_t lastSlot;
+  };
+
+  uint16_t allowedUbx[UBX_FILTER_MAX_ALLOWED];
+  uint8_t nbAllowedUbx;
+  char allowedNmea[UBX_FILTER_MAX_ALLOWED][3];
+  uint8_t nbAllowedNmea;
+  bool sfrbxDedupe;
+  uint32_t navInterval_ms;
+  SfrbxEntry sfrbxHistory[UBX_FILTER_SFRBX_HISTORY];
+  uint8_t sfrbxNext;
+  NavEntry navIds[UBX_FILTER_MAX_NAV_IDS];
+  uint8_t nbNavIds;
+
+  bool keepUbx(const UbxFramer::Frame& frame)  {
+
+    uint16_t type = (frame.cls << 8) | frame.id;
+    bool allowed = nbAllowedUbx == 0;
+    for (uint8_t i = 0; i < nbAllowedUbx && !allowed; i++)
+      allowed = allowedUbx[i] == type;
+    if (!allowed)
+      return false;
+
+    if (sfrbxDedupe && frame.cls == UBX_CLASS_RXM && frame.id == UBX_ID_RXM_SFRBX)
+      return firstSeenSubframe(frame);
+    if (navInterval_ms > 0 && frame.cls == UBX_CLASS_NAV)
+      return navSlotStart(frame);
+    return true;
+  }
+
+  bool keepNmea(const UbxFramer::Frame& frame)  {
+
+    if (nbAllowedNmea == 0)
+      return true;
+    // Skip the 2 characters talker ID
+    for (uint8_t i = 0; i < nbAllowedNmea; i++)
+      if (memcmp(frame.nmeaType + 2, allowedNmea[i], 3) == 0)
+        return true;
+    return false;
+  }
+
+  /*
+   * @brief:
+   *    Returns true if this SV subframe has not been seen recently.
+   *    Subframes are identified by a FNV-1a hash of their data words.
+   */
+  bool firstSeenSubframe(const UbxFramer::Frame& frame)  {
+
+    // Frame too short to be identified: keep it
+    if (frame.headLength <= SFRBX_HEADER_SIZE)
+      return true;
+    uint8_t gnssId = frame.head[0], svId = frame.head[1];
+    uint32_t hash = 2166136261UL;
+    for (uint16_t i = SFRBX_HEADER_SIZE; i < frame.headLength; i++)
+      hash = (hash ^ frame.head[i]) * 16777619UL;
+    hash ^= frame.payloadLength;
+
+    for (uint8_t i = 0; i < UBX_FILTER_SFRBX_HISTORY; i++)  {
+      const SfrbxEntry& e = sfrbxHistory[i];
+      if (e.used && e.gnssId == gnssId && e.svId == svId && e.hash == hash)
+        return false;
+    }
+    SfrbxEntry& e = sfrbxHistory[sfrbxNext];
+    e.gnssId = gnssId;
+    e.svId = svId;
+    e.used = 1;
+    e.hash = hash;
+    sfrbxNext = (sfrbxNext + 1) % UBX_FILTER_SFRBX_HISTORY;
+    return true;
+  }
+
+  /*
+   * @brief:
+   *    Returns true for the first message of a NAV ID in each
+   *    navInterval_ms slot of iTOW (first 4 payload bytes).
+   */
+  bool navSlotStart(const UbxFramer::Frame& frame)  {
+
+    if (frame.headLength < 4)
+      return true;
+    uint32_t iTOW = frame.head[0] | (frame.head[1] << 8) | ((uint32_t)frame.head[2] << 16) | ((uint32_t)frame.head[3] << 24);
+    uint32_t slot = iTOW / navInterval_ms;
+
+    for (uint8_t i = 0; i < nbNavIds; i++)  {
+      if (navIds[i].id == frame.id)  {
+        if (navIds[i].lastSlot == slot)
+          return false;
+        navIds[i].lastSlot = slot;
+        return true;
+      }
+    }
+    // First message of this ID
+    if (nbNavIds < UBX_FILTER_MAX_NAV_IDS)  {
+      navIds[nbNavIds].id = frame.id;
+      navIds[nbNavIds].lastSlot = slot;
+      nbNavIds++;
+    }
+    return true;
+  }
+};
+
+#endif
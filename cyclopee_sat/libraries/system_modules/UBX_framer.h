@@ -0,0 +1,379 @@
+/*
+ ****************************
+ *    UBX FRAMER MODULE     *
+ ****************************
+ * @brief:
+ *    This module is loaded to split a u-blox UART stream (UBX and NMEA
+ *    messages interleaved) into frames.
+ *    Bytes are consumed by spans of any size, a frame may straddle several
+ *    spans. UBX Fletcher checksums are computed a 32-bit word at a time on
+ *    the payload and NMEA checksums are checked. Each completed frame is
+ *    reported with its class/ID (or NMEA sentence type), its total length
+ *    and the first UBX_FRAMER_HEAD_SIZE bytes of its payload.
+ * @note:
+ *    No board specific code: used by the Teensy and SAMD loggers and
+ *    compiled on host by the gateway tests
+ *    (gateway/mpcd/tests/ubx_framer_test.cpp, make check) to check
+ *    generated and recorded .ubx streams.
+ *    Words are loaded with memcpy(), the Cortex-M0+ does not support
+ *    unaligned accesses.
+ *
+ * @UBX frame:
+ *    0xB5 0x62 | Class | ID | Length (LE, 2 bytes) | Payload | CK_A | CK_B
+ * @NMEA frame:
+ *    $ | Type (5 chars) | ,fields... | * | Checksum (2 hex chars) | CR | LF
+ */
+#ifndef UBX_FRAMER_H
+#define UBX_FRAMER_H
+
+/*
+ ****************
+ *  LIBRARIES   *
+ ****************
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ *********************
+ *   MODULE CONFIG   *
+ *********************
+ */
+// Number of payload bytes kept for frame inspection (NAV-PVT flags are at offset 21)
+#ifndef UBX_FRAMER_HEAD_SIZE
+#define UBX_FRAMER_HEAD_SIZE  64
+#endif
+// Maximum length for an NMEA message, used to detect lost sync
+#ifndef UBX_FRAMER_MAX_NMEA_LEN
+#define UBX_FRAMER_MAX_NMEA_LEN 100
+#endif
+
+/*
+ *******************
+ *   UBX FRAMER    *
+ *******************
+ */
+class UbxFramer {
+
+public:
+  // Frame types
+  enum FrameType : uint8_t {
+    FRAME_NONE = 0,   // No frame completed in consumed bytes
+    FRAME_UBX,
+    FRAME_NMEA,
+    FRAME_ERROR       // Sync lost, framer is hunting for a new frame start
+  };
+
+  // Sync errors
+  enum FrameError : uint8_t {
+    ERR_NONE = 0,
+    ERR_SYNC,           // Neither 0xB5 nor '$' where a frame should start
+    ERR_SYNC_62,        // 0xB5 not followed by 0x62
+    ERR_UBX_CHECKSUM,
+    ERR_NMEA_LENGTH,
+    ERR_NMEA_CHECKSUM,
+    ERR_NMEA_CR,
+    ERR_NMEA_LF
+  };
+
+  // Completed frame
+  struct Frame {
+    FrameType type;
+    FrameError error;
+    // UBX class and ID
+    uint8_t cls;
+    uint8_t id;
+    // UBX payload length or NMEA length between '$' and '*'
+    uint16_t payloadLength;
+    // Total frame length in bytes (sync chars and checksum included)
+    uint32_t length;
+    // NMEA sentence type (e.g. "GNGGA")
+    char nmeaType[6];
+    // First payload bytes (UBX) or characters following '$' (NMEA)
+    uint8_t head[UBX_FRAMER_HEAD_SIZE];
+    uint16_t headLength;
+  };
+
+  UbxFramer()  { reset(); }
+
+  /*
+   * @brief:
+   *    Resets framer, next byte is expected to start a frame.
+   */
+  void reset()  {
+    state = LOOKING_FOR_B5_DOLLAR;
+    hunting = false;
+    memset(&frame, 0, sizeof(frame));
+  }
+
+  /*
+   * @brief:
+   *    Returns true if framer is between two frames.
+   *    A new file may be opened at this point.
+   */
+  bool idle() const  { return state == LOOKING_FOR_B5_DOLLAR; }
+
+  /*
+   * @brief:
+   *    Consumes bytes until a frame is completed or data is exhausted.
+   * @params:
+   *    data: Bytes to parse.
+   *    len: Number of bytes available.
+   *    out: Completed frame (type FRAME_NONE if none).
+   * @return:
+   *    Number of bytes consumed. The completed frame (if any) ends on the
+   *    last consumed byte.
+   */
+  size_t parse(const uint8_t* data, size_t len, Frame& out)  {
+
+    size_t i = 0;
+    out.type = FRAME_NONE;
+
+    while (i < len)  {
+      // Bulk payload processing
+      if (state == PROCESSING_PAYLOAD)  {
+        size_t n = remaining < len - i ? remaining : len - i;
+        capture(data + i, n);
+        fletcher(data + i, n);
+        remaining -= n;
+        frame.length += n;
+        i += n;
+        if (remaining == 0)
+          state = LOOKING_FOR_CHECKSUM_A;
+        continue;
+      }
+
+      uint8_t c = data[i++];
+      frame.length++;
+
+      switch (state)  {
+        case LOOKING_FOR_B5_DOLLAR:
+          frame.length = 1;
+          if (c == 0xB5)
+            state = LOOKING_FOR_62;
+          else if (c == '$')
+            startNMEA();
+          // Hunting after an error: silently skip bytes
+          else if (fail(ERR_SYNC, out))
+            return i;
+          break;
+
+        case LOOKING_FOR_62:
+          if (c != 0x62)  {
+            if (fail(ERR_SYNC_62, out))
+              return i;
+            break;
+          }
+          ckA = ckB = 0;
+          frame.headLength = 0;
+          state = LOOKING_FOR_CLASS;
+          break;
+
+        case LOOKING_FOR_CLASS:
+          frame.cls = c;
+          ckA += c; ckB += ckA;
+          state = LOOKING_FOR_ID;
+          break;
+
+        case LOOKING_FOR_ID:
+          frame.id = c;
+          ckA += c; ckB += ckA;
+          state = LOOKING_FOR_LENGTH_LSB;
+          break;
+
+        case LOOKING_FOR_LENGTH_LSB:
+          frame.payloadLength = c;
+          ckA += c; ckB += ckA;
+          state = LOOKING_FOR_LENGTH_MSB;
+          break;
+
+        case LOOKING_FOR_LENGTH_MSB:
+          frame.payloadLength |= (uint16_t)c << 8;
+          ckA += c; ckB += ckA;
+          remaining = frame.payloadLength;
+          state = remaining > 0 ? PROCESSING_PAYLOAD : LOOKING_FOR_CHECKSUM_A;
+          break;
+
+        case LOOKING_FOR_CHECKSUM_A:
+          rxCkA = c;
+          state = LOOKING_FOR_CHECKSUM_B;
+          break;
+
+        case LOOKING_FOR_CHECKSUM_B:
+          if (rxCkA != (uint8_t)ckA || c != (uint8_t)ckB)  {
+            if (fail(ERR_UBX_CHECKSUM, out))
+              return i;
+            break;
+          }
+          return complete(FRAME_UBX, i, out);
+
+        // NMEA messages
+        case LOOKING_FOR_ASTERIX:
+          if (c == '*')  {
+            state = LOOKING_FOR_CSUM1;
+            break;
+          }
+          if (++frame.payloadLength > UBX_FRAMER_MAX_NMEA_LEN)  {
+            if (fail(ERR_NMEA_LENGTH, out))
+              return i;
+            break;
+          }
+          if (frame.payloadLength <= 5)
+            frame.nmeaType[frame.payloadLength - 1] = c;
+          capture(&c, 1);
+          nmeaCsum ^= c;
+          break;
+
+        case LOOKING_FOR_CSUM1:
+          if (c != hexChar(nmeaCsum >> 4))  {
+            if (fail(ERR_NMEA_CHECKSUM, out))
+              return i;
+            break;
+          }
+          state = LOOKING_FOR_CSUM2;
+          break;
+
+        case LOOKING_FOR_CSUM2:
+          if (c != hexChar(nmeaCsum & 0x0F))  {
+            if (fail(ERR_NMEA_CHECKSUM, out))
+              return i;
+            break;
+          }
+          state = LOOKING_FOR_TERM1;
+          break;
+
+        case LOOKING_FOR_TERM1:
+          if (c != '\r')  {
+            if (fail(ERR_NMEA_CR, out))
+              return i;
+            break;
+          }
+          state = LOOKING_FOR_TERM2;
+          break;
+
+        case LOOKING_FOR_TERM2:
+          if (c != '\n')  {
+            if (fail(ERR_NMEA_LF, out))
+              return i;
+            break;
+          }
+          return complete(FRAME_NMEA, i, out);
+
+        default:
+          break;
+      }
+    }
+
+    return i;
+  }
+
+private:
+  // Parse states
+  enum State : uint8_t {
+    LOOKING_FOR_B5_DOLLAR = 0,
+    LOOKING_FOR_62,
+    LOOKING_FOR_CLASS,
+    LOOKING_FOR_ID,
+    LOOKING_FOR_LENGTH_LSB,
+    LOOKING_FOR_LENGTH_MSB,
+    PROCESSING_PAYLOAD,
+    LOOKING_FOR_CHECKSUM_A,
+    LOOKING_FOR_CHECKSUM_B,
+    LOOKING_FOR_ASTERIX,
+    LOOKING_FOR_CSUM1,
+    LOOKING_FOR_CSUM2,
+    LOOKING_FOR_TERM1,
+    LOOKING_FOR_TERM2
+  };
+
+  State state;
+  // Sync lost: errors are not reported again until a frame is completed
+  bool hunting;
+  // Frame being parsed
+  Frame frame;
+  // UBX payload bytes left
+  uint16_t remaining;
+  // Running Fletcher checksum (only the low byte is meaningful)
+  uint32_t ckA, ckB;
+  uint8_t rxCkA;
+  // Running NMEA checksum
+  uint8_t nmeaCsum;
+
+  /*
+   * @brief:
+   *    Fletcher checksum over a payload span, one 32-bit word at a time.
+   *    For bytes b0..b3 : A += b0+b1+b2+b3 ; B += 4A + 4b0+3b1+2b2+b3.
+   *    Sums are kept on 32 bits, only their low byte is used.
+   */
+  void fletcher(const uint8_t* p, size_t n)  {
+
+    uint32_t a = ckA, b = ckB;
+    while (n >= 4)  {
+      uint32_t w;
+      memcpy(&w, p, 4);
+      uint32_t b0 = w & 0xFF, b1 = (w >> 8) & 0xFF, b2 = (w >> 16) & 0xFF, b3 = w >> 24;
+      b += 4 * a + 4 * b0 + 3 * b1 + 2 * b2 + b3;
+      a += b0 + b1 + b2 + b3;
+      p += 4;
+      n -= 4;
+    }
+    while (n--)  {
+      a += *p++;
+      b += a;
+    }
+    ckA = a;
+    ckB = b;
+  }
+
+  // Keeps the first payload bytes
+  void capture(const uint8_t* p, size_t n)  {
+
+    size_t room = UBX_FRAMER_HEAD_SIZE - frame.headLength;
+    if (n > room)
+      n = room;
+    memcpy(frame.head + frame.headLength, p, n);
+    frame.headLength += n;
+  }
+
+  void startNMEA()  {
+
+    state = LOOKING_FOR_ASTERIX;
+    frame.payloadLength = 0;
+    frame.headLength = 0;
+    memset(frame.nmeaType, 0, sizeof(frame.nmeaType));
+    nmeaCsum = 0;
+  }
+
+  static uint8_t hexChar(uint8_t nibble)  {
+    return nibble < 10 ? '0' + nibble : 'A' + nibble - 10;
+  }
+
+  size_t complete(FrameType type, size_t consumed, Frame& out)  {
+
+    frame.type = type;
+    frame.error = ERR_NONE;
+    out = frame;
+    state = LOOKING_FOR_B5_DOLLAR;
+    hunting = false;
+    frame.length = 0;
+    return consumed;
+  }
+
+  // Returns true if the error has to be reported
+  bool fail(FrameError error, Frame& out)  {
+
+    bool report = !hunting;
+    if (report)  {
+      out.type = FRAME_ERROR;
+      out.error = error;
+      out.length = frame.length;
+    }
+    state = LOOKING_FOR_B5_DOLLAR;
+    hunting = true;
+    frame.length = 0;
+    return report;
+  }
+};
+
+#endif
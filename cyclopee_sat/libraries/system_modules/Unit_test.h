@@ -0,0 +1,88 @@
+/*
+ ****************************
+ *    UNIT TEST HELPERS     *
+ ****************************
+ * @brief:
+ *    Shared by the unit test sketches: error count, check() and the
+ *    reproducible pseudo random values of the generated inputs (same
+ *    sequence on the boards and on host).
+ * @note:
+ *    No board specific code: the sketches also run on host with the
+ *    Arduino stand-in of the gateway tests (gateway/mpcd, make check).
+ *    Found as a library like the other system modules: the Arduino IDE
+ *    compiles a copy of the sketch folder, a path relative to the sketch
+ *    would not resolve.
+ *
+ * @Usage:
+ *    #include "Unit_test.h"
+ *    check(value == expected, "what is checked");
+ *    printResult();
+ */
+#ifndef UNIT_TEST_H
+#define UNIT_TEST_H
+
+/*
+ ****************
+ *  LIBRARIES   *
+ ****************
+ */
+#include <Arduino.h>
+#include <stdint.h>
+
+/*
+ ****************
+ *    CHECKS    *
+ ****************
+ */
+// Failed checks
+uint32_t errors = 0;
+
+void check(bool ok, const char* what)  {
+
+  if (!ok)  {
+    Serial.print("Failed : "); Serial.println(what);
+    errors++;
+  }
+}
+
+// Error count and verdict
+void printResult()  {
+
+  Serial.print("Errors :\t"); Serial.println(errors);
+  Serial.println(errors == 0 ? "TEST PASSED" : "TEST FAILED");
+}
+
+/*
+ ****************
+ *    RANDOM    *
+ ****************
+ */
+// Linear congruential generator, reset seed to replay a sequence
+uint32_t seed = 1;
+
+uint32_t nextRandom()  {
+
+  seed = seed * 1103515245 + 12345;
+  return seed;
+}
+
+// Uniform noise in [-amplitude, amplitude]
+float noise(float amplitude)  {
+
+  return amplitude * (((nextRandom() >> 8) % 2001) / 1000.0f - 1);
+}
+
+// Uniform integer in [-amplitude, amplitude]
+int32_t randomOffset(int32_t amplitude)  {
+
+  return (int32_t)((nextRandom() >> 8) % (2 * amplitude + 1)) - amplitude;
+}
+
+// Uniform integer in [min, max), as random(min, max) of the Arduino core
+int32_t randomRange(int32_t min, int32_t max)  {
+
+  // High bits of the generator, the low ones have short periods
+  return min + (int32_t)(((uint64_t)nextRandom() * (uint32_t)(max - min)) >> 32);
+}
+
+#endif
@@ -0,0 +1,235 @@
+/*
+ ****************************
+ *    WAVE STATS MODULE     *
+ ****************************
+ * @brief:
+ *    This module is loaded to compute sea state statistics from a burst of
+ *    distance samples (air gap to the sea surface) taken at the sensor
+ *    output rate:
+ *      - Mean distance, linear trend (tide) removed before the spectrum.
+ *      - Variance spectrum (Hann window, FFT): significant wave height
+ *        Hm0 = 4 * sqrt(m0), peak period Tp, mean period Tm01 = m0 / m1,
+ *        moments taken between WAVE_FMIN and WAVE_FMAX.
+ *      - Spectrum decimated into WAVE_BANDS bands of WAVE_BAND_WIDTH.
+ *    Samples are added from an interrupt (one per sensor frame, NAN for a
+ *    lost frame), statistics are computed from loop() once the burst is
+ *    full: only the summary is sent, not the samples.
+ * @note:
+ *    No board specific code. The FFT is a single precision radix-2 FFT:
+ *    the Teensy 3.5 FPU computes a 1024 samples burst in a few ms, once
+ *    per burst. Missing samples are replaced by the trend.
+ *    WAVE_BANDS and WAVE_BAND_WIDTH must match the gateway table
+ *    (cyclopee.wave_stats, psd_00 to psd_15).
+ */
+#ifndef WAVE_STATS_H
+#define WAVE_STATS_H
+
+/*
+ ****************
+ *  LIBRARIES   *
+ ****************
+ */
+#include <stdint.h>
+#include <math.h>
+
+/*
+ *********************
+ *   MODULE CONFIG   *
+ *********************
+ */
+// Samples of a burst (power of 2, 16384 max)
+#ifndef WAVE_BURST_SAMPLES
+#define WAVE_BURST_SAMPLES  1024
+#endif
+// Wave frequency range of the moments (swell to short wind waves)
+#ifndef WAVE_FMIN
+#define WAVE_FMIN           0.05f/*Hz*/
+#endif
+#ifndef WAVE_FMAX
+#define WAVE_FMAX           1.0f/*Hz*/
+#endif
+// Decimated spectrum: WAVE_BANDS bands from 0 Hz
+#ifndef WAVE_BANDS
+#define WAVE_BANDS          16
+#endif
+#ifndef WAVE_BAND_WIDTH
+#define WAVE_BAND_WIDTH     0.05f/*Hz*/
+#endif
+// Lowest part of valid samples in a burst
+#ifndef WAVE_MIN_VALID
+#define WAVE_MIN_VALID      0.9f
+#endif
+
+/*
+ *******************
+ *   WAVE STATS    *
+ *******************
+ */
+struct WaveStats {
+  // Mean distance over the burst
+  float meanDist_mm;
+  // Significant wave height
+  float hm0_mm;
+  // Peak and mean periods
+  float tp_s;
+  float tm01_s;
+  // Part of valid samples
+  float valid;
+  // Mean spectral density of each band (mm²/Hz)
+  float psd[WAVE_BANDS];
+};
+
+class WaveBurst {
+
+public:
+  /*
+   * @brief:
+   *    Starts a burst, samples added until full().
+   * @params:
+   *    sampleRate_hz: Sensor output rate.
+   */
+  void start(float sampleRate_hz)  {
+
+    fs = sampleRate_hz;
+    count = 0;
+    running = true;
+  }
+
+  // Burst dropped (sensor disconnected)
+  void abort()  { running = false; }
+
+  /*
+   * @brief:
+   *    Adds a sample (NAN if the frame was lost). Called from the sensor
+   *    interrupt, ignored outside a burst.
+   */
+  void add(float value)  {
+
+    if (running && count < WAVE_BURST_SAMPLES)
+      re[count++] = value;
+  }
+
+  bool active() const  { return running; }
+  bool full() const  { return running && count == WAVE_BURST_SAMPLES; }
+
+  /*
+   * @brief:
+   *    Computes the statistics of the full burst and ends it.
+   * @return:
+   *    False if less than WAVE_MIN_VALID of the samples are valid.
+   */
+  bool compute(WaveStats& s)  {
+
+    const uint16_t n = WAVE_BURST_SAMPLES;
+    running = false;
+
+    // Linear trend of the valid samples (least squares, centered sums)
+    float sx = 0, sy = 0;
+    uint16_t valid = 0;
+    for (uint16_t i = 0; i < n; i++)  {
+      if (isnan(re[i]))
+        continue;
+      sx += i;
+      sy += re[i];
+      valid++;
+    }
+    s.valid = (float)valid / n;
+    if (s.valid < WAVE_MIN_VALID)
+      return false;
+    float mx = sx / valid, my = sy / valid, sxx = 0, sxy = 0;
+    for (uint16_t i = 0; i < n; i++)  {
+      if (isnan(re[i]))
+        continue;
+      sxx += (i - mx) * (i - mx);
+      sxy += (i - mx) * (re[i] - my);
+    }
+    float slope = sxy / sxx;
+    float offset = my - slope * mx;
+    s.meanDist_mm = my;
+
+    // Detrended, Hann windowed samples, missing ones on the trend
+    // Window power of the valid samples only: variance kept with missing samples
+    float w2 = 0;
+    for (uint16_t i = 0; i < n; i++)  {
+      float w = 0.5f - 0.5f * cosf(2 * (float)M_PI * i / n);
+      if (isnan(re[i]))
+        re[i] = 0;
+      else  {
+        re[i] = (re[i] - offset - slope * i) * w;
+        w2 += w * w;
+      }
+      im[i] = 0;
+    }
+    fft();
+
+    // One sided variance spectrum, moments over the wave range
+    float df = fs / n, m0 = 0, m1 = 0, peak = 0;
+    uint16_t bandBins[WAVE_BANDS] = {0};
+    s.tp_s = NAN;
+    for (uint8_t b = 0; b < WAVE_BANDS; b++)
+      s.psd[b] = 0;
+    for (uint16_t k = 1; k < n / 2; k++)  {
+      float f = k * df;
+      float psd = 2 * (re[k] * re[k] + im[k] * im[k]) / (fs * w2);
+      if (f >= WAVE_FMIN && f <= WAVE_FMAX)  {
+        m0 += psd * df;
+        m1 += f * psd * df;
+        if (psd > peak)  {
+          peak = psd;
+          s.tp_s = 1 / f;
+        }
+      }
+      uint16_t b = f / WAVE_BAND_WIDTH;
+      if (b < WAVE_BANDS)  {
+        s.psd[b] += psd;
+        bandBins[b]++;
+      }
+    }
+    for (uint8_t b = 0; b < WAVE_BANDS; b++)
+      s.psd[b] = bandBins[b] ? s.psd[b] / bandBins[b] : NAN;
+    s.hm0_mm = 4 * sqrtf(m0);
+    s.tm01_s = m1 > 0 ? m0 / m1 : NAN;
+    return true;
+  }
+
+private:
+  float re[WAVE_BURST_SAMPLES], im[WAVE_BURST_SAMPLES];
+  volatile uint16_t count = 0;
+  volatile bool running = false;
+  float fs = 1;
+
+  // In place radix-2 FFT of re + j.im
+  void fft()  {
+
+    const uint16_t n = WAVE_BURST_SAMPLES;
+    // Bit reversal permutation
+    for (uint16_t i = 1, j = 0; i < n; i++)  {
+      uint16_t bit = n >> 1;
+      for (; j & bit; bit >>= 1)
+        j ^= bit;
+      j ^= bit;
+      if (i < j)  {
+        float t = re[i]; re[i] = re[j]; re[j] = t;
+        t = im[i]; im[i] = im[j]; im[j] = t;
+      }
+    }
+    // Butterflies, twiddles computed once per stage and index
+    for (uint16_t len = 2; len <= n; len <<= 1)  {
+      for (uint16_t k = 0; k < len / 2; k++)  {
+        float a = -2 * (float)M_PI * k / len;
+        float wr = cosf(a), wi = sinf(a);
+        for (uint16_t i = k; i < n; i += len)  {
+          uint16_t j = i + len / 2;
+          float tr = re[j] * wr - im[j] * wi;
+          float ti = re[j] * wi + im[j] * wr;
+          re[j] = re[i] - tr;
+          im[j] = im[i] - ti;
+          re[i] += tr;
+          im[i] += ti;
+        }
+      }
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,203 @@
+/*
+ ****************************
+ *  WINDOW AGGREGATE MODULE *
+ ****************************
+ * @brief:
+ *    This module is loaded to aggregate the samples of each channel over
+ *    fixed time windows (1s, 1min, 10min...) before they are sent:
+ *      - RunningStats: count, min, max, mean and standard deviation of a
+ *        channel, updated on each sample (Welford), constant memory.
+ *      - AggregateWindow: windows aligned on midnight UTC (a window length
+ *        divides the day), a sample of the next window closes the current
+ *        one.
+ *      - Each sink (SD, Bluetooth) takes the raw samples, the aggregates or
+ *        both (STREAM_RAW, STREAM_AGGREGATE), changed with the aggregate
+ *        order.
+ * @note:
+ *    No board specific code, float only (Teensy 3.5 FPU): Welford runs on
+ *    the deviations from the first sample of the window, so that a channel
+ *    far from 0 (coordinates in nanodegrees, distances in mm) keeps the
+ *    float resolution of its variations.
+ *
+ * @Order:
+ *    {"order":"aggregate","window":60,"sd":"raw","bt":"agg"}
+ *    Streams: "raw", "agg", "both" or "none". Missing members are left
+ *    unchanged.
+ */
+#ifndef WINDOW_AGGREGATE_H
+#define WINDOW_AGGREGATE_H
+
+/*
+ ****************
+ *  LIBRARIES   *
+ ****************
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include "JSON_order.h"
+
+/*
+ *********************
+ *   MODULE CONFIG   *
+ *********************
+ */
+// Longest window
+#ifndef AGG_MAX_WINDOW
+#define AGG_MAX_WINDOW    3600/*s*/
+#endif
+// Streams of a sink
+#define STREAM_NONE       0x00
+#define STREAM_RAW        0x01
+#define STREAM_AGGREGATE  0x02
+#define STREAM_BOTH       (STREAM_RAW | STREAM_AGGREGATE)
+
+/*
+ ************************
+ *   WINDOW AGGREGATE   *
+ ************************
+ */
+/*
+ * @brief:
+ *    Running statistics of one channel (T: float, int32_t or int64_t).
+ */
+template <class T>
+class RunningStats {
+
+public:
+  void clear()  { n = 0; }
+
+  void add(T x)  {
+
+    if (n == 0)  {
+      ref = lo = hi = x;
+      meanDev = m2 = 0;
+    }
+    float d = (float)(x - ref);
+    n++;
+    float delta = d - meanDev;
+    meanDev += delta / n;
+    m2 += delta * (d - meanDev);
+    if (x < lo)
+      lo = x;
+    if (x > hi)
+      hi = x;
+  }
+
+  uint32_t count() const  { return n; }
+  T min() const  { return lo; }
+  T max() const  { return hi; }
+  T mean() const  { return fromDeviation(ref, meanDev); }
+  // Sample standard deviation, 0 under 2 samples
+  float std() const  { return n > 1 ? sqrtf(m2 / (n - 1)) : 0; }
+
+private:
+  uint32_t n = 0;
+  // First sample of the window, deviations from it
+  T ref = 0, lo = 0, hi = 0;
+  float meanDev = 0, m2 = 0;
+
+  static float fromDeviation(float ref, float d)  { return ref + d; }
+  static int32_t fromDeviation(int32_t ref, float d)  { return ref + (int32_t)lroundf(d); }
+  static int64_t fromDeviation(int64_t ref, float d)  { return ref + lroundf(d); }
+};
+
+/*
+ * @brief:
+ *    Aggregation window, on sample times (µs since midnight UTC).
+ */
+class AggregateWindow {
+
+public:
+  AggregateWindow(uint32_t length_s)  { setLength(length_s); }
+
+  /*
+   * @brief:
+   *    Changes the window length, close the open window before.
+   * @return:
+   *    False if the length does not divide the day or exceeds
+   *    AGG_MAX_WINDOW, the length is left unchanged.
+   */
+  bool setLength(uint32_t length_s)  {
+
+    if (length_s == 0 || length_s > AGG_MAX_WINDOW || 86400 % length_s != 0)
+      return false;
+    len_s = length_s;
+    return true;
+  }
+
+  // Tells if a sample is out of the open window (or no window is open)
+  bool isNew(uint64_t time_us) const  { return !opened || time_us / len_us() != index; }
+  // Opens the window of a sample
+  void begin(uint64_t time_us)  { index = time_us / len_us(); opened = true; }
+  void end()  { opened = false; }
+
+  bool isOpen() const  { return opened; }
+  uint32_t length() const  { return len_s; }
+  // Start of the window (µs since midnight UTC)
+  uint64_t start_us() const  { return index * len_us(); }
+
+private:
+  uint32_t len_s = 1;
+  uint64_t index = 0;
+  bool opened = false;
+
+  uint64_t len_us() const  { return (uint64_t)len_s * 1000000; }
+};
+
+/*
+ * @brief:
+ *    Name of a sink streams in orders and answers.
+ */
+inline const char* streamName(uint8_t streams)  {
+
+  switch (streams)  {
+    case STREAM_RAW:        return "raw";
+    case STREAM_AGGREGATE:  return "agg";
+    case STREAM_BOTH:       return "both";
+    default:                return "none";
+  }
+}
+
+/*
+ * @brief:
+ *    Reads an aggregate order.
+ * @params:
+ *    order: Order line received from the gateway.
+ *    window_s: "window" member, unchanged if absent.
+ *    sdStreams, btStreams: "sd" and "bt" members, unchanged if absent.
+ * @return:
+ *    False if it is another order or a member is invalid, nothing is
+ *    changed.
+ */
+inline bool parseAggregateOrder(const char* order, uint32_t& window_s, uint8_t& sdStreams, uint8_t& btStreams)  {
+
+  if (!jsonMemberIs(order, "order", "aggregate"))
+    return false;
+  uint32_t window = window_s;
+  const char* value = jsonMember(order, "window");
+  if (value)  {
+    if (*value < '0' || *value > '9')
+      return false;
+    window = strtoul(value, NULL, 10);
+  }
+  const char* sinks[2] = {"sd", "bt"};
+  uint8_t streams[2] = {sdStreams, btStreams};
+  for (uint8_t s = 0; s < 2; s++)  {
+    if (!jsonMember(order, sinks[s]))
+      continue;
+    uint8_t found = 0xFF;
+    for (uint8_t v = STREAM_NONE; v <= STREAM_BOTH; v++)
+      if (jsonMemberIs(order, sinks[s], streamName(v)))
+        found = v;
+    if (found == 0xFF)
+      return false;
+    streams[s] = found;
+  }
+  window_s = window;
+  sdStreams = streams[0];
+  btStreams = streams[1];
+  return true;
+}
+
+#endif
@@ -0,0 +1,147 @@
+/* --------------------------
+ * @inspiration:
+ *    Change_filter_test
+ *
+ *  @brief:
+ *    This program checks the block compressor (Block_compressor.h) on
+ *    generated GNSS_logger lines (10Hz, slow varying sensors):
+ *      - Every block decoded on its own gives back its lines, whole.
+ *      - A block torn by a power loss (corrupted byte, truncated payload) is
+ *        rejected, the next blocks are still decoded.
+ *      - Segment id and block numbers read back from the blocks, segment
+ *        header written and read, a torn header rejected.
+ *      - The longest line fits an empty block, a longer one is refused.
+ *    The compression ratio and the time of an added line are then printed
+ *    (µs).
+ *
+ *  @board:
+ *    Teensy 3.5
+ * --------------------------
+ */
+/* ##########################
+ * #   GLOBAL DEFINITIONS   #
+ * ##########################
+ */
+// Lines of the log (1 min at 10Hz)
+#define NB_LINES      600
+// Blocks kept to be decoded
+#define MAX_BLOCKS    64
+// Id of the segment written
+#define SEGMENT_ID    0x5EC7105E
+
+/* ################
+ * #  LIBRARIES   #
+ * ################
+ */
+#include <stdio.h>
+#include "Unit_test.h"
+#include "Block_compressor.h"
+
+/* ################
+ * #  PROGRAM     #
+ * ################
+ */
+BlockCompressor compressor;
+uint8_t blocks[MAX_BLOCKS][LZB_BLOCK_SIZE];
+// Lines of each block
+uint16_t firstLine[MAX_BLOCKS + 1];
+uint16_t nbBlocks = 0;
+char text[LZB_MAX_RAW + 1];
+
+// GNSS_logger line at 10Hz
+uint16_t makeLine(char* line, uint16_t i)  {
+
+  uint32_t ds = 36000 * 12 + i;
+  return snprintf(line, 128, "%02lu:%02lu:%02lu.%01lu00,46.1234%04d,-1.1567%04d,%.3f,%d,%.2f,%.1f,%.3f,%d",
+                  (unsigned long)(ds / 36000), (unsigned long)(ds / 600 % 60), (unsigned long)(ds / 10 % 60),
+                  (unsigned long)(ds % 10), (int)(500 + noise(20)), (int)(800 + noise(20)), 12.5f + noise(0.05f),
+                  4, 0.8f + noise(0.01f), 1234.5f + noise(0.4f), 15.0f + i * 0.0001f + noise(0.005f), 6);
+}
+
+void writeBlock(uint16_t line)  {
+
+  memcpy(blocks[nbBlocks], compressor.finish(SEGMENT_ID, nbBlocks), LZB_BLOCK_SIZE);
+  nbBlocks++;
+  firstLine[nbBlocks] = line;
+}
+
+// Checks that block b holds its lines
+bool blockLines(uint16_t b)  {
+
+  uint16_t len, seq;
+  uint32_t segment;
+  if (!decodeLogBlock(blocks[b], (uint8_t*)text, len, segment, seq) || segment != SEGMENT_ID || seq != b)
+    return false;
+  char line[128];
+  uint16_t o = 0;
+  seed = 1;
+  for (uint16_t i = 0; i < firstLine[b + 1]; i++)  {
+    uint16_t n = makeLine(line, i);
+    if (i < firstLine[b])
+      continue;
+    if (o + n + 1 > len || memcmp(text + o, line, n) != 0 || text[o + n] != '\n')
+      return false;
+    o += n + 1;
+  }
+  return o == len;
+}
+
+void setup() {
+
+  Serial.begin(115200);
+  while (!Serial);
+
+  Serial.println("#### Block compressor test #####");
+
+  char line[LZB_MAX_LINE + 2];
+  uint32_t raw = 0, t_us = 0;
+  firstLine[0] = 0;
+  for (uint16_t i = 0; i < NB_LINES && nbBlocks < MAX_BLOCKS - 1; i++)  {
+    uint16_t n = makeLine(line, i);
+    raw += n + 1;
+    uint32_t t = micros();
+    bool added = compressor.addLine(line, n);
+    t_us += micros() - t;
+    if (!added)  {
+      writeBlock(i);
+      check(compressor.addLine(line, n), "line in an empty block");
+    }
+  }
+  writeBlock(NB_LINES);
+  check(nbBlocks < MAX_BLOCKS, "all lines in the blocks");
+
+  bool decoded = true;
+  for (uint16_t b = 0; b < nbBlocks; b++)
+    decoded = decoded && blockLines(b);
+  check(decoded, "decoded blocks");
+
+  // Torn blocks
+  uint16_t len, seq;
+  uint32_t segment, count;
+  blocks[1][LZB_HEADER_SIZE + 100] ^= 0x10;
+  check(!checkLogBlock(blocks[1], segment, seq), "corrupted block");
+  memset(blocks[2] + LZB_BLOCK_SIZE / 2, 0, LZB_BLOCK_SIZE / 2);
+  check(!decodeLogBlock(blocks[2], (uint8_t*)text, len, segment, seq), "truncated block");
+  check(blockLines(3), "block after the torn ones");
+
+  // Segment header
+  uint8_t sector[LZB_BLOCK_SIZE];
+  writeSegmentHeader(sector, SEGMENT_ID, nbBlocks);
+  check(readSegmentHeader(sector, segment, count) && segment == SEGMENT_ID && count == nbBlocks, "segment header");
+  check(!checkLogBlock(sector, segment, seq), "header is not a block");
+  sector[4] ^= 0x01;
+  check(!readSegmentHeader(sector, segment, count), "torn segment header");
+
+  // Line lengths
+  memset(line, 'x', LZB_MAX_LINE + 1);
+  check(compressor.addLine(line, LZB_MAX_LINE), "longest line");
+  compressor.clear();
+  check(!compressor.addLine(line, LZB_MAX_LINE + 1) && compressor.empty(), "line too long");
+
+  Serial.print("Ratio :\t\t"); Serial.println((float)raw / (nbBlocks * LZB_BLOCK_SIZE));
+  Serial.print("Add (us) :\t"); Serial.println((float)t_us / NB_LINES);
+  printResult();
+}
+
+void loop() {
+}
@@ -0,0 +1,129 @@
+/* --------------------------
+ * @inspiration:
+ *    Window_aggregate_test
+ *
+ *  @brief:
+ *    This program checks the change filters (Change_filter.h) on a
+ *    generated water temperature (slow daily variation, sensor noise, a
+ *    missing value):
+ *      - Series rebuilt as the gateway does (hold marker: previous sent
+ *        value, interpolation marker: line between the sent samples)
+ *        within the tolerance, for both modes.
+ *      - No run of markers longer than the heartbeat allows, samples
+ *        around the missing value and the last one (flush()) sent.
+ *      - keep sends the pending sample whatever its value.
+ *    The part of sent samples and the time of an added sample are then
+ *    printed (µs).
+ *
+ *  @board:
+ *    Teensy 3.5
+ * --------------------------
+ */
+/* ##########################
+ * #   GLOBAL DEFINITIONS   #
+ * ##########################
+ */
+// Samples of the series (1h at 1Hz)
+#define NB_SAMPLES    3600
+// Missing sample
+#define NAN_SAMPLE    1800
+// Tolerance of the filters (°C)
+#define TEMP_TOLERANCE  0.05f
+// Float error of the rebuilt samples
+#define REBUILD_EPSILON 1e-4f
+
+/* ################
+ * #  LIBRARIES   #
+ * ################
+ */
+#include "Unit_test.h"
+#include "Change_filter.h"
+
+/* ################
+ * #  PROGRAM     #
+ * ################
+ */
+float samples[NB_SAMPLES], sent[NB_SAMPLES];
+bool isSent[NB_SAMPLES];
+
+/*
+ * @brief:
+ *    Filters the series, rebuilds it and checks the error.
+ * @return:
+ *    Number of samples sent.
+ */
+uint16_t filterSeries(uint8_t mode, const char* name, uint32_t& t_us)  {
+
+  ChangeFilter filter(mode, TEMP_TOLERANCE);
+  for (uint16_t i = 0; i <= NB_SAMPLES; i++)  {
+    uint32_t t = micros();
+    bool s = i < NB_SAMPLES ? filter.add(samples[i]) : filter.flush();
+    t_us += micros() - t;
+    // Decision on the previous sample
+    if (i > 0)  {
+      isSent[i - 1] = s;
+      sent[i - 1] = filter.value();
+    }
+  }
+
+  // Rebuilt series, max marker run
+  float maxError = 0;
+  uint16_t run = 0, maxRun = 0, nbSent = 0;
+  int16_t last = -1;
+  for (uint16_t i = 0; i < NB_SAMPLES; i++)  {
+    if (!isSent[i])  {
+      run++;
+      continue;
+    }
+    nbSent++;
+    maxRun = run > maxRun ? run : maxRun;
+    run = 0;
+    // Markers between the previous sent sample and this one
+    for (int16_t j = last + 1; j < i && last >= 0; j++)  {
+      float v = mode == CF_DEADBAND ? sent[last] : sent[last] + (sent[i] - sent[last]) * (j - last) / (i - last);
+      maxError = fmaxf(maxError, fabsf(v - samples[j]));
+    }
+    if (!isnan(samples[i]))
+      maxError = fmaxf(maxError, fabsf(sent[i] - samples[i]));
+    last = i;
+  }
+  check(run == 0 && isSent[NB_SAMPLES - 1], "last sample sent");
+  check(maxRun < CF_HEARTBEAT, "heartbeat");
+  check(maxError <= TEMP_TOLERANCE + REBUILD_EPSILON, name);
+  check(isSent[NAN_SAMPLE - 1] && isSent[NAN_SAMPLE] && isnan(sent[NAN_SAMPLE]) && isSent[NAN_SAMPLE + 1], "missing sample");
+  Serial.print(name); Serial.print(" :\t"); Serial.print(100.0f * nbSent / NB_SAMPLES); Serial.print(" % sent, max error ");
+  Serial.println(maxError, 4);
+  return nbSent;
+}
+
+void setup() {
+
+  Serial.begin(115200);
+  while (!Serial);
+
+  Serial.println("#### Change filter test #####");
+
+  // 15°C, 2°C daily variation, +/- 0.02°C noise
+  for (uint16_t i = 0; i < NB_SAMPLES; i++)
+    samples[i] = 15.0f + 2.0f * sinf(2 * (float)M_PI * i / 86400 * 6) + noise(0.02f);
+  samples[NAN_SAMPLE] = NAN;
+
+  uint32_t t_us = 0;
+  uint16_t nbDeadband = filterSeries(CF_DEADBAND, "Deadband", t_us);
+  uint16_t nbDoor = filterSeries(CF_SWINGING_DOOR, "Swinging door", t_us);
+  check(nbDeadband < NB_SAMPLES / 4 && nbDoor < NB_SAMPLES / 4, "compression");
+
+  // keep
+  ChangeFilter filter(CF_DEADBAND, TEMP_TOLERANCE);
+  filter.add(15.0f);
+  check(filter.add(15.0f), "first sample sent");
+  check(!filter.add(15.0f), "unchanged sample");
+  check(filter.add(15.0f, true) && filter.value() == 15.0f, "kept sample");
+  check(filter.flush() && !filter.flush(), "flush");
+
+  Serial.print("Add (us) :\t"); Serial.println((float)t_us / (2 * NB_SAMPLES));
+  printResult();
+}
+
+void loop() {
+}
@@ -0,0 +1,148 @@
+/* --------------------------
+ * @inspiration:
+ *    RTCM_demux_test
+ *
+ *  @brief:
+ *    This program checks the fixed point GNSS values (GNSS_fixed.h) on
+ *    generated $GNGGA sentences parsed by TinyGPSPlus:
+ *      - Coordinates written with 9 decimals must be the NMEA minutes
+ *        converted exactly (integer reference), and the same as the double
+ *        path (String(lng(), 6)) at 6 decimals.
+ *      - Elevations (altitude + geoid separation) must be the same as the
+ *        double path at 3 decimals.
+ *    The time of both paths is then printed (µs per sample).
+ *
+ *  @board:
+ *    Teensy 3.5
+ * --------------------------
+ */
+/* ##########################
+ * #   GLOBAL DEFINITIONS   #
+ * ##########################
+ */
+// Number of generated sentences
+#define NB_SENTENCES  500
+
+/* ################
+ * #  LIBRARIES   #
+ * ################
+ */
+#include <TinyGPSPlus.h>
+#include "Unit_test.h"
+#include "GNSS_fixed.h"
+
+/* ################
+ * #  PROGRAM     #
+ * ################
+ */
+TinyGPSPlus gnss;
+TinyGPSCustom gnssGeoidElv(gnss, "GNGGA", 11);
+char sentence[128];
+
+/*
+ * @brief:
+ *    Builds a $GNGGA sentence (7 decimals of minutes) with its checksum.
+ */
+void makeSentence(uint8_t latDeg, uint32_t latMin, bool south, uint8_t lngDeg, uint32_t lngMin, bool west, int32_t alt_cm, int32_t geoid_cm)  {
+
+  char body[112];
+  snprintf(body, sizeof(body), "GNGGA,120000.00,%02u%02lu.%07lu,%c,%03u%02lu.%07lu,%c,4,12,0.6,%s%ld.%02ld,M,%s%ld.%02ld,M,1.0,0000",
+           latDeg, latMin / 10000000, latMin % 10000000, south ? 'S' : 'N',
+           lngDeg, lngMin / 10000000, lngMin % 10000000, west ? 'W' : 'E',
+           alt_cm < 0 ? "-" : "", labs(alt_cm) / 100, labs(alt_cm) % 100,
+           geoid_cm < 0 ? "-" : "", labs(geoid_cm) / 100, labs(geoid_cm) % 100);
+  uint8_t checksum = 0;
+  for (const char* p = body; *p; p++)
+    checksum ^= *p;
+  snprintf(sentence, sizeof(sentence), "$%s*%02X\r\n", body, checksum);
+}
+
+// Exact coordinate from the NMEA fields, 9 decimals
+void referenceCoord(char* str, uint8_t deg, uint32_t min_e7, bool negative)  {
+
+  // Billionths of degree as TinyGPSPlus computes them
+  uint32_t billionths = (5 * min_e7 + 1) / 3;
+  snprintf(str, GNSS_COORD_STR_LEN, "%s%u.%09lu", (negative && (deg || billionths)) ? "-" : "", deg, billionths);
+}
+
+void setup() {
+
+  Serial.begin(115200);
+  while (!Serial);
+
+  Serial.println("#### GNSS fixed test #####");
+
+  uint32_t fixed_us = 0, double_us = 0;
+  char fixed_str[GNSS_COORD_STR_LEN], ref_str[GNSS_COORD_STR_LEN];
+  for (uint16_t n = 0; n < NB_SENTENCES; n++)  {
+    uint8_t latDeg = randomRange(0, 90), lngDeg = randomRange(0, 180);
+    uint32_t latMin = randomRange(0, 600000000), lngMin = randomRange(0, 600000000);
+    bool south = randomRange(0, 2), west = randomRange(0, 2);
+    int32_t alt_cm = randomRange(-50000, 500000), geoid_cm = randomRange(-10000, 10000);
+    makeSentence(latDeg, latMin, south, lngDeg, lngMin, west, alt_cm, geoid_cm);
+    for (const char* p = sentence; *p; p++)
+      gnss.encode(*p);
+    if (!gnss.location.isUpdated() || !gnss.altitude.isUpdated())  {
+      Serial.print("Sentence not parsed : "); Serial.print(sentence);
+      errors++;
+      continue;
+    }
+
+    // Fixed point path
+    uint32_t t = micros();
+    GnssCoord lng = GnssCoord::fromRaw(gnss.location.rawLng());
+    GnssCoord lat = GnssCoord::fromRaw(gnss.location.rawLat());
+    int32_t elv_mm = gnss.altitude.value() * 10 + gnssStrToMilli(gnssGeoidElv.value());
+    String fixed = "";
+    lng.format(fixed_str);
+    fixed += fixed_str;
+    fixed += ',';
+    lat.format(fixed_str);
+    fixed += fixed_str;
+    fixed += ',';
+    gnssFormatMilli(fixed_str, elv_mm);
+    fixed += fixed_str;
+    fixed_us += micros() - t;
+
+    // Double path (GNSS_logger before GNSS_fixed.h)
+    t = micros();
+    double lng_deg = gnss.location.lng(), lat_deg = gnss.location.lat();
+    double elv_m = gnss.altitude.meters() + strtod(gnssGeoidElv.value(), NULL);
+    String dbl = String(lng_deg, 9) + ',' + String(lat_deg, 9) + ',' + String(elv_m, 3);
+    double_us += micros() - t;
+
+    // Exact values
+    String ref = "";
+    referenceCoord(ref_str, lngDeg, lngMin, west);
+    ref += ref_str;
+    ref += ',';
+    referenceCoord(ref_str, latDeg, latMin, south);
+    ref += ref_str;
+    ref += ',';
+    gnssFormatMilli(ref_str, (alt_cm + geoid_cm) * 10);
+    ref += ref_str;
+
+    // Ties on the 7th decimal may round either way with doubles
+    bool ok = fixed == ref;
+    lng.format(fixed_str, 6);
+    ok = ok && (lng.billionths % 1000 == 500 || String(fixed_str) == String(lng_deg, 6));
+    lat.format(fixed_str, 6);
+    ok = ok && (lat.billionths % 1000 == 500 || String(fixed_str) == String(lat_deg, 6));
+    gnssFormatMilli(fixed_str, elv_mm);
+    ok = ok && String(fixed_str) == String(elv_m, 3);
+    if (!ok)  {
+      Serial.print("Fixed : "); Serial.println(fixed);
+      Serial.print("Exact : "); Serial.println(ref);
+      Serial.print("Double: "); Serial.println(dbl);
+      errors++;
+    }
+  }
+
+  Serial.print("Errors :\t"); Serial.print(errors); Serial.print(" / "); Serial.println(NB_SENTENCES);
+  Serial.print("Fixed (us) :\t"); Serial.println((float)fixed_us / NB_SENTENCES);
+  Serial.print("Double (us) :\t"); Serial.println((float)double_us / NB_SENTENCES);
+  Serial.println(errors == 0 ? "TEST PASSED" : "TEST FAILED");
+}
+
+void loop() {
+}
@@ -0,0 +1,168 @@
+/* --------------------------
+ * @inspiration:
+ *    UBX_framer_test
+ *
+ *  @brief:
+ *    This program checks the Bluetooth stream demultiplexer (RTCM_demux.h)
+ *    on a generated stream: RTCM 3 frames of random types and lengths,
+ *    some of them corrupted, interleaved with JSON order lines.
+ *    Forwarded bytes must be exactly the frames, in order, every order
+ *    must be handed over and every corrupted frame counted.
+ *    With LIVE_TEST, the stream of BLUETOOTH_SERIAL is then forwarded to
+ *    GNSS_SERIAL and the counters printed every second (gateway mpcd -N).
+ *
+ *  @board:
+ *    Teensy 3.5
+ * --------------------------
+ */
+/* ##########################
+ * #   GLOBAL DEFINITIONS   #
+ * ##########################
+ */
+// Number of generated frames
+#define NB_FRAMES       500
+// One frame out of CORRUPT_EVERY is corrupted
+#define CORRUPT_EVERY   23
+// One order line after ORDER_EVERY frames
+#define ORDER_EVERY     10
+// Set to 1 to forward the live Bluetooth stream after the test
+#define LIVE_TEST       0
+#define GNSS_SERIAL       Serial5
+#define BLUETOOTH_SERIAL  Serial1
+
+/* ################
+ * #  LIBRARIES   #
+ * ################
+ */
+#include "Unit_test.h"
+#include "RTCM_demux.h"
+
+/* ################
+ * #  PROGRAM     #
+ * ################
+ */
+// Sink checking the forwarded bytes against the expected frames
+struct CheckSink {
+  // Bytes received and their running hash
+  uint32_t count;
+  uint32_t crc;
+  void write(uint8_t c)  {
+    count++;
+    crc = (crc * 31) ^ c;
+  }
+};
+
+RtcmDemux demux;
+CheckSink sink;
+uint8_t frame[3 + 1023 + 3];
+
+// CRC-24Q of a buffer
+uint32_t crc24q(const uint8_t* p, size_t n)  {
+
+  uint32_t crc = 0;
+  while (n--)  {
+    crc ^= (uint32_t)*p++ << 16;
+    for (uint8_t b = 0; b < 8; b++)  {
+      crc <<= 1;
+      if (crc & 0x1000000)
+        crc ^= 0x1864CFB;
+    }
+  }
+  return crc & 0xFFFFFF;
+}
+
+/*
+ * @brief:
+ *    Builds a frame of a type with a random payload.
+ * @return:
+ *    Frame length.
+ */
+size_t makeFrame(uint16_t type, uint16_t payloadLength)  {
+
+  frame[0] = RTCM_PREAMBLE;
+  frame[1] = (payloadLength >> 8) & 0x03;
+  frame[2] = payloadLength & 0xFF;
+  frame[3] = type >> 4;
+  frame[4] = (type << 4) | randomRange(0, 16);
+  for (uint16_t i = 2; i < payloadLength; i++)
+    frame[3 + i] = randomRange(0, 256);
+  uint32_t crc = crc24q(frame, 3 + payloadLength);
+  frame[3 + payloadLength] = crc >> 16;
+  frame[4 + payloadLength] = crc >> 8;
+  frame[5 + payloadLength] = crc;
+  return 6 + payloadLength;
+}
+
+void setup() {
+
+  static const uint16_t types[] = {1005, 1077, 1087, 1097, 1127, 1230};
+  static const char order[] = "{\"order\":\"getConfig\"}\r\n";
+
+  Serial.begin(115200);
+  while (!Serial);
+
+  Serial.println("#### RTCM demux test #####");
+
+  uint32_t expectedBytes = 0, expectedCrc = 0, corrupted = 0, orders = 0, ordersRead = 0, time_us = 0;
+  for (uint16_t n = 0; n < NB_FRAMES; n++)  {
+    size_t len = makeFrame(types[randomRange(0, 6)], randomRange(2, 1024));
+    // Payload byte corrupted (header left valid so that the frame is forwarded)
+    if (n % CORRUPT_EVERY == CORRUPT_EVERY - 1)  {
+      frame[3 + randomRange(0, len - 6)] ^= 0x10;
+      corrupted++;
+    }
+    for (size_t i = 0; i < len; i++)  {
+      expectedCrc = (expectedCrc * 31) ^ frame[i];
+      demux.feed(frame[i], sink, time_us++);
+    }
+    expectedBytes += len;
+
+    if (n % ORDER_EVERY == 0)  {
+      orders++;
+      for (const char* p = order; *p; p++)
+        demux.feed(*p, sink, time_us++);
+      if (demux.orderReady() && strcmp(demux.order(), "{\"order\":\"getConfig\"}") == 0)
+        ordersRead++;
+      demux.releaseOrder();
+    }
+  }
+
+  const RtcmDemux::Stats& s = demux.stats();
+  Serial.print("Frames :\t"); Serial.print(s.frames); Serial.print(" / "); Serial.println(NB_FRAMES - corrupted);
+  Serial.print("CRC errors :\t"); Serial.print(s.crcErrors); Serial.print(" / "); Serial.println(corrupted);
+  Serial.print("Forwarded :\t"); Serial.print(sink.count); Serial.print(" / "); Serial.println(expectedBytes);
+  Serial.print("Orders :\t"); Serial.print(ordersRead); Serial.print(" / "); Serial.println(orders);
+
+  check(s.frames == NB_FRAMES - corrupted, "valid frames counted");
+  check(s.crcErrors == corrupted, "corrupted frames counted");
+  check(sink.count == expectedBytes && sink.crc == expectedCrc, "forwarded bytes are the frames, in order");
+  check(ordersRead == orders && s.ordersDropped == 0, "every order handed over");
+  printResult();
+
+#if LIVE_TEST
+  GNSS_SERIAL.begin(115200);
+  BLUETOOTH_SERIAL.begin(115200);
+  demux.reset();
+#endif
+}
+
+void loop() {
+#if LIVE_TEST
+  static uint32_t lastPrint = millis();
+  while (BLUETOOTH_SERIAL.available() && GNSS_SERIAL.availableForWrite() > RTCM_DEMUX_HOLD)
+    demux.feed(BLUETOOTH_SERIAL.read(), GNSS_SERIAL, micros());
+  if (demux.orderReady())  {
+    Serial.print("Order : "); Serial.println(demux.order());
+    demux.releaseOrder();
+  }
+  if (millis() - lastPrint >= 1000)  {
+    const RtcmDemux::Stats& s = demux.stats();
+    Serial.print("Frames "); Serial.print(s.frames);
+    Serial.print(", CRC errors "); Serial.print(s.crcErrors);
+    Serial.print(", last type "); Serial.print(s.lastType);
+    Serial.print(", latency (us) "); Serial.print(s.lastLatency_us);
+    Serial.print(" max "); Serial.println(s.maxLatency_us);
+    lastPrint = millis();
+  }
+#endif
+}
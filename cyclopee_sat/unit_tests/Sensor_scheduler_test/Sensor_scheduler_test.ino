@@ -0,0 +1,128 @@
+/* --------------------------
+ * @inspiration:
+ *    RTCM_demux_test
+ *
+ *  @brief:
+ *    This program checks the sensor timetable (Sensor_scheduler.h) with the
+ *    GNSS_logger channels (GNSS 250ms, distance 100ms, temperature 10s with
+ *    a 375ms conversion), simulated over NB_TICKS ticks:
+ *      - Each channel must be read exactly every period, the temperature
+ *        read must come TEMP_LATENCY after its conversion start.
+ *      - No two events (start or read) may share a tick.
+ *      - update_interval orders must be parsed, periods below the sensor
+ *        minimum refused, and the timetable rebuilt.
+ *    The time of a tick is then printed (µs).
+ *
+ *  @board:
+ *    Teensy 3.5
+ * --------------------------
+ */
+/* ##########################
+ * #   GLOBAL DEFINITIONS   #
+ * ##########################
+ */
+// Simulated ticks
+#define NB_TICKS      100000
+// Channel config (GNSS_logger)
+#define GNSS_PERIOD   250/*ms*/
+#define DIST_PERIOD   100/*ms*/
+#define TEMP_PERIOD   10000/*ms*/
+#define TEMP_LATENCY  375/*ms*/
+
+/* ################
+ * #  LIBRARIES   #
+ * ################
+ */
+#include "Unit_test.h"
+#include "Sensor_scheduler.h"
+
+/* ################
+ * #  PROGRAM     #
+ * ################
+ */
+// Simulated time and last events
+uint32_t now_ms = 0;
+int32_t lastRead_ms[3] = {-1, -1, -1};
+int32_t lastStart_ms = -1;
+uint32_t reads[3] = {0, 0, 0};
+uint8_t eventsOnTick = 0;
+
+void checkRead(uint8_t i, uint32_t period_ms)  {
+
+  if (lastRead_ms[i] >= 0 && now_ms - lastRead_ms[i] != period_ms)  {
+    Serial.print("Channel "); Serial.print(i); Serial.print(" read after "); Serial.print(now_ms - lastRead_ms[i]); Serial.println(" ms");
+    errors++;
+  }
+  lastRead_ms[i] = now_ms;
+  reads[i]++;
+  eventsOnTick++;
+}
+
+bool readGnss()  { checkRead(0, GNSS_PERIOD); return true; }
+bool readDist()  { checkRead(1, DIST_PERIOD); return true; }
+void startTemp()  { lastStart_ms = now_ms; eventsOnTick++; }
+bool readTemp()  {
+
+  if (now_ms - lastStart_ms != TEMP_LATENCY)  {
+    Serial.print("Temperature read "); Serial.print(now_ms - lastStart_ms); Serial.println(" ms after start");
+    errors++;
+  }
+  checkRead(2, TEMP_PERIOD);
+  return true;
+}
+
+SchedChannel channels[3] = {
+  {"gnss", GNSS_PERIOD, GNSS_PERIOD, 0, NULL, readGnss},
+  {"dist", DIST_PERIOD, DIST_PERIOD, 0, NULL, readDist},
+  {"temp", TEMP_PERIOD, 2 * TEMP_LATENCY, TEMP_LATENCY, startTemp, readTemp}
+};
+SensorScheduler scheduler(channels, 3);
+
+void setup() {
+
+  Serial.begin(115200);
+  while (!Serial);
+
+  Serial.println("#### Sensor scheduler test #####");
+
+  check(scheduler.build(), "build");
+  check(scheduler.tickMs() == 25, "tick is the GCD of periods and latency");
+  for (uint8_t k = 0; k < scheduler.size(); k++)  {
+    uint8_t i = scheduler.rank(k);
+    Serial.print(channels[i].name); Serial.print(" phase (ms) :\t"); Serial.println(scheduler.phase(i) * scheduler.tickMs());
+  }
+
+  // Timetable
+  uint32_t shared = 0, tick_us = 0, readMask, fresh;
+  for (uint32_t n = 0; n < NB_TICKS; n++)  {
+    now_ms = n * scheduler.tickMs();
+    eventsOnTick = 0;
+    uint8_t f;
+    uint32_t t = micros();
+    readMask = scheduler.tick(f);
+    tick_us += micros() - t;
+    fresh = f;
+    check(fresh == readMask, "every read refreshes");
+    shared += eventsOnTick > 1;
+  }
+  check(shared == 0, "no shared tick");
+  check(reads[1] == NB_TICKS / (DIST_PERIOD / 25), "distance reads");
+
+  // Orders
+  int16_t channel;
+  uint32_t period_ms;
+  check(scheduler.parseIntervalOrder("{\"order\":\"update_interval\", \"channel\":\"dist\", \"value\":200}", channel, period_ms) && channel == 1 && period_ms == 200, "channel order");
+  check(scheduler.parseIntervalOrder("{\"order\":\"update_interval\",\"value\":1000}", channel, period_ms) && channel == SCHED_ALL_CHANNELS && period_ms == 1000, "all channels order");
+  check(!scheduler.parseIntervalOrder("{\"order\":\"update_interval\",\"channel\":\"di\",\"value\":100}", channel, period_ms), "unknown channel");
+  check(!scheduler.parseIntervalOrder("{\"order\":\"getConfig\"}", channel, period_ms), "other order");
+  check(!scheduler.setPeriod(1, 50) && channels[1].period_ms == DIST_PERIOD, "period below sensor minimum");
+  check(scheduler.setPeriod(SCHED_ALL_CHANNELS, 10) && channels[2].period_ms == 2 * TEMP_LATENCY, "all channels raised to minimum");
+  check(scheduler.setPeriod(SCHED_ALL_CHANNELS, 1000) && scheduler.tickMs() == 125, "all channels 1s");
+
+  Serial.print("Shared ticks :\t"); Serial.println(shared);
+  Serial.print("Tick (us) :\t"); Serial.println((float)tick_us / NB_TICKS);
+  printResult();
+}
+
+void loop() {
+}
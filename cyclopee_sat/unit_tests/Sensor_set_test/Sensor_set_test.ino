@@ -0,0 +1,152 @@
+/* --------------------------
+ * @inspiration:
+ *    Sensor_scheduler_test
+ *
+ *  @brief:
+ *    This program checks the compile-time sensor set (Sensor_set.h) with
+ *    mock drivers standing for URM14 (100ms), A01NYUB (frames every
+ *    200ms, polled every 100ms) and DS18B20 (1s, 375ms conversion) next to
+ *    a GNSS channel, simulated over NB_TICKS ticks:
+ *      - Sensor indexes, setup in the set order, values disconnected
+ *        before the first read.
+ *      - Scheduler channels generated from the descriptors: each sensor
+ *        read every period, the conversion started before the temperature
+ *        read, fresh bits of the polled sensor only on its frames.
+ *      - CSV header, CSV and JSON values: not refreshed and disconnected
+ *        sensors left out.
+ *    The time of a tick and of a JSON record are then printed (µs).
+ *
+ *  @board:
+ *    Teensy 3.5
+ * --------------------------
+ */
+/* ##########################
+ * #   GLOBAL DEFINITIONS   #
+ * ##########################
+ */
+// Simulated ticks
+#define NB_TICKS      10000
+
+/* ################
+ * #  LIBRARIES   #
+ * ################
+ */
+#include "Unit_test.h"
+#include "Sensor_set.h"
+
+/* ################
+ * #  PROGRAM     #
+ * ################
+ */
+// Simulated time, sensor events
+uint32_t now_ms = 0;
+uint32_t reads[3] = {0, 0, 0};
+int32_t tempStart_ms = -1;
+char setupOrder[16] = "";
+// Mock drivers
+struct MockUrm {
+  static constexpr SensorDesc desc = {"urm", "URM14 distance (mm)", 100, 100, 0, UINT16_MAX / 10.0, 1};
+  static void setup(volatile bool& connected)  {  strcat(setupOrder, "u"); connected = true; }
+  static void start()  {}
+  static bool read(float& dist_mm, volatile bool& connected)  {  reads[0]++; dist_mm = now_ms / 10; return true; }
+};
+constexpr SensorDesc MockUrm::desc;
+
+struct MockA01 {
+  static constexpr SensorDesc desc = {"a01", "A01NYUB distance (mm)", 100, 100, 0, -257 / 10.0, 1};
+  static void setup(volatile bool& connected)  {  strcat(setupOrder, "a"); connected = true; }
+  static void start()  {}
+  // A frame every other read
+  static bool read(float& dist_mm, volatile bool& connected)  {
+
+    reads[1]++;
+    if (reads[1] % 2)
+      return false;
+    dist_mm = 1000 + reads[1];
+    return true;
+  }
+};
+constexpr SensorDesc MockA01::desc;
+
+struct MockTemp {
+  static constexpr SensorDesc desc = {"temp", "External temperature (°C)", 1000, 750, 375, -127, 3};
+  static void setup(volatile bool& connected)  {  strcat(setupOrder, "t"); connected = true; }
+  static void start()  {  tempStart_ms = now_ms; }
+  static bool read(float& temp_C, volatile bool& connected)  {
+
+    check(tempStart_ms >= 0 && now_ms - tempStart_ms == desc.latency_ms, "conversion started before the read");
+    reads[2]++;
+    temp_C = 15.125f;
+    return true;
+  }
+};
+constexpr SensorDesc MockTemp::desc;
+
+typedef SensorSet<MockUrm, MockA01, MockTemp> Sensors;
+
+// GNSS channel before the set
+bool readGnss()  { return true; }
+SchedChannel channels[1 + Sensors::size] = {
+  {"gnss", 250, 250, 0, NULL, readGnss}
+};
+SensorScheduler scheduler(channels, 1 + Sensors::size);
+
+void setup() {
+
+  Serial.begin(115200);
+  while (!Serial);
+
+  Serial.println("#### Sensor set test #####");
+
+  // Layout
+  check(Sensors::size == 3 && Sensors::indexOf<MockUrm>() == 0 && Sensors::indexOf<MockA01>() == 1 && Sensors::indexOf<MockTemp>() == 2, "indexes");
+  check(sizeof(Sensors::Record::values) == 3 * sizeof(float), "record layout");
+  Sensors::setup();
+  check(strcmp(setupOrder, "uat") == 0, "setup in the set order");
+  check(Sensors::values[1] == MockA01::desc.noValue && Sensors::connected[2], "values before the first read");
+
+  // Channels
+  check(Sensors::channels(channels + 1) == 3, "channels written");
+  check(strcmp(channels[2].name, "a01") == 0 && channels[2].period_ms == 100, "channel from the descriptor");
+  check(channels[1].start == NULL && channels[3].start != NULL && channels[3].latency_ms == 375, "start only with a latency");
+  check(scheduler.build() && scheduler.tickMs() == 25, "build");
+
+  uint32_t tick_us = 0, a01Fresh = 0;
+  for (uint32_t n = 0; n < NB_TICKS; n++)  {
+    now_ms = n * scheduler.tickMs();
+    uint8_t fresh;
+    uint32_t t = micros();
+    uint8_t readMask = scheduler.tick(fresh);
+    tick_us += micros() - t;
+    if (readMask & (1 << 2))
+      a01Fresh += (fresh >> 2) & 1;
+  }
+  check(reads[0] == NB_TICKS / 4 && reads[1] == NB_TICKS / 4 && reads[2] == NB_TICKS / 40, "reads every period");
+  check(a01Fresh == reads[1] / 2 && Sensors::values[1] == 1000 + reads[1] - reads[1] % 2, "fresh on frames only");
+
+  // Emitters
+  Sensors::Record rec;
+  Sensors::values[0] = 1234.5f;
+  Sensors::values[1] = MockA01::desc.noValue;
+  Sensors::sample(rec, 0x07);
+  String str = "";
+  Sensors::csvHeader(str);
+  check(str == ",URM14 distance (mm),A01NYUB distance (mm),External temperature (°C)", "CSV header");
+  str = "";
+  Sensors::csvValues(str, rec);
+  check(str == ",1234.5,,15.125", "CSV values, disconnected sensor empty");
+  rec.fresh = 0x05;
+  rec.values[1] = 987;
+  str = "";
+  uint32_t t = micros();
+  Sensors::jsonValues(str, rec);
+  uint32_t json_us = micros() - t;
+  check(str == ",\"urm\":1234.5,\"temp\":15.125", "JSON values, sensor not refreshed left out");
+
+  Serial.print("Tick (us) :\t"); Serial.println((float)tick_us / NB_TICKS);
+  Serial.print("JSON (us) :\t"); Serial.println(json_us);
+  printResult();
+}
+
+void loop() {
+}
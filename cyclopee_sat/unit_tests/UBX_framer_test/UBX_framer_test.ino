@@ -0,0 +1,177 @@
+/* --------------------------
+ * @inspiration:
+ *    SD_test
+ *
+ *  @brief:
+ *    This program checks the UBX framer (UBX_framer.h) against a recorded
+ *    u-blox log file (RAWX logger .ubx file) stored on the SD card.
+ *    The file is fed to the framer twice : byte per byte, then by spans of
+ *    random sizes. Both passes must report the same frames, with no error
+ *    and a total frame length equal to the file size.
+ *    Frame counts per class/ID and parse throughput are printed.
+ *
+ *  @board:
+ *    Teensy 3.5
+ * --------------------------
+ */
+/* ##########################
+ * #   GLOBAL DEFINITIONS   #
+ * ##########################
+ */
+// Recorded file to check
+#define UBX_FILE_NAME   "test.ubx"
+// Maximum span size for the random span pass
+#define MAX_SPAN_SIZE   512
+// Maximum number of distinct class/ID pairs counted
+#define MAX_MSG_TYPES   16
+
+/* ################
+ * #  LIBRARIES   #
+ * ################
+ */
+#include <SD.h>
+#include "Unit_test.h"
+#include "UBX_framer.h"
+
+/* ################
+ * #  PROGRAM     #
+ * ################
+ */
+// Frame statistics of a pass
+struct PassStats {
+  uint32_t nbUbx;
+  uint32_t nbNmea;
+  uint32_t nbErrors;
+  uint32_t frameBytes;
+  uint32_t fileBytes;
+  uint32_t parseTime_us;
+  uint16_t msgType[MAX_MSG_TYPES];
+  uint32_t msgCount[MAX_MSG_TYPES];
+};
+
+File file;
+UbxFramer framer;
+UbxFramer::Frame frame;
+uint8_t buf[MAX_SPAN_SIZE];
+PassStats byteStats, spanStats;
+
+/*
+ * @brief:
+ *    Updates pass statistics with a completed frame.
+ */
+void countFrame(PassStats& stats, const UbxFramer::Frame& frame)  {
+
+  if (frame.type == UbxFramer::FRAME_ERROR)  {
+    stats.nbErrors++;
+    return;
+  }
+  stats.frameBytes += frame.length;
+  if (frame.type == UbxFramer::FRAME_NMEA)  {
+    stats.nbNmea++;
+    return;
+  }
+  stats.nbUbx++;
+  uint16_t type = (frame.cls << 8) | frame.id;
+  for (uint8_t i = 0; i < MAX_MSG_TYPES; i++)  {
+    if (stats.msgCount[i] == 0)
+      stats.msgType[i] = type;
+    if (stats.msgType[i] == type)  {
+      stats.msgCount[i]++;
+      return;
+    }
+  }
+}
+
+/*
+ * @brief:
+ *    Feeds the whole file to the framer.
+ * @params:
+ *    stats: Pass statistics.
+ *    maxSpan: Maximum span size (1 for byte per byte).
+ */
+void runPass(PassStats& stats, const size_t& maxSpan)  {
+
+  memset(&stats, 0, sizeof(stats));
+  framer.reset();
+  file.seek(0);
+
+  while (file.available())  {
+    size_t span = (maxSpan == 1) ? 1 : randomRange(1, maxSpan + 1);
+    size_t n = file.read(buf, span);
+    stats.fileBytes += n;
+
+    uint32_t t = micros();
+    size_t off = 0;
+    while (off < n)  {
+      off += framer.parse(buf + off, n - off, frame);
+      if (frame.type != UbxFramer::FRAME_NONE)
+        countFrame(stats, frame);
+    }
+    stats.parseTime_us += micros() - t;
+  }
+}
+
+/*
+ * @brief:
+ *    Prints pass statistics.
+ */
+void printPass(const char* name, const PassStats& stats)  {
+
+  Serial.print("## "); Serial.println(name);
+  Serial.print("File bytes :\t"); Serial.println(stats.fileBytes);
+  Serial.print("Frame bytes :\t"); Serial.println(stats.frameBytes);
+  Serial.print("UBX frames :\t"); Serial.println(stats.nbUbx);
+  Serial.print("NMEA frames :\t"); Serial.println(stats.nbNmea);
+  Serial.print("Frame errors :\t"); Serial.println(stats.nbErrors);
+  for (uint8_t i = 0; i < MAX_MSG_TYPES && stats.msgCount[i] > 0; i++)  {
+    Serial.print("  0x"); Serial.print(stats.msgType[i] >> 8, HEX);
+    Serial.print(" 0x"); Serial.print(stats.msgType[i] & 0xFF, HEX);
+    Serial.print(" :\t"); Serial.println(stats.msgCount[i]);
+  }
+  Serial.print("Parse time (us) :\t"); Serial.println(stats.parseTime_us);
+  Serial.print("Throughput (kB/s) :\t");
+  Serial.println(stats.parseTime_us ? stats.fileBytes * 1000.0 / stats.parseTime_us : 0);
+  Serial.println();
+}
+
+void setup() {
+
+  Serial.begin(115200);
+  while (!Serial);
+
+  Serial.println("#### UBX framer test #####");
+
+  /* SD card init */
+  Serial.print("SD card init... ");
+  if (!SD.begin(BUILTIN_SDCARD))  {
+    Serial.println("Failed, please reboot.");
+    while(1);
+  }
+  Serial.println("Done.");
+
+  /* Open recorded file */
+  Serial.print("Opening '" UBX_FILE_NAME "'... ");
+  file = SD.open(UBX_FILE_NAME, FILE_READ);
+  if (!file) {
+    Serial.println("Failed, please reboot.");
+    while(1);
+  }
+  Serial.println("Done.\n");
+
+  runPass(byteStats, 1);
+  printPass("Byte per byte", byteStats);
+  runPass(spanStats, MAX_SPAN_SIZE);
+  printPass("Random spans", spanStats);
+  file.close();
+
+  /* Check results */
+  check(byteStats.nbErrors == 0, "no frame error");
+  check(byteStats.frameBytes == byteStats.fileBytes, "frames cover the whole file");
+  check(spanStats.nbUbx == byteStats.nbUbx && spanStats.nbNmea == byteStats.nbNmea, "same frames by random spans");
+  check(spanStats.nbErrors == byteStats.nbErrors && spanStats.frameBytes == byteStats.frameBytes,
+        "same frame bytes by random spans");
+  printResult();
+}
+
+void loop() {
+}
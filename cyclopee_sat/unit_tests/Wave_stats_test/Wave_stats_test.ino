@@ -0,0 +1,108 @@
+/* --------------------------
+ * @inspiration:
+ *    Sensor_scheduler_test
+ *
+ *  @brief:
+ *    This program checks the wave statistics (Wave_stats.h) on a generated
+ *    burst of distance frames at 10Hz (GNSS_logger bursts):
+ *      - Mean distance, a swell of SWELL_HEIGHT at SWELL_PERIOD and a wind
+ *        sea of SEA_HEIGHT at SEA_PERIOD, a tide trend and noise.
+ *      - LOST_EVERY frames are lost (NAN).
+ *    Hm0 must be 4 times the standard deviation of the waves within
+ *    HM0_TOLERANCE, Tp the swell period within a frequency bin, the swell
+ *    band the largest of the decimated spectrum. A burst with too many lost
+ *    frames must be refused. The compute time is then printed (µs).
+ *
+ *  @board:
+ *    Teensy 3.5
+ * --------------------------
+ */
+/* ##########################
+ * #   GLOBAL DEFINITIONS   #
+ * ##########################
+ */
+// Burst (GNSS_logger)
+#define WAVE_BURST_SAMPLES  4096
+#define SAMPLE_RATE   10.0f/*Hz*/
+// Generated sea state
+#define MEAN_DIST     3000.0f/*mm*/
+#define SWELL_HEIGHT  600.0f/*mm, crest to trough*/
+#define SWELL_PERIOD  8.0f/*s*/
+#define SEA_HEIGHT    200.0f/*mm, crest to trough*/
+#define SEA_PERIOD    3.3f/*s*/
+#define TIDE_SLOPE    0.05f/*mm per frame*/
+#define NOISE         5.0f/*mm, uniform*/
+#define LOST_EVERY    31
+#define HM0_TOLERANCE 0.05f
+
+/* ################
+ * #  LIBRARIES   #
+ * ################
+ */
+#include "Unit_test.h"
+#include "Wave_stats.h"
+
+/* ################
+ * #  PROGRAM     #
+ * ################
+ */
+WaveBurst burst;
+// Generated burst, every lostEvery frame lost
+void generate(uint16_t lostEvery)  {
+
+  burst.start(SAMPLE_RATE);
+  for (uint16_t i = 0; burst.active() && !burst.full(); i++)  {
+    float t = i / SAMPLE_RATE;
+    float dist = MEAN_DIST + TIDE_SLOPE * (i - WAVE_BURST_SAMPLES / 2)
+               + SWELL_HEIGHT / 2 * sinf(2 * (float)M_PI * t / SWELL_PERIOD)
+               + SEA_HEIGHT / 2 * sinf(2 * (float)M_PI * t / SEA_PERIOD + 1) + noise(NOISE);
+    burst.add((i % lostEvery == lostEvery - 1) ? NAN : dist);
+  }
+}
+
+void setup() {
+
+  Serial.begin(115200);
+  while (!Serial);
+
+  Serial.println("#### Wave stats test #####");
+
+  WaveStats s;
+  generate(LOST_EVERY);
+  uint32_t t = micros();
+  check(burst.compute(s), "burst accepted");
+  t = micros() - t;
+  check(!burst.active(), "burst ended");
+
+  // Hm0 = 4 sigma, sigma² = sum of a²/2 (noise mostly outside the wave range)
+  float hm0 = 4 * sqrtf((SWELL_HEIGHT * SWELL_HEIGHT + SEA_HEIGHT * SEA_HEIGHT) / 8);
+  float df = SAMPLE_RATE / WAVE_BURST_SAMPLES;
+  check(fabsf(s.meanDist_mm - MEAN_DIST) < 5, "mean distance");
+  check(fabsf(s.hm0_mm - hm0) < HM0_TOLERANCE * hm0, "significant wave height");
+  check(fabsf(1 / s.tp_s - 1 / SWELL_PERIOD) <= df, "peak period");
+  check(s.tm01_s > SEA_PERIOD && s.tm01_s < SWELL_PERIOD, "mean period between both periods");
+  uint8_t peakBand = 0;
+  for (uint8_t b = 1; b < WAVE_BANDS; b++)
+    if (s.psd[b] > s.psd[peakBand])
+      peakBand = b;
+  check(peakBand == (uint8_t)(1 / SWELL_PERIOD / WAVE_BAND_WIDTH), "swell band");
+
+  Serial.print("Mean distance (mm) :\t"); Serial.println(s.meanDist_mm);
+  Serial.print("Hm0 (mm) :\t"); Serial.print(s.hm0_mm); Serial.print(" (expected "); Serial.print(hm0); Serial.println(")");
+  Serial.print("Tp (s) :\t"); Serial.println(s.tp_s);
+  Serial.print("Tm01 (s) :\t"); Serial.println(s.tm01_s);
+  Serial.print("Valid :\t"); Serial.println(s.valid);
+  for (uint8_t b = 0; b < WAVE_BANDS; b++)  {
+    Serial.print("PSD band "); Serial.print(b); Serial.print(" (mm2/Hz) :\t"); Serial.println(s.psd[b]);
+  }
+
+  // Sensor lost every other frame
+  generate(2);
+  check(!burst.compute(s), "burst with lost frames refused");
+
+  Serial.print("Compute (us) :\t"); Serial.println(t);
+  printResult();
+}
+
+void loop() {
+}
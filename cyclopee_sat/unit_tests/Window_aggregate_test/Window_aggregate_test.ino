@@ -0,0 +1,110 @@
+/* --------------------------
+ * @inspiration:
+ *    Sensor_scheduler_test
+ *
+ *  @brief:
+ *    This program checks the window aggregates (Window_aggregate.h):
+ *      - Running statistics of generated channels far from 0 (longitude in
+ *        nanodegrees, distance in mm) against a two pass computation in
+ *        double: mean, min, max exact or within a unit, standard deviation
+ *        within STD_TOLERANCE.
+ *      - Windows aligned on midnight, closed by the first sample of the
+ *        next window, lengths not dividing the day refused.
+ *      - aggregate orders parsed, invalid ones leaving the config
+ *        unchanged.
+ *    The time of an added sample is then printed (µs).
+ *
+ *  @board:
+ *    Teensy 3.5
+ * --------------------------
+ */
+/* ##########################
+ * #   GLOBAL DEFINITIONS   #
+ * ##########################
+ */
+// Samples of a window (1 min at 10Hz)
+#define NB_SAMPLES    600
+#define STD_TOLERANCE 0.01f
+
+/* ################
+ * #  LIBRARIES   #
+ * ################
+ */
+#include "Unit_test.h"
+#include "Window_aggregate.h"
+
+/* ################
+ * #  PROGRAM     #
+ * ################
+ */
+void setup() {
+
+  Serial.begin(115200);
+  while (!Serial);
+
+  Serial.println("#### Window aggregate test #####");
+
+  // Longitude -1.123456789° +/- 20 cm, distance 3 m +/- 50 mm
+  int64_t lng[NB_SAMPLES];
+  float dist[NB_SAMPLES];
+  RunningStats<int64_t> lngStats;
+  RunningStats<float> distStats;
+  uint32_t t_us = 0;
+  for (uint16_t i = 0; i < NB_SAMPLES; i++)  {
+    lng[i] = -1123456789LL + randomOffset(2500);
+    dist[i] = 3000.0f + randomOffset(500) / 10.0f;
+    uint32_t t = micros();
+    lngStats.add(lng[i]);
+    distStats.add(dist[i]);
+    t_us += micros() - t;
+  }
+  double lngSum = 0, distSum = 0, lngVar = 0, distVar = 0;
+  int64_t lngMin = lng[0], lngMax = lng[0];
+  for (uint16_t i = 0; i < NB_SAMPLES; i++)  {
+    lngSum += lng[i];
+    distSum += dist[i];
+    lngMin = lng[i] < lngMin ? lng[i] : lngMin;
+    lngMax = lng[i] > lngMax ? lng[i] : lngMax;
+  }
+  double lngMean = lngSum / NB_SAMPLES, distMean = distSum / NB_SAMPLES;
+  for (uint16_t i = 0; i < NB_SAMPLES; i++)  {
+    lngVar += (lng[i] - lngMean) * (lng[i] - lngMean);
+    distVar += (dist[i] - distMean) * (dist[i] - distMean);
+  }
+  double lngStd = sqrt(lngVar / (NB_SAMPLES - 1)), distStd = sqrt(distVar / (NB_SAMPLES - 1));
+  check(lngStats.count() == NB_SAMPLES, "count");
+  check(fabs(lngStats.mean() - lngMean) <= 1, "longitude mean within 1 nanodegree");
+  check(lngStats.min() == lngMin && lngStats.max() == lngMax, "longitude min and max");
+  check(fabs(lngStats.std() - lngStd) < STD_TOLERANCE * lngStd, "longitude standard deviation");
+  check(fabs(distStats.mean() - distMean) < 0.01, "distance mean");
+  check(fabs(distStats.std() - distStd) < STD_TOLERANCE * distStd, "distance standard deviation");
+  float lngRunningStd = lngStats.std();
+  lngStats.clear();
+  lngStats.add(5);
+  check(lngStats.count() == 1 && lngStats.mean() == 5 && lngStats.std() == 0, "cleared statistics");
+
+  // Windows
+  AggregateWindow window(60);
+  check(window.isNew(0), "no window open");
+  window.begin(3725000000ULL);
+  check(window.start_us() == 3720000000ULL, "window aligned on the minute");
+  check(!window.isNew(3779999999ULL), "same window");
+  check(window.isNew(3780000000ULL), "next window");
+  check(!window.setLength(7) && window.length() == 60, "length not dividing the day");
+  check(!window.setLength(7200) && window.setLength(600) && window.length() == 600, "longest window");
+
+  // Orders
+  uint32_t window_s = 60;
+  uint8_t sd = STREAM_RAW, bt = STREAM_RAW;
+  check(parseAggregateOrder("{\"order\":\"aggregate\", \"window\":1, \"bt\":\"agg\"}", window_s, sd, bt) && window_s == 1 && sd == STREAM_RAW && bt == STREAM_AGGREGATE, "aggregate order");
+  check(parseAggregateOrder("{\"order\":\"aggregate\",\"sd\":\"both\"}", window_s, sd, bt) && window_s == 1 && sd == STREAM_BOTH, "sink only");
+  check(!parseAggregateOrder("{\"order\":\"aggregate\",\"sd\":\"none\",\"bt\":\"all\"}", window_s, sd, bt) && sd == STREAM_BOTH && bt == STREAM_AGGREGATE, "invalid stream");
+  check(!parseAggregateOrder("{\"order\":\"update_interval\",\"value\":100}", window_s, sd, bt), "other order");
+
+  Serial.print("Longitude std (nanodeg) :\t"); Serial.print(lngStd); Serial.print(" (running "); Serial.print(lngRunningStd); Serial.println(")");
+  Serial.print("Add (us) :\t"); Serial.println((float)t_us / (2 * NB_SAMPLES));
+  printResult();
+}
+
+void loop() {
+}
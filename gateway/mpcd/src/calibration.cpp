@@ -0,0 +1,126 @@
+#include "calibration.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+#include "log.h"
+#include "pg_copy.h"
+
+static const char* CALIBRATION_QUERY =
+  "SELECT sat_id, (extract(epoch FROM valid_from) * 1000000)::int8, "
+  "(extract(epoch FROM valid_to) * 1000000)::int8, "
+  "antenna_offset_m, datum_offset_m, cond_alpha "
+  "FROM cyclopee.calibration ORDER BY sat_id, valid_from";
+
+bool CalibrationRegistry::load(PgConnection& db)  {
+
+  if (!db.ensureConnected())
+    return false;
+  PGresult* res = PQexec(db.handle(), CALIBRATION_QUERY);
+  if (PQresultStatus(res) != PGRES_TUPLES_OK)  {
+    logMsg(LOG_ERR, "calibration load failed: %s", PQresultErrorMessage(res));
+    PQclear(res);
+    return false;
+  }
+
+  bySat.clear();
+  count = PQntuples(res);
+  for (size_t i = 0; i < count; i++)  {
+    Calibration c;
+    c.validFrom = strtoll(PQgetvalue(res, i, 1), nullptr, 10);
+    c.validTo = PQgetisnull(res, i, 2) ? std::numeric_limits<int64_t>::max() : strtoll(PQgetvalue(res, i, 2), nullptr, 10);
+    c.antennaOffset_m = atof(PQgetvalue(res, i, 3));
+    c.datumOffset_m = atof(PQgetvalue(res, i, 4));
+    c.condAlpha = PQgetisnull(res, i, 5) ? DEFAULT_COND_ALPHA : atof(PQgetvalue(res, i, 5));
+    bySat[PQgetvalue(res, i, 0)].push_back(c);
+  }
+  PQclear(res);
+  logMsg(LOG_INFO, "%zu calibrations loaded", count);
+  return true;
+}
+
+const Calibration* CalibrationRegistry::find(std::string_view satId, int64_t time_us) const  {
+
+  auto it = bySat.find(std::string(satId));
+  if (it == bySat.end())
+    return nullptr;
+  const std::vector<Calibration>& list = it->second;
+  // Last calibration starting before time and still valid (same rule as cyclopee.recalibrate())
+  auto c = std::upper_bound(list.begin(), list.end(), time_us,
+                            [](int64_t t, const Calibration& cal)  { return t < cal.validFrom; });
+  while (c != list.begin())  {
+    --c;
+    if (time_us < c->validTo)
+      return &*c;
+  }
+  return nullptr;
+}
+
+namespace {
+
+/*
+ * @brief:
+ *    Looks up the calibration of each row. Rows come in runs of the same
+ *    satellite, the previous result is reused while it stays valid.
+ */
+template <typename F>
+void forEachCalibration(const ColumnBatch& batch, const CalibrationRegistry& calibrations, F onRow)  {
+
+  const Calibration* cal = nullptr;
+  const std::string* lastSat = nullptr;
+  for (size_t i = 0; i < batch.rows(); i++)  {
+    int64_t t = batch.time[i];
+    if (!lastSat || *lastSat != batch.satId[i] || !cal || t < cal->validFrom || t >= cal->validTo)  {
+      cal = calibrations.find(batch.satId[i], t);
+      lastSat = &batch.satId[i];
+    }
+    onRow(i, cal);
+  }
+}
+
+}
+
+void deriveWaterHeight(ColumnBatch& batch, const CalibrationRegistry& calibrations)  {
+
+  const SatType& type = *batch.type;
+  const std::vector<double>& elv = batch.columns[type.columnIndex("elv")];
+  const std::vector<double>& dist = batch.columns[type.columnIndex("dist")];
+  std::vector<double>& surface = batch.derived[type.derivedIndex("surface_elv")];
+  std::vector<double>& height = batch.derived[type.derivedIndex("water_height")];
+  size_t n = batch.rows();
+
+  // Offsets of each row (0 without calibration)
+  std::vector<double> antenna(n), datum(n);
+  forEachCalibration(batch, calibrations, [&](size_t i, const Calibration* cal)  {
+    antenna[i] = cal ? cal->antennaOffset_m : 0;
+    datum[i] = cal ? cal->datumOffset_m : 0;
+  });
+
+  // NaN (NULL) inputs give NaN outputs
+  surface.resize(n);
+  height.resize(n);
+  for (size_t i = 0; i < n; i++)
+    surface[i] = elv[i] - dist[i] * 0.001 - antenna[i];
+  for (size_t i = 0; i < n; i++)
+    height[i] = surface[i] + datum[i];
+}
+
+void deriveCond25(ColumnBatch& batch, const CalibrationRegistry& calibrations)  {
+
+  const SatType& type = *batch.type;
+  const std::vector<double>& cond = batch.columns[type.columnIndex("cond")];
+  const std::vector<double>& temp = batch.columns[type.columnIndex("temp")];
+  std::vector<double>& cond25 = batch.derived[type.derivedIndex("cond25")];
+  size_t n = batch.rows();
+
+  std::vector<double> alpha(n);
+  forEachCalibration(batch, calibrations, [&](size_t i, const Calibration* cal)  {
+    alpha[i] = cal ? cal->condAlpha : DEFAULT_COND_ALPHA;
+  });
+
+  cond25.resize(n);
+  for (size_t i = 0; i < n; i++)
+    cond25[i] = cond[i] / (1.0 + alpha[i] * (temp[i] - 25.0));
+}
@@ -0,0 +1,71 @@
+/*
+ ****************************
+ *   CALIBRATION REGISTRY   *
+ ****************************
+ * @brief:
+ *    Per-satellite calibrations (table cyclopee.calibration), keyed by
+ *    satellite ID and validity period, and the derived channels computed
+ *    with them at ingest:
+ *      - Cyclopée: surface_elv = elv - dist / 1000 - antenna_offset
+ *                  water_height = surface_elv + datum_offset
+ *      - Water case: cond25 = cond / (1 + cond_alpha * (temp - 25))
+ *    The registry is reloaded when the table changes (NOTIFY
+ *    mpcd_calibration, see gateway/sql/calibration.sql), which also
+ *    recomputes the stored derived channels over the affected range.
+ */
+#ifndef MPCD_CALIBRATION_H
+#define MPCD_CALIBRATION_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "schema.h"
+
+class PgConnection;
+
+// Channel notified on cyclopee.calibration changes
+#define CALIBRATION_CHANNEL   "mpcd_calibration"
+// Conductivity temperature coefficient without calibration (1/°C)
+#define DEFAULT_COND_ALPHA    0.02
+
+struct Calibration {
+  // Validity [validFrom, validTo[, Unix µs
+  int64_t validFrom;
+  int64_t validTo;
+  double antennaOffset_m;
+  double datumOffset_m;
+  double condAlpha;
+};
+
+class CalibrationRegistry {
+public:
+  /*
+   * @brief:
+   *    Reads cyclopee.calibration.
+   * @return:
+   *    False on database error (registry unchanged).
+   */
+  bool load(PgConnection& db);
+
+  /*
+   * @brief:
+   *    Returns the calibration of a satellite at a time, nullptr if none.
+   */
+  const Calibration* find(std::string_view satId, int64_t time_us) const;
+
+  size_t size() const  { return count; }
+
+private:
+  // Calibrations of each satellite, sorted by validFrom
+  std::unordered_map<std::string, std::vector<Calibration>> bySat;
+  size_t count = 0;
+};
+
+// Derived channels of satTypes()
+void deriveWaterHeight(ColumnBatch& batch, const CalibrationRegistry& calibrations);
+void deriveCond25(ColumnBatch& batch, const CalibrationRegistry& calibrations);
+
+#endif
@@ -0,0 +1,163 @@
+#include "downsample.h"
+
+#include <cmath>
+#include <cstring>
+
+bool parseDownsampleMethod(const char* name, DownsampleMethod& method)  {
+
+  if (strcmp(name, "none") == 0)
+    method = DS_NONE;
+  else if (strcmp(name, "lttb") == 0)
+    method = DS_LTTB;
+  else if (strcmp(name, "minmax") == 0)
+    method = DS_MINMAX;
+  else
+    return false;
+  return true;
+}
+
+Downsampler::Downsampler(DownsampleMethod method, int64_t from_us, int64_t to_us, size_t points, EmitCallback emit)
+  : method(method), from_us(from_us), span_us(to_us > from_us ? to_us - from_us : 1), onEmit(std::move(emit))  {
+
+  // LTTB keeps the first and last points outside the buckets
+  if (method == DS_LTTB)
+    buckets = points > 3 ? (int64_t)points - 2 : 1;
+  else
+    buckets = points > 2 ? (int64_t)points / 2 : 1;
+}
+
+int64_t Downsampler::bucketOf(int64_t time_us) const  {
+
+  if (time_us <= from_us)
+    return 0;
+  // 128 bits: spans of years in microseconds times thousands of buckets
+  int64_t b = (int64_t)((__int128)(time_us - from_us) * buckets / span_us);
+  return b < buckets ? b : buckets - 1;
+}
+
+void Downsampler::emit(const SeriesPoint& p)  {
+
+  nbEmitted++;
+  onEmit(p);
+}
+
+void Downsampler::add(const SeriesPoint& p)  {
+
+  nbAdded++;
+  seriesPoints++;
+  if (method == DS_NONE)  {
+    emit(p);
+    return;
+  }
+
+  int64_t b = bucketOf(p.time_us);
+  if (method == DS_MINMAX)  {
+    if (seriesPoints > 1 && b != currentBucket)
+      flushMinMax();
+    if (seriesPoints == 1 || b != currentBucket)  {
+      currentBucket = b;
+      low = high = p;
+    }
+    else if (p.y < low.y)  {
+      low = p;
+    }
+    else if (p.y > high.y)  {
+      high = p;
+    }
+    return;
+  }
+
+  // LTTB: the first point is kept as is
+  if (seriesPoints == 1)  {
+    anchor = p;
+    emit(p);
+    return;
+  }
+  if (current.empty())  {
+    current.push_back(p);
+    currentBucket = b;
+  }
+  else if (b == currentBucket && next.empty())  {
+    current.push_back(p);
+  }
+  else if (next.empty() || b == nextBucket)  {
+    next.push_back(p);
+    nextBucket = b;
+  }
+  else  {
+    // Next bucket complete: its average decides the point of the current one
+    selectBeforeNext();
+    current.swap(next);
+    currentBucket = nextBucket;
+    next.clear();
+    next.push_back(p);
+    nextBucket = b;
+  }
+}
+
+void Downsampler::selectBeforeNext()  {
+
+  double cx = 0, cy = 0;
+  for (const SeriesPoint& q : next)  {
+    cx += q.x;
+    cy += q.y;
+  }
+  select(current, cx / next.size(), cy / next.size());
+}
+
+void Downsampler::select(const std::vector<SeriesPoint>& bucket, double cx, double cy)  {
+
+  if (bucket.empty())
+    return;
+  size_t best = 0;
+  double bestArea = -1;
+  for (size_t i = 0; i < bucket.size(); i++)  {
+    // Twice the triangle area, the factor does not change the choice
+    double area = fabs((anchor.x - cx) * (bucket[i].y - anchor.y) - (anchor.x - bucket[i].x) * (cy - anchor.y));
+    if (area > bestArea)  {
+      bestArea = area;
+      best = i;
+    }
+  }
+  anchor = bucket[best];
+  emit(anchor);
+}
+
+void Downsampler::flushMinMax()  {
+
+  if (low.time_us == high.time_us)  {
+    emit(low);
+  }
+  else if (low.time_us < high.time_us)  {
+    emit(low);
+    emit(high);
+  }
+  else  {
+    emit(high);
+    emit(low);
+  }
+}
+
+void Downsampler::finish()  {
+
+  if (method == DS_MINMAX && seriesPoints > 0)  {
+    flushMinMax();
+  }
+  else if (method == DS_LTTB && seriesPoints > 1)  {
+    // The last point is kept as is, it closes the last bucket
+    std::vector<SeriesPoint>& tail = next.empty() ? current : next;
+    SeriesPoint last = tail.back();
+    tail.pop_back();
+    if (!next.empty())  {
+      selectBeforeNext();
+      select(next, last.x, last.y);
+    }
+    else  {
+      select(current, last.x, last.y);
+    }
+    emit(last);
+  }
+  current.clear();
+  next.clear();
+  seriesPoints = 0;
+}
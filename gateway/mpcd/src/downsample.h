@@ -0,0 +1,99 @@
+/*
+ ****************************
+ *       DOWNSAMPLING       *
+ ****************************
+ * @brief:
+ *    Reduces a time ordered series to about as many points as the panel
+ *    has pixels, on the fly (rows are not stored):
+ *      - LTTB (Largest-Triangle-Three-Buckets, S. Steinarsson 2013): the
+ *        first and last points are kept, in each bucket the point forming
+ *        the largest triangle with the point kept in the previous bucket
+ *        and the average of the next bucket is kept. Shape preserving,
+ *        one point per bucket.
+ *      - MINMAX: the lowest and highest points of each bucket, in time
+ *        order. Keeps every peak, two points per bucket.
+ *    Buckets are equal time spans of [from, to): a gap in the data stays a
+ *    gap, and a series is cut the same way whatever its sampling rate.
+ *    Only the points of two buckets are held.
+ * @note:
+ *    x and y are the coordinates of the triangles: (time, value) for a
+ *    series, (lon, lat) for a track (the selection does not depend on the
+ *    scale of the axes).
+ */
+#ifndef MPCD_DOWNSAMPLE_H
+#define MPCD_DOWNSAMPLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+enum DownsampleMethod { DS_NONE, DS_LTTB, DS_MINMAX };
+
+struct SeriesPoint {
+  int64_t time_us;
+  double x;
+  double y;
+};
+
+/*
+ * @brief:
+ *    Parses "none", "lttb" or "minmax".
+ * @return:
+ *    False if name is not a method.
+ */
+bool parseDownsampleMethod(const char* name, DownsampleMethod& method);
+
+class Downsampler {
+public:
+  // Receives the points kept, in time order
+  typedef std::function<void(const SeriesPoint& p)> EmitCallback;
+
+  /*
+   * @params:
+   *    method: Selection.
+   *    from_us, to_us: Time range of the query.
+   *    points: Points wanted (LTTB: at most points, MINMAX: at most points
+   *      rounded down to even).
+   *    emit: Callback.
+   */
+  Downsampler(DownsampleMethod method, int64_t from_us, int64_t to_us, size_t points, EmitCallback emit);
+
+  // Adds the next point of the series (time ascending)
+  void add(const SeriesPoint& p);
+
+  // Ends the series: emits the pending points, ready for another series
+  void finish();
+
+  // Points added and emitted since construction
+  uint64_t added() const  { return nbAdded; }
+  uint64_t emitted() const  { return nbEmitted; }
+
+private:
+  DownsampleMethod method;
+  int64_t from_us;
+  int64_t span_us;
+  int64_t buckets;
+  EmitCallback onEmit;
+  uint64_t nbAdded = 0;
+  uint64_t nbEmitted = 0;
+  // Points of the series so far
+  uint64_t seriesPoints = 0;
+
+  // LTTB: last point kept, points of the current and next buckets
+  SeriesPoint anchor{};
+  std::vector<SeriesPoint> current, next;
+  int64_t currentBucket = 0, nextBucket = 0;
+
+  // MINMAX: extremes of the current bucket
+  SeriesPoint low{}, high{};
+
+  int64_t bucketOf(int64_t time_us) const;
+  void emit(const SeriesPoint& p);
+  // Keeps the point of bucket making the largest triangle with anchor and (cx, cy)
+  void select(const std::vector<SeriesPoint>& bucket, double cx, double cy);
+  void selectBeforeNext();
+  void flushMinMax();
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include "event_loop.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "log.h"
+
+EventLoop::EventLoop()  {
+
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+
+  // Termination signals are read from a file descriptor
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigprocmask(SIG_BLOCK, &mask, nullptr);
+  sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  // Writing to a closed socket must not kill the daemon
+  signal(SIGPIPE, SIG_IGN);
+
+  add(sigfd, EPOLLIN, [this](uint32_t)  {
+    struct signalfd_siginfo info;
+    if (read(sigfd, &info, sizeof(info)) == sizeof(info))
+      logMsg(LOG_INFO, "signal %u received, stopping", info.ssi_signo);
+    stop();
+  });
+}
+
+EventLoop::~EventLoop()  {
+
+  close(sigfd);
+  close(epfd);
+}
+
+bool EventLoop::add(int fd, uint32_t events, Callback cb)  {
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.fd = fd;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)  {
+    logMsg(LOG_ERR, "epoll add fd %d: %s", fd, strerror(errno));
+    return false;
+  }
+  watchers[fd] = std::make_shared<Callback>(std::move(cb));
+  return true;
+}
+
+bool EventLoop::modify(int fd, uint32_t events)  {
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.fd = fd;
+  return epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void EventLoop::remove(int fd)  {
+
+  epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+  watchers.erase(fd);
+}
+
+int EventLoop::addTimer(int interval_ms, std::function<void()> cb)  {
+
+  int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (tfd < 0)
+    return -1;
+  struct itimerspec spec;
+  spec.it_interval.tv_sec = interval_ms / 1000;
+  spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+  spec.it_value = spec.it_interval;
+  timerfd_settime(tfd, 0, &spec, nullptr);
+
+  bool ok = add(tfd, EPOLLIN, [tfd, cb](uint32_t)  {
+    uint64_t expirations;
+    if (read(tfd, &expirations, sizeof(expirations)) == sizeof(expirations))
+      cb();
+  });
+  if (!ok)  {
+    close(tfd);
+    return -1;
+  }
+  return tfd;
+}
+
+void EventLoop::removeTimer(int id)  {
+
+  remove(id);
+  close(id);
+}
+
+void EventLoop::run()  {
+
+  struct epoll_event events[32];
+  running = true;
+
+  while (running)  {
+    int n = epoll_wait(epfd, events, 32, -1);
+    if (n < 0)  {
+      if (errno == EINTR)
+        continue;
+      logMsg(LOG_ERR, "epoll_wait: %s", strerror(errno));
+      break;
+    }
+    for (int i = 0; i < n; i++)  {
+      auto it = watchers.find(events[i].data.fd);
+      // Removed by a previous callback
+      if (it == watchers.end())
+        continue;
+      std::shared_ptr<Callback> cb = it->second;
+      (*cb)(events[i].events);
+    }
+  }
+}
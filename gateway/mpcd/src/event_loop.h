@@ -0,0 +1,65 @@
+/*
+ ****************************
+ *        EVENT LOOP        *
+ ****************************
+ * @brief:
+ *    Single threaded epoll loop. File descriptors and periodic timers
+ *    (timerfd) are watched with a callback each. SIGINT and SIGTERM stop
+ *    the loop (signalfd), so that pending data can be flushed on exit.
+ */
+#ifndef MPCD_EVENT_LOOP_H
+#define MPCD_EVENT_LOOP_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+
+class EventLoop {
+public:
+  typedef std::function<void(uint32_t events)> Callback;
+
+  EventLoop();
+  ~EventLoop();
+  EventLoop(const EventLoop&) = delete;
+  EventLoop& operator=(const EventLoop&) = delete;
+
+  /*
+   * @brief:
+   *    Watches a file descriptor.
+   * @params:
+   *    fd: File descriptor (not owned).
+   *    events: EPOLLIN, EPOLLOUT...
+   *    cb: Called with the ready events.
+   * @return:
+   *    False on epoll error.
+   */
+  bool add(int fd, uint32_t events, Callback cb);
+  bool modify(int fd, uint32_t events);
+  void remove(int fd);
+
+  /*
+   * @brief:
+   *    Calls cb every interval_ms.
+   * @return:
+   *    Timer id (to be given to removeTimer()), -1 on error.
+   */
+  int addTimer(int interval_ms, std::function<void()> cb);
+  void removeTimer(int id);
+
+  /*
+   * @brief:
+   *    Dispatches events until stop() or a termination signal.
+   */
+  void run();
+  void stop()  { running = false; }
+
+private:
+  int epfd;
+  int sigfd;
+  bool running = false;
+  // Callbacks are shared so that a callback may remove its own fd
+  std::map<int, std::shared_ptr<Callback>> watchers;
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include "ingest.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "log.h"
+#include "segment_queue.h"
+#include "time_util.h"
+
+Ingestor::Ingestor(PgConnection& db, const IngestConfig& config, SegmentWriter* queue)
+  : db(db), config(config), batches(config.keepRaw), queue(queue)  {
+
+  for (SampleBatch& batch : batches.all())
+    copySql.push_back(batch.copySql());
+  db.listen(CALIBRATION_CHANNEL);
+}
+
+bool Ingestor::handleLine(const std::string& source, std::string_view line, int64_t* latencyUs)  {
+
+  counters.lines++;
+  int64_t receivedUs = nowUnixUs();
+  int64_t sampleUs = INT64_MIN;
+  if (!batches.add(line, receivedUs, &sampleUs))  {
+    counters.invalidLines++;
+    logMsg(LOG_DBG, "%s: invalid line dropped: %.*s", source.c_str(), (int)line.size(), line.data());
+    return false;
+  }
+  if (latencyUs && sampleUs != INT64_MIN)
+    *latencyUs = receivedUs - sampleUs;
+  // Valid lines are also queued for the upstream server
+  if (queue)
+    queue->append(receivedUs, line);
+  return true;
+}
+
+void Ingestor::flush(bool force)  {
+
+  int64_t now = monotonicMs();
+  // Exiting: rows waiting for an interpolated member are loaded too
+  if (force)
+    batches.flushSeries();
+  std::vector<SampleBatch>& all = batches.all();
+  for (size_t i = 0; i < all.size(); i++)
+    flushBatch(all[i], copySql[i], force, now);
+}
+
+void Ingestor::flushBatch(SampleBatch& batch, const std::string& sql, bool force, int64_t now)  {
+
+  CopyBuffer& buffer = batch.buffer;
+  if (batch.rows() == 0)
+    return;
+  if (!force && batch.rows() < config.batchRows && now - batch.startMs < config.batchMs)
+    return;
+  // Database down: wait before trying again, unless exiting
+  if (failing && !force && now - lastFailureMs < config.retryMs)
+    return;
+
+  // Rows are encoded once connected, with the current calibrations
+  if (db.ensureConnected())  {
+    refreshCalibrations();
+    batches.encode(batch, calibrations);
+  }
+  size_t pending = buffer.rows();
+  if (!buffer.empty() && copyRows(sql, buffer))  {
+    if (failing)
+      logMsg(LOG_INFO, "database back, %zu pending rows sent", pending);
+    failing = false;
+    return;
+  }
+
+  counters.copyFailures++;
+  failing = true;
+  lastFailureMs = now;
+  // Database down, disk full, lock timeout...: the batch is retried later
+  if (batch.rows() > config.maxPendingRows || force)  {
+    logMsg(LOG_ERR, "%zu rows dropped", batch.rows());
+    counters.droppedRows += batch.rows();
+    batch.clear();
+  }
+}
+
+bool Ingestor::copyRows(const std::string& sql, CopyBuffer& buffer)  {
+
+  size_t total = buffer.rows();
+  if (db.copy(sql, buffer))  {
+    counters.rows += total;
+    counters.batches++;
+    logMsg(LOG_DBG, "%zu rows inserted", total);
+    buffer.clear();
+    return true;
+  }
+  if (!db.dataError())
+    return false;
+
+  // Rows refused (out of range value, constraint): sending them again
+  // fails again, the batch is split until the row is alone and skipped
+  logMsg(LOG_WARN, "%zu rows refused (SQLSTATE %s), split", total, db.lastSqlState().c_str());
+  CopyBuffer part;
+  size_t done = 0, step = (total + 1) / 2;
+  while (done < total)  {
+    size_t n = std::min(step, total - done);
+    part.clear();
+    part.appendRows(buffer, done, done + n);
+    if (db.copy(sql, part))  {
+      counters.rows += n;
+      counters.batches++;
+      done += n;
+      step = std::min(step * 2, total);
+      continue;
+    }
+    if (!db.dataError())  {
+      // Rows already inserted are not sent again
+      buffer.dropRows(done);
+      return false;
+    }
+    if (n == 1)  {
+      logMsg(LOG_ERR, "row refused (SQLSTATE %s), skipped", db.lastSqlState().c_str());
+      counters.refusedRows++;
+      done++;
+      step = std::min(step * 2, total);
+      continue;
+    }
+    step = (n + 1) / 2;
+  }
+  buffer.clear();
+  return true;
+}
+
+void Ingestor::refreshCalibrations()  {
+
+  bool changed = db.notified(CALIBRATION_CHANNEL);
+  if (!changed && calibrationConnection == db.connections())
+    return;
+  if (calibrations.load(db))  {
+    calibrationConnection = db.connections();
+    counters.calibrationLoads++;
+  }
+}
@@ -0,0 +1,111 @@
+/*
+ ****************************
+ *        INGESTOR          *
+ ****************************
+ * @brief:
+ *    Turns satellite JSON lines into rows and loads them by batches with
+ *    binary COPY. Each satellite type has its typed table and its batch
+ *    (sample_batch.h), lines of unknown types go to cyclopee.sensor (jsonb).
+ *    A batch is sent when it holds batchRows rows or when its first row
+ *    is batchMs old.
+ *    Typed rows are staged by columns: the derived channels of a batch
+ *    (calibration.h) are computed in one pass just before it is encoded.
+ *    The calibrations are reloaded at each connection and when the
+ *    database notifies a change.
+ *    Valid lines are also appended to the upstream queue if any
+ *    (segment_queue.h), the sync worker ships them on its own thread.
+ *    Lines are validated by the SAX parser: a bad line is dropped alone
+ *    instead of failing the whole COPY. A batch refused by the database
+ *    (out of range value, constraint) is split until the refused row is
+ *    alone and skipped, on any other failure the batch is kept for retry.
+ * @note:
+ *    Sample time is the satellite "time" field, or the reception time
+ *    when the satellite has no GNSS time yet ("time":null).
+ */
+#ifndef MPCD_INGEST_H
+#define MPCD_INGEST_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "calibration.h"
+#include "pg_copy.h"
+#include "sample_batch.h"
+
+class SegmentWriter;
+
+struct IngestConfig {
+  // Batch bounds
+  size_t batchRows = 1000;
+  int batchMs = 1000;
+  // Batch kept for retry while database fails, dropped above this size
+  size_t maxPendingRows = 500000;
+  // Delay between two attempts while database fails
+  int retryMs = 5000;
+  // Keep the raw line in the jsonb audit column of typed tables
+  bool keepRaw = false;
+};
+
+struct IngestStats {
+  uint64_t lines = 0;
+  uint64_t invalidLines = 0;
+  uint64_t rows = 0;
+  uint64_t batches = 0;
+  uint64_t copyFailures = 0;
+  uint64_t droppedRows = 0;
+  // Rows refused by the database (SQLSTATE class 22 or 23), skipped
+  uint64_t refusedRows = 0;
+  uint64_t calibrationLoads = 0;
+};
+
+class Ingestor {
+public:
+  Ingestor(PgConnection& db, const IngestConfig& config, SegmentWriter* queue = nullptr);
+
+  /*
+   * @brief:
+   *    Parses a satellite line and appends it to the batch of its type.
+   * @params:
+   *    source: Port name (for messages).
+   *    line: JSON line.
+   *    latencyUs: Set to reception time - sample time if the line has its time.
+   * @return:
+   *    False if line was rejected.
+   */
+  bool handleLine(const std::string& source, std::string_view line, int64_t* latencyUs = nullptr);
+
+  /*
+   * @brief:
+   *    Sends the batches whose bounds are reached.
+   * @params:
+   *    force: Send whatever is pending (exit).
+   */
+  void flush(bool force = false);
+
+  const IngestStats& stats() const  { return counters; }
+
+private:
+  PgConnection& db;
+  IngestConfig config;
+  IngestStats counters;
+  SampleBatches batches;
+  // COPY statement of each batch
+  std::vector<std::string> copySql;
+  SegmentWriter* queue;
+  CalibrationRegistry calibrations;
+  // Connection whose calibrations are loaded (PgConnection::connections())
+  uint64_t calibrationConnection = 0;
+  // Monotonic time of the last failed COPY
+  int64_t lastFailureMs = 0;
+  bool failing = false;
+
+  void flushBatch(SampleBatch& batch, const std::string& sql, bool force, int64_t now);
+  // Sends the encoded rows, false on failure with the rows not sent left in buffer
+  bool copyRows(const std::string& sql, CopyBuffer& buffer);
+  // Reloads the calibrations on new connection or notification
+  void refreshCalibrations();
+};
+
+#endif
@@ -0,0 +1,263 @@
+#include "json_sax.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+/*
+ * @brief:
+ *    Recursive descent parser over a string_view.
+ */
+class Parser {
+public:
+  Parser(std::string_view text, JsonHandler& handler) : s(text), h(handler) {}
+
+  bool run()  {
+    skipSpaces();
+    if (!value(0))
+      return false;
+    skipSpaces();
+    return pos == s.size();
+  }
+
+private:
+  std::string_view s;
+  JsonHandler& h;
+  size_t pos = 0;
+
+  void skipSpaces()  {
+    while (pos < s.size() && (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\r' || s[pos] == '\n'))
+      pos++;
+  }
+
+  bool literal(std::string_view word)  {
+    if (s.compare(pos, word.size(), word) != 0)
+      return false;
+    pos += word.size();
+    return true;
+  }
+
+  // Reads a string, pos on the opening quote. raw excludes quotes.
+  bool string(std::string_view& raw)  {
+    size_t start = ++pos;
+    while (pos < s.size())  {
+      unsigned char c = s[pos];
+      if (c == '"')  {
+        raw = s.substr(start, pos - start);
+        pos++;
+        return true;
+      }
+      if (c < 0x20)
+        return false;
+      if (c >= 0x80)  {
+        if (!utf8Char())
+          return false;
+        continue;
+      }
+      if (c == '\\')  {
+        if (++pos >= s.size())
+          return false;
+        switch (s[pos])  {
+          case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+            break;
+          case 'u': {
+            unsigned cp;
+            if (!hex4(cp) || cp == 0 || (cp >= 0xDC00 && cp <= 0xDFFF))
+              return false;
+            // High surrogate: the low one must follow
+            if (cp >= 0xD800 && cp <= 0xDBFF)  {
+              if (s.compare(pos + 1, 2, "\\u") != 0)
+                return false;
+              pos += 2;
+              if (!hex4(cp) || cp < 0xDC00 || cp > 0xDFFF)
+                return false;
+            }
+            break;
+          }
+          default:
+            return false;
+        }
+      }
+      pos++;
+    }
+    return false;
+  }
+
+  // Reads the 4 hex digits of a \u escape, pos on the 'u' and left on the last digit
+  bool hex4(unsigned& cp)  {
+    cp = 0;
+    for (int i = 0; i < 4; i++)  {
+      if (++pos >= s.size() || !isxdigit((unsigned char)s[pos]))
+        return false;
+      char c = s[pos];
+      cp = cp << 4 | (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+    }
+    return true;
+  }
+
+  /*
+   * @brief:
+   *    Checks a multibyte UTF-8 character, pos on its lead byte and left
+   *    after it. Overlong forms, surrogates, code points above U+10FFFF
+   *    and truncated sequences are refused (PostgreSQL rejects them).
+   */
+  bool utf8Char()  {
+    unsigned char c = s[pos];
+    size_t n;
+    unsigned cp, min;
+    if (c >= 0xC2 && c <= 0xDF)  {
+      n = 1;
+      cp = c & 0x1F;
+      min = 0x80;
+    } else if (c >= 0xE0 && c <= 0xEF)  {
+      n = 2;
+      cp = c & 0x0F;
+      min = 0x800;
+    } else if (c >= 0xF0 && c <= 0xF4)  {
+      n = 3;
+      cp = c & 0x07;
+      min = 0x10000;
+    } else  {
+      return false;
+    }
+    if (s.size() - pos <= n)
+      return false;
+    for (size_t i = 1; i <= n; i++)  {
+      unsigned char cc = s[pos + i];
+      if ((cc & 0xC0) != 0x80)
+        return false;
+      cp = cp << 6 | (cc & 0x3F);
+    }
+    if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+      return false;
+    pos += n + 1;
+    return true;
+  }
+
+  bool digits()  {
+    size_t start = pos;
+    while (pos < s.size() && s[pos] >= '0' && s[pos] <= '9')
+      pos++;
+    return pos > start;
+  }
+
+  bool number(int depth)  {
+    size_t start = pos;
+    if (s[pos] == '-')
+      pos++;
+    if (pos < s.size() && s[pos] == '0')
+      pos++;
+    else if (!digits())
+      return false;
+    if (pos < s.size() && s[pos] == '.')  {
+      pos++;
+      if (!digits())
+        return false;
+    }
+    if (pos < s.size() && (s[pos] == 'e' || s[pos] == 'E'))  {
+      pos++;
+      if (pos < s.size() && (s[pos] == '+' || s[pos] == '-'))
+        pos++;
+      if (!digits())
+        return false;
+    }
+    std::string_view text = s.substr(start, pos - start);
+    // strtod needs a terminated string, numbers are short
+    char buf[64];
+    double value = NAN;
+    if (text.size() < sizeof(buf))  {
+      text.copy(buf, text.size());
+      buf[text.size()] = '\0';
+      value = strtod(buf, nullptr);
+    }
+    h.numberValue(text, value, depth);
+    return true;
+  }
+
+  bool container(int depth, bool isObject)  {
+    if (depth >= JSON_MAX_DEPTH)
+      return false;
+    char close = isObject ? '}' : ']';
+    pos++;
+    h.startContainer(depth);
+    skipSpaces();
+    if (pos < s.size() && s[pos] == close)  {
+      pos++;
+      h.endContainer(depth);
+      return true;
+    }
+    while (true)  {
+      if (isObject)  {
+        std::string_view name;
+        if (pos >= s.size() || s[pos] != '"' || !string(name))
+          return false;
+        h.key(name, depth + 1);
+        skipSpaces();
+        if (pos >= s.size() || s[pos] != ':')
+          return false;
+        pos++;
+        skipSpaces();
+      }
+      if (!value(depth + 1))
+        return false;
+      skipSpaces();
+      if (pos >= s.size())
+        return false;
+      if (s[pos] == close)  {
+        pos++;
+        h.endContainer(depth);
+        return true;
+      }
+      if (s[pos] != ',')
+        return false;
+      pos++;
+      skipSpaces();
+    }
+  }
+
+  bool value(int depth)  {
+    if (pos >= s.size())
+      return false;
+    switch (s[pos])  {
+      case '{':
+        return container(depth, true);
+      case '[':
+        return container(depth, false);
+      case '"': {
+        std::string_view raw;
+        if (!string(raw))
+          return false;
+        h.stringValue(raw, depth);
+        return true;
+      }
+      case 't':
+        if (!literal("true"))
+          return false;
+        h.boolValue(true, depth);
+        return true;
+      case 'f':
+        if (!literal("false"))
+          return false;
+        h.boolValue(false, depth);
+        return true;
+      case 'n':
+        if (!literal("null"))
+          return false;
+        h.nullValue(depth);
+        return true;
+      default:
+        return number(depth);
+    }
+  }
+};
+
+}
+
+bool parseJson(std::string_view text, JsonHandler& handler)  {
+
+  Parser parser(text, handler);
+  return parser.run();
+}
@@ -0,0 +1,52 @@
+/*
+ ****************************
+ *     JSON SAX PARSER      *
+ ****************************
+ * @brief:
+ *    Event based JSON parser for satellite lines. The whole text is
+ *    validated (a line accepted here is accepted by PostgreSQL jsonb and
+ *    by the binary COPY of text columns) and each token is reported to a
+ *    JsonHandler, without building a document.
+ *    Strings must be valid UTF-8 (no overlong form, surrogate or code
+ *    point above U+10FFFF); \u0000 and unpaired surrogate escapes are
+ *    refused.
+ * @note:
+ *    String values and keys are reported raw, escapes are checked but not
+ *    decoded (satellite IDs and keys never contain any).
+ */
+#ifndef MPCD_JSON_SAX_H
+#define MPCD_JSON_SAX_H
+
+#include <string_view>
+
+// Maximum nesting depth accepted
+#define JSON_MAX_DEPTH  16
+
+/*
+ * @brief:
+ *    Receives parse events. Depth is 1 for the members of the top object.
+ */
+class JsonHandler {
+public:
+  virtual ~JsonHandler() {}
+  virtual void key(std::string_view name, int depth) {}
+  virtual void stringValue(std::string_view raw, int depth) {}
+  virtual void numberValue(std::string_view text, double value, int depth) {}
+  virtual void boolValue(bool value, int depth) {}
+  virtual void nullValue(int depth) {}
+  virtual void startContainer(int depth) {}
+  virtual void endContainer(int depth) {}
+};
+
+/*
+ * @brief:
+ *    Parses and validates a JSON text.
+ * @params:
+ *    text: JSON text, leading and trailing white spaces allowed.
+ *    handler: Events receiver.
+ * @return:
+ *    False if text is not valid JSON.
+ */
+bool parseJson(std::string_view text, JsonHandler& handler);
+
+#endif
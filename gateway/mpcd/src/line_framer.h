@@ -0,0 +1,85 @@
+/*
+ ****************************
+ *       LINE FRAMER        *
+ ****************************
+ * @brief:
+ *    Splits a byte stream into '\n' terminated lines ('\r' stripped).
+ *    Bytes are consumed by chunks of any size, lines may straddle chunks.
+ *    Lines longer than maxLength are dropped up to the next '\n'.
+ */
+#ifndef MPCD_LINE_FRAMER_H
+#define MPCD_LINE_FRAMER_H
+
+#include <cstring>
+#include <string>
+#include <string_view>
+
+class LineFramer {
+public:
+  explicit LineFramer(size_t maxLength = 4096) : maxLength(maxLength) {}
+
+  /*
+   * @brief:
+   *    Consumes a chunk, calls onLine(std::string_view) for each complete line.
+   */
+  template <typename F>
+  void feed(const char* data, size_t len, F onLine)  {
+
+    while (len > 0)  {
+      const char* nl = (const char*)memchr(data, '\n', len);
+      size_t n = nl ? (size_t)(nl - data) : len;
+
+      if (!overflow)  {
+        // Whole line in this chunk: no copy
+        if (nl && pending.empty())
+          emit(std::string_view(data, n), onLine);
+        else if (pending.size() + n > maxLength)  {
+          overflow = true;
+          pending.clear();
+          overflows++;
+        }
+        else  {
+          pending.append(data, n);
+          if (nl)  {
+            emit(pending, onLine);
+            pending.clear();
+          }
+        }
+      }
+      if (nl)  {
+        overflow = false;
+        n++;
+      }
+      data += n;
+      len -= n;
+    }
+  }
+
+  // Drops any partial line (port reopened)
+  void reset()  {
+    pending.clear();
+    overflow = false;
+  }
+
+  // Number of lines dropped because too long
+  size_t overflows = 0;
+
+private:
+  size_t maxLength;
+  std::string pending;
+  bool overflow = false;
+
+  template <typename F>
+  void emit(std::string_view line, F& onLine)  {
+    if (!line.empty() && line.back() == '\r')
+      line.remove_suffix(1);
+    if (line.empty())
+      return;
+    if (line.size() > maxLength)
+      overflows++;
+    else
+      onLine(line);
+  }
+};
+
+#endif
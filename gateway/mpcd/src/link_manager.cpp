@@ -0,0 +1,184 @@
+#include "link_manager.h"
+
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/epoll.h>
+
+#include "log.h"
+#include "time_util.h"
+
+namespace {
+
+// Device names of a directory of the BlueZ storage (adapters, devices)
+std::vector<std::string> listAddresses(const std::string& dir)  {
+
+  std::vector<std::string> names;
+  DIR* d = opendir(dir.c_str());
+  if (!d)
+    return names;
+  while (struct dirent* e = readdir(d))  {
+    LinkAddress a;
+    if (parseLinkAddress(e->d_name, a))
+      names.push_back(e->d_name);
+  }
+  closedir(d);
+  return names;
+}
+
+/*
+ * @brief:
+ *    Reads the name of a device from its info file.
+ * @return:
+ *    False if the device is not paired (no link key).
+ */
+bool readPairedDevice(const std::string& infoPath, std::string& name)  {
+
+  FILE* f = fopen(infoPath.c_str(), "r");
+  if (!f)
+    return false;
+  char line[256];
+  bool paired = false;
+  bool general = false;
+  while (fgets(line, sizeof(line), f))  {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '[')  {
+      general = strcmp(line, "[General]") == 0;
+      paired = paired || strcmp(line, "[LinkKey]") == 0;
+    }
+    else if (general && strncmp(line, "Name=", 5) == 0)  {
+      name = line + 5;
+    }
+  }
+  fclose(f);
+  return paired;
+}
+
+}
+
+bool LinkManager::addLink(const LinkAddress& address, const std::string& name)  {
+
+  for (const auto& link : links)
+    if (link->address().text == address.text)
+      return false;
+  links.emplace_back(new SatLink(address, name.empty() ? address.text : name + " (" + address.text + ")"));
+  logMsg(LOG_INFO, "link %s added", links.back()->name().c_str());
+  return true;
+}
+
+size_t LinkManager::discover(const std::string& pattern, const std::string& storage)  {
+
+  size_t added = 0;
+  for (const std::string& adapter : listAddresses(storage))  {
+    for (const std::string& device : listAddresses(storage + "/" + adapter))  {
+      std::string name;
+      if (!readPairedDevice(storage + "/" + adapter + "/" + device + "/info", name))
+        continue;
+      if (fnmatch(pattern.c_str(), name.c_str(), 0) != 0)
+        continue;
+      LinkAddress address;
+      if (parseLinkAddress(device, address) && addLink(address, name))
+        added++;
+    }
+  }
+  return added;
+}
+
+void LinkManager::watch(SatLink& link)  {
+
+  int fd = link.fd();
+  // Connecting: wait until writable
+  loop.add(fd, EPOLLOUT, [this, &link, fd](uint32_t events)  {
+    loop.remove(fd);
+    if (!link.finishConnect(monotonicMs()))
+      return;
+    // Connected: read the lines, write the queued frames
+    loop.add(fd, EPOLLIN | EPOLLRDHUP, [this, &link](uint32_t events)  {
+      int64_t now = monotonicMs();
+      bool alive = true;
+      if (events & EPOLLOUT)
+        alive = flush(link, now);
+      if (alive && (events & EPOLLIN))
+        alive = link.readLines([&](std::string_view line)  { onLine(link, line); });
+      if (!alive || (events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)))
+        drop(link, now);
+    });
+  });
+}
+
+void LinkManager::drop(SatLink& link, int64_t nowMs)  {
+
+  if (link.fd() >= 0)
+    loop.remove(link.fd());
+  link.close(nowMs);
+}
+
+bool LinkManager::flush(SatLink& link, int64_t nowMs)  {
+
+  if (!link.flushOutput(nowMs))
+    return false;
+  // A few frames per second and per link: the epoll_ctl call is cheap
+  return loop.modify(link.fd(), EPOLLIN | EPOLLRDHUP | (link.outputPending() ? (uint32_t)EPOLLOUT : 0));
+}
+
+size_t LinkManager::broadcast(const OutFrame& frame, OutPriority priority)  {
+
+  return sendTo("*", frame, priority);
+}
+
+size_t LinkManager::sendTo(const std::string& pattern, const OutFrame& frame, OutPriority priority)  {
+
+  int64_t now = monotonicMs();
+  size_t sent = 0;
+  for (auto& link : links)  {
+    if (link->status() != SatLink::UP || fnmatch(pattern.c_str(), link->name().c_str(), 0) != 0)
+      continue;
+    if (!link->send(frame, priority, now))
+      continue;
+    sent++;
+    if (!flush(*link, now))
+      drop(*link, now);
+  }
+  return sent;
+}
+
+void LinkManager::poll()  {
+
+  int64_t now = monotonicMs();
+  for (auto& link : links)  {
+    if (link->timedOut(now))  {
+      logMsg(LOG_DBG, "%s: connection timed out", link->name().c_str());
+      drop(*link, now);
+    }
+    if (link->due(now) && link->connect(now))
+      watch(*link);
+  }
+}
+
+size_t LinkManager::connected() const  {
+
+  size_t n = 0;
+  for (const auto& link : links)
+    n += link->status() == SatLink::UP;
+  return n;
+}
+
+void LinkManager::logStats(int periodMs)  {
+
+  static const char* const states[] = {"down", "connecting", "up"};
+  for (auto& link : links)  {
+    const LinkStats& s = link->stats();
+    double rate = periodMs > 0 ? s.periodBytes * 1000.0 / periodMs : 0;
+    double meanMs = s.latencyCount ? s.latencySumUs / 1000.0 / s.latencyCount : 0;
+    logMsg(LOG_INFO, "%s: %s, %.0f B/s, latency mean %.0f ms max %.0f ms, lines %llu, connects %llu, failures %llu, disconnects %llu",
+           link->name().c_str(), states[link->status()], rate, meanMs, s.latencyMaxUs / 1000.0,
+           (unsigned long long)s.linesIn, (unsigned long long)s.connects, (unsigned long long)s.failures,
+           (unsigned long long)s.disconnects);
+    if (s.rtcmFrames || s.rtcmDropped || s.ordersOut)
+      logMsg(LOG_INFO, "%s: RTCM frames %llu, dropped %llu, wait max %lld ms, orders %llu", link->name().c_str(),
+             (unsigned long long)s.rtcmFrames, (unsigned long long)s.rtcmDropped, (long long)s.rtcmWaitMaxMs,
+             (unsigned long long)s.ordersOut);
+    link->resetPeriod();
+  }
+}
@@ -0,0 +1,102 @@
+/*
+ ****************************
+ *      LINK MANAGER        *
+ ****************************
+ * @brief:
+ *    Keeps one link (sat_link.h) per satellite and feeds all of them into
+ *    the event loop. Satellites are given by address (-l) or discovered
+ *    among the devices paired with the gateway adapter, by name pattern
+ *    (-a). Down links are reconnected by poll() once their backoff is over,
+ *    newly paired satellites are picked up by the same timer.
+ *    Frames for the satellites (RTCM corrections, orders) are queued on
+ *    the links and written when their sockets are writable.
+ * @note:
+ *    Paired devices are read from the BlueZ storage:
+ *      /var/lib/bluetooth/<adapter>/<device>/info  ([General] Name=..., [LinkKey])
+ */
+#ifndef MPCD_LINK_MANAGER_H
+#define MPCD_LINK_MANAGER_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "event_loop.h"
+#include "sat_link.h"
+
+// BlueZ storage of paired devices
+#define BLUEZ_STORAGE  "/var/lib/bluetooth"
+
+class LinkManager {
+public:
+  // Receives each line with its link
+  typedef std::function<void(SatLink& link, std::string_view line)> LineCallback;
+
+  LinkManager(EventLoop& loop, LineCallback onLine) : loop(loop), onLine(std::move(onLine)) {}
+
+  /*
+   * @brief:
+   *    Adds a satellite link.
+   * @return:
+   *    False if the address is already managed.
+   */
+  bool addLink(const LinkAddress& address, const std::string& name);
+
+  /*
+   * @brief:
+   *    Adds the paired devices whose name matches a pattern.
+   * @params:
+   *    pattern: fnmatch() pattern, e.g. "CYCLOPEE*".
+   * @return:
+   *    Number of new links.
+   */
+  size_t discover(const std::string& pattern, const std::string& storage = BLUEZ_STORAGE);
+
+  /*
+   * @brief:
+   *    Sends a frame to every connected satellite.
+   * @return:
+   *    Number of links the frame was queued on.
+   */
+  size_t broadcast(const OutFrame& frame, OutPriority priority);
+
+  /*
+   * @brief:
+   *    Sends a frame to the connected satellites whose name matches.
+   * @params:
+   *    pattern: fnmatch() pattern on the link name, "*" for all.
+   * @return:
+   *    Number of links the frame was queued on.
+   */
+  size_t sendTo(const std::string& pattern, const OutFrame& frame, OutPriority priority);
+
+  /*
+   * @brief:
+   *    Starts the due connection attempts, abandons the stuck ones.
+   */
+  void poll();
+
+  /*
+   * @brief:
+   *    Logs the metrics of each link over the last period.
+   */
+  void logStats(int periodMs);
+
+  size_t size() const  { return links.size(); }
+  size_t connected() const;
+
+private:
+  EventLoop& loop;
+  LineCallback onLine;
+  std::vector<std::unique_ptr<SatLink>> links;
+
+  void watch(SatLink& link);
+  void drop(SatLink& link, int64_t nowMs);
+  // Writes the queued frames, watches EPOLLOUT while some are left
+  bool flush(SatLink& link, int64_t nowMs);
+};
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ ****************************
+ *         LOGGING          *
+ ****************************
+ * @brief:
+ *    printf-like messages on stderr (journald under systemd).
+ *    A message is written whole, the sync worker logs from its thread.
+ */
+#ifndef MPCD_LOG_H
+#define MPCD_LOG_H
+
+#include <cstdarg>
+#include <cstdio>
+
+enum LogLevel { LOG_ERR = 0, LOG_WARN, LOG_INFO, LOG_DBG };
+
+// Messages above this level are not displayed
+extern int logLevel;
+
+inline void logMsg(int level, const char* fmt, ...)  {
+
+  static const char* const prefix[] = {"<3>error: ", "<4>warning: ", "<6>", "<7>"};
+  if (level > logLevel)
+    return;
+  va_list args;
+  va_start(args, fmt);
+  flockfile(stderr);
+  fputs(prefix[level], stderr);
+  vfprintf(stderr, fmt, args);
+  fputc('\n', stderr);
+  funlockfile(stderr);
+  va_end(args);
+}
+
+#endif
@@ -0,0 +1,358 @@
+/*
+ ****************************
+ *          MPCD            *
+ ****************************
+ * @brief:
+ *    MultiProbeCase gateway daemon: reads satellite JSON lines from RFCOMM
+ *    sockets (-l, -a) or rfcomm ports (-d) and bulk loads them into the
+ *    typed tables of PostgreSQL.
+ *    Replaces the Node-RED "serial in -> json -> function -> postgresql" flow.
+ *    With -s, the lines are also queued on disk and shipped to a remote
+ *    server by the sync worker thread.
+ *    With -N, the RTCM corrections of an NTRIP caster are relayed to the
+ *    satellites on their links (replaces str2str), -o takes the orders
+ *    for the satellites from Node-RED (UDP).
+ *    With -H, Grafana reads downsampled series and tracks over HTTP
+ *    (query_server.h).
+ * @usage:
+ *    mpcd [-c conninfo] [-d device]... [-l address]... [-a pattern]
+ *         [-n batchRows] [-t batchMs] [-r] [-v]
+ *         [-s remoteConninfo [-q queueDir] [-g gatewayId] [-b kBps]]
+ *         [-N ntrip://[user:password@]host[:port]/mountpoint [-R types]] [-o port]
+ *         [-H [address:]port]
+ */
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <glob.h>
+#include <memory>
+#include <netinet/in.h>
+#include <set>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "event_loop.h"
+#include "ingest.h"
+#include "link_manager.h"
+#include "log.h"
+#include "ntrip_client.h"
+#include "pg_copy.h"
+#include "query_server.h"
+#include "rtcm_relay.h"
+#include "segment_queue.h"
+#include "serial_port.h"
+#include "sync_worker.h"
+
+// Ports watched when none is given
+#define DEFAULT_PORTS_GLOB  "/dev/rfcomm*"
+// Default database connection
+#define DEFAULT_CONNINFO    "dbname=mpc"
+// Period to try opening closed ports and to look for paired satellites
+#define REOPEN_PERIOD_MS    5000
+// Period of link backoff checks
+#define LINK_POLL_MS        250
+// Period of batch bound checks
+#define FLUSH_PERIOD_MS     100
+// Period of statistics messages
+#define STATS_PERIOD_MS     60000
+// Upstream queue directory
+#define DEFAULT_QUEUE_DIR   "/var/lib/mpcd/queue"
+// Period of queue writes to disk
+#define QUEUE_SYNC_MS       1000
+// Period of NTRIP reconnection and stall checks
+#define NTRIP_POLL_MS       1000
+
+int logLevel = LOG_INFO;
+
+static void usage(const char* prog)  {
+
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -c conninfo  libpq connection string (default \"" DEFAULT_CONNINFO "\")\n"
+          "  -d device    satellite port, repeat for each port (default " DEFAULT_PORTS_GLOB ")\n"
+          "  -l address   satellite RFCOMM address XX:XX:XX:XX:XX:XX[@channel] or tcp:host:port, repeat\n"
+          "  -a pattern   connect to the paired satellites whose name matches (e.g. 'CYCLOPEE*')\n"
+          "  -n rows      batch size in rows (default 1000)\n"
+          "  -t ms        batch age in milliseconds (default 1000)\n"
+          "  -r           keep raw lines in the jsonb audit column\n"
+          "  -v           verbose, repeat for debug messages\n"
+          "  -s conninfo  ship the lines to this remote server\n"
+          "  -q dir       upstream queue directory (default " DEFAULT_QUEUE_DIR ")\n"
+          "  -g id        gateway name upstream (default host name)\n"
+          "  -b kBps      upstream rate limit in kilobytes per second (default none)\n"
+          "  -N url       relay the RTCM corrections of ntrip://[user:password@]host[:port]/mountpoint to the links\n"
+          "  -R types     RTCM message types relayed, comma separated or 'all' (default " RTCM_DEFAULT_TYPES ")\n"
+          "  -o port      orders for the links on this loopback UDP port (\"[pattern<TAB>]order\")\n"
+          "  -H [addr:]port  downsampled series and tracks for Grafana over HTTP (default address 127.0.0.1)\n",
+          prog);
+}
+
+/*
+ * @brief:
+ *    Opens the loopback UDP socket receiving the orders.
+ * @return:
+ *    Socket, -1 on error.
+ */
+static int openOrderSocket(int port)  {
+
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  struct sockaddr_in sa = {};
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons((uint16_t)port);
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd >= 0 && bind(fd, (struct sockaddr*)&sa, sizeof(sa)) == 0)
+    return fd;
+  logMsg(LOG_ERR, "order port %d: %s", port, strerror(errno));
+  if (fd >= 0)
+    close(fd);
+  return -1;
+}
+
+static std::vector<std::string> globPorts(const char* pattern)  {
+
+  std::vector<std::string> ports;
+  glob_t g;
+  if (glob(pattern, 0, nullptr, &g) == 0)  {
+    for (size_t i = 0; i < g.gl_pathc; i++)
+      ports.push_back(g.gl_pathv[i]);
+    globfree(&g);
+  }
+  return ports;
+}
+
+int main(int argc, char** argv)  {
+
+  std::string conninfo = DEFAULT_CONNINFO;
+  std::vector<std::string> devices;
+  std::vector<LinkAddress> addresses;
+  std::string pairedPattern;
+  IngestConfig config;
+  SyncConfig syncConfig;
+  syncConfig.queueDir = DEFAULT_QUEUE_DIR;
+  std::string ntripUrl;
+  std::string rtcmTypes = RTCM_DEFAULT_TYPES;
+  int orderPort = 0;
+  QueryConfig queryConfig;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:d:l:a:n:t:rvs:q:g:b:N:R:o:H:h")) != -1)  {
+    switch (opt)  {
+      case 'c': conninfo = optarg; break;
+      case 'd': devices.push_back(optarg); break;
+      case 'l':
+        addresses.emplace_back();
+        if (!parseLinkAddress(optarg, addresses.back()))  {
+          logMsg(LOG_ERR, "bad satellite address %s", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'a': pairedPattern = optarg; break;
+      case 'n': config.batchRows = strtoul(optarg, nullptr, 10); break;
+      case 't': config.batchMs = atoi(optarg); break;
+      case 'r': config.keepRaw = true; break;
+      case 'v': logLevel++; break;
+      case 's': syncConfig.conninfo = optarg; break;
+      case 'q': syncConfig.queueDir = optarg; break;
+      case 'g': syncConfig.gatewayId = optarg; break;
+      case 'b': syncConfig.maxBytesPerSecond = strtoull(optarg, nullptr, 10) * 1000; break;
+      case 'N': ntripUrl = optarg; break;
+      case 'R': rtcmTypes = optarg; break;
+      case 'o': orderPort = atoi(optarg); break;
+      case 'H':
+        if (!parseQueryAddress(optarg, queryConfig))  {
+          logMsg(LOG_ERR, "bad query server address %s", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  bool useLinks = !addresses.empty() || !pairedPattern.empty();
+  if (devices.empty() && !useLinks)
+    devices = globPorts(DEFAULT_PORTS_GLOB);
+  if (devices.empty() && !useLinks)  {
+    logMsg(LOG_ERR, "no satellite port found (" DEFAULT_PORTS_GLOB ")");
+    return EXIT_FAILURE;
+  }
+  if (config.batchRows == 0)
+    config.batchRows = 1;
+  NtripSource ntripSource;
+  std::set<uint16_t> relayedTypes;
+  if (!ntripUrl.empty() && !parseNtripUrl(ntripUrl, ntripSource))  {
+    logMsg(LOG_ERR, "bad NTRIP source %s", ntripUrl.c_str());
+    return EXIT_FAILURE;
+  }
+  if (!parseRtcmTypes(rtcmTypes, relayedTypes))  {
+    logMsg(LOG_ERR, "bad RTCM message types %s", rtcmTypes.c_str());
+    return EXIT_FAILURE;
+  }
+  // Corrections and orders go through the links only
+  if ((!ntripUrl.empty() || orderPort) && !useLinks)
+    logMsg(LOG_WARN, "-N and -o need satellite links (-l, -a)");
+
+  // Upstream queue, written here and read by the sync worker
+  std::unique_ptr<SegmentWriter> queue;
+  std::unique_ptr<SyncWorker> sync;
+  if (!syncConfig.conninfo.empty())  {
+    if (syncConfig.gatewayId.empty())  {
+      char host[256] = "";
+      gethostname(host, sizeof(host) - 1);
+      syncConfig.gatewayId = host;
+    }
+    syncConfig.keepRaw = config.keepRaw;
+    queue.reset(new SegmentWriter(syncConfig.queueDir));
+    if (!queue->open())
+      return EXIT_FAILURE;
+    sync.reset(new SyncWorker(syncConfig));
+  }
+
+  // Query server: its own connections and threads
+  std::unique_ptr<QueryServer> queries;
+  if (queryConfig.port)  {
+    queryConfig.conninfo = conninfo;
+    queries.reset(new QueryServer(queryConfig));
+    if (!queries->start())
+      return EXIT_FAILURE;
+  }
+
+  EventLoop loop;
+  PgConnection db(conninfo);
+  Ingestor ingestor(db, config, queue.get());
+  std::vector<std::unique_ptr<SerialPort>> ports;
+  LinkManager links(loop, [&](SatLink& link, std::string_view line)  {
+    int64_t latencyUs = INT64_MIN;
+    ingestor.handleLine(link.name(), line, &latencyUs);
+    if (latencyUs != INT64_MIN)
+      link.addLatency(latencyUs);
+    ingestor.flush();
+  });
+
+  db.ensureConnected();
+
+  // RTCM corrections: one caster connection for all the satellites
+  RtcmRelay relay(links, relayedTypes);
+  std::unique_ptr<NtripClient> ntrip;
+  if (!ntripUrl.empty())  {
+    ntrip.reset(new NtripClient(loop, ntripSource, [&](const uint8_t* data, size_t len)  { relay.feed(data, len); }));
+    ntrip->poll();
+    loop.addTimer(NTRIP_POLL_MS, [&]()  { ntrip->poll(); });
+  }
+
+  // Orders: one datagram per order, sent after the pending corrections
+  int orderFd = orderPort ? openOrderSocket(orderPort) : -1;
+  if (orderPort && orderFd < 0)
+    return EXIT_FAILURE;
+  if (orderFd >= 0)  {
+    loop.add(orderFd, EPOLLIN, [&](uint32_t events)  {
+      char buf[2048];
+      ssize_t n;
+      while ((n = recv(orderFd, buf, sizeof(buf), 0)) > 0)  {
+        std::string_view order(buf, (size_t)n);
+        std::string pattern = "*";
+        size_t tab = order.find('\t');
+        if (tab != std::string_view::npos)  {
+          pattern = std::string(order.substr(0, tab));
+          order.remove_prefix(tab + 1);
+        }
+        std::string line(order);
+        if (line.empty() || line.back() != '\n')
+          line += '\n';
+        if (links.sendTo(pattern, std::make_shared<const std::string>(line), OUT_ORDER) == 0)
+          logMsg(LOG_WARN, "order for %s: no connected satellite", pattern.c_str());
+      }
+    });
+  }
+
+  // Opens a port and watches it, closes it on hang-up
+  auto watchPort = [&](SerialPort& port)  {
+    if (port.fd() >= 0 || !port.open())
+      return;
+    int fd = port.fd();
+    loop.add(fd, EPOLLIN, [&, fd](uint32_t events)  {
+      bool alive = port.readLines([&](std::string_view line)  {
+        ingestor.handleLine(port.name(), line);
+      });
+      if (!alive || (events & (EPOLLHUP | EPOLLERR)))  {
+        loop.remove(fd);
+        port.close();
+      }
+      // Full batch: do not wait for the timer
+      ingestor.flush();
+    });
+  };
+
+  for (const std::string& dev : devices)  {
+    ports.emplace_back(new SerialPort(dev));
+    watchPort(*ports.back());
+  }
+
+  for (const LinkAddress& address : addresses)
+    links.addLink(address, "");
+  if (!pairedPattern.empty() && links.discover(pairedPattern) == 0)
+    logMsg(LOG_WARN, "no paired satellite matches %s yet", pairedPattern.c_str());
+  links.poll();
+
+  loop.addTimer(REOPEN_PERIOD_MS, [&]()  {
+    for (auto& port : ports)
+      watchPort(*port);
+    if (!pairedPattern.empty())
+      links.discover(pairedPattern);
+  });
+  if (useLinks)
+    loop.addTimer(LINK_POLL_MS, [&]()  { links.poll(); });
+  loop.addTimer(FLUSH_PERIOD_MS, [&]()  { ingestor.flush(); });
+  if (queue)
+    loop.addTimer(QUEUE_SYNC_MS, [&]()  { queue->checkpoint(); });
+  loop.addTimer(STATS_PERIOD_MS, [&]()  {
+    const IngestStats& s = ingestor.stats();
+    logMsg(LOG_INFO, "lines %llu, invalid %llu, rows %llu, batches %llu, COPY failures %llu, dropped %llu, refused %llu, calibration loads %llu",
+           (unsigned long long)s.lines, (unsigned long long)s.invalidLines, (unsigned long long)s.rows,
+           (unsigned long long)s.batches, (unsigned long long)s.copyFailures, (unsigned long long)s.droppedRows,
+           (unsigned long long)s.refusedRows, (unsigned long long)s.calibrationLoads);
+    links.logStats(STATS_PERIOD_MS);
+    if (ntrip)  {
+      RtcmStats r = relay.stats();
+      const NtripStats& n = ntrip->stats();
+      logMsg(LOG_INFO, "NTRIP %s, %.0f B/s, connects %llu, failures %llu, RTCM frames %llu, CRC errors %llu, filtered %llu, relayed %llu, no satellite %llu",
+             ntrip->streaming() ? "up" : "down", n.periodBytes * 1000.0 / STATS_PERIOD_MS,
+             (unsigned long long)n.connects, (unsigned long long)n.failures, (unsigned long long)r.frames,
+             (unsigned long long)r.crcErrors, (unsigned long long)r.filtered, (unsigned long long)r.relayed,
+             (unsigned long long)r.noRover);
+      ntrip->resetPeriod();
+    }
+    if (queries)  {
+      QueryStats q = queries->stats();
+      logMsg(LOG_INFO, "queries %llu, errors %llu, rows read %llu, points sent %llu",
+             (unsigned long long)q.requests, (unsigned long long)q.errors, (unsigned long long)q.rowsRead,
+             (unsigned long long)q.pointsSent);
+    }
+    if (sync)  {
+      SyncStats u = sync->stats();
+      logMsg(LOG_INFO, "upstream: queued %llu, shipped %llu, lines %llu, duplicates %llu, rows %llu, kB %llu, failures %llu, refused lines %llu, dropped segments %llu",
+             (unsigned long long)queue->lastSeq(), (unsigned long long)u.lastSeq, (unsigned long long)u.lines,
+             (unsigned long long)u.duplicates, (unsigned long long)u.rows, (unsigned long long)(u.bytes / 1000),
+             (unsigned long long)u.failures, (unsigned long long)u.rejectedLines, (unsigned long long)u.droppedSegments);
+    }
+  });
+
+  logMsg(LOG_INFO, "mpcd started, %zu ports, %zu links", ports.size(), links.size());
+  if (sync)
+    sync->start();
+  loop.run();
+
+  // Send what is pending before exit
+  ingestor.flush(true);
+  if (sync)
+    sync->stop();
+  if (queries)
+    queries->stop();
+  if (orderFd >= 0)
+    close(orderFd);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,283 @@
+#include "ntrip_client.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netdb.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "time_util.h"
+
+namespace {
+
+std::string base64(const std::string& in)  {
+
+  static const char* const table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  size_t i = 0;
+  for (; i + 2 < in.size(); i += 3)  {
+    uint32_t v = ((uint8_t)in[i] << 16) | ((uint8_t)in[i + 1] << 8) | (uint8_t)in[i + 2];
+    out += table[v >> 18];
+    out += table[(v >> 12) & 63];
+    out += table[(v >> 6) & 63];
+    out += table[v & 63];
+  }
+  if (i < in.size())  {
+    uint32_t v = (uint8_t)in[i] << 16;
+    if (i + 1 < in.size())
+      v |= (uint8_t)in[i + 1] << 8;
+    out += table[v >> 18];
+    out += table[(v >> 12) & 63];
+    out += i + 1 < in.size() ? table[(v >> 6) & 63] : '=';
+    out += '=';
+  }
+  return out;
+}
+
+}
+
+bool parseNtripUrl(const std::string& url, NtripSource& source)  {
+
+  source = NtripSource();
+  if (url.compare(0, 8, "ntrip://") != 0)
+    return false;
+  std::string rest = url.substr(8);
+  size_t slash = rest.find('/');
+  if (slash == std::string::npos || slash + 1 >= rest.size())
+    return false;
+  source.mountpoint = rest.substr(slash + 1);
+  rest.resize(slash);
+
+  size_t at = rest.rfind('@');
+  if (at != std::string::npos)  {
+    std::string credentials = rest.substr(0, at);
+    size_t colon = credentials.find(':');
+    source.user = credentials.substr(0, colon);
+    if (colon != std::string::npos)
+      source.password = credentials.substr(colon + 1);
+    rest = rest.substr(at + 1);
+  }
+  size_t colon = rest.rfind(':');
+  if (colon != std::string::npos)  {
+    int port = atoi(rest.c_str() + colon + 1);
+    if (port <= 0 || port > 65535)
+      return false;
+    source.port = (uint16_t)port;
+    rest.resize(colon);
+  }
+  source.host = rest;
+  return !source.host.empty();
+}
+
+void NtripClient::poll()  {
+
+  int64_t now = monotonicMs();
+  if (state == DOWN && now >= nextAttemptMs)  {
+    connect(now);
+  }
+  else if (state != DOWN && now - lastActivityMs > NTRIP_STALL_MS)  {
+    logMsg(LOG_WARN, "NTRIP %s: no data for %d s, reconnecting", source.mountpoint.c_str(), NTRIP_STALL_MS / 1000);
+    counters.failures++;
+    close(now);
+  }
+}
+
+bool NtripClient::connect(int64_t nowMs)  {
+
+  lastActivityMs = nowMs;
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* res = nullptr;
+  int err = getaddrinfo(source.host.c_str(), std::to_string(source.port).c_str(), &hints, &res);
+  if (err != 0)  {
+    logMsg(LOG_WARN, "NTRIP %s: %s", source.host.c_str(), gai_strerror(err));
+    counters.failures++;
+    close(nowMs);
+    return false;
+  }
+  sock = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int r = sock < 0 ? -1 : ::connect(sock, res->ai_addr, res->ai_addrlen);
+  freeaddrinfo(res);
+  if (r != 0 && errno != EINPROGRESS)  {
+    logMsg(LOG_WARN, "NTRIP %s: %s", source.host.c_str(), strerror(errno));
+    counters.failures++;
+    close(nowMs);
+    return false;
+  }
+
+  state = CONNECTING;
+  header.clear();
+  chunked = false;
+  chunkLeft = crlfLeft = 0;
+  chunkLine.clear();
+  loop.add(sock, EPOLLOUT, [this](uint32_t events)  { onEvents(events); });
+  return true;
+}
+
+void NtripClient::close(int64_t nowMs)  {
+
+  if (sock >= 0)  {
+    loop.remove(sock);
+    ::close(sock);
+  }
+  sock = -1;
+  if (state == STREAMING)
+    logMsg(LOG_INFO, "NTRIP %s disconnected", source.mountpoint.c_str());
+  state = DOWN;
+  if (nowMs)  {
+    // 1 s, 2 s, 4 s... up to 60 s
+    int64_t delay = NTRIP_BACKOFF_MIN_MS;
+    for (int i = 0; i < failures && delay < NTRIP_BACKOFF_MAX_MS; i++)
+      delay *= 2;
+    nextAttemptMs = nowMs + (delay < NTRIP_BACKOFF_MAX_MS ? delay : NTRIP_BACKOFF_MAX_MS);
+    failures++;
+  }
+}
+
+void NtripClient::onEvents(uint32_t events)  {
+
+  int64_t now = monotonicMs();
+  if (state == CONNECTING)  {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+      err = errno;
+    if (err != 0 || !sendRequest())  {
+      logMsg(LOG_WARN, "NTRIP %s: %s", source.host.c_str(), strerror(err ? err : errno));
+      counters.failures++;
+      close(now);
+      return;
+    }
+    state = HEADER;
+    loop.modify(sock, EPOLLIN | EPOLLRDHUP);
+    return;
+  }
+
+  char buf[4096];
+  while (true)  {
+    ssize_t n = ::recv(sock, buf, sizeof(buf), 0);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+      break;
+    if (n <= 0)  {
+      // Closed by the caster, or lost
+      if (state != STREAMING)
+        counters.failures++;
+      close(now);
+      return;
+    }
+    lastActivityMs = now;
+    counters.bytesIn += n;
+    counters.periodBytes += n;
+    bool ok = state == HEADER ? readHeader(buf, (size_t)n) : consume(buf, (size_t)n);
+    if (!ok)  {
+      counters.failures++;
+      close(now);
+      return;
+    }
+  }
+  if (events & (EPOLLHUP | EPOLLERR))
+    close(now);
+}
+
+bool NtripClient::sendRequest()  {
+
+  std::string request = "GET /" + source.mountpoint + " HTTP/1.1\r\n"
+                        "Host: " + source.host + ":" + std::to_string(source.port) + "\r\n"
+                        "Ntrip-Version: Ntrip/2.0\r\n"
+                        "User-Agent: NTRIP mpcd/1.0\r\n";
+  if (!source.user.empty() || !source.password.empty())
+    request += "Authorization: Basic " + base64(source.user + ":" + source.password) + "\r\n";
+  request += "Connection: close\r\n\r\n";
+  // A few hundred bytes: fits in the empty send buffer of a new socket
+  return ::send(sock, request.data(), request.size(), MSG_NOSIGNAL) == (ssize_t)request.size();
+}
+
+bool NtripClient::readHeader(const char* data, size_t len)  {
+
+  header.append(data, len);
+  size_t eol = header.find("\r\n");
+  if (eol == std::string::npos)
+    return header.size() < NTRIP_MAX_HEADER;
+
+  size_t bodyStart;
+  int status = 0;
+  if (header.compare(0, 10, "ICY 200 OK") == 0)  {
+    // NTRIP 1: the stream follows the status line, sometimes after an empty line
+    bodyStart = eol + 2;
+    if (header.compare(bodyStart, 2, "\r\n") == 0)
+      bodyStart += 2;
+  }
+  else if (sscanf(header.c_str(), "HTTP/%*s %d", &status) == 1 && status == 200)  {
+    size_t end = header.find("\r\n\r\n");
+    if (end == std::string::npos)
+      return header.size() < NTRIP_MAX_HEADER;
+    bodyStart = end + 4;
+    // NTRIP 2 casters may send the stream by chunks
+    for (size_t pos = 0; pos < end; )  {
+      size_t next = header.find("\r\n", pos);
+      std::string field = header.substr(pos, next - pos);
+      if (strncasecmp(field.c_str(), "Transfer-Encoding:", 18) == 0 && strcasestr(field.c_str(), "chunked"))
+        chunked = true;
+      pos = next + 2;
+    }
+  }
+  else  {
+    // "SOURCETABLE 200 OK": unknown mountpoint, "HTTP/1.1 401": bad credentials...
+    logMsg(LOG_WARN, "NTRIP %s: %s", source.mountpoint.c_str(), header.substr(0, eol).c_str());
+    return false;
+  }
+
+  state = STREAMING;
+  failures = 0;
+  counters.connects++;
+  logMsg(LOG_INFO, "NTRIP %s:%u/%s connected%s", source.host.c_str(), source.port, source.mountpoint.c_str(),
+         chunked ? " (chunked)" : "");
+  std::string body = header.substr(bodyStart);
+  header.clear();
+  return body.empty() || consume(body.data(), body.size());
+}
+
+bool NtripClient::consume(const char* data, size_t len)  {
+
+  if (!chunked)  {
+    onData((const uint8_t*)data, len);
+    return true;
+  }
+  size_t i = 0;
+  while (i < len)  {
+    if (chunkLeft > 0)  {
+      size_t n = chunkLeft < len - i ? chunkLeft : len - i;
+      onData((const uint8_t*)data + i, n);
+      i += n;
+      chunkLeft -= n;
+      if (chunkLeft == 0)
+        crlfLeft = 2;
+    }
+    else if (crlfLeft > 0)  {
+      i++;
+      crlfLeft--;
+    }
+    else if (data[i] == '\n')  {
+      i++;
+      chunkLeft = strtoul(chunkLine.c_str(), nullptr, 16);
+      chunkLine.clear();
+      // Last chunk: the caster ended the stream
+      if (chunkLeft == 0)
+        return false;
+    }
+    else  {
+      if (data[i] != '\r')
+        chunkLine += data[i];
+      i++;
+      if (chunkLine.size() > 64)
+        return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,111 @@
+/*
+ ****************************
+ *       NTRIP CLIENT       *
+ ****************************
+ * @brief:
+ *    Receives the correction stream of a mountpoint from an NTRIP caster
+ *    (e.g. caster.centipede.fr), in the event loop:
+ *      GET /MOUNTPOINT, answer "ICY 200 OK" (NTRIP 1) or "HTTP/1.1 200 OK"
+ *      (NTRIP 2, chunked or not), then the raw RTCM stream.
+ *    The data is handed over as received, frames are cut by rtcm3.h.
+ *    A refused request, a lost connection or a stream silent for 30 s is
+ *    retried after an exponential backoff.
+ * @note:
+ *    No GGA is sent to the caster: single base mountpoints (Centipede)
+ *    do not need the rover position, network (VRS) mountpoints do.
+ *    The caster name is resolved before each attempt (getaddrinfo blocks
+ *    the loop for the time of the DNS answer, at most once per attempt).
+ */
+#ifndef MPCD_NTRIP_CLIENT_H
+#define MPCD_NTRIP_CLIENT_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "event_loop.h"
+
+#define NTRIP_DEFAULT_PORT   2101
+// Backoff between attempts: first delay, maximum delay
+#define NTRIP_BACKOFF_MIN_MS 1000
+#define NTRIP_BACKOFF_MAX_MS 60000
+// Connection abandoned if the caster sends nothing during this delay
+#define NTRIP_STALL_MS       30000
+// Longest answer header
+#define NTRIP_MAX_HEADER     4096
+
+struct NtripSource {
+  std::string host;
+  uint16_t port = NTRIP_DEFAULT_PORT;
+  std::string mountpoint;
+  std::string user;
+  std::string password;
+};
+
+/*
+ * @brief:
+ *    Parses "ntrip://[user[:password]@]host[:port]/mountpoint" (str2str syntax).
+ * @return:
+ *    False if url is not an NTRIP source.
+ */
+bool parseNtripUrl(const std::string& url, NtripSource& source);
+
+struct NtripStats {
+  uint64_t connects = 0;
+  uint64_t failures = 0;
+  uint64_t bytesIn = 0;
+  // Bytes received since last resetPeriod()
+  uint64_t periodBytes = 0;
+};
+
+class NtripClient {
+public:
+  // Receives the stream bytes
+  typedef std::function<void(const uint8_t* data, size_t len)> DataCallback;
+
+  NtripClient(EventLoop& loop, const NtripSource& source, DataCallback onData)
+    : loop(loop), source(source), onData(std::move(onData)) {}
+  ~NtripClient()  { close(); }
+  NtripClient(const NtripClient&) = delete;
+  NtripClient& operator=(const NtripClient&) = delete;
+
+  /*
+   * @brief:
+   *    Starts a connection when due, abandons a stuck or silent one.
+   */
+  void poll();
+
+  bool streaming() const  { return state == STREAMING; }
+  const NtripStats& stats() const  { return counters; }
+  void resetPeriod()  { counters.periodBytes = 0; }
+
+private:
+  enum State { DOWN, CONNECTING, HEADER, STREAMING };
+
+  EventLoop& loop;
+  NtripSource source;
+  DataCallback onData;
+  int sock = -1;
+  State state = DOWN;
+  NtripStats counters;
+  int failures = 0;
+  int64_t nextAttemptMs = 0;
+  // Connection start or last data, for the stall timeout
+  int64_t lastActivityMs = 0;
+  std::string header;
+  // NTRIP 2 chunked transfer: bytes left in the chunk, chunk size line
+  bool chunked = false;
+  size_t chunkLeft = 0;
+  size_t crlfLeft = 0;
+  std::string chunkLine;
+
+  bool connect(int64_t nowMs);
+  void close(int64_t nowMs = 0);
+  void onEvents(uint32_t events);
+  bool sendRequest();
+  // Reads the answer header, then the stream; false to close
+  bool readHeader(const char* data, size_t len);
+  bool consume(const char* data, size_t len);
+};
+
+#endif
@@ -0,0 +1,251 @@
+#include "pg_copy.h"
+
+#include <cstring>
+
+#include "log.h"
+#include "time_util.h"
+
+// Binary COPY signature, flags and header extension length
+static const char COPY_HEADER[19] = {'P', 'G', 'C', 'O', 'P', 'Y', '\n', '\377', '\r', '\n', '\0',
+                                     0, 0, 0, 0, 0, 0, 0, 0};
+
+/*
+ ***************************
+ *      COPY BUFFER        *
+ ***************************
+ */
+void CopyBuffer::clear()  {
+
+  data.assign(COPY_HEADER, sizeof(COPY_HEADER));
+  nbRows = 0;
+  rowStart.clear();
+  sealed = false;
+}
+
+void CopyBuffer::addTimestamp(int64_t unix_us)  {
+
+  putInt32(8);
+  putInt64(unixToPgUs(unix_us));
+}
+
+void CopyBuffer::addFloat4(float value)  {
+
+  uint32_t u;
+  memcpy(&u, &value, 4);
+  putInt32(4);
+  putInt32((int32_t)u);
+}
+
+void CopyBuffer::addFloat8(double value)  {
+
+  uint64_t u;
+  memcpy(&u, &value, 8);
+  putInt32(8);
+  putInt64((int64_t)u);
+}
+
+void CopyBuffer::appendRows(const CopyBuffer& from, size_t first, size_t last)  {
+
+  if (first >= last)
+    return;
+  if (sealed)  {
+    data.resize(data.size() - 2);
+    sealed = false;
+  }
+  size_t start = from.rowStart[first];
+  for (size_t i = first; i < last; i++)
+    rowStart.push_back(data.size() + from.rowStart[i] - start);
+  data.append(from.data, start, from.rowEnd(last - 1) - start);
+  nbRows += last - first;
+}
+
+void CopyBuffer::dropRows(size_t n)  {
+
+  if (n >= nbRows)  {
+    clear();
+    return;
+  }
+  size_t start = rowStart[n], removed = start - sizeof(COPY_HEADER);
+  data.erase(sizeof(COPY_HEADER), removed);
+  rowStart.erase(rowStart.begin(), rowStart.begin() + n);
+  for (size_t& offset : rowStart)
+    offset -= removed;
+  nbRows -= n;
+}
+
+std::string_view CopyBuffer::payload()  {
+
+  // Trailer is appended on demand and removed by the next row
+  if (!sealed)
+    data.append("\xff\xff", 2);
+  sealed = true;
+  return data;
+}
+
+/*
+ ***************************
+ *     PG CONNECTION       *
+ ***************************
+ */
+bool PgConnection::ensureConnected()  {
+
+  if (conn && PQstatus(conn) == CONNECTION_OK)
+    return true;
+  close();
+  conn = PQconnectdb(conninfo.c_str());
+  if (PQstatus(conn) != CONNECTION_OK)
+    return fail("connection");
+  logMsg(LOG_INFO, "connected to database");
+  nbConnections++;
+  for (const std::string& channel : channels)  {
+    PGresult* res = PQexec(conn, ("LISTEN " + channel).c_str());
+    bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    PQclear(res);
+    if (!ok)
+      return fail("LISTEN");
+  }
+  return true;
+}
+
+void PgConnection::close()  {
+
+  if (conn)
+    PQfinish(conn);
+  conn = nullptr;
+}
+
+bool PgConnection::fail(const char* what, const PGresult* res)  {
+
+  error = conn ? PQerrorMessage(conn) : "no connection";
+  const char* state = res ? PQresultErrorField(res, PG_DIAG_SQLSTATE) : nullptr;
+  sqlState = state ? state : "";
+  while (!error.empty() && error.back() == '\n')
+    error.pop_back();
+  logMsg(LOG_ERR, "database %s failed: %s", what, error.c_str());
+  if (conn && PQstatus(conn) != CONNECTION_OK)
+    close();
+  return false;
+}
+
+bool PgConnection::copy(const std::string& copySql, CopyBuffer& buffer)  {
+
+  if (!ensureConnected())
+    return false;
+
+  PGresult* res = PQexec(conn, copySql.c_str());
+  if (PQresultStatus(res) != PGRES_COPY_IN)  {
+    fail("COPY", res);
+    PQclear(res);
+    return false;
+  }
+  PQclear(res);
+
+  std::string_view payload = buffer.payload();
+  if (PQputCopyData(conn, payload.data(), (int)payload.size()) != 1 || PQputCopyEnd(conn, nullptr) != 1)
+    return fail("COPY data");
+
+  // The first error result is kept for its SQLSTATE
+  PGresult* failed = nullptr;
+  while ((res = PQgetResult(conn)) != nullptr)  {
+    if (PQresultStatus(res) != PGRES_COMMAND_OK && !failed)
+      failed = res;
+    else
+      PQclear(res);
+  }
+  if (!failed)
+    return true;
+  fail("COPY", failed);
+  PQclear(failed);
+  return false;
+}
+
+bool PgConnection::exec(const std::string& sql)  {
+
+  if (!ensureConnected())
+    return false;
+  PGresult* res = PQexec(conn, sql.c_str());
+  ExecStatusType status = PQresultStatus(res);
+  bool ok = status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK;
+  if (!ok)
+    fail("statement", res);
+  PQclear(res);
+  return ok;
+}
+
+void PgConnection::listen(const std::string& channel)  {
+
+  channels.push_back(channel);
+  if (connected())
+    exec("LISTEN " + channel);
+}
+
+bool PgConnection::notified(const std::string& channel)  {
+
+  if (!connected())
+    return false;
+  if (PQconsumeInput(conn) != 1)  {
+    fail("notification");
+    return false;
+  }
+  bool found = false;
+  PGnotify* notify;
+  while ((notify = PQnotifies(conn)) != nullptr)  {
+    found = found || channel == notify->relname;
+    PQfreemem(notify);
+  }
+  return found;
+}
+
+bool PgConnection::exec(const std::string& sql, const std::vector<std::string>& params, std::string* value)  {
+
+  if (!ensureConnected())
+    return false;
+  std::vector<const char*> values;
+  for (const std::string& p : params)
+    values.push_back(p.c_str());
+  PGresult* res = PQexecParams(conn, sql.c_str(), (int)values.size(), nullptr, values.data(), nullptr, nullptr, 0);
+  ExecStatusType status = PQresultStatus(res);
+  if (value)
+    *value = (status == PGRES_TUPLES_OK && PQntuples(res) > 0) ? PQgetvalue(res, 0, 0) : "";
+  bool ok = status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK;
+  if (!ok)
+    fail("statement", res);
+  PQclear(res);
+  return ok;
+}
+
+bool PgConnection::query(const std::string& sql, const std::vector<std::string>& params, const RowCallback& onRow)  {
+
+  if (!ensureConnected())
+    return false;
+  std::vector<const char*> values;
+  for (const std::string& p : params)
+    values.push_back(p.c_str());
+  if (!PQsendQueryParams(conn, sql.c_str(), (int)values.size(), nullptr, values.data(), nullptr, nullptr, 1))
+    return fail("query");
+  PQsetSingleRowMode(conn);
+
+  // Results are read to the end, the connection is then ready for the next query
+  bool ok = true, cancelled = false;
+  while (PGresult* res = PQgetResult(conn))  {
+    ExecStatusType status = PQresultStatus(res);
+    if (status == PGRES_SINGLE_TUPLE)  {
+      if (!cancelled && !onRow(res))  {
+        cancelled = true;
+        char err[256];
+        PGcancel* cancel = PQgetCancel(conn);
+        if (cancel)  {
+          PQcancel(cancel, err, sizeof(err));
+          PQfreeCancel(cancel);
+        }
+      }
+    }
+    else if (status != PGRES_TUPLES_OK && !cancelled)  {
+      ok = false;
+    }
+    PQclear(res);
+  }
+  if (!ok)
+    return fail("query");
+  return !cancelled;
+}
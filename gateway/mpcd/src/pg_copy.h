@@ -0,0 +1,218 @@
+/*
+ ****************************
+ *    POSTGRESQL COPY       *
+ ****************************
+ * @brief:
+ *    Bulk loading through libpq "COPY ... FROM STDIN (FORMAT binary)".
+ *    CopyBuffer encodes rows in the binary COPY format, PgConnection sends
+ *    a whole buffer in one COPY statement (one transaction, one round trip).
+ * @note:
+ *    Binary format: header, then per row a field count (int16) and for each
+ *    field its length (int32, -1 for NULL) and its big-endian value.
+ *    https://www.postgresql.org/docs/current/sql-copy.html#id-1.9.3.55.9.4
+ */
+#ifndef MPCD_PG_COPY_H
+#define MPCD_PG_COPY_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <libpq-fe.h>
+
+/*
+ ***************************
+ *      COPY BUFFER        *
+ ***************************
+ */
+class CopyBuffer {
+public:
+  CopyBuffer()  { clear(); }
+
+  // Empties the buffer, keeps the header
+  void clear();
+
+  // Starts a row of nbFields fields
+  void startRow(int16_t nbFields)  {
+    if (sealed)  {
+      data.resize(data.size() - 2);
+      sealed = false;
+    }
+    rowStart.push_back(data.size());
+    putInt16(nbFields);
+    nbRows++;
+  }
+
+  // Field writers, in column order
+  void addNull()  { putInt32(-1); }
+  void addTimestamp(int64_t unix_us);
+  void addInt2(int16_t value)  {
+    putInt32(2);
+    putInt16(value);
+  }
+  void addInt4(int32_t value)  {
+    putInt32(4);
+    putInt32(value);
+  }
+  void addFloat4(float value);
+  void addFloat8(double value);
+  void addText(std::string_view text)  {
+    putInt32((int32_t)text.size());
+    data.append(text);
+  }
+  void addJsonb(std::string_view json)  {
+    // jsonb binary format: version byte then the JSON text
+    putInt32((int32_t)json.size() + 1);
+    data.push_back(1);
+    data.append(json);
+  }
+
+  size_t rows() const  { return nbRows; }
+  size_t size() const  { return data.size(); }
+  bool empty() const  { return nbRows == 0; }
+
+  // Appends rows [first, last) of another buffer (refused batch split)
+  void appendRows(const CopyBuffer& from, size_t first, size_t last);
+  // Removes the first n rows (sent before a failure)
+  void dropRows(size_t n);
+
+  // Encoded payload, trailer included
+  std::string_view payload();
+
+private:
+  std::string data;
+  size_t nbRows;
+  // Offset of each row in data
+  std::vector<size_t> rowStart;
+  // Trailer appended by payload()
+  bool sealed;
+
+  // End offset of row i
+  size_t rowEnd(size_t i) const  { return i + 1 < nbRows ? rowStart[i + 1] : data.size() - (sealed ? 2 : 0); }
+
+  void putInt16(int16_t v)  {
+    uint16_t u = (uint16_t)v;
+    char b[2] = {(char)(u >> 8), (char)u};
+    data.append(b, 2);
+  }
+  void putInt32(int32_t v)  {
+    uint32_t u = (uint32_t)v;
+    char b[4] = {(char)(u >> 24), (char)(u >> 16), (char)(u >> 8), (char)u};
+    data.append(b, 4);
+  }
+  void putInt64(int64_t v)  {
+    putInt32((int32_t)((uint64_t)v >> 32));
+    putInt32((int32_t)(uint64_t)v);
+  }
+};
+
+/*
+ ***************************
+ *     PG CONNECTION       *
+ ***************************
+ */
+class PgConnection {
+public:
+  explicit PgConnection(std::string conninfo) : conninfo(std::move(conninfo)) {}
+  ~PgConnection()  { close(); }
+  PgConnection(const PgConnection&) = delete;
+  PgConnection& operator=(const PgConnection&) = delete;
+
+  /*
+   * @brief:
+   *    Connects if not connected (or connection broken).
+   * @return:
+   *    False if database cannot be reached.
+   */
+  bool ensureConnected();
+
+  void close();
+
+  bool connected() const  { return conn && PQstatus(conn) == CONNECTION_OK; }
+
+  /*
+   * @brief:
+   *    Sends a buffer with a COPY statement.
+   * @params:
+   *    copySql: "COPY table (columns) FROM STDIN (FORMAT binary)".
+   *    buffer: Encoded rows.
+   * @return:
+   *    False on error (connection is closed if broken, rows not inserted).
+   */
+  bool copy(const std::string& copySql, CopyBuffer& buffer);
+
+  /*
+   * @brief:
+   *    Executes SQL statements without result.
+   */
+  bool exec(const std::string& sql);
+
+  /*
+   * @brief:
+   *    Executes a statement with text parameters ($1, $2...).
+   * @params:
+   *    value: First value of the result if not nullptr ("" if no row or NULL).
+   */
+  bool exec(const std::string& sql, const std::vector<std::string>& params, std::string* value = nullptr);
+
+  // Receives one result row, returns false to cancel the query
+  typedef std::function<bool(const PGresult* row)> RowCallback;
+
+  /*
+   * @brief:
+   *    Executes a query with text parameters, rows in binary format are
+   *    handed over one at a time as the server sends them (single row
+   *    mode): a large result is never held in memory.
+   * @return:
+   *    False on error or if cancelled.
+   */
+  bool query(const std::string& sql, const std::vector<std::string>& params, const RowCallback& onRow);
+
+  /*
+   * @brief:
+   *    Subscribes to a notification channel, at each connection.
+   */
+  void listen(const std::string& channel);
+
+  /*
+   * @brief:
+   *    Reads the pending notifications (other channels are discarded).
+   * @return:
+   *    True if the channel was notified since last call.
+   */
+  bool notified(const std::string& channel);
+
+  // Incremented at each new connection (session state to restore)
+  uint64_t connections() const  { return nbConnections; }
+
+  PGconn* handle()  { return conn; }
+  const std::string& lastError() const  { return error; }
+  // SQLSTATE of the last failed statement ("" if it did not reach the server)
+  const std::string& lastSqlState() const  { return sqlState; }
+
+  /*
+   * @brief:
+   *    Tells a refusal of the data from a failure of the link or server.
+   * @return:
+   *    True if the last failure is a data exception (SQLSTATE class 22)
+   *    or an integrity violation (class 23) and the connection is still
+   *    up: sending the same rows again fails again.
+   */
+  bool dataError() const  {
+    return connected() && sqlState.size() == 5 && (sqlState.compare(0, 2, "22") == 0 || sqlState.compare(0, 2, "23") == 0);
+  }
+
+private:
+  std::string conninfo;
+  PGconn* conn = nullptr;
+  std::string error;
+  std::string sqlState;
+  std::vector<std::string> channels;
+  uint64_t nbConnections = 0;
+
+  bool fail(const char* what, const PGresult* res = nullptr);
+};
+
+#endif
@@ -0,0 +1,700 @@
+#include "query_server.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "downsample.h"
+#include "log.h"
+#include "pg_copy.h"
+#include "schema.h"
+#include "time_util.h"
+
+static const char* TIME_FILTER = "time >= to_timestamp($1::float8 / 1000) AND time < to_timestamp($2::float8 / 1000)";
+static const char* SAT_FILTER = " AND sat_id = ANY($3::text[])";
+
+namespace {
+
+// Table or view that may be queried, with its numeric columns
+struct Relation {
+  std::string name;
+  std::string table;
+  std::vector<std::string> columns;
+
+  bool has(const std::string& column) const  {
+    for (const std::string& c : columns)
+      if (c == column)
+        return true;
+    return false;
+  }
+};
+
+const std::vector<Relation>& relations()  {
+
+  static const std::vector<Relation> all = []()  {
+    std::vector<Relation> r;
+    for (const SatType& type : satTypes())  {
+      Relation rel{type.name, type.table, {}};
+      for (const Column& c : type.columns)
+        rel.columns.push_back(c.name);
+      for (const Column& c : type.derived)
+        rel.columns.push_back(c.name);
+      r.push_back(rel);
+    }
+    // Water level views of gateway/sql/water_level_aggregates.sql
+    for (const char* period : {"1s", "1min", "10min"})  {
+      std::string name = std::string("water_level_") + period;
+      r.push_back({name, "cyclopee." + name, {"surface_elv_m", "level_m", "min_m", "max_m"}});
+    }
+    return r;
+  }();
+  return all;
+}
+
+// Relation by type name or table name (schema optional)
+const Relation* findRelation(const std::string& name)  {
+
+  for (const Relation& rel : relations())
+    if (name == rel.name || name == rel.table || "cyclopee." + name == rel.table)
+      return &rel;
+  return nullptr;
+}
+
+int hexDigit(char c)  {
+
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+std::string urlDecode(std::string_view text)  {
+
+  std::string out;
+  for (size_t i = 0; i < text.size(); i++)  {
+    int hi, lo;
+    if (text[i] == '+')
+      out += ' ';
+    else if (text[i] == '%' && i + 2 < text.size() && (hi = hexDigit(text[i + 1])) >= 0 && (lo = hexDigit(text[i + 2])) >= 0)  {
+      out += (char)(hi << 4 | lo);
+      i += 2;
+    }
+    else
+      out += text[i];
+  }
+  return out;
+}
+
+struct Request {
+  std::string method;
+  std::string path;
+  std::vector<std::pair<std::string, std::string>> params;
+
+  // Last value of a parameter, def if absent
+  std::string get(const char* key, const char* def = "") const  {
+    for (auto it = params.rbegin(); it != params.rend(); ++it)
+      if (it->first == key)
+        return it->second;
+    return def;
+  }
+};
+
+// "GET /path?a=1&b=2 HTTP/1.1"
+bool parseRequestLine(const std::string& line, Request& request)  {
+
+  size_t sp1 = line.find(' ');
+  size_t sp2 = line.find(' ', sp1 + 1);
+  if (sp1 == std::string::npos || sp2 == std::string::npos)
+    return false;
+  request.method = line.substr(0, sp1);
+  std::string_view target(line.data() + sp1 + 1, sp2 - sp1 - 1);
+  size_t q = target.find('?');
+  request.path = urlDecode(target.substr(0, q));
+  if (q == std::string_view::npos)
+    return true;
+  std::string_view query = target.substr(q + 1);
+  while (!query.empty())  {
+    size_t amp = query.find('&');
+    std::string_view item = query.substr(0, amp);
+    size_t eq = item.find('=');
+    if (!item.empty())
+      request.params.emplace_back(urlDecode(item.substr(0, eq)),
+                                  eq == std::string_view::npos ? "" : urlDecode(item.substr(eq + 1)));
+    query = amp == std::string_view::npos ? std::string_view() : query.substr(amp + 1);
+  }
+  return true;
+}
+
+bool parseMs(const std::string& text, int64_t& ms)  {
+
+  char* end = nullptr;
+  long long v = strtoll(text.c_str(), &end, 10);
+  if (text.empty() || *end != '\0')
+    return false;
+  ms = v;
+  return true;
+}
+
+/*
+ * @brief:
+ *    Turns "column<op>number" into " AND column op number".
+ * @return:
+ *    False if the column is not in the relation, or the value not a number.
+ */
+bool whereClause(const std::string& text, const Relation& rel, std::string& sql)  {
+
+  size_t op = text.find_first_of("<>=!");
+  if (op == std::string::npos || op == 0)
+    return false;
+  size_t value = text.find_first_not_of("<>=!", op);
+  if (value == std::string::npos)
+    return false;
+  std::string column = text.substr(0, op);
+  std::string oper = text.substr(op, value - op);
+  if (!rel.has(column))
+    return false;
+  if (oper == "!=")
+    oper = "<>";
+  else if (oper != "=" && oper != "<" && oper != "<=" && oper != ">" && oper != ">=")
+    return false;
+  char* end = nullptr;
+  double v = strtod(text.c_str() + value, &end);
+  if (*end != '\0' || !std::isfinite(v))
+    return false;
+  char number[32];
+  snprintf(number, sizeof(number), "%.17g", v);
+  sql += " AND " + column + " " + oper + " " + number;
+  return true;
+}
+
+// Satellite list "A,B" as a text[] literal {"A","B"}
+std::string satArray(const std::string& list)  {
+
+  std::string out = "{";
+  size_t pos = 0;
+  while (pos <= list.size())  {
+    size_t comma = list.find(',', pos);
+    if (comma == std::string::npos)
+      comma = list.size();
+    if (out.size() > 1)
+      out += ',';
+    out += '"';
+    for (size_t i = pos; i < comma; i++)  {
+      if (list[i] == '"' || list[i] == '\\')
+        out += '\\';
+      out += list[i];
+    }
+    out += '"';
+    pos = comma + 1;
+  }
+  return out + "}";
+}
+
+void jsonString(std::string& out, std::string_view text)  {
+
+  out += '"';
+  for (char c : text)  {
+    if (c == '"' || c == '\\')  {
+      out += '\\';
+      out += c;
+    }
+    else if ((uint8_t)c < 0x20)  {
+      char esc[8];
+      snprintf(esc, sizeof(esc), "\\u%04x", c);
+      out += esc;
+    }
+    else  {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+void csvString(std::string& out, std::string_view text)  {
+
+  out += '"';
+  for (char c : text)  {
+    if (c == '"')
+      out += '"';
+    out += c;
+  }
+  out += '"';
+}
+
+void appendNumber(std::string& out, double v)  {
+
+  char number[32];
+  snprintf(number, sizeof(number), "%.10g", v);
+  out += number;
+}
+
+// Big-endian binary fields of a result row
+int64_t pgInt64(const char* p)  {
+
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++)
+    v = (v << 8) | (uint8_t)p[i];
+  return (int64_t)v;
+}
+
+double pgFloat8(const char* p)  {
+
+  uint64_t v = (uint64_t)pgInt64(p);
+  double d;
+  memcpy(&d, &v, sizeof(d));
+  return d;
+}
+
+/*
+ * @brief:
+ *    HTTP answer with chunked transfer: the status line is sent with the
+ *    first chunk, so that a query failing before any output gets an error.
+ */
+class HttpStream {
+public:
+  explicit HttpStream(int fd) : fd(fd) {}
+
+  void setContentType(const char* type)  { contentType = type; }
+  bool failed() const  { return broken; }
+  bool started() const  { return headerSent; }
+
+  void write(std::string_view data)  {
+    buffer.append(data);
+    if (buffer.size() >= QUERY_CHUNK_BYTES)
+      flush();
+  }
+
+  // Sends the buffer as a chunk
+  void flush()  {
+    if (buffer.empty())
+      return;
+    char size[24];
+    snprintf(size, sizeof(size), "%zx\r\n", buffer.size());
+    std::string chunk = header() + size + buffer + "\r\n";
+    buffer.clear();
+    sendAll(chunk);
+  }
+
+  // Last chunk
+  void finish()  {
+    flush();
+    sendAll(header() + "0\r\n\r\n");
+  }
+
+  // Whole answer with a JSON error, if nothing was sent yet
+  void error(int status, const std::string& message)  {
+    if (headerSent)
+      return;
+    std::string body = "{\"error\":";
+    jsonString(body, message);
+    body += "}\n";
+    char head[256];
+    snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n"
+             "Connection: close\r\n\r\n", status, reason(status), body.size());
+    headerSent = true;
+    sendAll(head + body);
+  }
+
+private:
+  int fd;
+  const char* contentType = "application/json";
+  bool headerSent = false;
+  bool broken = false;
+  std::string buffer;
+
+  static const char* reason(int status)  {
+    switch (status)  {
+      case 400: return "Bad Request";
+      case 404: return "Not Found";
+      case 405: return "Method Not Allowed";
+      case 503: return "Service Unavailable";
+      default: return "Internal Server Error";
+    }
+  }
+
+  std::string header()  {
+    if (headerSent)
+      return "";
+    headerSent = true;
+    return std::string("HTTP/1.1 200 OK\r\nContent-Type: ") + contentType + "\r\nTransfer-Encoding: chunked\r\n"
+           "Cache-Control: no-store\r\nConnection: close\r\n\r\n";
+  }
+
+  void sendAll(const std::string& data)  {
+    size_t done = 0;
+    while (!broken && done < data.size())  {
+      ssize_t n = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        broken = true;
+      else
+        done += (size_t)n;
+    }
+  }
+};
+
+enum OutputFormat { OUT_COLUMNS, OUT_ROWS, OUT_CSV };
+
+/*
+ * @brief:
+ *    Writes the points kept: columns time (Unix ms), metric (satellite),
+ *    then the value fields. Rows and CSV are streamed, columnar JSON is
+ *    assembled at the end (its size is the number of points kept).
+ */
+class ResultWriter {
+public:
+  ResultWriter(HttpStream& out, OutputFormat format, std::vector<std::string> fields)
+    : out(out), format(format), fields(std::move(fields)), columns(this->fields.size())  {
+
+    out.setContentType(format == OUT_CSV ? "text/csv" : "application/json");
+    if (format == OUT_CSV)  {
+      std::string head = "time,metric";
+      for (const std::string& f : this->fields)
+        head += "," + f;
+      out.write(head + "\n");
+    }
+    else if (format == OUT_ROWS)  {
+      out.write("[");
+    }
+  }
+
+  void row(int64_t time_us, const std::string& metric, const double* values)  {
+
+    std::string line;
+    long long ms = (long long)(time_us / 1000);
+    if (format == OUT_COLUMNS)  {
+      const char* sep = points ? "," : "";
+      times += sep + std::to_string(ms);
+      metrics += sep;
+      jsonString(metrics, metric);
+      for (size_t i = 0; i < fields.size(); i++)  {
+        columns[i] += sep;
+        appendNumber(columns[i], values[i]);
+      }
+    }
+    else if (format == OUT_ROWS)  {
+      line = points ? ",{\"time\":" : "{\"time\":";
+      line += std::to_string(ms) + ",\"metric\":";
+      jsonString(line, metric);
+      for (size_t i = 0; i < fields.size(); i++)  {
+        line += ",";
+        jsonString(line, fields[i]);
+        line += ":";
+        appendNumber(line, values[i]);
+      }
+      line += "}";
+    }
+    else  {
+      line = std::to_string(ms) + ",";
+      csvString(line, metric);
+      for (size_t i = 0; i < fields.size(); i++)  {
+        line += ",";
+        appendNumber(line, values[i]);
+      }
+      line += "\n";
+    }
+    if (!line.empty())
+      out.write(line);
+    points++;
+  }
+
+  void end()  {
+
+    if (format == OUT_COLUMNS)  {
+      out.write("{\"time\":[");
+      out.write(times);
+      out.write("],\"metric\":[");
+      out.write(metrics);
+      out.write("]");
+      for (size_t i = 0; i < fields.size(); i++)  {
+        std::string key = ",";
+        jsonString(key, fields[i]);
+        out.write(key + ":[");
+        out.write(columns[i]);
+        out.write("]");
+      }
+      out.write("}\n");
+    }
+    else if (format == OUT_ROWS)  {
+      out.write("]\n");
+    }
+    out.finish();
+  }
+
+  uint64_t count() const  { return points; }
+
+private:
+  HttpStream& out;
+  OutputFormat format;
+  std::vector<std::string> fields;
+  std::string times, metrics;
+  std::vector<std::string> columns;
+  uint64_t points = 0;
+};
+
+}
+
+bool parseQueryAddress(const std::string& text, QueryConfig& config)  {
+
+  std::string port = text;
+  size_t colon = text.rfind(':');
+  if (colon != std::string::npos)  {
+    config.address = text.substr(0, colon);
+    port = text.substr(colon + 1);
+  }
+  struct in_addr a;
+  int p = atoi(port.c_str());
+  if (p <= 0 || p > 65535 || inet_pton(AF_INET, config.address.c_str(), &a) != 1)
+    return false;
+  config.port = (uint16_t)p;
+  return true;
+}
+
+bool QueryServer::start()  {
+
+  listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int one = 1;
+  struct sockaddr_in sa = {};
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(config.port);
+  inet_pton(AF_INET, config.address.c_str(), &sa.sin_addr);
+  if (listenFd < 0 || setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0
+      || bind(listenFd, (struct sockaddr*)&sa, sizeof(sa)) != 0 || listen(listenFd, 16) != 0)  {
+    logMsg(LOG_ERR, "query server %s:%u: %s", config.address.c_str(), config.port, strerror(errno));
+    if (listenFd >= 0)
+      close(listenFd);
+    listenFd = -1;
+    return false;
+  }
+  stopping = false;
+  for (int i = 0; i < (config.threads > 0 ? config.threads : 1); i++)
+    threads.emplace_back(&QueryServer::run, this);
+  logMsg(LOG_INFO, "query server on http://%s:%u", config.address.c_str(), config.port);
+  return true;
+}
+
+void QueryServer::stop()  {
+
+  stopping = true;
+  for (std::thread& t : threads)
+    if (t.joinable())
+      t.join();
+  threads.clear();
+  if (listenFd >= 0)
+    close(listenFd);
+  listenFd = -1;
+}
+
+QueryStats QueryServer::stats() const  {
+
+  QueryStats s;
+  s.requests = requests;
+  s.errors = errors;
+  s.rowsRead = rowsRead;
+  s.pointsSent = pointsSent;
+  return s;
+}
+
+void QueryServer::run()  {
+
+  PgConnection db(config.conninfo);
+  while (!stopping)  {
+    struct pollfd p = {listenFd, POLLIN, 0};
+    if (poll(&p, 1, QUERY_POLL_MS) <= 0)
+      continue;
+    // Another worker may have taken the connection (non-blocking socket)
+    int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0)
+      continue;
+    struct timeval recvTimeout = {QUERY_RECV_TIMEOUT_S, 0}, sendTimeout = {QUERY_SEND_TIMEOUT_S, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &recvTimeout, sizeof(recvTimeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+    handle(fd, db);
+    close(fd);
+  }
+}
+
+void QueryServer::handle(int fd, PgConnection& db)  {
+
+  // Request header (a GET has no body)
+  std::string head;
+  char buf[2048];
+  while (head.find("\r\n\r\n") == std::string::npos && head.size() < QUERY_MAX_REQUEST)  {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return;
+    head.append(buf, (size_t)n);
+  }
+  requests++;
+  HttpStream out(fd);
+  Request request;
+  if (!parseRequestLine(head.substr(0, head.find("\r\n")), request))  {
+    errors++;
+    out.error(400, "bad request");
+    return;
+  }
+  if (request.method != "GET")  {
+    errors++;
+    out.error(405, "GET only");
+    return;
+  }
+
+  int64_t startMs = monotonicMs();
+  bool track = request.path == "/track";
+  if (request.path == "/health")  {
+    if (!db.ensureConnected())  {
+      errors++;
+      out.error(503, "database unreachable");
+      return;
+    }
+    out.write("{\"status\":\"ok\"}\n");
+    out.finish();
+    return;
+  }
+  if (!track && request.path != "/series")  {
+    errors++;
+    out.error(404, "unknown path, use /series, /track or /health");
+    return;
+  }
+
+  // Common parameters
+  int64_t fromMs = 0, toMs = 0;
+  if (!parseMs(request.get("from"), fromMs) || !parseMs(request.get("to"), toMs) || toMs <= fromMs)  {
+    errors++;
+    out.error(400, "from and to (Unix ms, e.g. ${__from} and ${__to}) are needed");
+    return;
+  }
+  int64_t points = QUERY_DEFAULT_POINTS;
+  int64_t intervalMs;
+  if (!request.get("points").empty())
+    points = atoll(request.get("points").c_str());
+  else if (parseMs(request.get("interval"), intervalMs) && intervalMs > 0)
+    points = (toMs - fromMs) / intervalMs;
+  points = points < QUERY_MIN_POINTS ? QUERY_MIN_POINTS : points > QUERY_MAX_POINTS ? QUERY_MAX_POINTS : points;
+  DownsampleMethod method;
+  if (!parseDownsampleMethod(request.get("method", "lttb").c_str(), method)
+      || (track && method == DS_MINMAX))  {
+    errors++;
+    out.error(400, track ? "method: lttb or none" : "method: lttb, minmax or none");
+    return;
+  }
+  std::string format = request.get("format", "json");
+  OutputFormat outputFormat = format == "csv" ? OUT_CSV : format == "rows" ? OUT_ROWS : OUT_COLUMNS;
+  if (format != "json" && format != "csv" && format != "rows")  {
+    errors++;
+    out.error(400, "format: json, rows or csv");
+    return;
+  }
+  std::string sats = request.get("sat");
+  std::vector<std::string> params = {std::to_string(fromMs), std::to_string(toMs)};
+  if (!sats.empty())
+    params.push_back(satArray(sats));
+
+  // Statement: (time, sat_id, values...) ordered by satellite then time
+  std::string sql;
+  std::vector<std::string> fields;
+  std::string table = request.get("table");
+  if (track)  {
+    fields = {"lat", "lon"};
+    for (const SatType& type : satTypes())  {
+      const Relation* rel = findRelation(type.name);
+      if (!table.empty() && rel != findRelation(table))
+        continue;
+      // Tables without a filtered column are left out (e.g. where=fix=4)
+      std::string where;
+      bool ok = rel->has("lat") && rel->has("lon");
+      for (const auto& p : request.params)
+        if (p.first == "where")
+          ok = ok && whereClause(p.second, *rel, where);
+      if (!ok)
+        continue;
+      sql += sql.empty() ? "" : " UNION ALL ";
+      sql += "SELECT time, sat_id, lon::float8, lat::float8 FROM " + rel->table + " WHERE " + TIME_FILTER
+             + " AND lat IS NOT NULL AND lon IS NOT NULL" + (sats.empty() ? "" : SAT_FILTER) + where;
+    }
+    if (sql.empty())  {
+      errors++;
+      out.error(400, "no table with positions matches table and where");
+      return;
+    }
+    sql = "SELECT * FROM (" + sql + ") AS positions ORDER BY 2, 1";
+  }
+  else  {
+    const Relation* rel = findRelation(table);
+    std::string field = request.get("field");
+    if (!rel || !rel->has(field))  {
+      errors++;
+      out.error(400, "unknown table or field");
+      return;
+    }
+    std::string where;
+    for (const auto& p : request.params)  {
+      if (p.first == "where" && !whereClause(p.second, *rel, where))  {
+        errors++;
+        out.error(400, "bad where " + p.second + " (column<op>number)");
+        return;
+      }
+    }
+    fields = {field};
+    sql = "SELECT time, sat_id, " + field + "::float8 FROM " + rel->table + " WHERE " + TIME_FILTER + " AND "
+          + field + " IS NOT NULL" + (sats.empty() ? "" : SAT_FILTER) + where + " ORDER BY sat_id, time";
+  }
+
+  // Rows are downsampled per satellite as they come
+  ResultWriter writer(out, outputFormat, fields);
+  std::string metric;
+  Downsampler sampler(method, fromMs * 1000, toMs * 1000, (size_t)points, [&](const SeriesPoint& p)  {
+    double values[2] = {p.y, p.x};
+    writer.row(p.time_us, metric, values);
+  });
+  uint64_t rows = 0;
+  bool ok = db.query(sql, params, [&](const PGresult* row)  {
+    if (PQgetisnull(row, 0, 0) || PQgetisnull(row, 0, 2) || (track && PQgetisnull(row, 0, 3)))
+      return true;
+    int64_t time_us = pgInt64(PQgetvalue(row, 0, 0)) + PG_EPOCH_OFFSET_S * 1000000LL;
+    std::string_view sat(PQgetvalue(row, 0, 1), (size_t)PQgetlength(row, 0, 1));
+    if (rows == 0 || sat != metric)  {
+      sampler.finish();
+      metric = sat;
+    }
+    rows++;
+    SeriesPoint p;
+    p.time_us = time_us;
+    if (track)  {
+      p.x = pgFloat8(PQgetvalue(row, 0, 2));
+      p.y = pgFloat8(PQgetvalue(row, 0, 3));
+    }
+    else  {
+      p.x = (double)(time_us - fromMs * 1000) / 1e6;
+      p.y = pgFloat8(PQgetvalue(row, 0, 2));
+    }
+    sampler.add(p);
+    // Client gone: the query is cancelled
+    return !out.failed();
+  });
+  rowsRead += rows;
+  if (!ok)  {
+    errors++;
+    out.error(db.connected() ? 500 : 503, db.connected() ? db.lastError() : "database unreachable");
+    return;
+  }
+  sampler.finish();
+  writer.end();
+  pointsSent += writer.count();
+  logMsg(LOG_DBG, "query %s %s: %llu rows, %llu points, %lld ms", request.path.c_str(),
+         track ? "lat,lon" : fields[0].c_str(), (unsigned long long)rows, (unsigned long long)writer.count(),
+         (long long)(monotonicMs() - startMs));
+}
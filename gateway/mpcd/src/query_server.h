@@ -0,0 +1,109 @@
+/*
+ ****************************
+ *       QUERY SERVER       *
+ ****************************
+ * @brief:
+ *    Read-only HTTP service for the Grafana Infinity datasource: time series
+ *    and tracks of the typed tables, downsampled on the gateway
+ *    (downsample.h) instead of sending every row to the browser.
+ *      GET /series?table=cyclopee&field=water_height&sat=A,B&from=ms&to=ms
+ *                 [&points=N | &interval=ms][&method=lttb|minmax|none]
+ *                 [&where=fix=4]...[&format=json|rows|csv]
+ *      GET /track?sat=A,B&from=ms&to=ms[&points=N][&where=...][&table=...]
+ *      GET /health
+ *    Rows are read from PostgreSQL one at a time (single row mode, binary)
+ *    and downsampled as they arrive, per satellite. The answer is sent by
+ *    chunks: columnar JSON {"time":[...],"metric":[...],"<field>":[...]}
+ *    (default), JSON rows or CSV (streamed as the points are kept).
+ * @note:
+ *    Each worker thread has its own database connection: queries never
+ *    delay the ingest loop. Table and column names are taken from
+ *    schema.h only and where values must be numbers, nothing from the
+ *    request is pasted into the SQL.
+ */
+#ifndef MPCD_QUERY_SERVER_H
+#define MPCD_QUERY_SERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Points per series when the request gives none, and bounds
+#define QUERY_DEFAULT_POINTS  1000
+#define QUERY_MIN_POINTS      3
+#define QUERY_MAX_POINTS      20000
+// Longest request header
+#define QUERY_MAX_REQUEST     8192
+// Socket timeouts of a client
+#define QUERY_RECV_TIMEOUT_S  5
+#define QUERY_SEND_TIMEOUT_S  10
+// Answer bytes sent per chunk
+#define QUERY_CHUNK_BYTES     16384
+// Period of the stop flag checks
+#define QUERY_POLL_MS         500
+
+class PgConnection;
+
+struct QueryConfig {
+  // Database read
+  std::string conninfo;
+  // Listening address, loopback by default (Grafana on the gateway)
+  std::string address = "127.0.0.1";
+  uint16_t port = 0;
+  // Requests served at the same time
+  int threads = 2;
+};
+
+/*
+ * @brief:
+ *    Parses "[address:]port".
+ * @return:
+ *    False if text is not a valid address.
+ */
+bool parseQueryAddress(const std::string& text, QueryConfig& config);
+
+struct QueryStats {
+  uint64_t requests = 0;
+  // Answers other than 200
+  uint64_t errors = 0;
+  uint64_t rowsRead = 0;
+  uint64_t pointsSent = 0;
+};
+
+class QueryServer {
+public:
+  explicit QueryServer(const QueryConfig& config) : config(config) {}
+  ~QueryServer()  { stop(); }
+  QueryServer(const QueryServer&) = delete;
+  QueryServer& operator=(const QueryServer&) = delete;
+
+  /*
+   * @brief:
+   *    Opens the listening socket and starts the worker threads.
+   * @return:
+   *    False if the address cannot be bound.
+   */
+  bool start();
+
+  // Stops the threads after the requests in progress
+  void stop();
+
+  // Counters, may be read from another thread
+  QueryStats stats() const;
+
+private:
+  QueryConfig config;
+  int listenFd = -1;
+  std::vector<std::thread> threads;
+  std::atomic<bool> stopping{false};
+
+  std::atomic<uint64_t> requests{0}, errors{0}, rowsRead{0}, pointsSent{0};
+
+  void run();
+  // Reads a request and sends its answer
+  void handle(int fd, PgConnection& db);
+};
+
+#endif
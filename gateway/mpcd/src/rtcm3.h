@@ -0,0 +1,112 @@
+/*
+ ****************************
+ *      RTCM3 FRAMER        *
+ ****************************
+ * @brief:
+ *    Splits an RTCM 3 byte stream into frames checked by their CRC-24Q:
+ *      0xD3 | 6 bits 0, 10 bits length | payload (length bytes) | CRC-24Q
+ *    The message type is the first 12 bits of the payload.
+ *    Bytes are consumed by chunks of any size, frames may straddle chunks.
+ *    After a bad frame, the framer resynchronizes on the next 0xD3.
+ */
+#ifndef MPCD_RTCM3_H
+#define MPCD_RTCM3_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#define RTCM3_PREAMBLE      0xD3
+#define RTCM3_HEADER        3
+#define RTCM3_CRC           3
+#define RTCM3_MAX_PAYLOAD   1023
+
+/*
+ * @brief:
+ *    CRC-24Q (Qualcomm) of RTCM 3, polynomial 0x1864CFB.
+ */
+inline uint32_t rtcm3Crc24q(const uint8_t* data, size_t len)  {
+
+  uint32_t crc = 0;
+  for (size_t i = 0; i < len; i++)  {
+    crc ^= (uint32_t)data[i] << 16;
+    for (int b = 0; b < 8; b++)  {
+      crc <<= 1;
+      if (crc & 0x1000000)
+        crc ^= 0x1864CFB;
+    }
+  }
+  return crc & 0xFFFFFF;
+}
+
+// Message type of a whole frame
+inline uint16_t rtcm3Type(std::string_view frame)  {
+
+  return (uint16_t)(((uint8_t)frame[3] << 4) | ((uint8_t)frame[4] >> 4));
+}
+
+class Rtcm3Framer {
+public:
+  uint64_t frames = 0;
+  uint64_t crcErrors = 0;
+  // Bytes skipped while looking for a preamble
+  uint64_t skippedBytes = 0;
+
+  /*
+   * @brief:
+   *    Consumes a chunk, calls onFrame(std::string_view frame, uint16_t type)
+   *    for each valid frame (preamble to CRC included). The view is valid
+   *    during the call only.
+   */
+  template <typename F>
+  void feed(const uint8_t* data, size_t len, F onFrame)  {
+
+    buffer.insert(buffer.end(), data, data + len);
+    size_t pos = 0;
+    while (true)  {
+      while (pos < buffer.size() && buffer[pos] != RTCM3_PREAMBLE)  {
+        pos++;
+        skippedBytes++;
+      }
+      if (buffer.size() - pos < RTCM3_HEADER)
+        break;
+      // 6 reserved bits must be 0, otherwise 0xD3 was a data byte
+      if (buffer[pos + 1] & 0xFC)  {
+        pos++;
+        skippedBytes++;
+        continue;
+      }
+      size_t length = ((buffer[pos + 1] & 0x03) << 8) | buffer[pos + 2];
+      size_t total = RTCM3_HEADER + length + RTCM3_CRC;
+      if (buffer.size() - pos < total)
+        break;
+
+      const uint8_t* f = buffer.data() + pos;
+      size_t body = RTCM3_HEADER + length;
+      uint32_t crc = ((uint32_t)f[body] << 16) | ((uint32_t)f[body + 1] << 8) | f[body + 2];
+      // A message holds at least its 12 bits type
+      if (length >= 2 && rtcm3Crc24q(f, body) == crc)  {
+        frames++;
+        std::string_view view((const char*)f, total);
+        onFrame(view, rtcm3Type(view));
+        pos += total;
+      }
+      else  {
+        // Resynchronizes on the next preamble, inside the bad frame if any
+        crcErrors++;
+        pos++;
+        skippedBytes++;
+      }
+    }
+    buffer.erase(buffer.begin(), buffer.begin() + pos);
+  }
+
+  void reset()  { buffer.clear(); }
+
+private:
+  // Bytes of the frame in progress (at most one frame once feed() returns)
+  std::vector<uint8_t> buffer;
+};
+
+#endif
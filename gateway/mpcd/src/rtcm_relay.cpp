@@ -0,0 +1,45 @@
+#include "rtcm_relay.h"
+
+#include <cstdlib>
+#include <memory>
+
+bool parseRtcmTypes(const std::string& list, std::set<uint16_t>& types)  {
+
+  types.clear();
+  if (list == "all")
+    return true;
+  const char* p = list.c_str();
+  while (*p)  {
+    char* end;
+    long type = strtol(p, &end, 10);
+    if (end == p || type < 1 || type > 4095 || (*end && *end != ','))
+      return false;
+    types.insert((uint16_t)type);
+    p = *end ? end + 1 : end;
+  }
+  return !types.empty();
+}
+
+void RtcmRelay::feed(const uint8_t* data, size_t len)  {
+
+  framer.feed(data, len, [this](std::string_view frame, uint16_t type)  {
+    if (!types.empty() && types.count(type) == 0)  {
+      counters.filtered++;
+      return;
+    }
+    // One copy for all the links
+    OutFrame shared = std::make_shared<const std::string>(frame);
+    if (links.broadcast(shared, OUT_RTCM) > 0)
+      counters.relayed++;
+    else
+      counters.noRover++;
+  });
+}
+
+RtcmStats RtcmRelay::stats() const  {
+
+  RtcmStats s = counters;
+  s.frames = framer.frames;
+  s.crcErrors = framer.crcErrors;
+  return s;
+}
@@ -0,0 +1,66 @@
+/*
+ ****************************
+ *       RTCM RELAY         *
+ ****************************
+ * @brief:
+ *    Relays the RTCM 3 corrections of an NTRIP caster (ntrip_client.h) to
+ *    the satellites, on their telemetry links (link_manager.h):
+ *    the stream is cut into CRC checked frames (rtcm3.h), the frames whose
+ *    type the rover receivers do not use are dropped, each frame left is
+ *    queued once and shared by all the connected satellites, ahead of the
+ *    orders. One caster connection serves every boat.
+ */
+#ifndef MPCD_RTCM_RELAY_H
+#define MPCD_RTCM_RELAY_H
+
+#include <cstdint>
+#include <set>
+#include <string>
+
+#include "link_manager.h"
+#include "rtcm3.h"
+
+/*
+ * Messages used by the u-blox ZED-F9P rovers:
+ *   1005/1006 base position, 1074/1077 GPS, 1084/1087 GLONASS,
+ *   1094/1097 Galileo, 1124/1127 BeiDou (MSM4/MSM7), 1230 GLONASS biases.
+ * Ephemerides, antenna and receiver descriptors are not needed.
+ */
+#define RTCM_DEFAULT_TYPES  "1005,1006,1074,1077,1084,1087,1094,1097,1124,1127,1230"
+
+/*
+ * @brief:
+ *    Parses a comma separated list of message types, "all" for no filter.
+ * @return:
+ *    False if a type is not a number of 1 to 4095.
+ */
+bool parseRtcmTypes(const std::string& list, std::set<uint16_t>& types);
+
+struct RtcmStats {
+  uint64_t frames = 0;
+  uint64_t crcErrors = 0;
+  // Frames whose type is filtered out
+  uint64_t filtered = 0;
+  // Frames relayed, and received while no satellite was connected
+  uint64_t relayed = 0;
+  uint64_t noRover = 0;
+};
+
+class RtcmRelay {
+public:
+  // types: message types relayed, empty for all
+  RtcmRelay(LinkManager& links, std::set<uint16_t> types) : links(links), types(std::move(types)) {}
+
+  // Consumes stream bytes
+  void feed(const uint8_t* data, size_t len);
+
+  RtcmStats stats() const;
+
+private:
+  LinkManager& links;
+  std::set<uint16_t> types;
+  Rtcm3Framer framer;
+  RtcmStats counters;
+};
+
+#endif
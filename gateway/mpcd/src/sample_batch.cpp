@@ -0,0 +1,242 @@
+#include "sample_batch.h"
+
+#include <cmath>
+#include <cstdint>
+
+#include "json_sax.h"
+#include "time_util.h"
+
+// Maximum number of top level members kept per line
+#define MAX_MEMBERS 32
+
+namespace {
+
+/*
+ * @brief:
+ *    Collects the top level members of a satellite line.
+ */
+class SatLineHandler : public JsonHandler {
+public:
+  struct Member {
+    std::string_view key;
+    std::string_view text;
+    double value;
+    bool isNumber;
+  };
+
+  std::string_view id;
+  std::string_view time;
+  bool isObject = false;
+  Member members[MAX_MEMBERS];
+  int nbMembers = 0;
+
+  void startContainer(int depth) override  {
+    if (depth == 0)
+      isObject = true;
+  }
+  void key(std::string_view name, int depth) override  {
+    current = (depth == 1) ? name : std::string_view();
+  }
+  void stringValue(std::string_view raw, int depth) override  {
+    if (depth != 1)
+      return;
+    if (current == "id")
+      id = raw;
+    else if (current == "time")
+      time = raw;
+    else
+      add(raw, NAN, false);
+  }
+  void numberValue(std::string_view text, double value, int depth) override  {
+    if (depth == 1)
+      add(text, value, true);
+  }
+  void nullValue(int depth) override  {
+    if (depth == 1)
+      add(std::string_view(), NAN, false);
+  }
+
+  const Member* find(const char* key) const  {
+    for (int i = 0; i < nbMembers; i++)
+      if (members[i].key == key)
+        return &members[i];
+    return nullptr;
+  }
+
+private:
+  std::string_view current;
+
+  void add(std::string_view text, double value, bool isNumber)  {
+    if (nbMembers < MAX_MEMBERS)
+      members[nbMembers++] = {current, text, value, isNumber};
+  }
+};
+
+// Returns the index of the line type in satTypes(), -1 if unknown
+int findSatType(const SatLineHandler& sat)  {
+
+  const std::vector<SatType>& types = satTypes();
+  for (size_t t = 0; t < types.size(); t++)  {
+    bool match = true;
+    for (const char* key : types[t].signature)
+      match = match && sat.find(key) != nullptr;
+    if (match)
+      return (int)t;
+  }
+  return -1;
+}
+
+// Writes a staged value, NaN and integers out of the column range are NULL
+void addTypedValue(CopyBuffer& buffer, const Column& column, double value)  {
+
+  if (!std::isfinite(value))  {
+    buffer.addNull();
+    return;
+  }
+  double rounded = std::round(value);
+  switch (column.type)  {
+    case COL_FLOAT8: buffer.addFloat8(value); break;
+    case COL_FLOAT4: buffer.addFloat4((float)value); break;
+    case COL_INT2:
+      if (rounded < INT16_MIN || rounded > INT16_MAX)
+        buffer.addNull();
+      else
+        buffer.addInt2((int16_t)rounded);
+      break;
+    case COL_INT4:
+      if (rounded < INT32_MIN || rounded > INT32_MAX)
+        buffer.addNull();
+      else
+        buffer.addInt4((int32_t)rounded);
+      break;
+  }
+}
+
+}
+
+SampleBatch::SampleBatch(const SatType* type) : type(type), staging(type)  {}
+
+std::string SampleBatch::copySql(const char* into) const  {
+
+  if (type)
+    return type->copySql(into);
+  return std::string("COPY ") + (into ? into : GENERIC_TABLE) + " (time, data) FROM STDIN (FORMAT binary)";
+}
+
+void SampleBatch::clear()  {
+
+  staging.clear();
+  buffer.clear();
+}
+
+SampleBatches::SampleBatches(bool keepRaw) : keepRaw(keepRaw)  {
+
+  for (const SatType& type : satTypes())
+    batches.emplace_back(&type);
+  batches.emplace_back(nullptr);
+}
+
+SampleBatch* SampleBatches::add(std::string_view line, int64_t receivedUs, int64_t* sampleUs)  {
+
+  SatLineHandler sat;
+  // Only JSON objects are samples (satellites also echo orders and debug text)
+  if (line.empty() || line.front() != '{' || !parseJson(line, sat) || !sat.isObject)
+    return nullptr;
+
+  int64_t time_us;
+  if (sat.time.empty() || !parseSatTime(sat.time, time_us))  {
+    if (receivedUs < 0)
+      return nullptr;
+    time_us = receivedUs;
+  }
+  else if (sampleUs)
+    *sampleUs = time_us;
+
+  int t = sat.id.empty() ? -1 : findSatType(sat);
+  SampleBatch& batch = (t < 0) ? batches.back() : batches[t];
+  if (batch.rows() == 0)
+    batch.startMs = monotonicMs();
+
+  // Unknown type: whole line in the jsonb table
+  if (t < 0)  {
+    batch.buffer.startRow(2);
+    batch.buffer.addTimestamp(time_us);
+    batch.buffer.addJsonb(line);
+    return &batch;
+  }
+
+  const SatType& type = satTypes()[t];
+  size_t n = type.columns.size();
+  rowValues.resize(n);
+  rowKinds.resize(n);
+  for (size_t c = 0; c < n; c++)  {
+    const SatLineHandler::Member* m = sat.find(type.columns[c].key);
+    rowValues[c] = (m && m->isNumber) ? m->value : NAN;
+    rowKinds[c] = (m && !m->isNumber) ? cellKind(m->text) : CELL_VALUE;
+  }
+  addRow(batch, time_us, sat.id, rowValues.data(), rowKinds.data(), line);
+  return &batch;
+}
+
+void SampleBatches::addRow(SampleBatch& batch, int64_t time_us, std::string_view satId, const double* values,
+                           const CellKind* kinds, std::string_view raw)  {
+
+  batch.series.add(batch.staging, time_us, satId, values, kinds, raw, keepRaw);
+}
+
+size_t SampleBatches::flushSeries()  {
+
+  size_t n = 0;
+  for (SampleBatch& batch : batches)
+    if (batch.type)
+      n += batch.series.flush(batch.staging, keepRaw);
+  return n;
+}
+
+std::vector<SeriesFill::State> SampleBatches::saveSeries() const  {
+
+  std::vector<SeriesFill::State> saved;
+  for (const SampleBatch& batch : batches)
+    saved.push_back(batch.series.state());
+  return saved;
+}
+
+void SampleBatches::restoreSeries(const std::vector<SeriesFill::State>& saved)  {
+
+  for (size_t i = 0; i < batches.size() && i < saved.size(); i++)
+    batches[i].series.restore(saved[i]);
+}
+
+void SampleBatches::encode(SampleBatch& batch, const CalibrationRegistry& calibrations)  {
+
+  ColumnBatch& staging = batch.staging;
+  if (staging.empty())
+    return;
+  const SatType& type = *staging.type;
+  if (type.derive)
+    type.derive(staging, calibrations);
+
+  CopyBuffer& buffer = batch.buffer;
+  for (size_t i = 0; i < staging.rows(); i++)  {
+    buffer.startRow(type.nbFields());
+    buffer.addTimestamp(staging.time[i]);
+    buffer.addText(staging.satId[i]);
+    for (size_t c = 0; c < type.columns.size(); c++)
+      addTypedValue(buffer, type.columns[c], staging.columns[c][i]);
+    for (size_t d = 0; d < type.derived.size(); d++)
+      addTypedValue(buffer, type.derived[d], staging.derived[d][i]);
+    if (keepRaw)
+      buffer.addJsonb(staging.raw[i]);
+    else
+      buffer.addNull();
+  }
+  staging.clear();
+}
+
+size_t SampleBatches::rows() const  {
+
+  size_t n = 0;
+  for (const SampleBatch& batch : batches)
+    n += batch.rows();
+  return n;
+}
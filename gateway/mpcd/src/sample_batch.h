@@ -0,0 +1,108 @@
+/*
+ ****************************
+ *      SAMPLE BATCHES      *
+ ****************************
+ * @brief:
+ *    Parses satellite lines and stages them in one batch per table: the
+ *    typed tables of satTypes() (schema.h), then cyclopee.sensor for lines
+ *    of unknown types. Typed rows are kept by columns until encode()
+ *    computes their derived channels and writes them in binary COPY format.
+ *    Shared by the local ingest (ingest.h) and the upstream sync
+ *    (sync_worker.h).
+ *    Members sent on change ("=", "~") are rebuilt per satellite
+ *    (series_fill.h) before being staged.
+ */
+#ifndef MPCD_SAMPLE_BATCH_H
+#define MPCD_SAMPLE_BATCH_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "calibration.h"
+#include "pg_copy.h"
+#include "schema.h"
+#include "series_fill.h"
+
+struct SampleBatch {
+  // Satellite type, nullptr for the generic table
+  const SatType* type;
+  // Typed rows not encoded yet
+  ColumnBatch staging;
+  // Rows waiting for their interpolated members, kept by clear()
+  SeriesFill series;
+  // Encoded rows
+  CopyBuffer buffer;
+  // Monotonic time of the first row
+  int64_t startMs = 0;
+
+  explicit SampleBatch(const SatType* type);
+  size_t rows() const  { return staging.rows() + buffer.rows(); }
+  const char* table() const  { return type ? type->table : GENERIC_TABLE; }
+  // COPY statement of the batch, into another table if given
+  std::string copySql(const char* into = nullptr) const;
+  void clear();
+};
+
+class SampleBatches {
+public:
+  // keepRaw: keep the line in the jsonb audit column of typed tables
+  explicit SampleBatches(bool keepRaw);
+
+  /*
+   * @brief:
+   *    Parses a satellite line and appends it to the batch of its type.
+   * @params:
+   *    line: JSON line.
+   *    receivedUs: Reception time, sample time if the line has none
+   *      (negative: lines without time are not samples, SD card import).
+   *    sampleUs: Set to the time of the line if it has one.
+   * @return:
+   *    Batch of the line, nullptr if line is not a sample.
+   */
+  SampleBatch* add(std::string_view line, int64_t receivedUs, int64_t* sampleUs = nullptr);
+
+  /*
+   * @brief:
+   *    Stages a typed row through the series of its satellite.
+   * @params:
+   *    batch: Batch of the row type.
+   *    values, kinds: One per column of the type.
+   *    raw: Line of the row.
+   */
+  void addRow(SampleBatch& batch, int64_t time_us, std::string_view satId, const double* values,
+              const CellKind* kinds, std::string_view raw);
+
+  /*
+   * @brief:
+   *    Stages the rows still waiting for interpolated members (end of a
+   *    file, exit), their unknown members NULL.
+   * @return:
+   *    Rows staged.
+   */
+  size_t flushSeries();
+
+  // Series of every type, to add lines again from a saved point
+  std::vector<SeriesFill::State> saveSeries() const;
+  void restoreSeries(const std::vector<SeriesFill::State>& saved);
+
+  /*
+   * @brief:
+   *    Computes the derived channels of the staged rows and encodes them.
+   */
+  void encode(SampleBatch& batch, const CalibrationRegistry& calibrations);
+
+  std::vector<SampleBatch>& all()  { return batches; }
+  size_t rows() const;
+
+private:
+  bool keepRaw;
+  // One batch per satellite type, then the generic batch
+  std::vector<SampleBatch> batches;
+  // Members of the row being added
+  std::vector<double> rowValues;
+  std::vector<CellKind> rowKinds;
+};
+
+#endif
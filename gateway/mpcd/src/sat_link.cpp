@@ -0,0 +1,246 @@
+#include "sat_link.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log.h"
+
+// BlueZ socket constants and RFCOMM address (<bluetooth/bluetooth.h>, <bluetooth/rfcomm.h>)
+#ifndef AF_BLUETOOTH
+#define AF_BLUETOOTH    31
+#endif
+#define BTPROTO_RFCOMM  3
+
+struct sockaddr_rc {
+  sa_family_t rc_family;
+  uint8_t rc_bdaddr[6];
+  uint8_t rc_channel;
+};
+
+bool parseLinkAddress(const std::string& spec, LinkAddress& address)  {
+
+  address = LinkAddress();
+  address.text = spec;
+  if (spec.compare(0, 4, "tcp:") == 0)  {
+    size_t colon = spec.rfind(':');
+    if (colon <= 4)
+      return false;
+    address.kind = LinkAddress::TCP;
+    address.host = spec.substr(4, colon - 4);
+    address.port = (uint16_t)atoi(spec.c_str() + colon + 1);
+    struct in_addr a;
+    return address.port != 0 && inet_pton(AF_INET, address.host.c_str(), &a) == 1;
+  }
+
+  unsigned b[6];
+  int channel = RFCOMM_DEFAULT_CHANNEL;
+  int n = 0;
+  if (sscanf(spec.c_str(), "%2x:%2x:%2x:%2x:%2x:%2x%n", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &n) != 6 || n != 17)
+    return false;
+  if (spec.size() > 17 && (spec[17] != '@' || (channel = atoi(spec.c_str() + 18)) < 1 || channel > 30))
+    return false;
+  address.kind = LinkAddress::RFCOMM;
+  // bdaddr_t is stored least significant byte first
+  for (int i = 0; i < 6; i++)
+    address.bdaddr[i] = (uint8_t)b[5 - i];
+  address.channel = (uint8_t)channel;
+  return true;
+}
+
+SatLink::SatLink(const LinkAddress& address, std::string name) : addr(address), linkName(std::move(name))  {}
+
+bool SatLink::connect(int64_t nowMs)  {
+
+  close();
+  attemptMs = nowMs;
+  int r;
+  if (addr.kind == LinkAddress::RFCOMM)  {
+    sock = socket(AF_BLUETOOTH, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, BTPROTO_RFCOMM);
+    struct sockaddr_rc sa = {};
+    sa.rc_family = AF_BLUETOOTH;
+    memcpy(sa.rc_bdaddr, addr.bdaddr, 6);
+    sa.rc_channel = addr.channel;
+    r = sock < 0 ? -1 : ::connect(sock, (struct sockaddr*)&sa, sizeof(sa));
+  }
+  else  {
+    sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    struct sockaddr_in sa = {};
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(addr.port);
+    inet_pton(AF_INET, addr.host.c_str(), &sa.sin_addr);
+    r = sock < 0 ? -1 : ::connect(sock, (struct sockaddr*)&sa, sizeof(sa));
+  }
+
+  if (r == 0 || errno == EINPROGRESS)  {
+    int sndbuf = LINK_SNDBUF;
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    state = CONNECTING;
+    return true;
+  }
+  logMsg(LOG_DBG, "%s: %s", linkName.c_str(), strerror(errno));
+  counters.failures++;
+  close(nowMs);
+  return false;
+}
+
+bool SatLink::finishConnect(int64_t nowMs)  {
+
+  int err = 0;
+  socklen_t len = sizeof(err);
+  if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+    err = errno;
+  if (err != 0)  {
+    logMsg(LOG_DBG, "%s: %s", linkName.c_str(), strerror(err));
+    close(nowMs);
+    return false;
+  }
+  state = UP;
+  framer.reset();
+  counters.connects++;
+  counters.connectMs = nowMs - attemptMs;
+  logMsg(LOG_INFO, "%s connected (%lld ms)", linkName.c_str(), (long long)counters.connectMs);
+  return true;
+}
+
+void SatLink::close(int64_t nowMs)  {
+
+  if (sock >= 0)
+    ::close(sock);
+  sock = -1;
+  if (state == UP)  {
+    counters.disconnects++;
+    logMsg(LOG_INFO, "%s disconnected", linkName.c_str());
+  }
+  // Connection refused or abandoned
+  else if (state == CONNECTING)  {
+    counters.failures++;
+  }
+  if (nowMs)
+    scheduleRetry(nowMs);
+  state = DOWN;
+  clearOutput();
+}
+
+void SatLink::scheduleRetry(int64_t nowMs)  {
+
+  // 1 s, 2 s, 4 s... up to 60 s, +-20 % so that links do not retry together
+  int64_t delay = LINK_BACKOFF_MIN_MS;
+  for (int i = 0; i < failures && delay < LINK_BACKOFF_MAX_MS; i++)
+    delay *= 2;
+  if (delay > LINK_BACKOFF_MAX_MS)
+    delay = LINK_BACKOFF_MAX_MS;
+  delay += delay * (rand() % 41 - 20) / 100;
+  nextAttemptMs = nowMs + delay;
+  failures++;
+}
+
+ssize_t SatLink::readChunk(char* buf, size_t len)  {
+
+  if (sock < 0 || state != UP)
+    return -1;
+  ssize_t n = ::recv(sock, buf, len, 0);
+  if (n > 0)
+    return n;
+  if (n < 0 && (errno == EAGAIN || errno == EINTR))
+    return 0;
+  // n == 0: closed by the satellite
+  return -1;
+}
+
+bool SatLink::send(OutFrame frame, OutPriority priority, int64_t nowMs)  {
+
+  if (state != UP)
+    return false;
+  outBytes[priority] += frame->size();
+  out[priority].push_back({std::move(frame), nowMs});
+  // Link slower than the stream: drop the oldest frames, not the one being written
+  while (outBytes[priority] > LINK_OUT_MAX_BYTES && out[priority].size() > 1)  {
+    if (priority == OUT_RTCM)
+      counters.rtcmDropped++;
+    popFrame(priority, current == priority ? 1 : 0);
+  }
+  return true;
+}
+
+bool SatLink::flushOutput(int64_t nowMs)  {
+
+  while (state == UP)  {
+    if (current < 0)  {
+      // Stale corrections would only delay the fresh ones
+      while (!out[OUT_RTCM].empty() && nowMs - out[OUT_RTCM].front().queuedMs > LINK_RTCM_MAX_AGE_MS)  {
+        counters.rtcmDropped++;
+        popFrame(OUT_RTCM);
+      }
+      for (int p = 0; p < OUT_PRIORITIES && current < 0; p++)
+        if (!out[p].empty())
+          current = p;
+      if (current < 0)
+        return true;
+      offset = 0;
+    }
+
+    Pending& pending = out[current].front();
+    const std::string& data = *pending.frame;
+    ssize_t n = ::send(sock, data.data() + offset, data.size() - offset, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0)  {
+      if (errno == EINTR)
+        continue;
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    counters.bytesOut += n;
+    offset += n;
+    if (offset < data.size())
+      continue;
+
+    if (current == OUT_RTCM)  {
+      counters.rtcmFrames++;
+      if (nowMs - pending.queuedMs > counters.rtcmWaitMaxMs)
+        counters.rtcmWaitMaxMs = nowMs - pending.queuedMs;
+    }
+    else  {
+      counters.ordersOut++;
+    }
+    popFrame(current);
+    current = -1;
+  }
+  return false;
+}
+
+void SatLink::popFrame(int priority, size_t index)  {
+
+  outBytes[priority] -= out[priority][index].frame->size();
+  out[priority].erase(out[priority].begin() + index);
+}
+
+void SatLink::clearOutput()  {
+
+  for (int p = 0; p < OUT_PRIORITIES; p++)  {
+    out[p].clear();
+    outBytes[p] = 0;
+  }
+  current = -1;
+  offset = 0;
+}
+
+void SatLink::addLatency(int64_t latencyUs)  {
+
+  counters.latencySumUs += latencyUs;
+  counters.latencyCount++;
+  if (latencyUs > counters.latencyMaxUs)
+    counters.latencyMaxUs = latencyUs;
+}
+
+void SatLink::resetPeriod()  {
+
+  counters.latencySumUs = 0;
+  counters.latencyMaxUs = 0;
+  counters.latencyCount = 0;
+  counters.periodBytes = 0;
+  counters.rtcmWaitMaxMs = 0;
+}
@@ -0,0 +1,218 @@
+/*
+ ****************************
+ *     SATELLITE LINK       *
+ ****************************
+ * @brief:
+ *    Stream socket to one satellite: RFCOMM socket opened directly on the
+ *    satellite address (no rfcomm bind, no tty), or TCP socket to a
+ *    loopback stand-in (fake_sat -t) for tests.
+ *    Connects without blocking, splits the stream into lines and keeps
+ *    the link metrics. After a failure or a disconnection, the next
+ *    attempt waits an exponential backoff with jitter.
+ *    Outgoing data (RTCM corrections, orders) is queued by priority and
+ *    written whole frame by whole frame when the socket is writable:
+ *    a correction waits at most for the end of the frame being sent.
+ *    Corrections too old to be useful to the receiver are dropped.
+ * @note:
+ *    The RFCOMM socket address is declared here (same layout as BlueZ
+ *    <bluetooth/rfcomm.h>), mpcd needs no libbluetooth.
+ */
+#ifndef MPCD_SAT_LINK_H
+#define MPCD_SAT_LINK_H
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+
+#include "line_framer.h"
+
+// SPP channel of the satellite Bluetooth modules (HC-05, HC-06)
+#define RFCOMM_DEFAULT_CHANNEL  1
+// Backoff between attempts: first delay, maximum delay
+#define LINK_BACKOFF_MIN_MS     1000
+#define LINK_BACKOFF_MAX_MS     60000
+// Connection attempt abandoned after this delay
+#define LINK_CONNECT_TIMEOUT_MS 20000
+// Corrections older than this are dropped instead of sent
+#define LINK_RTCM_MAX_AGE_MS    2000
+// Queued bytes per priority above which the oldest frames are dropped
+#define LINK_OUT_MAX_BYTES      16384
+// Socket send buffer: small, so that frames wait in the queues where
+// priorities and ages apply (about 0.5 s of a Bluetooth SPP link)
+#define LINK_SNDBUF             4096
+
+// Output priorities, lowest value sent first
+enum OutPriority { OUT_RTCM = 0, OUT_ORDER, OUT_PRIORITIES };
+
+// Outgoing frame, shared by all the links it is sent to
+typedef std::shared_ptr<const std::string> OutFrame;
+
+struct LinkAddress {
+  enum Kind { RFCOMM, TCP } kind = RFCOMM;
+  // RFCOMM: bdaddr (little endian, as in bdaddr_t) and channel
+  uint8_t bdaddr[6] = {};
+  uint8_t channel = RFCOMM_DEFAULT_CHANNEL;
+  // TCP: IPv4 address and port
+  std::string host;
+  uint16_t port = 0;
+  // "98:D3:B1:FD:C3:2C" or "tcp:127.0.0.1:7000"
+  std::string text;
+};
+
+/*
+ * @brief:
+ *    Parses "XX:XX:XX:XX:XX:XX[@channel]" (RFCOMM) or "tcp:host:port".
+ * @return:
+ *    False if spec is not an address.
+ */
+bool parseLinkAddress(const std::string& spec, LinkAddress& address);
+
+struct LinkStats {
+  uint64_t connects = 0;
+  uint64_t failures = 0;
+  uint64_t disconnects = 0;
+  uint64_t bytesIn = 0;
+  uint64_t linesIn = 0;
+  uint64_t bytesOut = 0;
+  // Corrections written, dropped (too old or queue full)
+  uint64_t rtcmFrames = 0;
+  uint64_t rtcmDropped = 0;
+  uint64_t ordersOut = 0;
+  // Last connection duration (ms)
+  int64_t connectMs = 0;
+  // Sample latency (satellite time to reception), since last resetPeriod()
+  int64_t latencySumUs = 0;
+  int64_t latencyMaxUs = 0;
+  uint64_t latencyCount = 0;
+  // Bytes received since last resetPeriod()
+  uint64_t periodBytes = 0;
+  // Longest wait of a correction in the queue since last resetPeriod() (ms)
+  int64_t rtcmWaitMaxMs = 0;
+};
+
+class SatLink {
+public:
+  enum State { DOWN, CONNECTING, UP };
+
+  SatLink(const LinkAddress& address, std::string name);
+  ~SatLink()  { close(); }
+  SatLink(const SatLink&) = delete;
+  SatLink& operator=(const SatLink&) = delete;
+
+  /*
+   * @brief:
+   *    Starts a connection (non-blocking).
+   * @return:
+   *    False if it failed at once (next attempt after the backoff).
+   */
+  bool connect(int64_t nowMs);
+
+  /*
+   * @brief:
+   *    Completes a connection when its socket is writable.
+   * @return:
+   *    False if the connection was refused or timed out.
+   */
+  bool finishConnect(int64_t nowMs);
+
+  /*
+   * @brief:
+   *    Closes the link, the next attempt waits the backoff.
+   */
+  void close(int64_t nowMs = 0);
+
+  /*
+   * @brief:
+   *    Reads available bytes into the line framer.
+   * @params:
+   *    onLine: Called with each complete line.
+   * @return:
+   *    False if the satellite closed the link or it was lost.
+   */
+  template <typename F>
+  bool readLines(F onLine)  {
+    char buf[4096];
+    while (true)  {
+      ssize_t n = readChunk(buf, sizeof(buf));
+      if (n <= 0)
+        return n == 0;
+      counters.bytesIn += n;
+      counters.periodBytes += n;
+      framer.feed(buf, (size_t)n, [&](std::string_view line)  {
+        // A link that delivers lines is healthy again
+        failures = 0;
+        counters.linesIn++;
+        onLine(line);
+      });
+    }
+  }
+
+  /*
+   * @brief:
+   *    Queues a frame for the satellite, see flushOutput().
+   * @return:
+   *    False if the link is not up.
+   */
+  bool send(OutFrame frame, OutPriority priority, int64_t nowMs);
+
+  /*
+   * @brief:
+   *    Writes the queued frames while the socket accepts them, the frame
+   *    being written first, then by priority.
+   * @return:
+   *    False on socket error.
+   */
+  bool flushOutput(int64_t nowMs);
+
+  // True when frames wait for the socket
+  bool outputPending() const  { return current >= 0 || !out[OUT_RTCM].empty() || !out[OUT_ORDER].empty(); }
+
+  // Records the latency of a sample
+  void addLatency(int64_t latencyUs);
+
+  // True when an attempt is due
+  bool due(int64_t nowMs) const  { return state == DOWN && nowMs >= nextAttemptMs; }
+  // True when a connection attempt lasts too long
+  bool timedOut(int64_t nowMs) const  { return state == CONNECTING && nowMs - attemptMs > LINK_CONNECT_TIMEOUT_MS; }
+
+  State status() const  { return state; }
+  int fd() const  { return sock; }
+  const std::string& name() const  { return linkName; }
+  const LinkAddress& address() const  { return addr; }
+  const LinkStats& stats() const  { return counters; }
+  void resetPeriod();
+
+private:
+  LinkAddress addr;
+  std::string linkName;
+  int sock = -1;
+  State state = DOWN;
+  LineFramer framer;
+  LinkStats counters;
+  // Consecutive failures, for the backoff
+  int failures = 0;
+  int64_t attemptMs = 0;
+  int64_t nextAttemptMs = 0;
+
+  struct Pending {
+    OutFrame frame;
+    int64_t queuedMs;
+  };
+  std::deque<Pending> out[OUT_PRIORITIES];
+  size_t outBytes[OUT_PRIORITIES] = {};
+  // Queue whose front frame is partly written (-1 if none), bytes written
+  int current = -1;
+  size_t offset = 0;
+
+  void popFrame(int priority, size_t index = 0);
+  void clearOutput();
+
+  // Returns bytes read, 0 if nothing available, -1 on error or hang-up
+  ssize_t readChunk(char* buf, size_t len);
+  void scheduleRetry(int64_t nowMs);
+};
+
+#endif
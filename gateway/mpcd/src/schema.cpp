@@ -0,0 +1,153 @@
+#include "schema.h"
+
+#include <cstring>
+
+#include "calibration.h"
+
+std::string SatType::copySql(const char* into) const  {
+
+  std::string sql = "COPY ";
+  sql += into ? into : table;
+  sql += " (time, sat_id";
+  for (const Column& c : columns)  {
+    sql += ", ";
+    sql += c.name;
+  }
+  for (const Column& c : derived)  {
+    sql += ", ";
+    sql += c.name;
+  }
+  sql += ", raw) FROM STDIN (FORMAT binary)";
+  return sql;
+}
+
+int SatType::columnIndex(const char* name) const  {
+
+  for (size_t i = 0; i < columns.size(); i++)
+    if (strcmp(columns[i].name, name) == 0)
+      return (int)i;
+  return -1;
+}
+
+int SatType::derivedIndex(const char* name) const  {
+
+  for (size_t i = 0; i < derived.size(); i++)
+    if (strcmp(derived[i].name, name) == 0)
+      return (int)i;
+  return -1;
+}
+
+ColumnBatch::ColumnBatch(const SatType* type) : type(type)  {
+
+  if (type)  {
+    columns.resize(type->columns.size());
+    derived.resize(type->derived.size());
+  }
+}
+
+void ColumnBatch::clear()  {
+
+  time.clear();
+  satId.clear();
+  raw.clear();
+  for (auto& c : columns)
+    c.clear();
+  for (auto& c : derived)
+    c.clear();
+}
+
+const std::vector<SatType>& satTypes()  {
+
+  static const std::vector<SatType> types = {
+    // cyclopee_sat/GNSS_logger json_logStr()
+    {"cyclopee", "cyclopee.cyclopee_sample", {"elv", "dist"}, {
+      {"lon", "lon", COL_FLOAT8},
+      {"lat", "lat", COL_FLOAT8},
+      {"elv", "elv", COL_FLOAT8},
+      {"fix", "fix", COL_INT2},
+      {"pdop", "pdop", COL_FLOAT4},
+      {"dist", "dist", COL_FLOAT4},
+      {"temp", "temp", COL_FLOAT4},
+    }, {
+      {nullptr, "surface_elv", COL_FLOAT8},
+      {nullptr, "water_height", COL_FLOAT8},
+    }, deriveWaterHeight},
+    // simple_mpc_sat/GNSS_logger json_logStr()
+    {"water", "cyclopee.water_sample", {"turb", "cond"}, {
+      {"lon", "lon", COL_FLOAT8},
+      {"lat", "lat", COL_FLOAT8},
+      {"raw_turb", "raw_turb", COL_FLOAT4},
+      {"turb", "turb", COL_FLOAT4},
+      {"raw_cond", "raw_cond", COL_FLOAT4},
+      {"cond", "cond", COL_FLOAT4},
+      {"temp", "temp", COL_FLOAT4},
+    }, {
+      {nullptr, "cond25", COL_FLOAT4},
+    }, deriveCond25},
+    // air_sat/air_sat.ino
+    {"air", "cyclopee.air_sample", {"Co2"}, {
+      {"lon", "lon", COL_FLOAT8},
+      {"lat", "lat", COL_FLOAT8},
+      {"Co2", "co2", COL_INT4},
+      {"Co2_Temperature", "co2_temp", COL_FLOAT4},
+      {"Co2_Humidity", "co2_hum", COL_FLOAT4},
+      {"BME_Temperature", "bme_temp", COL_FLOAT4},
+      {"BME_Humidity", "bme_hum", COL_FLOAT4},
+      {"BME_Pressure", "bme_pres", COL_FLOAT4},
+    }, {}, nullptr},
+    // cyclopee_sat/GNSS_logger json_aggregateStr(), one line per window
+    {"cyclopee_window", "cyclopee.cyclopee_window", {"window"}, {
+      {"window", "duration", COL_INT4},
+      {"lon_n", "lon_n", COL_INT4},
+      {"lon_mean", "lon_mean", COL_FLOAT8},
+      {"lon_min", "lon_min", COL_FLOAT8},
+      {"lon_max", "lon_max", COL_FLOAT8},
+      {"lon_std", "lon_std", COL_FLOAT4},
+      {"lat_n", "lat_n", COL_INT4},
+      {"lat_mean", "lat_mean", COL_FLOAT8},
+      {"lat_min", "lat_min", COL_FLOAT8},
+      {"lat_max", "lat_max", COL_FLOAT8},
+      {"lat_std", "lat_std", COL_FLOAT4},
+      {"elv_n", "elv_n", COL_INT4},
+      {"elv_mean", "elv_mean", COL_FLOAT8},
+      {"elv_min", "elv_min", COL_FLOAT8},
+      {"elv_max", "elv_max", COL_FLOAT8},
+      {"elv_std", "elv_std", COL_FLOAT4},
+      {"dist_n", "dist_n", COL_INT4},
+      {"dist_mean", "dist_mean", COL_FLOAT4},
+      {"dist_min", "dist_min", COL_FLOAT4},
+      {"dist_max", "dist_max", COL_FLOAT4},
+      {"dist_std", "dist_std", COL_FLOAT4},
+      {"temp_n", "temp_n", COL_INT4},
+      {"temp_mean", "temp_mean", COL_FLOAT4},
+      {"temp_min", "temp_min", COL_FLOAT4},
+      {"temp_max", "temp_max", COL_FLOAT4},
+      {"temp_std", "temp_std", COL_FLOAT4},
+    }, {}, nullptr},
+    // cyclopee_sat/GNSS_logger json_waveStr(), one line per distance burst
+    {"wave", "cyclopee.wave_stats", {"hm0"}, {
+      {"mean_dist", "mean_dist", COL_FLOAT4},
+      {"hm0", "hm0", COL_FLOAT4},
+      {"tp", "tp", COL_FLOAT4},
+      {"tm01", "tm01", COL_FLOAT4},
+      {"valid", "valid", COL_FLOAT4},
+      {"psd_00", "psd_00", COL_FLOAT4},
+      {"psd_01", "psd_01", COL_FLOAT4},
+      {"psd_02", "psd_02", COL_FLOAT4},
+      {"psd_03", "psd_03", COL_FLOAT4},
+      {"psd_04", "psd_04", COL_FLOAT4},
+      {"psd_05", "psd_05", COL_FLOAT4},
+      {"psd_06", "psd_06", COL_FLOAT4},
+      {"psd_07", "psd_07", COL_FLOAT4},
+      {"psd_08", "psd_08", COL_FLOAT4},
+      {"psd_09", "psd_09", COL_FLOAT4},
+      {"psd_10", "psd_10", COL_FLOAT4},
+      {"psd_11", "psd_11", COL_FLOAT4},
+      {"psd_12", "psd_12", COL_FLOAT4},
+      {"psd_13", "psd_13", COL_FLOAT4},
+      {"psd_14", "psd_14", COL_FLOAT4},
+      {"psd_15", "psd_15", COL_FLOAT4},
+    }, {}, nullptr},
+  };
+  return types;
+}
@@ -0,0 +1,83 @@
+/*
+ ****************************
+ *      SAMPLE SCHEMAS      *
+ ****************************
+ * @brief:
+ *    Typed tables of each satellite type (gateway/sql/typed_tables.sql).
+ *    A line is routed to the first type whose signature keys are all
+ *    present, its members are written in real float/int columns.
+ *    Lines of unknown types go to the jsonb table cyclopee.sensor.
+ *    Rows are staged by columns (ColumnBatch) so that derived channels
+ *    (calibration.h) are computed on whole columns before the COPY.
+ * @note:
+ *    Every typed table starts with (time, sat_id), then the member
+ *    columns, the derived columns and the optional raw jsonb audit column.
+ */
+#ifndef MPCD_SCHEMA_H
+#define MPCD_SCHEMA_H
+
+#include <string>
+#include <vector>
+
+enum ColumnType { COL_FLOAT8, COL_FLOAT4, COL_INT2, COL_INT4 };
+
+struct Column {
+  // Member name in the satellite line
+  const char* key;
+  // Column name in the table
+  const char* name;
+  ColumnType type;
+};
+
+struct ColumnBatch;
+class CalibrationRegistry;
+
+// Computes the derived columns of a batch
+typedef void (*DeriveFn)(ColumnBatch& batch, const CalibrationRegistry& calibrations);
+
+struct SatType {
+  const char* name;
+  const char* table;
+  // Members identifying the type
+  std::vector<const char*> signature;
+  std::vector<Column> columns;
+  // Columns computed at ingest (key unused)
+  std::vector<Column> derived;
+  DeriveFn derive;
+
+  // "COPY table (time, sat_id, columns..., derived..., raw) FROM STDIN (FORMAT binary)",
+  // into another table with the same columns if given
+  std::string copySql(const char* into = nullptr) const;
+  // Number of fields of a row
+  int nbFields() const  { return (int)(columns.size() + derived.size()) + 3; }
+  // Index of a member or derived column, -1 if none
+  int columnIndex(const char* name) const;
+  int derivedIndex(const char* name) const;
+};
+
+/*
+ * @brief:
+ *    Rows of one satellite type, stored by columns.
+ *    Missing or null values are NaN (written as NULL).
+ */
+struct ColumnBatch {
+  const SatType* type = nullptr;
+  std::vector<int64_t> time;
+  std::vector<std::string> satId;
+  std::vector<std::vector<double>> columns;
+  std::vector<std::vector<double>> derived;
+  std::vector<std::string> raw;
+
+  explicit ColumnBatch(const SatType* type = nullptr);
+  size_t rows() const  { return time.size(); }
+  bool empty() const  { return time.empty(); }
+  void clear();
+};
+
+// Known satellite types
+const std::vector<SatType>& satTypes();
+
+// Table of lines of unknown types
+#define GENERIC_TABLE  "cyclopee.sensor"
+
+#endif
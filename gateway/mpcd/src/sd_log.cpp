@@ -0,0 +1,278 @@
+#include "sd_log.h"
+
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+#include "time_util.h"
+
+namespace {
+
+// CSV header names (before the unit) and satellite members
+struct CsvColumn {
+  const char* name;
+  const char* key;
+};
+
+const CsvColumn CSV_COLUMNS[] = {
+  {"Longitude", "lon"},
+  {"Latitude", "lat"},
+  // Written in m despite its header, as the "elv" member
+  {"Altitude", "elv"},
+  {"Fix Mode", "fix"},
+  {"PDOP", "pdop"},
+  {"Distance", "dist"},
+  {"External temperature", "temp"},
+  {"Temperature", "temp"},
+  {"Raw Turbidity", "raw_turb"},
+  {"Turbidity", "turb"},
+  {"Raw Conductivity", "raw_cond"},
+  {"Conductivity", "cond"},
+  // simple_mpc_sat/GNSS_logger header
+  {"Condctivity", "cond"},
+};
+
+std::string_view trim(std::string_view s)  {
+
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+    s.remove_prefix(1);
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r'))
+    s.remove_suffix(1);
+  return s;
+}
+
+// Next comma separated cell, false after the last one
+bool nextCell(std::string_view& rest, std::string_view& cell, bool& more)  {
+
+  if (!more)
+    return false;
+  const char* comma = (const char*)memchr(rest.data(), ',', rest.size());
+  if (comma)  {
+    cell = rest.substr(0, comma - rest.data());
+    rest.remove_prefix(cell.size() + 1);
+  }
+  else  {
+    cell = rest;
+    more = false;
+  }
+  return true;
+}
+
+// "YYYY_MM_DD" (or '-', '/' separated), midnight in Unix us
+bool parseDate(std::string_view text, int64_t& midnight_us)  {
+
+  int v[3] = {0, 0, 0};
+  size_t pos = 0;
+  for (int i = 0; i < 3; i++)  {
+    size_t start = pos;
+    while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9' && pos - start < 4)
+      v[i] = v[i] * 10 + (text[pos++] - '0');
+    if (pos == start || (i < 2 && (pos >= text.size() || strchr("_-/", text[pos++]) == nullptr)))
+      return false;
+  }
+  if (pos != text.size() || v[0] < 2000 || v[1] < 1 || v[1] > 12 || v[2] < 1 || v[2] > 31)
+    return false;
+  midnight_us = daysFromCivil(v[0], (unsigned)v[1], (unsigned)v[2]) * 86400LL * 1000000LL;
+  return true;
+}
+
+// "HH:MM:SS[.frac]", microseconds since midnight
+bool parseTimeOfDay(std::string_view text, int64_t& tod_us)  {
+
+  if (text.size() < 8 || text[2] != ':' || text[5] != ':')
+    return false;
+  int64_t f[3];
+  for (int i = 0; i < 3; i++)  {
+    char a = text[i * 3], b = text[i * 3 + 1];
+    if (a < '0' || a > '9' || b < '0' || b > '9')
+      return false;
+    f[i] = (a - '0') * 10 + (b - '0');
+  }
+  if (f[0] > 23 || f[1] > 59 || f[2] > 60)
+    return false;
+  int64_t frac_us = 0;
+  if (text.size() > 8)  {
+    if (text[8] != '.' || text.size() == 9)
+      return false;
+    int64_t scale = 100000;
+    for (size_t i = 9; i < text.size(); i++)  {
+      if (text[i] < '0' || text[i] > '9')
+        return false;
+      frac_us += (text[i] - '0') * scale;
+      scale /= 10;
+    }
+  }
+  tod_us = (f[0] * 3600 + f[1] * 60 + f[2]) * 1000000 + frac_us;
+  return true;
+}
+
+double parseNumber(std::string_view cell)  {
+
+  cell = trim(cell);
+  double v;
+  auto r = std::from_chars(cell.data(), cell.data() + cell.size(), v);
+  return (r.ec == std::errc() && r.ptr == cell.data() + cell.size()) ? v : NAN;
+}
+
+}
+
+SdLogReader::SdLogReader(std::string_view data, std::string satId, std::string_view dirDate, const SatType* forcedType)
+  : data(data), satId(std::move(satId))  {
+
+  readHeader(dirDate, forcedType);
+}
+
+bool SdLogReader::nextLine(std::string_view& line)  {
+
+  if (pos >= data.size())
+    return false;
+  const char* start = data.data() + pos;
+  const char* eol = (const char*)memchr(start, '\n', data.size() - pos);
+  size_t len = eol ? (size_t)(eol - start) : data.size() - pos;
+  pos += len + (eol ? 1 : 0);
+  line = std::string_view(start, len);
+  if (!line.empty() && line.back() == '\r')
+    line.remove_suffix(1);
+  nbLines++;
+  return true;
+}
+
+bool SdLogReader::readHeader(std::string_view dirDate, const SatType* forcedType)  {
+
+  // First line: JSON sample, Date line or header
+  size_t start = pos;
+  std::string_view line;
+  while (nextLine(line) && trim(line).empty())
+    start = pos;
+  line = trim(line);
+  if (!line.empty() && line.front() == '{')  {
+    pos = start;
+    nbLines--;
+    fileKind = SD_LOG_JSON;
+    return true;
+  }
+
+  bool dated = false;
+  if (line.compare(0, 6, "Date:,") == 0)  {
+    dated = parseDate(trim(line.substr(6)), day_us);
+    nextLine(line);
+  }
+  if (!dated && !parseDate(dirDate, day_us))  {
+    why = "no date (Date line or YYYY_MM_DD directory)";
+    return false;
+  }
+  if (line.compare(0, 4, "Time") != 0)  {
+    why = "no header line";
+    return false;
+  }
+
+  // Member of each column after the time
+  std::vector<const char*> keys;
+  std::string_view rest = line, cell;
+  bool more = true;
+  nextCell(rest, cell, more);
+  while (nextCell(rest, cell, more))  {
+    cell = trim(cell);
+    size_t unit = cell.find(" (");
+    std::string_view name = trim(cell.substr(0, unit));
+    const char* key = nullptr;
+    for (const CsvColumn& c : CSV_COLUMNS)
+      if (name == c.name)
+        key = c.key;
+    keys.push_back(key);
+  }
+
+  const std::vector<SatType>& types = satTypes();
+  if (forcedType)  {
+    csvType = forcedType;
+  }
+  else  {
+    // Signature complete first, then most columns matched
+    int best = 0;
+    for (const SatType& type : types)  {
+      int matched = 0;
+      for (const char* key : keys)
+        for (const Column& c : type.columns)
+          if (key && strcmp(key, c.key) == 0)
+            matched++;
+      bool signature = true;
+      for (const char* s : type.signature)  {
+        bool found = false;
+        for (const char* key : keys)
+          found = found || (key && strcmp(key, s) == 0);
+        signature = signature && found;
+      }
+      int score = matched + (signature ? 1000 : 0);
+      if (score > best)  {
+        best = score;
+        csvType = &type;
+      }
+    }
+    if (!csvType)  {
+      why = "no column of a known satellite type";
+      return false;
+    }
+  }
+  batchIndex = (size_t)(csvType - types.data());
+  for (const char* key : keys)  {
+    int index = -1;
+    for (size_t c = 0; key && c < csvType->columns.size(); c++)
+      if (strcmp(key, csvType->columns[c].key) == 0)
+        index = (int)c;
+    layout.push_back(index);
+  }
+  fileKind = SD_LOG_CSV;
+  return true;
+}
+
+bool SdLogReader::addCsvRow(std::string_view line, SampleBatches& batches, SampleBatch& batch)  {
+
+  std::string_view rest = line, cell;
+  bool more = true;
+  int64_t tod_us;
+  if (!nextCell(rest, cell, more) || !parseTimeOfDay(trim(cell), tod_us))
+    return false;
+  // Segment past midnight
+  if (previousTod_us >= 0 && tod_us < previousTod_us - 43200LL * 1000000LL)
+    day_us += 86400LL * 1000000LL;
+  previousTod_us = tod_us;
+
+  rowValues.assign(csvType->columns.size(), NAN);
+  rowKinds.assign(csvType->columns.size(), CELL_VALUE);
+  for (size_t i = 0; i < layout.size() && nextCell(rest, cell, more); i++)  {
+    if (layout[i] < 0)
+      continue;
+    // Cells sent on change: marker, else a number
+    cell = trim(cell);
+    rowKinds[layout[i]] = cellKind(cell);
+    if (rowKinds[layout[i]] == CELL_VALUE)
+      rowValues[layout[i]] = parseNumber(cell);
+  }
+  batches.addRow(batch, day_us + tod_us, satId, rowValues.data(), rowKinds.data(), line);
+  return true;
+}
+
+size_t SdLogReader::read(SampleBatches& batches, size_t maxRows)  {
+
+  size_t rows = 0;
+  std::string_view line;
+  while (rows < maxRows && fileKind != SD_LOG_UNKNOWN && nextLine(line))  {
+    if (line.empty())
+      continue;
+    bool added;
+    if (fileKind == SD_LOG_CSV)
+      added = addCsvRow(line, batches, batches.all()[batchIndex]);
+    else
+      added = batches.add(line, -1) != nullptr;
+    if (added)
+      rows++;
+    else
+      nbSkipped++;
+  }
+  // End of the file: rows still waiting for an interpolated value
+  if (done() && !flushed)  {
+    flushed = true;
+    rows += batches.flushSeries();
+  }
+  return rows;
+}
@@ -0,0 +1,106 @@
+/*
+ ****************************
+ *       SD CARD LOGS       *
+ ****************************
+ * @brief:
+ *    Reads the log files of the satellite SD cards into sample batches
+ *    (sample_batch.h), for the import of the data not received over
+ *    Bluetooth (tools/mpcimport.cpp):
+ *      - CSV segments YYYY_MM_DD/HH_MM_SS.csv of the Teensy loggers
+ *        (newLogFile()): a "Date:,YYYY_MM_DD" line, a header line naming
+ *        the columns, then one row per sample, time of day first.
+ *      - JSON lines (AIR.csv of air_sat): the lines sent over Bluetooth.
+ *    CSV columns are matched to the members of a satellite type by their
+ *    header name, so that every logger version is read without a format
+ *    table per firmware. The type is the one whose signature members are
+ *    all in the header, otherwise the one with most matching columns.
+ *    The whole file is in memory: lines are cut with memchr (vectorized
+ *    by the C library) and numbers read with std::from_chars, nothing is
+ *    copied.
+ * @note:
+ *    The CSV rows carry no satellite id (the card belongs to one
+ *    satellite): it is given by the caller. Rows without GNSS time ("NaN")
+ *    cannot be placed in time and are skipped. A segment running past
+ *    midnight keeps the date of its first line: the time of day going
+ *    back by more than 12 h moves to the next day.
+ *    Cells sent on change ("=", "~") are rebuilt within the file, which
+ *    the satellite starts and ends with values (series_fill.h).
+ */
+#ifndef MPCD_SD_LOG_H
+#define MPCD_SD_LOG_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "sample_batch.h"
+#include "schema.h"
+
+enum SdLogKind { SD_LOG_UNKNOWN, SD_LOG_CSV, SD_LOG_JSON };
+
+class SdLogReader {
+public:
+  /*
+   * @params:
+   *    data: Whole file, must outlive the reader.
+   *    satId: Satellite of the CSV rows.
+   *    dirDate: "YYYY_MM_DD" of the directory, used if the file has no Date line.
+   *    forcedType: Type of the CSV rows, nullptr to find it from the header.
+   */
+  SdLogReader(std::string_view data, std::string satId, std::string_view dirDate = "",
+              const SatType* forcedType = nullptr);
+
+  SdLogKind kind() const  { return fileKind; }
+  // Type of the CSV rows, nullptr for JSON lines
+  const SatType* type() const  { return csvType; }
+  // Why the file cannot be read, empty if it can
+  const std::string& error() const  { return why; }
+
+  /*
+   * @brief:
+   *    Parses the next lines into batches.
+   * @params:
+   *    batches: Receives the rows (CSV rows in the staging of their type).
+   *    maxRows: Stops once this number of rows is staged.
+   * @return:
+   *    Rows added (with the rows waiting for an interpolated cell at the
+   *    end of the file), 0 at the end of the file.
+   */
+  size_t read(SampleBatches& batches, size_t maxRows);
+
+  bool done() const  { return pos >= data.size(); }
+
+  // Lines read, lines skipped (no time, bad row)
+  uint64_t lines() const  { return nbLines; }
+  uint64_t skipped() const  { return nbSkipped; }
+
+private:
+  std::string_view data;
+  std::string satId;
+  SdLogKind fileKind = SD_LOG_UNKNOWN;
+  const SatType* csvType = nullptr;
+  // Batch of csvType in the batches
+  size_t batchIndex = 0;
+  // Column of csvType for each CSV column after the time, -1 if not stored
+  std::vector<int> layout;
+  // Cells of the row being added
+  std::vector<double> rowValues;
+  std::vector<CellKind> rowKinds;
+  // Waiting rows staged at the end of the file
+  bool flushed = false;
+  // Midnight of the file date, day of the previous row
+  int64_t day_us = 0;
+  int64_t previousTod_us = -1;
+  size_t pos = 0;
+  uint64_t nbLines = 0;
+  uint64_t nbSkipped = 0;
+  std::string why;
+
+  // Next line without its line ending, false at the end
+  bool nextLine(std::string_view& line);
+  bool readHeader(std::string_view dirDate, const SatType* forcedType);
+  bool addCsvRow(std::string_view line, SampleBatches& batches, SampleBatch& batch);
+};
+
+#endif
@@ -0,0 +1,403 @@
+#include "segment_queue.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "log.h"
+#include "time_util.h"
+
+// Segment header size and magic
+#define SEGMENT_HEADER      64
+static const char SEGMENT_MAGIC[8] = {'M', 'P', 'C', 'Q', 'S', 'E', 'G', '1'};
+
+namespace {
+
+struct RecordHeader {
+  uint32_t length;
+  uint32_t crc;
+  uint64_t seq;
+  int64_t receivedUs;
+};
+
+size_t align8(size_t n)  { return (n + 7) & ~(size_t)7; }
+
+std::string segmentPath(const std::string& dir, uint64_t index)  {
+
+  char name[32];
+  snprintf(name, sizeof(name), "/%016" PRIu64 ".seg", index);
+  return dir + name;
+}
+
+uint32_t recordCrc(uint64_t seq, int64_t receivedUs, const void* line, size_t length)  {
+
+  uLong crc = crc32(0L, (const Bytef*)&seq, sizeof(seq));
+  crc = crc32(crc, (const Bytef*)&receivedUs, sizeof(receivedUs));
+  return (uint32_t)crc32(crc, (const Bytef*)line, (uInt)length);
+}
+
+bool readCheckpoint(const std::string& dir, QueuePosition& p)  {
+
+  FILE* f = fopen((dir + "/checkpoint").c_str(), "r");
+  if (!f)
+    return false;
+  bool ok = fscanf(f, "%" SCNu64 " %zu %" SCNu64, &p.segment, &p.offset, &p.seq) == 3;
+  fclose(f);
+  return ok;
+}
+
+bool writeCheckpoint(const std::string& dir, const QueuePosition& p)  {
+
+  std::string tmp = dir + "/checkpoint.tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0640);
+  if (fd < 0)
+    return false;
+  char text[64];
+  int n = snprintf(text, sizeof(text), "%" PRIu64 " %zu %" PRIu64 "\n", p.segment, p.offset, p.seq);
+  bool ok = write(fd, text, n) == n && fsync(fd) == 0;
+  ::close(fd);
+  return ok && rename(tmp.c_str(), (dir + "/checkpoint").c_str()) == 0;
+}
+
+}
+
+std::vector<uint64_t> listSegments(const std::string& dir)  {
+
+  std::vector<uint64_t> segments;
+  DIR* d = opendir(dir.c_str());
+  if (!d)
+    return segments;
+  while (struct dirent* e = readdir(d))  {
+    const char* name = e->d_name;
+    size_t len = strlen(name);
+    if (len != 20 || strcmp(name + 16, ".seg") != 0)
+      continue;
+    segments.push_back(strtoull(name, nullptr, 10));
+  }
+  closedir(d);
+  std::sort(segments.begin(), segments.end());
+  return segments;
+}
+
+/*
+ ***************************
+ *     SEGMENT WRITER      *
+ ***************************
+ */
+SegmentWriter::SegmentWriter(std::string dir, size_t segmentBytes)
+  : dir(std::move(dir)), segmentBytes(segmentBytes)  {}
+
+SegmentWriter::~SegmentWriter()  {
+
+  checkpoint();
+  unmapSegment();
+}
+
+bool SegmentWriter::open()  {
+
+  if (mkdir(dir.c_str(), 0750) != 0 && errno != EEXIST)  {
+    logMsg(LOG_ERR, "queue %s: %s", dir.c_str(), strerror(errno));
+    return false;
+  }
+
+  std::vector<uint64_t> segments = listSegments(dir);
+  if (segments.empty())  {
+    // New queue: sequences go on after those already shipped, or start
+    // at the current time so that a wiped queue stays above them
+    QueuePosition p;
+    bool shipped = readCheckpoint(dir, p);
+    nextSeq = shipped ? p.seq + 1 : 1;
+    if (nextSeq < (uint64_t)nowUnixUs())
+      nextSeq = nowUnixUs();
+    return createSegment(shipped ? p.segment + 1 : 1) && mapSegment(shipped ? p.segment + 1 : 1);
+  }
+
+  if (!mapSegment(segments.back()))
+    return false;
+  if (recover())
+    return true;
+  // Last segment sealed
+  uint64_t sealed = index;
+  return createSegment(sealed + 1) && mapSegment(sealed + 1);
+}
+
+bool SegmentWriter::createSegment(uint64_t newIndex)  {
+
+  std::string path = segmentPath(dir, newIndex);
+  std::string tmp = path + ".tmp";
+  int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0640);
+  if (fd < 0)  {
+    logMsg(LOG_ERR, "queue %s: %s", tmp.c_str(), strerror(errno));
+    return false;
+  }
+  // Blocks reserved now: a full disk must not fault a write in the mapping
+  uint8_t header[SEGMENT_HEADER] = {};
+  memcpy(header, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+  memcpy(header + 8, &nextSeq, sizeof(nextSeq));
+  int err = posix_fallocate(fd, 0, segmentBytes);
+  bool ok = err == 0 && pwrite(fd, header, sizeof(header), 0) == (ssize_t)sizeof(header) && fsync(fd) == 0;
+  ::close(fd);
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0)  {
+    logMsg(LOG_ERR, "queue %s: %s", path.c_str(), strerror(err ? err : errno));
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool SegmentWriter::mapSegment(uint64_t newIndex)  {
+
+  std::string path = segmentPath(dir, newIndex);
+  int fd = ::open(path.c_str(), O_RDWR);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < SEGMENT_HEADER + 2 * sizeof(RecordHeader))  {
+    logMsg(LOG_ERR, "queue %s: cannot open", path.c_str());
+    if (fd >= 0)
+      ::close(fd);
+    return false;
+  }
+  void* m = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (m == MAP_FAILED)  {
+    logMsg(LOG_ERR, "queue %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  unmapSegment();
+  map = (uint8_t*)m;
+  mapBytes = st.st_size;
+  index = newIndex;
+  pos = syncedPos = SEGMENT_HEADER;
+  return true;
+}
+
+void SegmentWriter::unmapSegment()  {
+
+  if (map)
+    munmap(map, mapBytes);
+  map = nullptr;
+}
+
+bool SegmentWriter::recover()  {
+
+  if (memcmp(map, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0)  {
+    logMsg(LOG_ERR, "queue segment %" PRIu64 " is not a segment, skipped", index);
+    return false;
+  }
+  memcpy(&nextSeq, map + 8, sizeof(nextSeq));
+  pos = SEGMENT_HEADER;
+  while (pos + sizeof(RecordHeader) <= mapBytes)  {
+    const RecordHeader* h = (const RecordHeader*)(map + pos);
+    if (h->length == SEGMENT_END)
+      return false;
+    // End of records, or record torn by a power cut
+    if (h->length == 0 || pos + sizeof(RecordHeader) + h->length > mapBytes || h->seq != nextSeq
+        || h->crc != recordCrc(h->seq, h->receivedUs, h + 1, h->length))
+      break;
+    nextSeq = h->seq + 1;
+    pos += align8(sizeof(RecordHeader) + h->length);
+  }
+  if (pos + sizeof(RecordHeader) > mapBytes)
+    return false;
+  if (((const RecordHeader*)(map + pos))->length != 0)  {
+    logMsg(LOG_WARN, "queue segment %" PRIu64 ": torn record at %zu overwritten", index, pos);
+    memset(map + pos, 0, mapBytes - pos);
+    msync(map, mapBytes, MS_SYNC);
+  }
+  syncedPos = pos;
+  logMsg(LOG_INFO, "queue %s: segment %" PRIu64 ", next sequence %" PRIu64, dir.c_str(), index, nextSeq);
+  return true;
+}
+
+bool SegmentWriter::seal()  {
+
+  // The next segment exists before the reader sees the end of this one
+  if (!createSegment(index + 1))
+    return false;
+  RecordHeader* h = (RecordHeader*)(map + pos);
+  __atomic_store_n(&h->length, SEGMENT_END, __ATOMIC_RELEASE);
+  pos += sizeof(RecordHeader);
+  checkpoint();
+  return mapSegment(index + 1);
+}
+
+bool SegmentWriter::append(int64_t receivedUs, std::string_view line)  {
+
+  if (!map)
+    return false;
+  size_t need = align8(sizeof(RecordHeader) + line.size());
+  // Room for the sealing record
+  if (pos + need + sizeof(RecordHeader) > mapBytes)  {
+    if (SEGMENT_HEADER + need + sizeof(RecordHeader) > segmentBytes || !seal())
+      return false;
+  }
+
+  RecordHeader* h = (RecordHeader*)(map + pos);
+  h->seq = nextSeq;
+  h->receivedUs = receivedUs;
+  memcpy(h + 1, line.data(), line.size());
+  h->crc = recordCrc(nextSeq, receivedUs, line.data(), line.size());
+  // Published last
+  __atomic_store_n(&h->length, (uint32_t)line.size(), __ATOMIC_RELEASE);
+  pos += need;
+  nextSeq++;
+  return true;
+}
+
+void SegmentWriter::checkpoint()  {
+
+  if (!map || pos == syncedPos)
+    return;
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t start = syncedPos & ~(page - 1);
+  if (msync(map + start, pos - start, MS_SYNC) != 0)
+    logMsg(LOG_ERR, "queue segment %" PRIu64 ": %s", index, strerror(errno));
+  syncedPos = pos;
+}
+
+/*
+ ***************************
+ *     SEGMENT READER      *
+ ***************************
+ */
+void SegmentReader::open()  {
+
+  if (readCheckpoint(dir, current))
+    return;
+  std::vector<uint64_t> segments = listSegments(dir);
+  current.segment = segments.empty() ? 1 : segments.front();
+  current.offset = SEGMENT_HEADER;
+  current.seq = 0;
+}
+
+bool SegmentReader::mapSegment(uint64_t index)  {
+
+  unmapSegment();
+  int fd = ::open(segmentPath(dir, index).c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  void* m = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > SEGMENT_HEADER)
+    m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (m == MAP_FAILED)
+    return false;
+  map = (const uint8_t*)m;
+  mapBytes = st.st_size;
+  mappedIndex = index;
+  if (memcmp(map, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0)  {
+    unmapSegment();
+    return false;
+  }
+  return true;
+}
+
+void SegmentReader::unmapSegment()  {
+
+  if (map)
+    munmap((void*)map, mapBytes);
+  map = nullptr;
+}
+
+bool SegmentReader::nextSegment()  {
+
+  for (uint64_t index : listSegments(dir))  {
+    if (index > current.segment)  {
+      current.segment = index;
+      current.offset = SEGMENT_HEADER;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SegmentReader::next(QueueRecord& record)  {
+
+  for (;;)  {
+    if (!map || mappedIndex != current.segment)  {
+      if (!mapSegment(current.segment))  {
+        // Segment deleted (queue full) or not a segment
+        if (!nextSegment())
+          return false;
+        continue;
+      }
+      if (current.offset < SEGMENT_HEADER)
+        current.offset = SEGMENT_HEADER;
+    }
+
+    size_t offset = current.offset;
+    if (offset + sizeof(RecordHeader) > mapBytes)  {
+      if (!nextSegment())
+        return false;
+      continue;
+    }
+    const RecordHeader* h = (const RecordHeader*)(map + offset);
+    uint32_t length = __atomic_load_n(&h->length, __ATOMIC_ACQUIRE);
+    if (length == 0)
+      return false;
+    if (length == SEGMENT_END)  {
+      // Next segment created by the writer before sealing this one
+      if (!nextSegment())
+        return false;
+      continue;
+    }
+    if (offset + sizeof(RecordHeader) + length > mapBytes
+        || h->crc != recordCrc(h->seq, h->receivedUs, h + 1, length))  {
+      logMsg(LOG_ERR, "queue segment %" PRIu64 " corrupted at %zu, end of segment skipped", current.segment, offset);
+      if (!nextSegment())
+        return false;
+      continue;
+    }
+
+    record.seq = h->seq;
+    record.receivedUs = h->receivedUs;
+    record.line = std::string_view((const char*)(h + 1), length);
+    current.offset = offset + align8(sizeof(RecordHeader) + length);
+    current.seq = h->seq;
+    return true;
+  }
+}
+
+void SegmentReader::rewind(const QueuePosition& p)  {
+
+  current = p;
+}
+
+bool SegmentReader::commit(const QueuePosition& p)  {
+
+  if (!writeCheckpoint(dir, p))  {
+    logMsg(LOG_ERR, "queue %s: cannot write checkpoint", dir.c_str());
+    return false;
+  }
+  for (uint64_t index : listSegments(dir))
+    if (index < p.segment)
+      unlink(segmentPath(dir, index).c_str());
+  return true;
+}
+
+size_t SegmentReader::dropOldest(size_t maxSegments)  {
+
+  std::vector<uint64_t> segments = listSegments(dir);
+  // The segment of the writer is never deleted
+  if (maxSegments < 2)
+    maxSegments = 2;
+  if (segments.size() <= maxSegments)
+    return 0;
+  size_t nb = segments.size() - maxSegments;
+  for (size_t i = 0; i < nb; i++)
+    unlink(segmentPath(dir, segments[i]).c_str());
+  if (current.segment < segments[nb])  {
+    unmapSegment();
+    current.segment = segments[nb];
+    current.offset = SEGMENT_HEADER;
+  }
+  logMsg(LOG_WARN, "queue %s full, %zu oldest segments dropped", dir.c_str(), nb);
+  return nb;
+}
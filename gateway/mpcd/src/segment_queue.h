@@ -0,0 +1,180 @@
+/*
+ ****************************
+ *      SEGMENT QUEUE       *
+ ****************************
+ * @brief:
+ *    Durable append-only queue of satellite lines waiting for the upstream
+ *    server. Lines are appended by the ingest thread (SegmentWriter) and
+ *    read by the sync worker thread (SegmentReader) through mmap'd segment
+ *    files of a directory:
+ *      <dir>/0000000000000001.seg, 0000000000000002.seg, ...
+ *      <dir>/checkpoint          position of the last line shipped
+ *    Each line gets a sequence number, used upstream to resume and to
+ *    ignore lines already received.
+ * @note:
+ *    Segment: 64 bytes header ("MPCQSEG1", first sequence), then records
+ *    aligned on 8 bytes:
+ *      uint32 length   line length, 0 not written yet, SEGMENT_END sealed
+ *      uint32 crc      CRC-32 of seq, time and line
+ *      uint64 seq
+ *      int64  receivedUs
+ *      line bytes
+ *    The writer publishes the length last, the reader never sees a half
+ *    written record. A record torn by a power cut fails its CRC and is
+ *    overwritten when the writer reopens the queue.
+ */
+#ifndef MPCD_SEGMENT_QUEUE_H
+#define MPCD_SEGMENT_QUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Default size of a segment file
+#define SEGMENT_BYTES       (16 * 1024 * 1024)
+// Length of the record sealing a segment
+#define SEGMENT_END         0xFFFFFFFFu
+
+struct QueueRecord {
+  uint64_t seq;
+  int64_t receivedUs;
+  // Points into the segment mapping, valid until the reader changes segment
+  std::string_view line;
+};
+
+struct QueuePosition {
+  uint64_t segment = 0;
+  size_t offset = 0;
+  // Sequence of the last record before this position
+  uint64_t seq = 0;
+};
+
+// Segment indexes of a queue directory, sorted
+std::vector<uint64_t> listSegments(const std::string& dir);
+
+/*
+ ***************************
+ *     SEGMENT WRITER      *
+ ***************************
+ */
+class SegmentWriter {
+public:
+  SegmentWriter(std::string dir, size_t segmentBytes = SEGMENT_BYTES);
+  ~SegmentWriter();
+  SegmentWriter(const SegmentWriter&) = delete;
+  SegmentWriter& operator=(const SegmentWriter&) = delete;
+
+  /*
+   * @brief:
+   *    Opens the queue, creates it if needed, and recovers the position
+   *    after the last complete record.
+   * @return:
+   *    False if the directory cannot be used.
+   */
+  bool open();
+
+  /*
+   * @brief:
+   *    Appends a line (memory copy, written to disk by checkpoint()).
+   * @return:
+   *    False if line cannot be queued (too long, disk error).
+   */
+  bool append(int64_t receivedUs, std::string_view line);
+
+  /*
+   * @brief:
+   *    Writes the records appended since last call to disk (msync).
+   */
+  void checkpoint();
+
+  uint64_t lastSeq() const  { return nextSeq - 1; }
+  const std::string& directory() const  { return dir; }
+
+private:
+  std::string dir;
+  size_t segmentBytes;
+  uint64_t index = 0;
+  uint8_t* map = nullptr;
+  size_t mapBytes = 0;
+  // Write position, position already on disk
+  size_t pos = 0;
+  size_t syncedPos = 0;
+  uint64_t nextSeq = 1;
+
+  // Creates a segment file starting at nextSeq
+  bool createSegment(uint64_t newIndex);
+  bool mapSegment(uint64_t newIndex);
+  void unmapSegment();
+  // Scans the records of the current segment, false if it is sealed
+  bool recover();
+  // Closes the current segment and goes on with a new one
+  bool seal();
+};
+
+/*
+ ***************************
+ *     SEGMENT READER      *
+ ***************************
+ */
+class SegmentReader {
+public:
+  explicit SegmentReader(std::string dir) : dir(std::move(dir)) {}
+  ~SegmentReader()  { unmapSegment(); }
+  SegmentReader(const SegmentReader&) = delete;
+  SegmentReader& operator=(const SegmentReader&) = delete;
+
+  /*
+   * @brief:
+   *    Starts after the saved checkpoint, or at the oldest segment.
+   */
+  void open();
+
+  /*
+   * @brief:
+   *    Reads the next record.
+   * @return:
+   *    False if the writer has not appended more records yet.
+   */
+  bool next(QueueRecord& record);
+
+  QueuePosition position() const  { return current; }
+
+  /*
+   * @brief:
+   *    Goes back to a previous position (batch not shipped).
+   */
+  void rewind(const QueuePosition& p);
+
+  /*
+   * @brief:
+   *    Saves a position as checkpoint and deletes the segments before it.
+   * @return:
+   *    False if the checkpoint file cannot be written.
+   */
+  bool commit(const QueuePosition& p);
+
+  /*
+   * @brief:
+   *    Deletes the oldest segments above a maximum (uplink down for too
+   *    long), the reader moves to the oldest one left.
+   * @return:
+   *    Number of segments deleted.
+   */
+  size_t dropOldest(size_t maxSegments);
+
+private:
+  std::string dir;
+  QueuePosition current;
+  const uint8_t* map = nullptr;
+  size_t mapBytes = 0;
+  uint64_t mappedIndex = 0;
+
+  bool mapSegment(uint64_t index);
+  void unmapSegment();
+  // Moves to the first segment after index, false if none
+  bool nextSegment();
+};
+
+#endif
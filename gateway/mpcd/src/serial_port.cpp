@@ -0,0 +1,69 @@
+#include "serial_port.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "log.h"
+
+bool SerialPort::open()  {
+
+  close();
+  portFd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (portFd < 0)  {
+    logMsg(LOG_DBG, "%s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+
+  struct termios tio;
+  if (tcgetattr(portFd, &tio) == 0)  {
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, baud);
+    cfsetospeed(&tio, baud);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    tcsetattr(portFd, TCSANOW, &tio);
+  }
+  framer.reset();
+  logMsg(LOG_INFO, "%s opened", path.c_str());
+  return true;
+}
+
+void SerialPort::close()  {
+
+  if (portFd >= 0)  {
+    ::close(portFd);
+    logMsg(LOG_INFO, "%s closed", path.c_str());
+  }
+  portFd = -1;
+}
+
+ssize_t SerialPort::readChunk(char* buf, size_t len)  {
+
+  if (portFd < 0)
+    return -1;
+  ssize_t n = ::read(portFd, buf, len);
+  if (n > 0)
+    return n;
+  if (n < 0 && (errno == EAGAIN || errno == EINTR))
+    return 0;
+  // n == 0: hang-up
+  return -1;
+}
+
+bool SerialPort::write(const char* data, size_t len)  {
+
+  while (len > 0)  {
+    ssize_t n = ::write(portFd, data, len);
+    if (n < 0)  {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
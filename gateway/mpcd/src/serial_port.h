@@ -0,0 +1,69 @@
+/*
+ ****************************
+ *       SERIAL PORT        *
+ ****************************
+ * @brief:
+ *    Non-blocking raw tty (e.g. /dev/rfcommN bound by rfcomm), read by
+ *    chunks and split into lines.
+ */
+#ifndef MPCD_SERIAL_PORT_H
+#define MPCD_SERIAL_PORT_H
+
+#include <string>
+#include <termios.h>
+
+#include "line_framer.h"
+
+class SerialPort {
+public:
+  SerialPort(std::string path, speed_t baud = B115200) : path(std::move(path)), baud(baud) {}
+  ~SerialPort()  { close(); }
+  SerialPort(const SerialPort&) = delete;
+  SerialPort& operator=(const SerialPort&) = delete;
+
+  /*
+   * @brief:
+   *    Opens and configures the port (raw, 8N1, non-blocking).
+   * @return:
+   *    False if port cannot be opened.
+   */
+  bool open();
+  void close();
+
+  /*
+   * @brief:
+   *    Reads available bytes into the line framer.
+   * @params:
+   *    onLine: Called with each complete line.
+   * @return:
+   *    False if port was closed or lost (hang-up, rfcomm released).
+   */
+  template <typename F>
+  bool readLines(F onLine)  {
+    char buf[4096];
+    while (true)  {
+      ssize_t n = readChunk(buf, sizeof(buf));
+      if (n > 0)
+        framer.feed(buf, (size_t)n, onLine);
+      else
+        return n == 0;
+    }
+  }
+
+  // Writes bytes (orders to the satellite), returns false on error
+  bool write(const char* data, size_t len);
+
+  int fd() const  { return portFd; }
+  const std::string& name() const  { return path; }
+
+private:
+  std::string path;
+  speed_t baud;
+  int portFd = -1;
+  LineFramer framer;
+
+  // Returns bytes read, 0 if nothing available, -1 on error or hang-up
+  ssize_t readChunk(char* buf, size_t len);
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include "series_fill.h"
+
+#include <cmath>
+
+CellKind cellKind(std::string_view text)  {
+
+  if (text == "=")
+    return CELL_HOLD;
+  if (text == "~")
+    return CELL_INTERP;
+  return CELL_VALUE;
+}
+
+SeriesFill::Series& SeriesFill::find(std::string_view satId, size_t nbColumns)  {
+
+  if (cached && cachedId == satId)
+    return *cached;
+  cachedId = satId;
+  auto it = series.find(cachedId);
+  if (it == series.end())  {
+    it = series.emplace(cachedId, Series()).first;
+    it->second.last.assign(nbColumns, NAN);
+    it->second.lastTime.assign(nbColumns, 0);
+    it->second.open.assign(nbColumns, 0);
+  }
+  // Elements of an unordered_map do not move on insertion
+  cached = &it->second;
+  return *cached;
+}
+
+void SeriesFill::stage(ColumnBatch& out, int64_t time_us, std::string_view satId, const double* values,
+                       std::string_view raw, bool keepRaw)  {
+
+  out.time.push_back(time_us);
+  out.satId.emplace_back(satId);
+  for (size_t c = 0; c < out.columns.size(); c++)
+    out.columns[c].push_back(values[c]);
+  if (keepRaw)
+    out.raw.emplace_back(raw);
+}
+
+void SeriesFill::release(Series& s, ColumnBatch& out, bool keepRaw)  {
+
+  size_t kept = 0;
+  for (size_t i = 0; i < s.rows.size(); i++)  {
+    Row& row = s.rows[i];
+    if (row.unknown > 0)  {
+      if (kept != i)
+        s.rows[kept] = std::move(row);
+      kept++;
+      continue;
+    }
+    stage(out, row.time, row.satId, row.values.data(), row.raw, keepRaw);
+  }
+  s.rows.resize(kept);
+}
+
+void SeriesFill::add(ColumnBatch& out, int64_t time_us, std::string_view satId, const double* values,
+                     const CellKind* kinds, std::string_view raw, bool keepRaw)  {
+
+  size_t n = out.columns.size();
+  Series& s = find(satId, n);
+  rowValues.assign(values, values + n);
+  rowKinds.assign(kinds, kinds + n);
+  int unknown = 0;
+  bool resolved = false;
+  for (size_t c = 0; c < n; c++)  {
+    switch (kinds[c])  {
+      case CELL_VALUE:
+        // End of the interpolated run of the waiting rows
+        if (s.open[c] > 0)  {
+          double span = (double)(time_us - s.lastTime[c]);
+          for (Row& w : s.rows)  {
+            if (w.kinds[c] != CELL_INTERP)
+              continue;
+            double f = span > 0 ? (w.time - s.lastTime[c]) / span : 1;
+            w.values[c] = s.last[c] + (values[c] - s.last[c]) * f;
+            w.kinds[c] = CELL_VALUE;
+            w.unknown--;
+          }
+          s.open[c] = 0;
+          resolved = true;
+        }
+        s.last[c] = values[c];
+        s.lastTime[c] = time_us;
+        break;
+      case CELL_HOLD:
+        rowValues[c] = s.last[c];
+        rowKinds[c] = CELL_VALUE;
+        break;
+      case CELL_INTERP:
+        // No value to start from
+        if (std::isnan(s.last[c]))  {
+          rowValues[c] = NAN;
+          rowKinds[c] = CELL_VALUE;
+        }
+        else
+          unknown++;
+        break;
+    }
+  }
+  if (resolved)
+    release(s, out, keepRaw);
+
+  if (unknown == 0)  {
+    stage(out, time_us, satId, rowValues.data(), raw, keepRaw);
+    return;
+  }
+  for (size_t c = 0; c < n; c++)
+    if (rowKinds[c] == CELL_INTERP)
+      s.open[c]++;
+  s.rows.push_back({time_us, std::string(satId), rowValues, rowKinds, keepRaw ? std::string(raw) : std::string(), unknown});
+
+  // Satellite gone quiet within a run: oldest row without its unknown cells
+  if (s.rows.size() > FILL_MAX_WAITING)  {
+    Row& oldest = s.rows.front();
+    for (size_t c = 0; c < n; c++)
+      if (oldest.kinds[c] == CELL_INTERP)  {
+        oldest.values[c] = NAN;
+        oldest.kinds[c] = CELL_VALUE;
+        s.open[c]--;
+      }
+    oldest.unknown = 0;
+    release(s, out, keepRaw);
+  }
+}
+
+size_t SeriesFill::flush(ColumnBatch& out, bool keepRaw)  {
+
+  size_t n = 0;
+  for (auto& entry : series)  {
+    Series& s = entry.second;
+    for (Row& row : s.rows)  {
+      for (size_t c = 0; c < row.values.size(); c++)
+        if (row.kinds[c] == CELL_INTERP)
+          row.values[c] = NAN;
+      stage(out, row.time, row.satId, row.values.data(), row.raw, keepRaw);
+      n++;
+    }
+    s.rows.clear();
+    s.open.assign(s.open.size(), 0);
+  }
+  return n;
+}
+
+size_t SeriesFill::waiting() const  {
+
+  size_t n = 0;
+  for (const auto& entry : series)
+    n += entry.second.rows.size();
+  return n;
+}
+
+void SeriesFill::restore(const State& saved)  {
+
+  series = saved;
+  cached = nullptr;
+}
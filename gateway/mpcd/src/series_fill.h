@@ -0,0 +1,102 @@
+/*
+ ****************************
+ *        SERIES FILL       *
+ ****************************
+ * @brief:
+ *    Rebuilds the channels that satellites send on change
+ *    (Change_filter.h): a member or CSV cell "=" holds the previous value
+ *    of its column, "~" is interpolated in time between the values sent
+ *    before and after it. Rows with interpolated cells wait, per
+ *    satellite, for the next value of their columns (at most the satellite
+ *    heartbeat later), the other rows are staged at once.
+ * @note:
+ *    Lines must come in the satellite order: live link, upstream queue or
+ *    SD card file. A marker without previous value (mpcd started within a
+ *    series) is NULL, as the cells still waiting when flush() ends a file
+ *    or the daemon. A line lost on the link spreads the interpolation over
+ *    the gap.
+ */
+#ifndef MPCD_SERIES_FILL_H
+#define MPCD_SERIES_FILL_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "schema.h"
+
+// Rows waiting per satellite before the oldest is staged as is
+#define FILL_MAX_WAITING  4096
+
+enum CellKind : uint8_t { CELL_VALUE, CELL_HOLD, CELL_INTERP };
+
+// Kind of a text cell ("=", "~" or a value)
+CellKind cellKind(std::string_view text);
+
+class SeriesFill {
+  struct Series;
+
+public:
+  // Satellite series, saved before lines that may be added again
+  typedef std::unordered_map<std::string, Series> State;
+
+  /*
+   * @brief:
+   *    Adds a row, stages it once its cells are known.
+   * @params:
+   *    out: Staging of the row type.
+   *    values: One per column (unused for markers).
+   *    kinds: One per column.
+   *    raw: Line kept in out.raw if keepRaw.
+   */
+  void add(ColumnBatch& out, int64_t time_us, std::string_view satId, const double* values,
+           const CellKind* kinds, std::string_view raw, bool keepRaw);
+
+  /*
+   * @brief:
+   *    Stages the waiting rows, cells not known are NaN.
+   * @return:
+   *    Rows staged.
+   */
+  size_t flush(ColumnBatch& out, bool keepRaw);
+
+  size_t waiting() const;
+  State state() const  { return series; }
+  void restore(const State& saved);
+
+private:
+  struct Row {
+    int64_t time;
+    std::string satId;
+    std::vector<double> values;
+    std::vector<CellKind> kinds;
+    std::string raw;
+    // Interpolated cells not known yet
+    int unknown;
+  };
+  struct Series {
+    // Last value sent in each column and its time
+    std::vector<double> last;
+    std::vector<int64_t> lastTime;
+    // Waiting rows interpolating each column
+    std::vector<int> open;
+    std::vector<Row> rows;
+  };
+  State series;
+  // Series of the previous row (satellites send bursts of lines)
+  Series* cached = nullptr;
+  std::string cachedId;
+  // Row being added
+  std::vector<double> rowValues;
+  std::vector<CellKind> rowKinds;
+
+  Series& find(std::string_view satId, size_t nbColumns);
+  static void stage(ColumnBatch& out, int64_t time_us, std::string_view satId, const double* values,
+                    std::string_view raw, bool keepRaw);
+  // Stages the rows whose cells are all known, in order
+  static void release(Series& s, ColumnBatch& out, bool keepRaw);
+};
+
+#endif
@@ -0,0 +1,226 @@
+#include "sync_worker.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <unordered_set>
+#include <vector>
+
+#include "calibration.h"
+#include "log.h"
+#include "pg_copy.h"
+#include "sample_batch.h"
+#include "segment_queue.h"
+#include "time_util.h"
+
+static const char* SYNC_STATE_QUERY = "SELECT last_seq FROM cyclopee.sync_state WHERE gateway_id = $1";
+static const char* SYNC_STATE_UPDATE =
+  "INSERT INTO cyclopee.sync_state (gateway_id, last_seq, synced_at) VALUES ($1, $2, now()) "
+  "ON CONFLICT (gateway_id) DO UPDATE SET last_seq = greatest(sync_state.last_seq, EXCLUDED.last_seq), "
+  "synced_at = EXCLUDED.synced_at";
+
+namespace {
+
+// Temporary table receiving the rows of a table (cyclopee.water_sample -> sync_water_sample)
+std::string tempTable(const char* table)  {
+
+  const char* dot = strchr(table, '.');
+  return std::string("sync_") + (dot ? dot + 1 : table);
+}
+
+// FNV-1a hash of a line
+uint64_t lineHash(std::string_view line)  {
+
+  uint64_t h = 14695981039346656037ULL;
+  for (char c : line)  {
+    h ^= (uint8_t)c;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+}
+
+void SyncWorker::start()  {
+
+  stopping = false;
+  thread = std::thread(&SyncWorker::run, this);
+}
+
+void SyncWorker::stop()  {
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  if (thread.joinable())
+    thread.join();
+}
+
+bool SyncWorker::wait(int ms)  {
+
+  std::unique_lock<std::mutex> lock(mutex);
+  wake.wait_for(lock, std::chrono::milliseconds(ms), [this]()  { return stopping.load(); });
+  return !stopping;
+}
+
+SyncStats SyncWorker::stats() const  {
+
+  SyncStats s;
+  s.lines = lines;
+  s.duplicates = duplicates;
+  s.rows = rows;
+  s.batches = batches;
+  s.bytes = bytes;
+  s.failures = failures;
+  s.droppedSegments = droppedSegments;
+  s.rejectedLines = rejectedLines;
+  s.lastSeq = lastSeq;
+  return s;
+}
+
+void SyncWorker::run()  {
+
+  SegmentReader reader(config.queueDir);
+  PgConnection remote(config.conninfo);
+  SampleBatches samples(config.keepRaw);
+  CalibrationRegistry calibrations;
+  std::unordered_set<uint64_t> seen;
+
+  // Statements of each batch: COPY into its temporary table, then move
+  // the new rows into the remote table
+  std::vector<std::string> createSql, copySql, insertSql;
+  for (SampleBatch& batch : samples.all())  {
+    std::string temp = tempTable(batch.table());
+    createSql.push_back("CREATE TEMP TABLE IF NOT EXISTS " + temp + " (LIKE " + batch.table() + " INCLUDING DEFAULTS)");
+    copySql.push_back(batch.copySql(temp.c_str()));
+    insertSql.push_back(std::string("INSERT INTO ") + batch.table() + " SELECT * FROM " + temp
+                        + " ON CONFLICT DO NOTHING; TRUNCATE " + temp);
+  }
+
+  reader.open();
+  remote.listen(CALIBRATION_CHANNEL);
+  // Connection whose temporary tables are created
+  uint64_t session = 0;
+  // Last sequence received by the server
+  uint64_t remoteSeq = 0;
+  int retry = config.retryMs;
+  // Lines per batch: halved while the server refuses the rows of a batch,
+  // doubled back after each batch shipped
+  size_t batchLines = config.batchLines;
+
+  for (;;)  {
+    droppedSegments += reader.dropOldest(config.maxSegments);
+
+    // (Re)connection: temporary tables, resume point and calibrations
+    if (session != remote.connections() || !remote.connected())  {
+      bool ok = remote.ensureConnected();
+      for (size_t i = 0; ok && i < createSql.size(); i++)
+        ok = remote.exec(createSql[i]);
+      std::string value;
+      ok = ok && remote.exec(SYNC_STATE_QUERY, {config.gatewayId}, &value) && calibrations.load(remote);
+      if (!ok)  {
+        failures++;
+        if (!wait(retry))
+          break;
+        retry = std::min(retry * 2, config.retryMaxMs);
+        continue;
+      }
+      session = remote.connections();
+      remoteSeq = strtoull(value.c_str(), nullptr, 10);
+      logMsg(LOG_INFO, "upstream connected, last sequence %" PRIu64, remoteSeq);
+    }
+    else if (remote.notified(CALIBRATION_CHANNEL))  {
+      calibrations.load(remote);
+    }
+
+    // Batch of lines, series of the satellites kept to add them again
+    QueuePosition start = reader.position();
+    std::vector<SeriesFill::State> series = samples.saveSeries();
+    QueueRecord record;
+    size_t nbLines = 0;
+    seen.clear();
+    while (nbLines < batchLines && reader.next(record))  {
+      nbLines++;
+      // Already received (checkpoint lost) or repeated by the satellite
+      if (record.seq <= remoteSeq || !seen.insert(lineHash(record.line)).second)  {
+        duplicates++;
+        continue;
+      }
+      samples.add(record.line, record.receivedUs);
+    }
+    if (nbLines == 0)  {
+      if (!wait(config.idleMs))
+        break;
+      continue;
+    }
+    QueuePosition end = reader.position();
+
+    // One transaction: rows and resume point
+    int64_t startMs = monotonicMs();
+    size_t nbRows = 0, nbBytes = 0;
+    std::vector<SampleBatch>& all = samples.all();
+    bool ok = remote.exec("BEGIN");
+    for (size_t i = 0; ok && i < all.size(); i++)  {
+      if (all[i].rows() == 0)
+        continue;
+      samples.encode(all[i], calibrations);
+      nbRows += all[i].buffer.rows();
+      nbBytes += all[i].buffer.size();
+      ok = remote.copy(copySql[i], all[i].buffer) && remote.exec(insertSql[i]);
+    }
+    ok = ok && remote.exec(SYNC_STATE_UPDATE, {config.gatewayId, std::to_string(end.seq)}) && remote.exec("COMMIT");
+    for (SampleBatch& batch : all)
+      batch.clear();
+
+    if (!ok)  {
+      // Rows refused (out of range value, constraint): sending them again
+      // fails again, the batch is split until the line is alone and skipped
+      bool refused = remote.dataError();
+      if (remote.connected())
+        remote.exec("ROLLBACK");
+      if (refused && nbLines == 1)  {
+        reader.commit(end);
+        rejectedLines++;
+        logMsg(LOG_ERR, "upstream line %" PRIu64 " refused (SQLSTATE %s), skipped", end.seq, remote.lastSqlState().c_str());
+        batchLines = std::min(batchLines * 2, config.batchLines);
+        continue;
+      }
+      reader.rewind(start);
+      samples.restoreSeries(series);
+      if (refused)  {
+        batchLines = (nbLines + 1) / 2;
+        logMsg(LOG_WARN, "upstream batch refused (SQLSTATE %s), retry by %zu lines", remote.lastSqlState().c_str(), batchLines);
+        continue;
+      }
+      failures++;
+      logMsg(LOG_WARN, "upstream batch failed, retry in %d s", retry / 1000);
+      if (!wait(retry))
+        break;
+      retry = std::min(retry * 2, config.retryMaxMs);
+      continue;
+    }
+
+    retry = config.retryMs;
+    batchLines = std::min(batchLines * 2, config.batchLines);
+    remoteSeq = std::max(remoteSeq, end.seq);
+    reader.commit(end);
+    lines += nbLines;
+    rows += nbRows;
+    bytes += nbBytes;
+    batches++;
+    lastSeq = end.seq;
+    logMsg(LOG_DBG, "upstream: %zu lines, %zu rows, %zu bytes", nbLines, nbRows, nbBytes);
+
+    // Upload rate limit: a batch of n bytes takes at least n / rate
+    if (config.maxBytesPerSecond)  {
+      int64_t minMs = (int64_t)(nbBytes * 1000 / config.maxBytesPerSecond);
+      int64_t elapsed = monotonicMs() - startMs;
+      if (elapsed < minMs && !wait((int)(minMs - elapsed)))
+        break;
+    }
+    if (stopping)
+      break;
+  }
+}
@@ -0,0 +1,100 @@
+/*
+ ****************************
+ *       SYNC WORKER        *
+ ****************************
+ * @brief:
+ *    Ships the queued satellite lines (segment_queue.h) to the remote
+ *    PostgreSQL server, on its own thread: local ingest never waits for
+ *    the uplink (WiFi or 4G).
+ *    Lines are read by batches, duplicates removed, turned into rows of
+ *    the typed tables (sample_batch.h) and sent in one transaction:
+ *      COPY into temporary tables, INSERT ... ON CONFLICT DO NOTHING into
+ *      the remote tables, then cyclopee.sync_state.last_seq of the gateway.
+ *    The local checkpoint is saved after the commit. After a failure or a
+ *    restart, shipping resumes from the checkpoint, lines whose sequence
+ *    is not above last_seq are skipped (see gateway/sql/sync_remote.sql).
+ *    A link or server failure is retried with a growing delay. Rows
+ *    refused by the server (SQLSTATE class 22 or 23) are not: the batch
+ *    is halved until the refused line is alone, which is then skipped and
+ *    counted (rejectedLines).
+ * @note:
+ *    Binary COPY rows are several times smaller than the JSON lines.
+ *    libpq has no transport compression: on a metered link, a compressed
+ *    tunnel (ssh -C) can carry the connection (mpcd/README.md).
+ */
+#ifndef MPCD_SYNC_WORKER_H
+#define MPCD_SYNC_WORKER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct SyncConfig {
+  // Remote server
+  std::string conninfo;
+  // Gateway name in cyclopee.sync_state
+  std::string gatewayId;
+  // Queue directory
+  std::string queueDir;
+  // Lines per transaction
+  size_t batchLines = 5000;
+  // Upload rate limit in bytes per second, 0 for none
+  uint64_t maxBytesPerSecond = 0;
+  // Oldest segments dropped above this number (uplink down too long)
+  size_t maxSegments = 64;
+  // Delay before retrying, doubled up to retryMaxMs while failing
+  int retryMs = 5000;
+  int retryMaxMs = 300000;
+  // Delay between two reads of an empty queue
+  int idleMs = 1000;
+  // Keep the raw line in the jsonb audit column of typed tables
+  bool keepRaw = false;
+};
+
+struct SyncStats {
+  uint64_t lines = 0;
+  uint64_t duplicates = 0;
+  uint64_t rows = 0;
+  uint64_t batches = 0;
+  uint64_t bytes = 0;
+  uint64_t failures = 0;
+  uint64_t droppedSegments = 0;
+  // Lines whose rows the server refused (data error), skipped
+  uint64_t rejectedLines = 0;
+  // Sequence of the last line shipped
+  uint64_t lastSeq = 0;
+};
+
+class SyncWorker {
+public:
+  explicit SyncWorker(const SyncConfig& config) : config(config) {}
+  ~SyncWorker()  { stop(); }
+  SyncWorker(const SyncWorker&) = delete;
+  SyncWorker& operator=(const SyncWorker&) = delete;
+
+  void start();
+
+  // Stops the thread (a transaction in progress is rolled back by the server)
+  void stop();
+
+  // Counters, may be read from another thread
+  SyncStats stats() const;
+
+private:
+  SyncConfig config;
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::atomic<bool> stopping{false};
+
+  std::atomic<uint64_t> lines{0}, duplicates{0}, rows{0}, batches{0}, bytes{0}, failures{0}, droppedSegments{0}, rejectedLines{0}, lastSeq{0};
+
+  void run();
+  // Waits a delay, false if stopping
+  bool wait(int ms);
+};
+
+#endif
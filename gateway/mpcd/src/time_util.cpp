@@ -0,0 +1,76 @@
+#include "time_util.h"
+
+#include <ctime>
+
+int64_t daysFromCivil(int64_t y, unsigned m, unsigned d)  {
+
+  y -= m <= 2;
+  const int64_t era = (y >= 0 ? y : y - 399) / 400;
+  const unsigned yoe = (unsigned)(y - era * 400);
+  const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int64_t)doe - 719468;
+}
+
+bool parseSatTime(std::string_view text, int64_t& unix_us)  {
+
+  // Y, M, D, h, m, s
+  int64_t field[6] = {0};
+  size_t pos = 0;
+  const char separator[6] = {'/', '/', ' ', ':', ':', '\0'};
+
+  for (int i = 0; i < 6; i++)  {
+    size_t start = pos;
+    while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9' && pos - start < 4)
+      field[i] = field[i] * 10 + (text[pos++] - '0');
+    if (pos == start)
+      return false;
+    if (i < 5)  {
+      if (pos >= text.size())
+        return false;
+      char c = text[pos];
+      if (c != separator[i] && !(i < 2 && c == '-') && !(i == 2 && c == 'T'))
+        return false;
+      pos++;
+    }
+  }
+
+  // Fraction of second
+  int64_t frac_us = 0;
+  if (pos < text.size() && text[pos] == '.')  {
+    int64_t scale = 100000;
+    pos++;
+    size_t start = pos;
+    while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9')  {
+      frac_us += (text[pos++] - '0') * scale;
+      scale /= 10;
+    }
+    if (pos == start)
+      return false;
+  }
+  if (pos != text.size())
+    return false;
+
+  if (field[0] < 2000 || field[1] < 1 || field[1] > 12 || field[2] < 1 || field[2] > 31 ||
+      field[3] > 23 || field[4] > 59 || field[5] > 60)
+    return false;
+
+  int64_t days = daysFromCivil(field[0], field[1], field[2]);
+  int64_t sec = days * 86400 + field[3] * 3600 + field[4] * 60 + field[5];
+  unix_us = sec * 1000000 + frac_us;
+  return true;
+}
+
+int64_t nowUnixUs()  {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int64_t monotonicMs()  {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
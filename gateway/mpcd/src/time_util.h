@@ -0,0 +1,54 @@
+/*
+ ****************************
+ *      TIME UTILITIES      *
+ ****************************
+ * @brief:
+ *    Satellite time strings and PostgreSQL timestamps.
+ *    Times are kept as microseconds since the Unix epoch (UTC).
+ */
+#ifndef MPCD_TIME_UTIL_H
+#define MPCD_TIME_UTIL_H
+
+#include <cstdint>
+#include <string_view>
+
+// Seconds between 1970-01-01 and 2000-01-01 (PostgreSQL epoch)
+#define PG_EPOCH_OFFSET_S  946684800LL
+
+/*
+ * @brief:
+ *    Parses a satellite time "YYYY/MM/DD hh:mm:ss[.frac]" (UTC).
+ *    Fields may be unpadded (AIR_SAT), '-' is accepted as date separator.
+ * @params:
+ *    text: Time string.
+ *    unix_us: Parsed time.
+ * @return:
+ *    False if text is not a valid time.
+ */
+bool parseSatTime(std::string_view text, int64_t& unix_us);
+
+/*
+ * @brief:
+ *    Returns the current time.
+ */
+int64_t nowUnixUs();
+
+/*
+ * @brief:
+ *    Returns the current monotonic time in milliseconds.
+ */
+int64_t monotonicMs();
+
+/*
+ * @brief:
+ *    Converts a Unix time to a PostgreSQL binary timestamp.
+ */
+inline int64_t unixToPgUs(int64_t unix_us)  { return unix_us - PG_EPOCH_OFFSET_S * 1000000LL; }
+
+/*
+ * @brief:
+ *    Returns days since 1970-01-01 of a civil date (proleptic Gregorian).
+ */
+int64_t daysFromCivil(int64_t y, unsigned m, unsigned d);
+
+#endif
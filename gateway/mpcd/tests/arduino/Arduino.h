@@ -0,0 +1,116 @@
+/*
+ ****************************
+ *   ARDUINO HOST STAND-IN  *
+ ****************************
+ * @brief:
+ *    Subset of the Arduino core used by the unit test sketches of the
+ *    satellite (cyclopee_sat/unit_tests), to run them on host with make
+ *    check: String (concatenation, fixed decimals, comparison), Serial
+ *    printing to stdout, micros() and millis() from the steady clock or a
+ *    simulated time, random(), pins without effect.
+ * @note:
+ *    Sketches are compiled as C++ with this header forced in (the IDE adds
+ *    it), tests/sketch_main.cpp calls setup() once.
+ */
+#ifndef MPCD_TESTS_ARDUINO_H
+#define MPCD_TESTS_ARDUINO_H
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using std::isnan;
+
+// Simulated time set by a test, the steady clock if negative
+inline int64_t hostTime_us = -1;
+
+inline uint32_t micros()  {
+  if (hostTime_us >= 0)
+    return (uint32_t)hostTime_us;
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+inline uint32_t millis()  { return hostTime_us >= 0 ? (uint32_t)(hostTime_us / 1000) : micros() / 1000; }
+inline void delay(uint32_t ms)  {}
+inline void noInterrupts()  {}
+inline void interrupts()  {}
+
+inline void randomSeed(unsigned long seed)  { srand((unsigned)seed); }
+inline long random(long max)  { return max > 0 ? rand() % max : 0; }
+inline long random(long min, long max)  { return min < max ? min + random(max - min) : min; }
+
+#define LOW             0
+#define HIGH            1
+#define INPUT           0
+#define OUTPUT          1
+#define INPUT_PULLUP    2
+#define INPUT_PULLDOWN  3
+#define CHANGE          1
+inline void pinMode(uint8_t pin, uint8_t mode)  {}
+inline void digitalWrite(uint8_t pin, uint8_t level)  {}
+inline int digitalRead(uint8_t pin)  { return LOW; }
+inline int digitalPinToInterrupt(uint8_t pin)  { return pin; }
+inline void attachInterrupt(int irq, void (*isr)(), int mode)  {}
+
+class String {
+public:
+  String(const char* text = "") : s(text) {}
+  String(char c) : s(1, c) {}
+  String(int value) : s(std::to_string(value)) {}
+  String(unsigned value) : s(std::to_string(value)) {}
+  String(long value) : s(std::to_string(value)) {}
+  String(unsigned long value) : s(std::to_string(value)) {}
+  String(double value, int decimals = 2)  {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+    s = buf;
+  }
+
+  String& operator+=(const String& o)  { s += o.s; return *this; }
+  String& operator+=(const char* o)  { s += o; return *this; }
+  String& operator+=(char c)  { s += c; return *this; }
+  friend String operator+(String a, const String& b)  { return a += b; }
+  bool operator==(const String& o) const  { return s == o.s; }
+  bool operator==(const char* o) const  { return s == o; }
+  bool operator!=(const String& o) const  { return s != o.s; }
+
+  const char* c_str() const  { return s.c_str(); }
+  unsigned length() const  { return (unsigned)s.size(); }
+
+private:
+  std::string s;
+};
+
+class HostSerial {
+public:
+  void begin(unsigned long baud)  {}
+  explicit operator bool() const  { return true; }
+
+  void print(const char* text)  { fputs(text, stdout); }
+  void print(const String& text)  { print(text.c_str()); }
+  void print(char c)  { putchar(c); }
+  void print(long value)  { printf("%ld", value); }
+  void print(unsigned long value)  { printf("%lu", value); }
+  void print(int value)  { print((long)value); }
+  void print(unsigned value)  { print((unsigned long)value); }
+  void print(double value, int decimals = 2)  { printf("%.*f", decimals, value); }
+
+  template <class T>
+  void println(const T& value)  {
+    print(value);
+    putchar('\n');
+  }
+  void println(double value, int decimals)  {
+    print(value, decimals);
+    putchar('\n');
+  }
+  void println()  { putchar('\n'); }
+};
+
+inline HostSerial Serial;
+
+#endif
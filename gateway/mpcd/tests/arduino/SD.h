@@ -0,0 +1,172 @@
+/*
+ ****************************
+ *     SD HOST STAND-IN     *
+ ****************************
+ * @brief:
+ *    In-memory SD card for the host tests of the satellite logging
+ *    modules (Log_segment.h), with the FAT32 behaviour of SdFat that a
+ *    power loss exposes:
+ *      - A file has its data (sectors written or preallocated) and two
+ *        sizes: the size seen by the open files and the size written in
+ *        the directory, only by flush(), close() and truncate().
+ *      - preAllocate() reserves sectors holding stale data (setStaleData())
+ *        without changing any size.
+ *      - powerLoss() brings every file back to its directory size: reads
+ *        and seeks stop there, as after a reboot.
+ */
+#ifndef MPCD_TESTS_SD_H
+#define MPCD_TESTS_SD_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <set>
+#include <memory>
+#include <string>
+
+#define FILE_READ         0
+#define FILE_WRITE        1
+#define FILE_WRITE_BEGIN  2
+#define O_RDWR            0x02
+#define O_CREAT           0x40
+
+struct SdEntry {
+  std::string data;
+  uint64_t size = 0;
+  uint64_t dirSize = 0;
+};
+
+class File {
+public:
+  File() {}
+  File(std::shared_ptr<SdEntry> entry, uint64_t pos) : e(std::move(entry)), pos(pos) {}
+
+  explicit operator bool() const  { return (bool)e; }
+
+  size_t write(const void* buf, size_t n)  {
+    if (!e)
+      return 0;
+    if (e->data.size() < pos + n)
+      e->data.resize(pos + n);
+    memcpy(&e->data[pos], buf, n);
+    pos += n;
+    e->size = std::max(e->size, pos);
+    return n;
+  }
+  size_t println()  { return write("\r\n", 2); }
+  size_t println(const char* text)  { return write(text, strlen(text)) + println(); }
+
+  int read(void* buf, size_t n)  {
+    if (!e || pos >= e->size)
+      return 0;
+    n = std::min<uint64_t>(n, e->size - pos);
+    memcpy(buf, e->data.data() + pos, n);
+    pos += n;
+    return (int)n;
+  }
+
+  bool seek(uint64_t p)  {
+    if (!e || p > e->size)
+      return false;
+    pos = p;
+    return true;
+  }
+
+  // Shrinks only, clusters after the end are freed, directory written
+  bool truncate(uint64_t length)  {
+    if (!e || length > e->size)
+      return false;
+    e->size = length;
+    e->data.resize(length);
+    e->dirSize = length;
+    return true;
+  }
+
+  void flush()  {
+    if (e)
+      e->dirSize = e->size;
+  }
+  void close()  {
+    flush();
+    e.reset();
+  }
+  uint64_t size() const  { return e ? e->size : 0; }
+
+private:
+  std::shared_ptr<SdEntry> e;
+  uint64_t pos = 0;
+};
+
+// Stale content of the free sectors (blocks of an older segment)
+inline std::string sdStaleData;
+
+class FsFile {
+public:
+  FsFile() {}
+  explicit FsFile(std::shared_ptr<SdEntry> entry) : e(std::move(entry)) {}
+
+  explicit operator bool() const  { return (bool)e; }
+
+  // Contiguous sectors, file size unchanged (FAT32)
+  bool preAllocate(uint64_t length)  {
+    if (!e || e->size != 0)
+      return false;
+    e->data = sdStaleData;
+    e->data.resize(length);
+    return true;
+  }
+  void close()  { e.reset(); }
+
+private:
+  std::shared_ptr<SdEntry> e;
+};
+
+class SdClass {
+public:
+  class Fs {
+  public:
+    explicit Fs(SdClass& sd) : sd(sd) {}
+    FsFile open(const char* path, int flags)  { return FsFile(sd.entry(path, (flags & O_CREAT) != 0)); }
+  private:
+    SdClass& sd;
+  } sdfs{*this};
+
+  File open(const char* path, int mode = FILE_READ)  {
+    std::shared_ptr<SdEntry> e = entry(path, mode != FILE_READ);
+    if (!e)
+      return File();
+    return File(e, mode == FILE_WRITE ? e->size : 0);
+  }
+  bool exists(const char* path)  { return files.count(path) || dirs.count(path); }
+  bool mkdir(const char* path)  { return dirs.insert(path).second; }
+  bool remove(const char* path)  { return files.erase(path) > 0; }
+  bool mediaPresent()  { return true; }
+
+  // Files as after a reboot: sizes read from the directory
+  void powerLoss()  {
+    for (auto& f : files)  {
+      std::shared_ptr<SdEntry> e = std::make_shared<SdEntry>(*f.second);
+      e->size = e->dirSize;
+      f.second = e;
+    }
+  }
+
+  std::map<std::string, std::shared_ptr<SdEntry>> files;
+
+private:
+  std::set<std::string> dirs;
+
+  std::shared_ptr<SdEntry> entry(const char* path, bool create)  {
+    auto it = files.find(path);
+    if (it != files.end())
+      return it->second;
+    if (!create)
+      return nullptr;
+    return files[path] = std::make_shared<SdEntry>();
+  }
+};
+
+inline SdClass SD;
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ ****************************
+ *     DOWNSAMPLE TEST      *
+ ****************************
+ * @brief:
+ *    Host test of the series reduction of the query server
+ *    (downsample.h), run by make check:
+ *      - A week at 1 Hz with a spike and a 17 h gap, reduced to 1000
+ *        points: first and last points kept, time order, spike kept, no
+ *        point in the gap, at most the points wanted.
+ *      - Series of 1 and 2 points, another series after finish().
+ *      - A straight track with a detour keeps the detour.
+ * @usage:
+ *    downsample_test
+ */
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "downsample.h"
+
+// One week at 1 Hz, gap between GAP_START and GAP_END (s)
+#define SERIES_S     (7 * 86400)
+#define SPIKE_S      123456
+#define GAP_START    200000
+#define GAP_END      260000
+#define POINTS       1000
+
+static int errors = 0;
+
+static void check(bool ok, const std::string& what)  {
+
+  if (!ok)  {
+    printf("Failed : %s\n", what.c_str());
+    errors++;
+  }
+}
+
+static void week(DownsampleMethod method, const char* name)  {
+
+  std::vector<SeriesPoint> out;
+  Downsampler ds(method, 0, SERIES_S * 1000000LL, POINTS, [&](const SeriesPoint& p)  { out.push_back(p); });
+  for (int64_t s = 0; s < SERIES_S; s++)  {
+    if (s > GAP_START && s < GAP_END)
+      continue;
+    ds.add({s * 1000000, (double)s, sin(s / 3000.0) + (s == SPIKE_S ? 50 : 0)});
+  }
+  ds.finish();
+
+  bool sorted = true, spike = false, gap = true;
+  for (size_t i = 0; i < out.size(); i++)  {
+    int64_t s = out[i].time_us / 1000000;
+    sorted = sorted && (i == 0 || out[i].time_us > out[i - 1].time_us);
+    spike = spike || s == SPIKE_S;
+    gap = gap && !(s > GAP_START && s < GAP_END);
+  }
+  std::string n = name;
+  check(!out.empty() && out.front().time_us == 0 && out.back().time_us == (SERIES_S - 1) * 1000000LL, n + ": first and last points");
+  check(sorted, n + ": time order");
+  check(spike, n + ": spike kept");
+  check(gap, n + ": gap stays a gap");
+  check(method == DS_NONE ? out.size() == ds.added() : out.size() <= POINTS, n + ": points emitted");
+  check(ds.emitted() == out.size(), n + ": emitted count");
+  printf("%s :\t%llu points, %zu emitted\n", name, (unsigned long long)ds.added(), out.size());
+}
+
+int main()  {
+
+  DownsampleMethod method;
+  check(parseDownsampleMethod("lttb", method) && method == DS_LTTB, "lttb method");
+  check(parseDownsampleMethod("minmax", method) && method == DS_MINMAX, "minmax method");
+  check(!parseDownsampleMethod("avg", method), "unknown method");
+
+  week(DS_LTTB, "lttb");
+  week(DS_MINMAX, "minmax");
+  week(DS_NONE, "none");
+
+  // Short series, the downsampler is reused after finish()
+  std::vector<SeriesPoint> out;
+  Downsampler ds(DS_LTTB, 0, 100, 10, [&](const SeriesPoint& p)  { out.push_back(p); });
+  ds.add({5, 5, 1});
+  ds.finish();
+  check(out.size() == 1, "series of 1 point");
+  out.clear();
+  ds.add({5, 5, 1});
+  ds.add({6, 6, 1});
+  ds.finish();
+  check(out.size() == 2, "series of 2 points");
+  out.clear();
+  for (int i = 0; i < 100; i++)
+    ds.add({i, (double)i, (double)(i % 7)});
+  ds.finish();
+  check(out.size() == 10, "100 points in 10 buckets");
+
+  // Track (lon, lat): the detour of a straight line is kept
+  out.clear();
+  Downsampler track(DS_LTTB, 0, 1000, 5, [&](const SeriesPoint& p)  { out.push_back(p); });
+  for (int i = 0; i < 1000; i++)
+    track.add({i, i * 1e-5, i == 500 ? 1e-3 : 0});
+  track.finish();
+  bool detour = false;
+  for (const SeriesPoint& p : out)
+    detour = detour || p.time_us == 500;
+  check(out.size() == 5 && detour, "track detour kept");
+
+  printf("Errors :\t%d\n%s\n", errors, errors == 0 ? "TEST PASSED" : "TEST FAILED");
+  return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,70 @@
+/*
+ ****************************
+ *     JSON SAX TEST        *
+ ****************************
+ * @brief:
+ *    Host test of the satellite line parser (json_sax.h), run by make
+ *    check: lines refused by PostgreSQL (jsonb or binary COPY of text)
+ *    must be refused here, so a bad line never fails a whole batch.
+ * @usage:
+ *    json_sax_test
+ */
+#include <cstdio>
+#include <string>
+
+#include "json_sax.h"
+
+static int errors = 0;
+
+static void check(bool ok, const std::string& what)  {
+
+  if (!ok)  {
+    printf("Failed : %s\n", what.c_str());
+    errors++;
+  }
+}
+
+static void expect(const std::string& line, bool valid)  {
+
+  JsonHandler handler;
+  check(parseJson(line, handler) == valid, (valid ? "accepted: " : "refused: ") + line);
+}
+
+int main()  {
+
+  // Structure
+  expect("{\"sat\":\"cyclopee1\",\"time\":null,\"urm\":[1.5,-2e3,0],\"ok\":true}", true);
+  expect("{\"sat\":\"cyclopee1\",}", false);
+  expect("{\"a\":01}", false);
+  expect("{\"a\":\"\t\"}", false);
+
+  // Escapes
+  expect("{\"a\":\"\\\"\\\\\\/\\b\\f\\n\\r\\t\\u00e9\\u20AC\"}", true);
+  expect("{\"a\":\"\\x\"}", false);
+  expect("{\"a\":\"\\u12\"}", false);
+  expect("{\"a\":\"\\u0000\"}", false);
+  expect("{\"\\u0000\":1}", false);
+  expect("{\"a\":\"\\ud83d\\ude00\"}", true);
+  expect("{\"a\":\"\\ud83d\"}", false);
+  expect("{\"a\":\"\\ud83dx\"}", false);
+  expect("{\"a\":\"\\ud83d\\u0041\"}", false);
+  expect("{\"a\":\"\\ude00\"}", false);
+
+  // UTF-8
+  expect("{\"a\":\"\xC3\xA9t\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80 \xF4\x8F\xBF\xBF\"}", true);
+  expect("{\"a\":\"\xC3\"}", false);
+  expect("{\"a\":\"\xE2\x82\"}", false);
+  expect("{\"a\":\"\xE2\x82", false);
+  expect("{\"a\":\"\x80\"}", false);
+  expect("{\"a\":\"\xFF\"}", false);
+  expect("{\"a\":\"\xC0\xAF\"}", false);
+  expect("{\"a\":\"\xE0\x80\xAF\"}", false);
+  expect("{\"a\":\"\xF0\x80\x80\xAF\"}", false);
+  expect("{\"a\":\"\xED\xA0\x80\"}", false);
+  expect("{\"a\":\"\xF4\x90\x80\x80\"}", false);
+  expect("{\"a\":\"\xF5\x80\x80\x80\"}", false);
+  expect("{\"\xC3\x28\":1}", false);
+
+  printf("Errors :\t%d\n%s\n", errors, errors == 0 ? "TEST PASSED" : "TEST FAILED");
+  return errors == 0 ? 0 : 1;
+}
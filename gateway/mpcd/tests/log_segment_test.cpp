@@ -0,0 +1,190 @@
+/*
+ ****************************
+ *    LOG SEGMENT TEST      *
+ ****************************
+ * @brief:
+ *    Host test of the journaled segments of the satellite logger
+ *    (Log_segment.h), run by make check, on an SD card stand-in with the
+ *    FAT32 behaviour of SdFat (tests/arduino/SD.h): preallocation does not
+ *    set the file size, the directory size is only written by a flush.
+ *      - 165 s of GNSS_logger lines at 10 Hz in 60 s compressed segments,
+ *        then a power loss: the open segment, whose directory size was
+ *        never synced after its last checkpoint, is recovered up to that
+ *        checkpoint (stale blocks of an older file in its preallocated
+ *        sectors are not taken), the segment created ahead is removed and
+ *        the closed segments are intact. Every line kept is decoded in
+ *        order, without gap.
+ *      - A power loss before the first checkpoint of a segment keeps its
+ *        header on the card.
+ * @usage:
+ *    log_segment_test
+ */
+#define SERIAL_DBG(x) ;
+
+#include <Arduino.h>
+#include <SD.h>
+
+#include <string>
+#include <vector>
+
+#include "Log_segment.h"
+
+// Lines per second, segment duration (s), date (DDMMYY) and start (s)
+#define LINE_HZ       10
+#define SEGMENT_S     60
+#define DATE          181026
+#define START_S       43200
+// Id of the stale blocks of an older segment
+#define STALE_ID      0xBADBADu
+
+static const char* HEADER = "Time (HH:MM:SS.ssssss),Longitude (°),Latitude (°),Altitude (cm),Fix Mode,PDOP,Distance (mm),External temperature (°C),Fresh";
+
+static int errors = 0;
+
+static void check(bool ok, const std::string& what)  {
+
+  if (!ok)  {
+    printf("Failed : %s\n", what.c_str());
+    errors++;
+  }
+}
+
+// GNSS_logger line of sample i
+static std::string makeLine(uint32_t i)  {
+
+  char line[160];
+  snprintf(line, sizeof(line), "%02u:%02u:%02u.%u00000,-1.15670%02u,46.12340%02u,%u,4,0.80,%.1f,15.%03u,7",
+           (START_S + i / LINE_HZ) / 3600, (START_S + i / LINE_HZ) / 60 % 60, (START_S + i / LINE_HZ) % 60, i % LINE_HZ,
+           i * 7 % 13, i * 5 % 11, 1234 + i % 3, 1500.0 + (i % 17) * 0.3, i / 10 % 1000);
+  return line;
+}
+
+// Logs samples [from, to), a line every 1/LINE_HZ s, idle() between bursts
+static void logLines(LogSegmenter& seg, uint32_t from, uint32_t to)  {
+
+  for (uint32_t i = from; i < to; i++)  {
+    hostTime_us = (int64_t)i * 1000000 / LINE_HZ;
+    seg.update(DATE, START_S + i / LINE_HZ);
+    if (i % 20 == 19)
+      seg.idle();
+    std::string line = makeLine(i);
+    check(seg.println(line.c_str(), line.size()), "line " + std::to_string(i) + " logged");
+  }
+}
+
+// Lines of the blocks of a segment file, false if a block is invalid
+static bool decodeSegment(const std::string& path, std::vector<std::string>& lines, uint32_t& blocks)  {
+
+  File f = SD.open(path.c_str());
+  uint8_t sector[LZB_BLOCK_SIZE];
+  uint32_t id, count, segment;
+  uint16_t seq, len;
+  if (!f || f.read(sector, LZB_BLOCK_SIZE) != LZB_BLOCK_SIZE || !readSegmentHeader(sector, id, count))
+    return false;
+  blocks = 0;
+  char text[LZB_MAX_RAW + 1];
+  while (f.read(sector, LZB_BLOCK_SIZE) == LZB_BLOCK_SIZE)  {
+    if (!decodeLogBlock(sector, (uint8_t*)text, len, segment, seq) || segment != id || seq != blocks)
+      return false;
+    blocks++;
+    std::string block(text, len);
+    size_t start = 0, end;
+    while ((end = block.find('\n', start)) != std::string::npos)  {
+      lines.push_back(block.substr(start, end - start));
+      start = end + 1;
+    }
+  }
+  return blocks == count;
+}
+
+// Segment starting at daySeconds holds its Date and header lines then samples [first, first + n)
+static void checkSegment(uint32_t daySeconds, uint32_t first, uint32_t n, uint32_t minLines, const char* what)  {
+
+  char path[LOG_SEG_PATH_LEN];
+  snprintf(path, sizeof(path), "2026_10_18/%02u_%02u_%02u.csz", daySeconds / 3600, daySeconds / 60 % 60, daySeconds % 60);
+  std::vector<std::string> lines;
+  uint32_t blocks = 0;
+  std::string name = std::string(what) + " " + path;
+  check(decodeSegment(path, lines, blocks), name + ": valid blocks, count in the header");
+  check(SD.open(path).size() == (uint64_t)(blocks + 1) * LZB_BLOCK_SIZE, name + ": cut after its blocks");
+  bool ordered = lines.size() >= 2 && lines[0] == "Date:,2026_10_18" && lines[1] == HEADER;
+  for (size_t i = 2; ordered && i < lines.size(); i++)
+    ordered = lines[i] == makeLine(first + i - 2);
+  check(ordered, name + ": lines in order without gap");
+  uint32_t samples = lines.size() >= 2 ? lines.size() - 2 : 0;
+  check(samples >= minLines && samples <= n, name + ": lines kept");
+  printf("%s :\t%u blocks, %u of %u lines\n", path, blocks, samples, n);
+}
+
+int main()  {
+
+  // Stale blocks of an older segment in the free sectors
+  {
+    BlockCompressor old;
+    std::string stale;
+    for (uint32_t i = 0; stale.size() < LOG_SEG_JOURNAL_SIZE; i++)  {
+      std::string line = makeLine(90000 + i);
+      if (!old.addLine(line.c_str(), line.size()))  {
+        stale.append((const char*)old.finish(STALE_ID, stale.size() / LZB_BLOCK_SIZE), LZB_BLOCK_SIZE);
+        old.addLine(line.c_str(), line.size());
+      }
+    }
+    sdStaleData = stale;
+  }
+
+  // 165 s: two closed segments, 45 s in the open one, power loss
+  const uint32_t nbLines = 165 * LINE_HZ, perSegment = SEGMENT_S * LINE_HZ;
+  const char* openPath = "2026_10_18/12_02_00.csz";
+  const char* aheadPath = "2026_10_18/12_03_00.csz";
+  uint32_t checkpointCount = 0, blocksWritten = 0;
+  {
+    BlockCompressor compressor;
+    LogSegmenter seg(HEADER, SEGMENT_S * 1000, "", &compressor);
+    seg.begin();
+    logLines(seg, 0, nbLines);
+    check(strcmp(seg.path(), openPath) == 0 && SD.exists(aheadPath), "open segment and segment created ahead");
+
+    // Blocks on the card past the directory size
+    const SdEntry& open = *SD.files[openPath];
+    uint32_t id, segment;
+    uint16_t seq;
+    check(readSegmentHeader((const uint8_t*)open.data.data(), id, checkpointCount), "checkpoint in the segment header");
+    while ((blocksWritten + 2) * LZB_BLOCK_SIZE <= open.data.size()
+           && checkLogBlock((const uint8_t*)open.data.data() + (blocksWritten + 1) * LZB_BLOCK_SIZE, segment, seq) && segment == id)
+      blocksWritten++;
+    check(open.dirSize == (uint64_t)(checkpointCount + 1) * LZB_BLOCK_SIZE, "directory size written at the checkpoint only");
+    check(blocksWritten > checkpointCount && checkpointCount >= LOG_SEG_CHECKPOINT_BLOCKS, "blocks written after the checkpoint");
+    SD.powerLoss();
+  }
+  {
+    BlockCompressor compressor;
+    LogSegmenter seg(HEADER, SEGMENT_S * 1000, "", &compressor);
+    seg.begin();
+    check(!SD.exists(aheadPath), "segment created ahead removed");
+    checkSegment(START_S, 0, perSegment, perSegment, "closed");
+    checkSegment(START_S + SEGMENT_S, perSegment, perSegment, perSegment, "closed");
+    checkSegment(START_S + 2 * SEGMENT_S, 2 * perSegment, nbLines - 2 * perSegment, 1, "recovered");
+    uint32_t blocks = 0;
+    std::vector<std::string> lines;
+    decodeSegment(openPath, lines, blocks);
+    check(blocks == checkpointCount, "recovered up to the last checkpoint");
+    printf("Power loss :\t%u blocks written, %u at the checkpoint, %u recovered\n", blocksWritten, checkpointCount, blocks);
+
+    // New segment 10 minutes later, power loss before its first checkpoint
+    logLines(seg, 600 * LINE_HZ, 605 * LINE_HZ);
+    SD.powerLoss();
+  }
+  {
+    BlockCompressor compressor;
+    LogSegmenter seg(HEADER, SEGMENT_S * 1000, "", &compressor);
+    seg.begin();
+    File f = SD.open("2026_10_18/12_10_00.csz");
+    uint8_t sector[LZB_BLOCK_SIZE];
+    uint32_t id, count;
+    check(f && f.read(sector, LZB_BLOCK_SIZE) == LZB_BLOCK_SIZE && readSegmentHeader(sector, id, count) && count == 0,
+          "segment header kept before the first checkpoint");
+  }
+
+  printf("Errors :\t%d\n%s\n", errors, errors == 0 ? "TEST PASSED" : "TEST FAILED");
+  return errors == 0 ? 0 : 1;
+}
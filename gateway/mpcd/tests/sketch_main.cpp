@@ -0,0 +1,19 @@
+/*
+ ****************************
+ *   SKETCH TEST RUNNER     *
+ ****************************
+ * @brief:
+ *    Runs a unit test sketch of the satellite on host (make check): its
+ *    setup() checks everything, the exit status is the failed checks
+ *    counted by Unit_test.h (cyclopee_sat/libraries/system_modules).
+ */
+#include <cstdint>
+
+void setup();
+extern uint32_t errors;
+
+int main()  {
+
+  setup();
+  return errors == 0 ? 0 : 1;
+}
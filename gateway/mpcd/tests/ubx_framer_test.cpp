@@ -0,0 +1,182 @@
+/*
+ ****************************
+ *     UBX FRAMER TEST      *
+ ****************************
+ * @brief:
+ *    Host test of the satellite UBX framer (UBX_framer.h), run by make
+ *    check. Each stream is fed to the framer by spans of several sizes
+ *    (byte per byte up to the whole stream, and random sizes): every pass
+ *    must report the same frames, without error, their lengths adding up
+ *    to the stream size.
+ *      - Generated stream: UBX frames (empty, NAV-PVT, RXM-RAWX, 1.5 kB
+ *        payload) and NMEA sentences, checked against the frames written.
+ *        A corrupted payload byte must drop its frame only.
+ *      - Recorded .ubx files (RAWX logger) given as arguments.
+ * @usage:
+ *    ubx_framer_test [file.ubx...]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "UBX_framer.h"
+
+// Frame as reported, compared between passes
+struct Seen {
+  uint8_t type;
+  uint8_t error;
+  uint16_t msg;
+  uint32_t length;
+  std::string nmeaType;
+
+  bool operator==(const Seen& o) const  {
+    return type == o.type && error == o.error && msg == o.msg && length == o.length && nmeaType == o.nmeaType;
+  }
+};
+
+static int errors = 0;
+
+static void check(bool ok, const std::string& what)  {
+
+  if (!ok)  {
+    printf("Failed : %s\n", what.c_str());
+    errors++;
+  }
+}
+
+// Feeds the stream by spans of span bytes (0: random sizes up to 512)
+static std::vector<Seen> run(const std::vector<uint8_t>& data, size_t span)  {
+
+  std::vector<Seen> seen;
+  UbxFramer framer;
+  UbxFramer::Frame frame;
+  srand(1);
+  size_t pos = 0;
+  while (pos < data.size())  {
+    size_t n = span ? span : 1 + rand() % 512;
+    if (n > data.size() - pos)
+      n = data.size() - pos;
+    size_t off = 0;
+    while (off < n)  {
+      off += framer.parse(data.data() + pos + off, n - off, frame);
+      if (frame.type != UbxFramer::FRAME_NONE)
+        seen.push_back({frame.type, frame.error, (uint16_t)(frame.type == UbxFramer::FRAME_UBX ? frame.cls << 8 | frame.id : 0),
+                        frame.length, frame.type == UbxFramer::FRAME_NMEA ? frame.nmeaType : ""});
+    }
+    pos += n;
+  }
+  return seen;
+}
+
+// Runs every span size, returns the frames of the byte per byte pass
+static std::vector<Seen> runSpans(const std::vector<uint8_t>& data, const std::string& name)  {
+
+  static const size_t spans[] = {1, 2, 3, 4, 5, 7, 13, 64, 512, 0, SIZE_MAX};
+  std::vector<Seen> ref = run(data, 1);
+  for (size_t span : spans)  {
+    std::vector<Seen> seen = run(data, span);
+    check(seen == ref, name + ": same frames by spans of " + (span == 0 ? std::string("random size") : std::to_string(span)));
+  }
+  return ref;
+}
+
+static void addUbx(std::vector<uint8_t>& out, std::vector<Seen>& written, uint8_t cls, uint8_t id, uint16_t len)  {
+
+  size_t start = out.size();
+  out.insert(out.end(), {0xB5, 0x62, cls, id, (uint8_t)(len & 0xFF), (uint8_t)(len >> 8)});
+  for (uint16_t i = 0; i < len; i++)
+    out.push_back(rand() & 0xFF);
+  uint8_t a = 0, b = 0;
+  for (size_t i = start + 2; i < out.size(); i++)  {
+    a += out[i];
+    b += a;
+  }
+  out.push_back(a);
+  out.push_back(b);
+  written.push_back({UbxFramer::FRAME_UBX, UbxFramer::ERR_NONE, (uint16_t)(cls << 8 | id), (uint32_t)(len + 8), ""});
+}
+
+static void addNmea(std::vector<uint8_t>& out, std::vector<Seen>& written, const char* body)  {
+
+  uint8_t cs = 0;
+  for (const char* p = body; *p; p++)
+    cs ^= *p;
+  char line[128];
+  int n = snprintf(line, sizeof(line), "$%s*%02X\r\n", body, cs);
+  out.insert(out.end(), line, line + n);
+  written.push_back({UbxFramer::FRAME_NMEA, UbxFramer::ERR_NONE, 0, (uint32_t)n, std::string(body, 5)});
+}
+
+static void generatedStream()  {
+
+  std::vector<uint8_t> data;
+  std::vector<Seen> written;
+  srand(42);
+  for (int epoch = 0; epoch < 50; epoch++)  {
+    addUbx(data, written, 0x01, 0x07, 92);            // NAV-PVT
+    addUbx(data, written, 0x02, 0x15, 16 + 32 * (epoch % 40));  // RXM-RAWX
+    addNmea(data, written, "GNGGA,123519.00,4807.03812,N,01131.00012,E,4,12,0.8,545.4,M,46.9,M,1.0,0000");
+    addNmea(data, written, "GNRMC,123519.00,A,4807.03812,N,01131.00012,E,0.004,,230394,,,D,V");
+    if (epoch % 10 == 0)  {
+      addUbx(data, written, 0x06, 0x8A, 0);           // Empty payload
+      addUbx(data, written, 0x01, 0x35, 1500);        // NAV-SAT, many satellites
+    }
+  }
+
+  std::vector<Seen> seen = runSpans(data, "generated");
+  check(seen == written, "generated: frames written");
+  uint64_t bytes = 0;
+  for (const Seen& s : seen)
+    bytes += s.length;
+  check(bytes == data.size(), "generated: frame lengths add up to the stream");
+
+  // Corrupted payload byte of the second frame (RXM-RAWX)
+  data[92 + 8 + 6 + 10] ^= 0x5A;
+  seen = runSpans(data, "corrupted");
+  check(seen.size() == written.size() && seen[1].type == UbxFramer::FRAME_ERROR && seen[1].error == UbxFramer::ERR_UBX_CHECKSUM,
+        "corrupted: checksum error on its frame");
+  bool next = seen.size() == written.size();
+  for (size_t i = 2; next && i < seen.size(); i++)
+    next = seen[i] == written[i];
+  check(next, "corrupted: next frames parsed");
+  printf("Generated :\t%zu bytes, %zu frames\n", data.size(), written.size());
+}
+
+static void recordedFile(const char* path)  {
+
+  FILE* f = fopen(path, "rb");
+  if (!f)  {
+    check(false, std::string("open ") + path);
+    return;
+  }
+  std::vector<uint8_t> data;
+  uint8_t buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    data.insert(data.end(), buf, buf + n);
+  fclose(f);
+
+  std::vector<Seen> seen = runSpans(data, path);
+  uint64_t bytes = 0;
+  size_t ubx = 0, nmea = 0, errs = 0;
+  for (const Seen& s : seen)  {
+    bytes += s.type == UbxFramer::FRAME_ERROR ? 0 : s.length;
+    ubx += s.type == UbxFramer::FRAME_UBX;
+    nmea += s.type == UbxFramer::FRAME_NMEA;
+    errs += s.type == UbxFramer::FRAME_ERROR;
+  }
+  check(errs == 0, std::string(path) + ": no sync error");
+  check(bytes == data.size(), std::string(path) + ": frame lengths add up to the file");
+  printf("%s :\t%zu bytes, %zu UBX, %zu NMEA, %zu errors\n", path, data.size(), ubx, nmea, errs);
+}
+
+int main(int argc, char** argv)  {
+
+  generatedStream();
+  for (int i = 1; i < argc; i++)
+    recordedFile(argv[i]);
+  printf("Errors :\t%d\n%s\n", errors, errors == 0 ? "TEST PASSED" : "TEST FAILED");
+  return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,188 @@
+/*
+ ****************************
+ *       FAKE CASTER        *
+ ****************************
+ * @brief:
+ *    NTRIP caster stand-in to test the RTCM relay of mpcd without network:
+ *    serves one mountpoint on a loopback TCP port and sends, at the given
+ *    rate, an epoch of RTCM 3 frames with valid CRC-24Q (types of a
+ *    Centipede base: 1005, MSM4/MSM7, 1230, plus a 1033 and a 1019 that mpcd
+ *    filters out). Payloads carry the send time (bytes 2 to 9, after the
+ *    type), fake_sat -t uses it to measure the relay latency.
+ *    -b corrupts a frame every N frames, -2 answers in NTRIP 2 (chunked).
+ * @usage:
+ *    fake_caster [-p port] [-m mountpoint] [-r rate_hz] [-s msm_bytes] [-b bad_every] [-2]
+ *    mpcd -N ntrip://127.0.0.1:2101/TEST -l tcp:127.0.0.1:7000 ...
+ */
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "rtcm3.h"
+
+static volatile bool running = true;
+
+static void stopHandler(int)  { running = false; }
+
+// Frame of a type whose payload holds the send time, then filler bytes
+static std::string makeFrame(uint16_t type, size_t payloadLen, int64_t sentUs, unsigned seed)  {
+
+  std::vector<uint8_t> f(RTCM3_HEADER + payloadLen);
+  f[0] = RTCM3_PREAMBLE;
+  f[1] = (uint8_t)(payloadLen >> 8) & 0x03;
+  f[2] = (uint8_t)payloadLen;
+  f[3] = (uint8_t)(type >> 4);
+  f[4] = (uint8_t)(type << 4);
+  for (size_t i = 0; i < 8 && 5 + i < f.size(); i++)
+    f[5 + i] = (uint8_t)(sentUs >> (56 - 8 * i));
+  for (size_t i = 13; i < f.size(); i++)
+    f[i] = (uint8_t)(seed * 31 + i * 7);
+  uint32_t crc = rtcm3Crc24q(f.data(), f.size());
+  f.push_back((uint8_t)(crc >> 16));
+  f.push_back((uint8_t)(crc >> 8));
+  f.push_back((uint8_t)crc);
+  return std::string((const char*)f.data(), f.size());
+}
+
+// Sends all or closes the client
+static bool sendAll(int& fd, const std::string& data)  {
+
+  if (fd >= 0 && send(fd, data.data(), data.size(), MSG_NOSIGNAL) == (ssize_t)data.size())
+    return true;
+  if (fd >= 0)
+    close(fd);
+  fd = -1;
+  return false;
+}
+
+int main(int argc, char** argv)  {
+
+  int port = 2101;
+  std::string mountpoint = "TEST";
+  double rate = 1.0;
+  size_t msmBytes = 200;
+  long badEvery = 0;
+  bool ntrip2 = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:m:r:s:b:2")) != -1)  {
+    switch (opt)  {
+      case 'p': port = atoi(optarg); break;
+      case 'm': mountpoint = optarg; break;
+      case 'r': rate = atof(optarg); break;
+      case 's': msmBytes = strtoul(optarg, nullptr, 10); break;
+      case 'b': badEvery = atol(optarg); break;
+      case '2': ntrip2 = true; break;
+      default:
+        fprintf(stderr, "usage: %s [-p port] [-m mountpoint] [-r rate_hz] [-s msm_bytes] [-b bad_every] [-2]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (msmBytes < 16 || msmBytes > RTCM3_MAX_PAYLOAD)
+    msmBytes = 200;
+
+  signal(SIGINT, stopHandler);
+  signal(SIGTERM, stopHandler);
+  signal(SIGPIPE, SIG_IGN);
+
+  int listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  int one = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in sa = {};
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(listener, (struct sockaddr*)&sa, sizeof(sa)) < 0 || listen(listener, 4) < 0)  {
+    perror("bind");
+    return EXIT_FAILURE;
+  }
+  printf("ntrip://127.0.0.1:%d/%s\n", port, mountpoint.c_str());
+  fflush(stdout);
+
+  // Clients streaming, clients whose request is not read yet
+  std::vector<int> clients, waiting;
+  long epochs = 0, frames = 0, bad = 0;
+  useconds_t period_us = rate > 0 ? (useconds_t)(1e6 / rate) : 1000000;
+  while (running)  {
+    int fd;
+    while ((fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK)) >= 0)
+      waiting.push_back(fd);
+
+    for (size_t i = 0; i < waiting.size(); )  {
+      char req[2048];
+      ssize_t n = recv(waiting[i], req, sizeof(req) - 1, 0);
+      if (n < 0)  {
+        i++;
+        continue;
+      }
+      req[n > 0 ? n : 0] = '\0';
+      int client = waiting[i];
+      waiting.erase(waiting.begin() + i);
+      std::string get = "GET /" + mountpoint + " ";
+      if (strncmp(req, get.c_str(), get.size()) != 0)  {
+        sendAll(client, "SOURCETABLE 200 OK\r\nContent-Type: text/plain\r\n\r\nSTR;" + mountpoint
+                + ";;RTCM3;;2;GPS+GLO+GAL+BDS;;FRA;0;0;0;0;none;N;N;0;\r\nENDSOURCETABLE\r\n");
+        if (client >= 0)
+          close(client);
+        continue;
+      }
+      const char* answer = ntrip2 ? "HTTP/1.1 200 OK\r\nNtrip-Version: Ntrip/2.0\r\nContent-Type: gnss/data\r\n"
+                                    "Transfer-Encoding: chunked\r\n\r\n" : "ICY 200 OK\r\n";
+      if (sendAll(client, answer))  {
+        clients.push_back(client);
+        printf("client connected\n");
+        fflush(stdout);
+      }
+    }
+
+    // One epoch: base position every 10 epochs, observations, biases, and filtered types
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    int64_t nowUs = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    std::vector<std::pair<uint16_t, size_t>> epoch = {{1077, msmBytes}, {1087, msmBytes * 3 / 4},
+                                                       {1097, msmBytes * 3 / 4}, {1127, msmBytes / 2}, {1230, 16}};
+    if (epochs % 10 == 0)  {
+      epoch.insert(epoch.begin(), {1005, 19});
+      epoch.push_back({1033, 40});
+      epoch.push_back({1019, 61});
+    }
+    std::string data;
+    for (const auto& m : epoch)  {
+      std::string frame = makeFrame(m.first, m.second, nowUs, (unsigned)frames);
+      if (badEvery > 0 && frames % badEvery == badEvery - 1)  {
+        frame[frame.size() / 2] ^= 0x55;
+        bad++;
+      }
+      data += frame;
+      frames++;
+    }
+    if (ntrip2)  {
+      char size[16];
+      snprintf(size, sizeof(size), "%zx\r\n", data.size());
+      data = size + data + "\r\n";
+    }
+    for (size_t i = 0; i < clients.size(); )  {
+      if (sendAll(clients[i], data))  {
+        i++;
+      }
+      else  {
+        clients.erase(clients.begin() + i);
+        printf("client disconnected\n");
+        fflush(stdout);
+      }
+    }
+    epochs++;
+    usleep(period_us);
+  }
+
+  printf("%ld epochs, %ld frames, %ld corrupted\n", epochs, frames, bad);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,235 @@
+/*
+ ****************************
+ *      FAKE SATELLITE      *
+ ****************************
+ * @brief:
+ *    Emulates satellites on pseudo-terminals to test mpcd without
+ *    Bluetooth: each satellite gets a pty (symlinked to <prefix>N) and
+ *    sends JSON lines at the given rate, in the firmware formats.
+ *    With -t, each satellite listens on a loopback TCP port instead
+ *    (stand-in for the RFCOMM socket), -x drops the connections
+ *    periodically to exercise the reconnections. The RTCM frames relayed
+ *    by mpcd (fake_caster) are then checked and their latency measured.
+ * @usage:
+ *    fake_sat [-p prefix] [-n satellites] [-r rate_hz] [-k kind] [-b bad_every] [-t port [-x drop_s]]
+ *    kind: cyclopee (default), eau, air
+ *    mpcd -d /tmp/fakesat0 -d /tmp/fakesat1 ...
+ *    mpcd -l tcp:127.0.0.1:7000 -l tcp:127.0.0.1:7001 ...
+ */
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "rtcm3.h"
+
+static volatile bool running = true;
+
+static void stopHandler(int)  { running = false; }
+
+static std::string timeStr(const struct timespec& ts)  {
+
+  struct tm t;
+  gmtime_r(&ts.tv_sec, &t);
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%04d/%02d/%02d %02d:%02d:%02d.%06ld", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
+           t.tm_hour, t.tm_min, t.tm_sec, ts.tv_nsec / 1000);
+  return buf;
+}
+
+static std::string sampleLine(const std::string& kind, int sat, long seq, const struct timespec& ts)  {
+
+  char buf[512];
+  double phase = seq * 0.01 + sat;
+  if (kind == "eau")
+    snprintf(buf, sizeof(buf),
+             "{\"id\":\"EAU_%d;00:00:00:00:00:%02d\",\"time\":\"%s\",\"lon\":%.8f,\"lat\":%.8f,"
+             "\"raw_turb\":%.3f,\"turb\":%.2f,\"raw_cond\":%.3f,\"cond\":%.2f,\"temp\":%.2f}",
+             sat, sat, timeStr(ts).c_str(), -1.15 + sat * 1e-3, 46.15, 1.2 + 0.1 * sin(phase), 12.5 + sin(phase),
+             0.8, 52000.0 + 100 * sin(phase), 14.0 + 0.5 * sin(phase));
+  else if (kind == "air")
+    snprintf(buf, sizeof(buf),
+             "{\"id\":\"Air_00:00:00:00:00:%02d\",\"time\":\"%s\",\"lon\":%.8f,\"lat\":%.8f,\"Co2\":%d,"
+             "\"Co2_Temperature\":%.2f,\"Co2_Humidity\":%.2f,\"BME_Temperature\":%.2f,\"BME_Humidity\":%.2f,"
+             "\"BME_Pressure\":%.2f}",
+             sat, timeStr(ts).c_str(), -1.15, 46.15, 420 + (int)(10 * sin(phase)), 18.0, 60.0, 18.2, 59.0,
+             101325.0 + 50 * sin(phase));
+  else
+    snprintf(buf, sizeof(buf),
+             "{\"id\":\"CYCLOPEE_%d;00:00:00:00:00:%02d\",\"time\":\"%s\",\"lon\":%.9f,\"lat\":%.9f,\"elv\":%.3f,"
+             "\"fix\":4,\"pdop\":1.2,\"dist\":%.1f,\"temp\":%.1f}",
+             sat, sat, timeStr(ts).c_str(), -1.15 + sat * 1e-3, 46.15, 52.1 + 0.5 * sin(phase),
+             4000.0 + 300 * sin(phase), 15.0);
+  return buf;
+}
+
+int main(int argc, char** argv)  {
+
+  std::string prefix = "/tmp/fakesat";
+  std::string kind = "cyclopee";
+  int nbSat = 1;
+  double rate = 1.0;
+  long badEvery = 0;
+  int tcpPort = 0;
+  int dropEvery = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:n:r:k:b:t:x:")) != -1)  {
+    switch (opt)  {
+      case 'p': prefix = optarg; break;
+      case 'n': nbSat = atoi(optarg); break;
+      case 'r': rate = atof(optarg); break;
+      case 'k': kind = optarg; break;
+      case 'b': badEvery = atol(optarg); break;
+      case 't': tcpPort = atoi(optarg); break;
+      case 'x': dropEvery = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-p prefix] [-n satellites] [-r rate_hz] [-k cyclopee|eau|air] [-b bad_every] "
+                "[-t port [-x drop_s]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  signal(SIGINT, stopHandler);
+  signal(SIGTERM, stopHandler);
+  signal(SIGPIPE, SIG_IGN);
+
+  // Satellite output: pty master, or connected client in TCP mode (-1 if none)
+  std::vector<int> masters;
+  std::vector<int> listeners;
+  std::vector<std::string> links;
+  for (int i = 0; tcpPort > 0 && i < nbSat; i++)  {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in sa = {};
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(tcpPort + i);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0 || listen(fd, 1) < 0)  {
+      perror("bind");
+      return EXIT_FAILURE;
+    }
+    printf("tcp:127.0.0.1:%d\n", tcpPort + i);
+    listeners.push_back(fd);
+    masters.push_back(-1);
+  }
+  for (int i = 0; tcpPort == 0 && i < nbSat; i++)  {
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0)  {
+      perror("posix_openpt");
+      return EXIT_FAILURE;
+    }
+    std::string link = prefix + std::to_string(i);
+    unlink(link.c_str());
+    if (symlink(ptsname(fd), link.c_str()) < 0)  {
+      perror("symlink");
+      return EXIT_FAILURE;
+    }
+    // Writes must not block while mpcd is not reading
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    printf("%s -> %s\n", link.c_str(), ptsname(fd));
+    masters.push_back(fd);
+    links.push_back(link);
+  }
+  fflush(stdout);
+
+  // TCP mode: corrections received from mpcd
+  std::vector<Rtcm3Framer> framers(nbSat);
+  uint64_t otherBytes = 0;
+  int64_t latencySumUs = 0, latencyMaxUs = 0;
+  uint64_t latencyCount = 0;
+
+  long seq = 0, sent = 0, lost = 0;
+  useconds_t period_us = rate > 0 ? (useconds_t)(1e6 / rate) : 1000000;
+  time_t lastDrop = time(nullptr);
+  while (running)  {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    // TCP mode: accept a new client, drop them all every dropEvery s
+    bool drop = dropEvery > 0 && ts.tv_sec - lastDrop >= dropEvery;
+    if (drop)
+      lastDrop = ts.tv_sec;
+    for (size_t i = 0; i < listeners.size(); i++)  {
+      if (drop && masters[i] >= 0)  {
+        close(masters[i]);
+        masters[i] = -1;
+      }
+      int client = accept4(listeners[i], nullptr, nullptr, SOCK_NONBLOCK);
+      if (client >= 0)  {
+        if (masters[i] >= 0)
+          close(masters[i]);
+        masters[i] = client;
+        otherBytes += framers[i].skippedBytes;
+        framers[i].skippedBytes = 0;
+        framers[i].reset();
+      }
+      uint8_t in[4096];
+      ssize_t n;
+      while (masters[i] >= 0 && (n = recv(masters[i], in, sizeof(in), 0)) > 0)  {
+        framers[i].feed(in, (size_t)n, [&](std::string_view frame, uint16_t type)  {
+          // Send time written by fake_caster after the type
+          if (frame.size() < 16)
+            return;
+          int64_t sentUs = 0;
+          for (int b = 0; b < 8; b++)
+            sentUs = (sentUs << 8) | (uint8_t)frame[5 + b];
+          struct timespec now;
+          clock_gettime(CLOCK_REALTIME, &now);
+          int64_t latencyUs = (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000 - sentUs;
+          latencySumUs += latencyUs;
+          latencyCount++;
+          if (latencyUs > latencyMaxUs)
+            latencyMaxUs = latencyUs;
+        });
+      }
+    }
+    for (int i = 0; i < nbSat; i++)  {
+      if (masters[i] < 0)
+        continue;
+      std::string line = (badEvery > 0 && seq % badEvery == badEvery - 1) ? "{\"id\":\"broken\",\"time\":" :
+                                                                             sampleLine(kind, i, seq, ts);
+      line += "\r\n";
+      if (write(masters[i], line.data(), line.size()) == (ssize_t)line.size())  {
+        sent++;
+      }
+      else  {
+        lost++;
+        // Client gone
+        if (!listeners.empty() && errno != EAGAIN)  {
+          close(masters[i]);
+          masters[i] = -1;
+        }
+      }
+    }
+    seq++;
+    usleep(period_us);
+  }
+
+  printf("%ld lines sent, %ld lost\n", sent, lost);
+  if (tcpPort > 0)  {
+    uint64_t frames = 0, crcErrors = 0;
+    for (const Rtcm3Framer& framer : framers)  {
+      frames += framer.frames;
+      crcErrors += framer.crcErrors;
+      otherBytes += framer.skippedBytes;
+    }
+    printf("%llu RTCM frames received, %llu CRC errors, latency mean %.1f ms max %.1f ms, %llu other bytes (orders)\n",
+           (unsigned long long)frames, (unsigned long long)crcErrors,
+           latencyCount ? latencySumUs / 1000.0 / latencyCount : 0.0, latencyMaxUs / 1000.0,
+           (unsigned long long)otherBytes);
+  }
+  for (const std::string& link : links)
+    unlink(link.c_str());
+  return EXIT_SUCCESS;
+}
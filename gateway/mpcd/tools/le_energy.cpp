@@ -0,0 +1,76 @@
+/*
+ ****************************
+ *        LE ENERGY         *
+ ****************************
+ * @brief:
+ *    Battery life of le_logger, legacy mode against low energy mode, from
+ *    the model of LE_energy.h: simulates the sample cycles of the given
+ *    number of days for each sample interval (SD writes every -n samples,
+ *    receiver backup when it saves energy, as decided by the logger) and
+ *    prints mean current, battery life and gain.
+ *    Currents and durations are set by the LE_* definitions (-D at build).
+ * @usage:
+ *    le_energy [-i interval_s[,interval_s...]] [-n flush_samples] [-c capacity_mAh] [-d days]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <vector>
+
+#include "LE_energy.h"
+
+// Mean current over the cycles of the given duration
+static double simulate(LeMode mode, uint32_t sleep_ms, uint16_t flushSamples, bool gnssBackup, double days)  {
+
+  double charge = 0, elapsed = 0, end = days * 86400e3;
+  for (uint64_t n = 0; elapsed < end; n++)  {
+    uint16_t lines = (mode == LE_MODE_LEGACY) ? 1 : ((n + 1) % flushSamples == 0 ? flushSamples : 0);
+    LeCycle c = leCycle(mode, sleep_ms, lines, gnssBackup);
+    charge += c.charge_mAms;
+    elapsed += c.period_ms;
+  }
+  return charge / elapsed;
+}
+
+int main(int argc, char** argv)  {
+
+  std::vector<uint32_t> intervals = {2, 10, 60, 300, 600};
+  long flushSamples = 30;
+  double capacity = 20000, days = 7;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "i:n:c:d:")) != -1)  {
+    switch (opt)  {
+      case 'i':
+        intervals.clear();
+        for (char* s = strtok(optarg, ","); s; s = strtok(NULL, ","))
+          intervals.push_back(strtoul(s, NULL, 10));
+        break;
+      case 'n': flushSamples = atol(optarg); break;
+      case 'c': capacity = atof(optarg); break;
+      case 'd': days = atof(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-i interval_s[,interval_s...]] [-n flush_samples] [-c capacity_mAh] [-d days]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (intervals.empty() || flushSamples < 1 || flushSamples > UINT16_MAX || capacity <= 0 || days <= 0)  {
+    fprintf(stderr, "Invalid options\n");
+    return 1;
+  }
+
+  printf("Battery %.0f mAh (%.0f%% used), SD write every %ld samples, %.1f days simulated\n",
+         capacity, LE_BATTERY_USABLE * 100.0, flushSamples, days);
+  printf("%10s %12s %12s %12s %12s %8s %8s\n", "interval_s", "legacy_mA", "legacy_d", "low_mA", "low_d", "backup", "gain");
+  for (uint32_t interval : intervals)  {
+    uint32_t sleep_ms = interval * 1000;
+    bool backup = leGnssBackupSaves(sleep_ms, flushSamples);
+    double legacy = simulate(LE_MODE_LEGACY, sleep_ms, 1, false, days);
+    double low = simulate(LE_MODE_LOW_ENERGY, sleep_ms, flushSamples, backup, days);
+    printf("%10u %12.2f %12.1f %12.2f %12.1f %8s %7.1fx\n", interval,
+           legacy, leBatteryDays(capacity, legacy), low, leBatteryDays(capacity, low),
+           backup ? "yes" : "no", legacy / low);
+  }
+  return 0;
+}
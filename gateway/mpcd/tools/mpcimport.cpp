@@ -0,0 +1,413 @@
+/*
+ ****************************
+ *        MPC IMPORT        *
+ ****************************
+ * @brief:
+ *    Loads the logs of a satellite SD card (sd_log.h) into the typed tables,
+ *    to recover the periods not received over Bluetooth (satellite out of
+ *    range, gateway down):
+ *      - the files found under the given paths (*.csv, and *.csz segments
+ *        compressed by blocks, Block_compressor.h) are shared between
+ *        worker threads, largest first, each thread has its own database
+ *        connection;
+ *      - a compressed segment is decoded block by block, in sequence: the
+ *        blocks torn by a power loss are counted as lost, the blocks of an
+ *        older file left in the preallocated space are skipped;
+ *      - a file is read by batches of rows; the rows already in the table
+ *        (same sat_id and time, received over Bluetooth or by a previous
+ *        import) or repeated are removed, the derived channels are
+ *        computed (calibration.h) and the batch is sent by binary COPY.
+ *    Importing a card twice adds nothing: the import can be run again after
+ *    a failure.
+ * @usage:
+ *    mpcimport -i satId [-c conninfo] [-k type] [-j threads] [-b rows] [-n] [-v] path...
+ *    mpcimport -i "CYCLOPEE_01;AA:BB:CC:DD:EE:FF" /media/sd
+ */
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+#include "Block_compressor.h"
+#include "calibration.h"
+#include "log.h"
+#include "pg_copy.h"
+#include "sample_batch.h"
+#include "schema.h"
+#include "sd_log.h"
+
+#define DEFAULT_CONNINFO    "dbname=mpc"
+// Rows parsed, deduplicated and sent at once
+#define DEFAULT_BATCH_ROWS  100000
+
+static const char* EXISTING_TIMES =
+  "SELECT (extract(epoch FROM time) * 1000000)::int8 FROM %s WHERE sat_id = $1 "
+  "AND time >= to_timestamp(0) + $2::int8 * interval '1 microsecond' "
+  "AND time <= to_timestamp(0) + $3::int8 * interval '1 microsecond'";
+
+int logLevel = LOG_INFO;
+
+struct ImportFile {
+  std::string path;
+  off_t size;
+};
+
+struct ImportConfig {
+  std::string conninfo = DEFAULT_CONNINFO;
+  std::string satId;
+  const SatType* type = nullptr;
+  size_t batchRows = DEFAULT_BATCH_ROWS;
+  bool dryRun = false;
+};
+
+struct ImportStats {
+  std::atomic<uint64_t> files{0}, failedFiles{0}, bytes{0}, badBlocks{0}, lines{0}, skipped{0}, rows{0}, duplicates{0}, inserted{0};
+};
+
+static void usage(const char* prog)  {
+
+  fprintf(stderr,
+          "usage: %s [options] path...\n"
+          "  -i id        satellite id of the CSV files (sat_id, e.g. \"CYCLOPEE_01;AA:BB:CC:DD:EE:FF\")\n"
+          "  -c conninfo  libpq connection string (default \"" DEFAULT_CONNINFO "\")\n"
+          "  -k type      satellite type of the CSV files (cyclopee, water, air), default from the header\n"
+          "  -j threads   worker threads (default number of cores)\n"
+          "  -b rows      rows per COPY (default %d)\n"
+          "  -n           parse only, nothing is written\n"
+          "  -v           verbose, repeat for debug messages\n",
+          prog, DEFAULT_BATCH_ROWS);
+}
+
+static bool hasExtension(const std::string& path, const char* ext)  {
+
+  return path.size() > 4 && strcasecmp(path.c_str() + path.size() - 4, ext) == 0;
+}
+
+// Log files under a path (*.csv or *.csz, any case)
+static void findFiles(const std::string& path, std::vector<ImportFile>& files)  {
+
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)  {
+    logMsg(LOG_WARN, "%s: %s", path.c_str(), strerror(errno));
+    return;
+  }
+  if (S_ISREG(st.st_mode))  {
+    if (hasExtension(path, ".csv") || hasExtension(path, ".csz"))
+      files.push_back({path, st.st_size});
+    return;
+  }
+  if (!S_ISDIR(st.st_mode))
+    return;
+  DIR* dir = opendir(path.c_str());
+  if (!dir)
+    return;
+  while (struct dirent* e = readdir(dir))  {
+    if (e->d_name[0] != '.')
+      findFiles(path + "/" + e->d_name, files);
+  }
+  closedir(dir);
+}
+
+static bool readFile(const std::string& path, std::string& data)  {
+
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0)  {
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  data.resize((size_t)st.st_size);
+  size_t done = 0;
+  while (done < data.size())  {
+    ssize_t n = read(fd, &data[done], data.size() - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    done += (size_t)n;
+  }
+  data.resize(done);
+  close(fd);
+  return true;
+}
+
+/*
+ * @brief:
+ *    Lines of a journaled segment (segment header sector, then numbered
+ *    blocks): valid blocks of the segment in order.
+ * @return:
+ *    Blocks lost: missing numbers, blocks of the last checkpoint not found.
+ */
+static uint64_t decodeBlocks(const std::string& data, std::string& text)  {
+
+  const uint8_t* sectors = (const uint8_t*)data.data();
+  size_t n = data.size() / LZB_BLOCK_SIZE;
+  uint8_t raw[LZB_MAX_RAW];
+  uint32_t id = 0, checkpoint = 0, segment;
+  uint16_t len, seq;
+  // Torn header: id of the first block
+  bool known = n > 0 && readSegmentHeader(sectors, id, checkpoint);
+  uint64_t lost = 0, expected = 0;
+  text.clear();
+  for (size_t i = 1; i < n; i++)  {
+    const uint8_t* block = sectors + i * LZB_BLOCK_SIZE;
+    if (!decodeLogBlock(block, raw, len, segment, seq) || (known && segment != id) || seq < expected)
+      continue;
+    if (!known)  {
+      id = segment;
+      known = true;
+    }
+    lost += seq - expected;
+    expected = seq + 1;
+    text.append((const char*)raw, len);
+  }
+  return lost + (checkpoint > expected ? checkpoint - expected : 0);
+}
+
+// Keeps the staged rows whose flag is set
+static void keepRows(ColumnBatch& staging, const std::vector<bool>& keep)  {
+
+  size_t j = 0;
+  for (size_t i = 0; i < staging.rows(); i++)  {
+    if (!keep[i])
+      continue;
+    staging.time[j] = staging.time[i];
+    staging.satId[j].swap(staging.satId[i]);
+    for (auto& column : staging.columns)
+      column[j] = column[i];
+    if (!staging.raw.empty())
+      staging.raw[j].swap(staging.raw[i]);
+    j++;
+  }
+  staging.time.resize(j);
+  staging.satId.resize(j);
+  for (auto& column : staging.columns)
+    column.resize(j);
+  if (!staging.raw.empty())
+    staging.raw.resize(j);
+}
+
+/*
+ * @brief:
+ *    Removes the staged rows already in the table, and the rows repeated in
+ *    the batch. One range query per satellite of the batch.
+ * @return:
+ *    False on database error.
+ */
+static bool removeDuplicates(PgConnection& db, ColumnBatch& staging, uint64_t& duplicates)  {
+
+  std::vector<bool> keep(staging.rows(), true);
+  std::vector<std::string> sats;
+  for (const std::string& sat : staging.satId)
+    if (std::find(sats.begin(), sats.end(), sat) == sats.end())
+      sats.push_back(sat);
+
+  char sql[512];
+  snprintf(sql, sizeof(sql), EXISTING_TIMES, staging.type->table);
+  for (const std::string& sat : sats)  {
+    int64_t first = INT64_MAX, last = INT64_MIN;
+    for (size_t i = 0; i < staging.rows(); i++)  {
+      if (staging.satId[i] == sat)  {
+        first = std::min(first, staging.time[i]);
+        last = std::max(last, staging.time[i]);
+      }
+    }
+    std::unordered_set<int64_t> seen;
+    bool ok = db.query(sql, {sat, std::to_string(first), std::to_string(last)}, [&](const PGresult* row)  {
+      uint64_t v = 0;
+      const char* p = PQgetvalue(row, 0, 0);
+      for (int b = 0; b < 8; b++)
+        v = (v << 8) | (uint8_t)p[b];
+      seen.insert((int64_t)v);
+      return true;
+    });
+    if (!ok)
+      return false;
+    for (size_t i = 0; i < staging.rows(); i++)  {
+      if (staging.satId[i] == sat && !seen.insert(staging.time[i]).second)  {
+        keep[i] = false;
+        duplicates++;
+      }
+    }
+  }
+  keepRows(staging, keep);
+  return true;
+}
+
+/*
+ * @brief:
+ *    Imports one file.
+ * @return:
+ *    False if the file could not be read or loaded.
+ */
+static bool importFile(const ImportFile& file, const ImportConfig& config, PgConnection& db,
+                       const CalibrationRegistry& calibrations, ImportStats& stats)  {
+
+  std::string data;
+  if (!readFile(file.path, data))  {
+    logMsg(LOG_WARN, "%s: %s", file.path.c_str(), strerror(errno));
+    return false;
+  }
+  size_t bytes = data.size();
+  if (hasExtension(file.path, ".csz"))  {
+    std::string text;
+    uint64_t bad = decodeBlocks(data, text);
+    if (bad > 0)
+      logMsg(LOG_WARN, "%s: %llu blocks lost", file.path.c_str(), (unsigned long long)bad);
+    stats.badBlocks += bad;
+    data.swap(text);
+    // Segment created ahead, left by a power loss
+    if (data.empty())  {
+      logMsg(LOG_DBG, "%s: no block", file.path.c_str());
+      stats.bytes += bytes;
+      return true;
+    }
+  }
+  // Directory YYYY_MM_DD of the segment
+  std::string dirDate;
+  size_t slash = file.path.rfind('/');
+  if (slash != std::string::npos)  {
+    size_t prev = file.path.rfind('/', slash - 1);
+    dirDate = file.path.substr(prev == std::string::npos ? 0 : prev + 1, slash - (prev == std::string::npos ? 0 : prev + 1));
+  }
+
+  SdLogReader reader(data, config.satId, dirDate, config.type);
+  if (reader.kind() == SD_LOG_UNKNOWN)  {
+    logMsg(LOG_WARN, "%s: %s, skipped", file.path.c_str(), reader.error().c_str());
+    return false;
+  }
+  if (reader.kind() == SD_LOG_CSV && config.satId.empty())  {
+    logMsg(LOG_WARN, "%s: CSV rows have no satellite id, give it with -i", file.path.c_str());
+    return false;
+  }
+
+  SampleBatches batches(false);
+  uint64_t rows = 0, duplicates = 0, inserted = 0;
+  bool ok = true;
+  while (ok && reader.read(batches, config.batchRows) > 0)  {
+    for (SampleBatch& batch : batches.all())  {
+      if (batch.staging.empty() && batch.buffer.empty())
+        continue;
+      rows += batch.rows();
+      if (!config.dryRun && !batch.staging.empty())
+        ok = removeDuplicates(db, batch.staging, duplicates);
+      if (!ok)
+        break;
+      batches.encode(batch, calibrations);
+      size_t n = batch.buffer.rows();
+      if (!config.dryRun && n > 0)
+        ok = db.copy(batch.copySql(), batch.buffer);
+      if (ok && !config.dryRun)
+        inserted += n;
+      batch.clear();
+    }
+  }
+  stats.bytes += bytes;
+  stats.lines += reader.lines();
+  stats.skipped += reader.skipped();
+  stats.rows += rows;
+  stats.duplicates += duplicates;
+  stats.inserted += inserted;
+  logMsg(ok ? LOG_DBG : LOG_WARN, "%s: %s %s, %llu rows, %llu duplicates, %llu inserted, %llu lines skipped%s",
+         file.path.c_str(), reader.kind() == SD_LOG_CSV ? "CSV" : "JSON lines",
+         reader.type() ? reader.type()->name : "", (unsigned long long)rows, (unsigned long long)duplicates,
+         (unsigned long long)inserted, (unsigned long long)reader.skipped(), ok ? "" : ", load failed");
+  return ok;
+}
+
+int main(int argc, char** argv)  {
+
+  ImportConfig config;
+  unsigned threads = std::thread::hardware_concurrency();
+  int opt;
+
+  while ((opt = getopt(argc, argv, "i:c:k:j:b:nvh")) != -1)  {
+    switch (opt)  {
+      case 'i': config.satId = optarg; break;
+      case 'c': config.conninfo = optarg; break;
+      case 'k':
+        for (const SatType& type : satTypes())
+          if (strcmp(type.name, optarg) == 0)
+            config.type = &type;
+        if (!config.type)  {
+          logMsg(LOG_ERR, "unknown satellite type %s", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'j': threads = (unsigned)atoi(optarg); break;
+      case 'b': config.batchRows = strtoul(optarg, nullptr, 10); break;
+      case 'n': config.dryRun = true; break;
+      case 'v': logLevel++; break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  if (optind >= argc)  {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (threads == 0)
+    threads = 1;
+  if (config.batchRows == 0)
+    config.batchRows = DEFAULT_BATCH_ROWS;
+
+  std::vector<ImportFile> files;
+  for (int i = optind; i < argc; i++)
+    findFiles(argv[i], files);
+  if (files.empty())  {
+    logMsg(LOG_ERR, "no log file found");
+    return EXIT_FAILURE;
+  }
+  // Largest first: the threads end together
+  std::sort(files.begin(), files.end(), [](const ImportFile& a, const ImportFile& b)  { return a.size > b.size; });
+  if (threads > files.size())
+    threads = (unsigned)files.size();
+
+  // Checks the database once before starting the threads
+  CalibrationRegistry calibrations;
+  if (!config.dryRun)  {
+    PgConnection db(config.conninfo);
+    if (!db.ensureConnected() || !calibrations.load(db))
+      return EXIT_FAILURE;
+  }
+
+  ImportStats stats;
+  std::atomic<size_t> next{0};
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; t++)  {
+    workers.emplace_back([&]()  {
+      PgConnection db(config.conninfo);
+      size_t i;
+      while ((i = next++) < files.size())  {
+        stats.files++;
+        if (!importFile(files[i], config, db, calibrations, stats))
+          stats.failedFiles++;
+      }
+    });
+  }
+  for (std::thread& w : workers)
+    w.join();
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  logMsg(LOG_INFO, "%llu files (%llu failed), %.1f MB, %llu blocks lost, %llu lines, %llu skipped, %llu rows, %llu duplicates, %llu inserted%s",
+         (unsigned long long)stats.files, (unsigned long long)stats.failedFiles, stats.bytes / 1e6,
+         (unsigned long long)stats.badBlocks, (unsigned long long)stats.lines, (unsigned long long)stats.skipped, (unsigned long long)stats.rows,
+         (unsigned long long)stats.duplicates, (unsigned long long)stats.inserted, config.dryRun ? " (dry run)" : "");
+  logMsg(LOG_INFO, "%.2f s, %u threads, %.0f rows/s", seconds, threads, seconds > 0 ? stats.rows / seconds : 0.0);
+  return stats.failedFiles ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,103 @@
+-- ## Étalonnage appliqué à l'ingestion (mpcd)
+-- ## A lancer après typed_tables.sql et water_level_aggregates.sql
+-- psql -U postgres -h localhost -d mpc -f calibration.sql
+--
+-- mpcd calcule à l'écriture, avec l'étalonnage de cyclopee.calibration valide à la date de la mesure :
+--   cyclopee_sample.surface_elv  = elv - dist / 1000 - antenna_offset_m
+--   cyclopee_sample.water_height = surface_elv + datum_offset_m
+--   water_sample.cond25          = cond / (1 + cond_alpha * (temp - 25))
+-- Sans étalonnage, les offsets valent 0 et cond_alpha 0.02.
+-- Un changement de cyclopee.calibration recalcule les colonnes dérivées sur la seule période concernée
+-- et prévient mpcd (NOTIFY mpcd_calibration) qui recharge ses étalonnages.
+
+-- ## Coefficient de température de la conductivité (1/°C)
+ALTER TABLE cyclopee.calibration ADD COLUMN IF NOT EXISTS cond_alpha DOUBLE PRECISION NOT NULL DEFAULT 0.02;
+
+-- ## Colonnes dérivées
+-- Les hypertables compressées n'acceptent l'ajout de colonnes que nullables, sans défaut
+ALTER TABLE cyclopee.cyclopee_sample ADD COLUMN IF NOT EXISTS surface_elv DOUBLE PRECISION;
+ALTER TABLE cyclopee.cyclopee_sample ADD COLUMN IF NOT EXISTS water_height DOUBLE PRECISION;
+ALTER TABLE cyclopee.water_sample ADD COLUMN IF NOT EXISTS cond25 REAL;
+
+-- ## Recalcul des colonnes dérivées d'un satellite sur [t_from, t_to[
+-- Les chunks compressés de la période sont décompressés (mise à jour impossible sinon),
+-- la politique de compression les recompressera.
+CREATE OR REPLACE FUNCTION cyclopee.recalibrate(p_sat_id TEXT, t_from TIMESTAMPTZ, t_to TIMESTAMPTZ)
+RETURNS VOID
+LANGUAGE plpgsql AS
+$$
+DECLARE
+    chunk REGCLASS;
+    cal cyclopee.calibration;
+BEGIN
+    t_to := coalesce(t_to, 'infinity');
+    FOR chunk IN
+        SELECT format('%I.%I', c.chunk_schema, c.chunk_name)::REGCLASS
+        FROM timescaledb_information.chunks c
+        WHERE c.hypertable_schema = 'cyclopee'
+          AND c.hypertable_name IN ('cyclopee_sample', 'water_sample')
+          AND c.is_compressed
+          AND c.range_end > t_from AND c.range_start < t_to
+    LOOP
+        PERFORM decompress_chunk(chunk, if_compressed => TRUE);
+    END LOOP;
+
+    -- Mesures sans étalonnage
+    UPDATE cyclopee.cyclopee_sample s
+    SET surface_elv = elv - dist / 1000,
+        water_height = elv - dist / 1000
+    WHERE s.sat_id = p_sat_id AND s.time >= t_from AND s.time < t_to
+      AND NOT EXISTS (SELECT 1 FROM cyclopee.calibration c
+                      WHERE c.sat_id = s.sat_id AND s.time >= c.valid_from
+                        AND (c.valid_to IS NULL OR s.time < c.valid_to));
+    UPDATE cyclopee.water_sample s
+    SET cond25 = cond / (1 + 0.02 * (temp - 25))
+    WHERE s.sat_id = p_sat_id AND s.time >= t_from AND s.time < t_to
+      AND NOT EXISTS (SELECT 1 FROM cyclopee.calibration c
+                      WHERE c.sat_id = s.sat_id AND s.time >= c.valid_from
+                        AND (c.valid_to IS NULL OR s.time < c.valid_to));
+
+    -- Périodes étalonnées, par date de début : en cas de chevauchement le dernier étalonnage l'emporte (comme mpcd)
+    FOR cal IN
+        SELECT * FROM cyclopee.calibration c
+        WHERE c.sat_id = p_sat_id
+          AND (c.valid_to IS NULL OR c.valid_to > t_from) AND c.valid_from < t_to
+        ORDER BY c.valid_from
+    LOOP
+        UPDATE cyclopee.cyclopee_sample
+        SET surface_elv = elv - dist / 1000 - cal.antenna_offset_m,
+            water_height = elv - dist / 1000 - cal.antenna_offset_m + cal.datum_offset_m
+        WHERE sat_id = p_sat_id
+          AND time >= greatest(cal.valid_from, t_from) AND time < least(coalesce(cal.valid_to, 'infinity'), t_to);
+        UPDATE cyclopee.water_sample
+        SET cond25 = cond / (1 + cal.cond_alpha * (temp - 25))
+        WHERE sat_id = p_sat_id
+          AND time >= greatest(cal.valid_from, t_from) AND time < least(coalesce(cal.valid_to, 'infinity'), t_to);
+    END LOOP;
+END;
+$$;
+
+-- ## Recalcul à chaque modification d'étalonnage (ancienne et nouvelle période)
+CREATE OR REPLACE FUNCTION cyclopee.calibration_changed()
+RETURNS TRIGGER
+LANGUAGE plpgsql AS
+$$
+BEGIN
+    IF TG_OP IN ('UPDATE', 'DELETE') THEN
+        PERFORM cyclopee.recalibrate(OLD.sat_id, OLD.valid_from, OLD.valid_to);
+    END IF;
+    IF TG_OP IN ('INSERT', 'UPDATE') THEN
+        PERFORM cyclopee.recalibrate(NEW.sat_id, NEW.valid_from, NEW.valid_to);
+    END IF;
+    PERFORM pg_notify('mpcd_calibration', coalesce(NEW.sat_id, OLD.sat_id));
+    RETURN NULL;
+END;
+$$;
+
+DROP TRIGGER IF EXISTS calibration_changed ON cyclopee.calibration;
+CREATE TRIGGER calibration_changed
+    AFTER INSERT OR UPDATE OR DELETE ON cyclopee.calibration
+    FOR EACH ROW EXECUTE FUNCTION cyclopee.calibration_changed();
+
+-- ## Calcul initial des mesures déjà enregistrées
+-- SELECT cyclopee.recalibrate(sat_id, '-infinity', 'infinity') FROM (SELECT DISTINCT sat_id FROM cyclopee.satellite_seen) AS seen;
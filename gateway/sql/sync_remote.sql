@@ -0,0 +1,36 @@
+-- ## Serveur distant : réception des données des passerelles (mpcd -s)
+-- ## A lancer sur le serveur après typed_tables.sql, water_level_aggregates.sql et calibration.sql
+-- ## (mêmes tables que la base locale), et après la création de cyclopee.sensor
+-- psql -U postgres -h localhost -d mpc -f sync_remote.sql
+--
+-- Chaque passerelle envoie ses mesures par lots, un lot par transaction. Le numéro de la dernière
+-- ligne reçue (last_seq) est enregistré dans la même transaction : après une coupure, la passerelle
+-- reprend juste après.
+
+-- ## Position de chaque passerelle
+CREATE TABLE IF NOT EXISTS cyclopee.sync_state
+(
+    gateway_id TEXT PRIMARY KEY,        -- mpcd -g, nom d'hôte par défaut
+    last_seq BIGINT NOT NULL,           -- numéro de la dernière ligne reçue
+    synced_at TIMESTAMPTZ NOT NULL      -- heure du dernier lot
+);
+
+-- ## Unicité : une mesure reçue deux fois (reprise, satellite qui répète) n'est gardée qu'une fois
+-- A créer avant la compression des premiers chunks
+CREATE UNIQUE INDEX IF NOT EXISTS uq_cyclopee_sample ON cyclopee.cyclopee_sample (sat_id, time);
+CREATE UNIQUE INDEX IF NOT EXISTS uq_water_sample ON cyclopee.water_sample (sat_id, time);
+CREATE UNIQUE INDEX IF NOT EXISTS uq_air_sample ON cyclopee.air_sample (sat_id, time);
+CREATE UNIQUE INDEX IF NOT EXISTS uq_cyclopee_window ON cyclopee.cyclopee_window (sat_id, time);
+CREATE UNIQUE INDEX IF NOT EXISTS uq_wave_stats ON cyclopee.wave_stats (sat_id, time);
+CREATE UNIQUE INDEX IF NOT EXISTS uq_sensor ON cyclopee.sensor (time, md5(data::text));
+
+-- ## Utilisateur des passerelles
+-- CREATE ROLE mpcd_sync LOGIN PASSWORD 'changeme';
+-- GRANT USAGE ON SCHEMA cyclopee TO mpcd_sync;
+-- GRANT SELECT, INSERT ON cyclopee.cyclopee_sample, cyclopee.water_sample, cyclopee.air_sample, cyclopee.cyclopee_window, cyclopee.wave_stats, cyclopee.sensor TO mpcd_sync;
+-- GRANT SELECT ON cyclopee.calibration TO mpcd_sync;
+-- GRANT SELECT, INSERT, UPDATE ON cyclopee.sync_state TO mpcd_sync;
+-- GRANT TEMPORARY ON DATABASE mpc TO mpcd_sync;
+
+-- ## Suivi
+-- SELECT gateway_id, synced_at, now() - synced_at AS retard FROM cyclopee.sync_state;
@@ -0,0 +1,165 @@
+-- ## Tables typées par type de satellite (alimentées par mpcd)
+-- ## Une table par type, colonnes float/int réelles, compression TimescaleDB native
+-- ## raw : ligne JSON d'origine, seulement si mpcd est lancé avec -r (audit)
+-- ## Les lignes de type inconnu restent dans cyclopee.sensor (jsonb)
+-- psql -U postgres -h localhost -d mpc -f typed_tables.sql
+
+CREATE SCHEMA IF NOT EXISTS cyclopee;
+
+-- ## Cyclopée : GNSS RTK + distance à l'eau (cyclopee_sat/GNSS_logger)
+CREATE TABLE IF NOT EXISTS cyclopee.cyclopee_sample
+(
+    time TIMESTAMPTZ NOT NULL,
+    sat_id TEXT NOT NULL,       -- btName;macAddr
+    lon DOUBLE PRECISION,       -- degrés
+    lat DOUBLE PRECISION,       -- degrés
+    elv DOUBLE PRECISION,       -- m, hauteur ellipsoïdale de l'antenne
+    fix SMALLINT,               -- 1 : autonome, 2 : DGPS, 4 : RTK fix, 5 : RTK float
+    pdop REAL,
+    dist REAL,                  -- mm, distance antenne / eau
+    temp REAL,                  -- °C
+    raw JSONB
+);
+SELECT create_hypertable('cyclopee.cyclopee_sample', 'time', if_not_exists => TRUE);
+CREATE INDEX IF NOT EXISTS idx_cyclopee_sample ON cyclopee.cyclopee_sample (sat_id, time DESC);
+
+-- ## Caisson eau : turbidité, conductivité (simple_mpc_sat/GNSS_logger)
+CREATE TABLE IF NOT EXISTS cyclopee.water_sample
+(
+    time TIMESTAMPTZ NOT NULL,
+    sat_id TEXT NOT NULL,
+    lon DOUBLE PRECISION,
+    lat DOUBLE PRECISION,
+    raw_turb REAL,              -- V
+    turb REAL,                  -- NTU
+    raw_cond REAL,              -- V
+    cond REAL,                  -- µS/cm
+    temp REAL,                  -- °C
+    raw JSONB
+);
+SELECT create_hypertable('cyclopee.water_sample', 'time', if_not_exists => TRUE);
+CREATE INDEX IF NOT EXISTS idx_water_sample ON cyclopee.water_sample (sat_id, time DESC);
+
+-- ## AIR_SAT : CO2, température, humidité, pression (air_sat)
+CREATE TABLE IF NOT EXISTS cyclopee.air_sample
+(
+    time TIMESTAMPTZ NOT NULL,
+    sat_id TEXT NOT NULL,
+    lon DOUBLE PRECISION,
+    lat DOUBLE PRECISION,
+    co2 INTEGER,                -- ppm
+    co2_temp REAL,              -- °C
+    co2_hum REAL,               -- %
+    bme_temp REAL,              -- °C
+    bme_hum REAL,               -- %
+    bme_pres REAL,              -- Pa
+    raw JSONB
+);
+SELECT create_hypertable('cyclopee.air_sample', 'time', if_not_exists => TRUE);
+CREATE INDEX IF NOT EXISTS idx_air_sample ON cyclopee.air_sample (sat_id, time DESC);
+
+-- ## Cyclopée : statistiques par fenêtre de temps (cyclopee_sat/GNSS_logger, flux agrégé)
+-- ## time : début de la fenêtre, duration : durée (s)
+CREATE TABLE IF NOT EXISTS cyclopee.cyclopee_window
+(
+    time TIMESTAMPTZ NOT NULL,
+    sat_id TEXT NOT NULL,
+    duration INTEGER,           -- s, membre window
+    lon_n INTEGER,              -- mesures de la fenêtre
+    lon_mean DOUBLE PRECISION,  -- degrés
+    lon_min DOUBLE PRECISION,   -- degrés
+    lon_max DOUBLE PRECISION,   -- degrés
+    lon_std REAL,               -- degrés, écart type
+    lat_n INTEGER,              -- mesures de la fenêtre
+    lat_mean DOUBLE PRECISION,  -- degrés
+    lat_min DOUBLE PRECISION,   -- degrés
+    lat_max DOUBLE PRECISION,   -- degrés
+    lat_std REAL,               -- degrés, écart type
+    elv_n INTEGER,              -- mesures de la fenêtre
+    elv_mean DOUBLE PRECISION,  -- m
+    elv_min DOUBLE PRECISION,   -- m
+    elv_max DOUBLE PRECISION,   -- m
+    elv_std REAL,               -- m, écart type
+    dist_n INTEGER,             -- mesures de la fenêtre
+    dist_mean REAL,             -- mm
+    dist_min REAL,              -- mm
+    dist_max REAL,              -- mm
+    dist_std REAL,              -- mm, écart type
+    temp_n INTEGER,             -- mesures de la fenêtre
+    temp_mean REAL,             -- °C
+    temp_min REAL,              -- °C
+    temp_max REAL,              -- °C
+    temp_std REAL,              -- °C, écart type
+    raw JSONB
+);
+SELECT create_hypertable('cyclopee.cyclopee_window', 'time', if_not_exists => TRUE);
+CREATE INDEX IF NOT EXISTS idx_cyclopee_window ON cyclopee.cyclopee_window (sat_id, time DESC);
+
+-- ## Cyclopée : houle, une ligne par rafale de mesures de distance (cyclopee_sat/GNSS_logger)
+-- ## time : début de la rafale, spectre moyen par bande de 0.05 Hz
+CREATE TABLE IF NOT EXISTS cyclopee.wave_stats
+(
+    time TIMESTAMPTZ NOT NULL,
+    sat_id TEXT NOT NULL,
+    mean_dist REAL,             -- mm, distance moyenne antenne / eau
+    hm0 REAL,                   -- mm, hauteur significative
+    tp REAL,                    -- s, période pic
+    tm01 REAL,                  -- s, période moyenne
+    valid REAL,                 -- part des mesures valides
+    psd_00 REAL,                -- mm²/Hz, bande 0.00-0.05 Hz
+    psd_01 REAL,
+    psd_02 REAL,
+    psd_03 REAL,
+    psd_04 REAL,
+    psd_05 REAL,
+    psd_06 REAL,
+    psd_07 REAL,
+    psd_08 REAL,
+    psd_09 REAL,
+    psd_10 REAL,
+    psd_11 REAL,
+    psd_12 REAL,
+    psd_13 REAL,
+    psd_14 REAL,
+    psd_15 REAL,                -- mm²/Hz, bande 0.75-0.80 Hz
+    raw JSONB
+);
+SELECT create_hypertable('cyclopee.wave_stats', 'time', if_not_exists => TRUE);
+CREATE INDEX IF NOT EXISTS idx_wave_stats ON cyclopee.wave_stats (sat_id, time DESC);
+
+-- ## Compression native : segments par satellite, chunks de plus de 7 jours
+ALTER TABLE cyclopee.cyclopee_sample SET (timescaledb.compress, timescaledb.compress_segmentby = 'sat_id', timescaledb.compress_orderby = 'time DESC');
+ALTER TABLE cyclopee.water_sample SET (timescaledb.compress, timescaledb.compress_segmentby = 'sat_id', timescaledb.compress_orderby = 'time DESC');
+ALTER TABLE cyclopee.air_sample SET (timescaledb.compress, timescaledb.compress_segmentby = 'sat_id', timescaledb.compress_orderby = 'time DESC');
+ALTER TABLE cyclopee.cyclopee_window SET (timescaledb.compress, timescaledb.compress_segmentby = 'sat_id', timescaledb.compress_orderby = 'time DESC');
+ALTER TABLE cyclopee.wave_stats SET (timescaledb.compress, timescaledb.compress_segmentby = 'sat_id', timescaledb.compress_orderby = 'time DESC');
+SELECT add_compression_policy('cyclopee.cyclopee_sample', INTERVAL '7 days', if_not_exists => TRUE);
+SELECT add_compression_policy('cyclopee.water_sample', INTERVAL '7 days', if_not_exists => TRUE);
+SELECT add_compression_policy('cyclopee.air_sample', INTERVAL '7 days', if_not_exists => TRUE);
+SELECT add_compression_policy('cyclopee.cyclopee_window', INTERVAL '7 days', if_not_exists => TRUE);
+SELECT add_compression_policy('cyclopee.wave_stats', INTERVAL '7 days', if_not_exists => TRUE);
+
+-- ## Satellites vus (variable $satellites de Grafana)
+CREATE OR REPLACE VIEW cyclopee.satellite_seen AS
+    SELECT time, sat_id FROM cyclopee.cyclopee_sample
+    UNION ALL SELECT time, sat_id FROM cyclopee.water_sample
+    UNION ALL SELECT time, sat_id FROM cyclopee.air_sample
+    UNION ALL SELECT time, sat_id FROM cyclopee.cyclopee_window
+    UNION ALL SELECT time, sat_id FROM cyclopee.wave_stats
+    UNION ALL SELECT time, data ->>'id' FROM cyclopee.sensor;
+
+-- ## Reprise des données jsonb existantes (à lancer une seule fois)
+-- INSERT INTO cyclopee.cyclopee_sample
+--     SELECT time, data ->>'id', (data ->>'lon')::float8, (data ->>'lat')::float8, (data ->>'elv')::float8,
+--            (data ->>'fix')::smallint, (data ->>'pdop')::real, (data ->>'dist')::real, (data ->>'temp')::real, NULL
+--     FROM cyclopee.sensor WHERE data ? 'elv' AND data ? 'dist';
+-- INSERT INTO cyclopee.water_sample
+--     SELECT time, data ->>'id', (data ->>'lon')::float8, (data ->>'lat')::float8, (data ->>'raw_turb')::real,
+--            (data ->>'turb')::real, (data ->>'raw_cond')::real, (data ->>'cond')::real, (data ->>'temp')::real, NULL
+--     FROM cyclopee.sensor WHERE data ? 'turb' AND data ? 'cond';
+-- INSERT INTO cyclopee.air_sample
+--     SELECT time, data ->>'id', (data ->>'lon')::float8, (data ->>'lat')::float8, (data ->>'Co2')::integer,
+--            (data ->>'Co2_Temperature')::real, (data ->>'Co2_Humidity')::real, (data ->>'BME_Temperature')::real,
+--            (data ->>'BME_Humidity')::real, (data ->>'BME_Pressure')::real, NULL
+--     FROM cyclopee.sensor WHERE data ? 'Co2';
+-- DELETE FROM cyclopee.sensor WHERE (data ? 'elv' AND data ? 'dist') OR (data ? 'turb' AND data ? 'cond') OR data ? 'Co2';
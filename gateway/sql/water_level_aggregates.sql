@@ -0,0 +1,118 @@
+-- ## Hauteur d'eau Cyclopée : agrégats continus 1 s, 1 min, 10 min
+-- ## A lancer après typed_tables.sql
+-- psql -U postgres -h localhost -d mpc -f water_level_aggregates.sql
+--
+-- Les agrégats ne portent que sur les mesures RTK fix (fix = 4) avec une distance valide (< 5 m),
+-- et stockent somme, nombre, min et max de (elv - dist) : ils ne dépendent pas de l'étalonnage.
+-- Les offsets de chaque satellite sont appliqués par les vues water_level_* à la lecture,
+-- un changement d'étalonnage ne demande donc aucun recalcul des agrégats.
+
+-- ## Étalonnage des satellites
+-- hauteur d'eau = elv - dist - antenna_offset_m + datum_offset_m
+CREATE TABLE IF NOT EXISTS cyclopee.calibration
+(
+    sat_id TEXT NOT NULL,               -- btName;macAddr
+    valid_from TIMESTAMPTZ NOT NULL,
+    valid_to TIMESTAMPTZ,               -- NULL : étalonnage en cours
+    antenna_offset_m DOUBLE PRECISION NOT NULL DEFAULT 0,  -- centre de phase antenne / zéro du capteur de distance
+    datum_offset_m DOUBLE PRECISION NOT NULL DEFAULT 0,    -- hauteur ellipsoïdale -> zéro hydrographique
+    note TEXT,
+    PRIMARY KEY (sat_id, valid_from)
+);
+-- ex. : valeurs des panneaux Grafana La Pallice
+-- INSERT INTO cyclopee.calibration (sat_id, valid_from, antenna_offset_m, datum_offset_m, note)
+--     VALUES ('CYCLOPEE_1;98:D3:B1:FD:C3:2C', '2023-01-01', 0.086, -46.941 + 3.447, 'zéro hydro La Pallice');
+
+-- ## 1 s
+CREATE MATERIALIZED VIEW IF NOT EXISTS cyclopee.water_elv_1s
+WITH (timescaledb.continuous) AS
+    SELECT time_bucket(INTERVAL '1 second', time) AS bucket,
+           sat_id,
+           sum(elv - dist / 1000) AS sum_m,
+           count(*) AS nb,
+           min(elv - dist / 1000) AS min_m,
+           max(elv - dist / 1000) AS max_m
+    FROM cyclopee.cyclopee_sample
+    WHERE fix = 4 AND dist < 5000
+    GROUP BY bucket, sat_id
+WITH NO DATA;
+
+-- ## 1 min (agrégat hiérarchique sur 1 s)
+CREATE MATERIALIZED VIEW IF NOT EXISTS cyclopee.water_elv_1min
+WITH (timescaledb.continuous) AS
+    SELECT time_bucket(INTERVAL '1 minute', bucket) AS bucket,
+           sat_id,
+           sum(sum_m) AS sum_m,
+           sum(nb) AS nb,
+           min(min_m) AS min_m,
+           max(max_m) AS max_m
+    FROM cyclopee.water_elv_1s
+    GROUP BY time_bucket(INTERVAL '1 minute', bucket), sat_id
+WITH NO DATA;
+
+-- ## 10 min (agrégat hiérarchique sur 1 min)
+CREATE MATERIALIZED VIEW IF NOT EXISTS cyclopee.water_elv_10min
+WITH (timescaledb.continuous) AS
+    SELECT time_bucket(INTERVAL '10 minutes', bucket) AS bucket,
+           sat_id,
+           sum(sum_m) AS sum_m,
+           sum(nb) AS nb,
+           min(min_m) AS min_m,
+           max(max_m) AS max_m
+    FROM cyclopee.water_elv_1min
+    GROUP BY time_bucket(INTERVAL '10 minutes', bucket), sat_id
+WITH NO DATA;
+
+-- ## Rafraîchissement incrémental : seuls les buckets récents sont recalculés
+-- Les données plus récentes que end_offset sont agrégées à la volée (agrégation temps réel)
+SELECT add_continuous_aggregate_policy('cyclopee.water_elv_1s',
+    start_offset => INTERVAL '1 hour', end_offset => INTERVAL '10 seconds', schedule_interval => INTERVAL '10 seconds', if_not_exists => TRUE);
+SELECT add_continuous_aggregate_policy('cyclopee.water_elv_1min',
+    start_offset => INTERVAL '1 day', end_offset => INTERVAL '1 minute', schedule_interval => INTERVAL '1 minute', if_not_exists => TRUE);
+SELECT add_continuous_aggregate_policy('cyclopee.water_elv_10min',
+    start_offset => INTERVAL '7 days', end_offset => INTERVAL '10 minutes', schedule_interval => INTERVAL '10 minutes', if_not_exists => TRUE);
+ALTER MATERIALIZED VIEW cyclopee.water_elv_1s SET (timescaledb.materialized_only = false);
+ALTER MATERIALIZED VIEW cyclopee.water_elv_1min SET (timescaledb.materialized_only = false);
+ALTER MATERIALIZED VIEW cyclopee.water_elv_10min SET (timescaledb.materialized_only = false);
+
+-- ## Les buckets 1 s ne sont gardés que 30 jours (les vues 1 min et 10 min couvrent les vues longues)
+SELECT add_retention_policy('cyclopee.water_elv_1s', INTERVAL '30 days', if_not_exists => TRUE);
+
+-- ## Hauteur d'eau étalonnée
+-- surface_elv_m : hauteur ellipsoïdale de la surface de l'eau
+-- level_m : hauteur d'eau par rapport au datum (zéro hydrographique)
+-- Sans étalonnage valide, les offsets sont nuls (hauteur de l'antenne moins la distance)
+CREATE OR REPLACE VIEW cyclopee.water_level_1s AS
+    SELECT a.bucket AS time, a.sat_id,
+           a.sum_m / a.nb - coalesce(c.antenna_offset_m, 0) AS surface_elv_m,
+           a.sum_m / a.nb - coalesce(c.antenna_offset_m, 0) + coalesce(c.datum_offset_m, 0) AS level_m,
+           a.min_m - coalesce(c.antenna_offset_m, 0) + coalesce(c.datum_offset_m, 0) AS min_m,
+           a.max_m - coalesce(c.antenna_offset_m, 0) + coalesce(c.datum_offset_m, 0) AS max_m,
+           a.nb
+    FROM cyclopee.water_elv_1s a
+    LEFT JOIN cyclopee.calibration c ON c.sat_id = a.sat_id AND a.bucket >= c.valid_from AND (c.valid_to IS NULL OR a.bucket < c.valid_to);
+
+CREATE OR REPLACE VIEW cyclopee.water_level_1min AS
+    SELECT a.bucket AS time, a.sat_id,
+           a.sum_m / a.nb - coalesce(c.antenna_offset_m, 0) AS surface_elv_m,
+           a.sum_m / a.nb - coalesce(c.antenna_offset_m, 0) + coalesce(c.datum_offset_m, 0) AS level_m,
+           a.min_m - coalesce(c.antenna_offset_m, 0) + coalesce(c.datum_offset_m, 0) AS min_m,
+           a.max_m - coalesce(c.antenna_offset_m, 0) + coalesce(c.datum_offset_m, 0) AS max_m,
+           a.nb
+    FROM cyclopee.water_elv_1min a
+    LEFT JOIN cyclopee.calibration c ON c.sat_id = a.sat_id AND a.bucket >= c.valid_from AND (c.valid_to IS NULL OR a.bucket < c.valid_to);
+
+CREATE OR REPLACE VIEW cyclopee.water_level_10min AS
+    SELECT a.bucket AS time, a.sat_id,
+           a.sum_m / a.nb - coalesce(c.antenna_offset_m, 0) AS surface_elv_m,
+           a.sum_m / a.nb - coalesce(c.antenna_offset_m, 0) + coalesce(c.datum_offset_m, 0) AS level_m,
+           a.min_m - coalesce(c.antenna_offset_m, 0) + coalesce(c.datum_offset_m, 0) AS min_m,
+           a.max_m - coalesce(c.antenna_offset_m, 0) + coalesce(c.datum_offset_m, 0) AS max_m,
+           a.nb
+    FROM cyclopee.water_elv_10min a
+    LEFT JOIN cyclopee.calibration c ON c.sat_id = a.sat_id AND a.bucket >= c.valid_from AND (c.valid_to IS NULL OR a.bucket < c.valid_to);
+
+-- ## Calcul initial sur les données existantes
+-- CALL refresh_continuous_aggregate('cyclopee.water_elv_1s', NULL, now() - INTERVAL '10 seconds');
+-- CALL refresh_continuous_aggregate('cyclopee.water_elv_1min', NULL, now() - INTERVAL '1 minute');
+-- CALL refresh_continuous_aggregate('cyclopee.water_elv_10min', NULL, now() - INTERVAL '10 minutes');
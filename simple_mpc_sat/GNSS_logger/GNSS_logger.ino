@@ -7,6 +7,9 @@
  *    This program logs distance and temperature readings into a log file on the SD card 
  *    using GNSS time. GNSS signal quality is logged as well.
  *    Log file segmentation and new day file creation are handled.
+ *    Turbidity, conductivity and temperature are sent on change
+ *    (Change_filter.h): unchanged values are replaced by a marker, lines
+ *    are written one sample late.
  *   
  * @board :
  *    Teensy 3.5
@@ -85,8 +88,7 @@
 #define GNSS_BAUDRATE 115200//bauds
 // Time value if GNSS module disconnected
 #define NO_GNSS_TIME      24606099 // HH:MM:SS.CC
-// Longitude/latitude value if GNSS module disconnected
-#define NO_GNSS_LOCATION  91//°
+// Longitude/latitude not received are GnssCoord::none() (GNSS_fixed.h)
 // NMEA messages inteval
 #define GNSS_NMEA_INTERVAL  200//ms
 
@@ -100,6 +102,16 @@
 // Conductivity
 #define COND_DECIMALS 2
 
+/************** CHANGE FILTERS *****************/
+// Largest error of the values rebuilt by the gateway (Change_filter.h)
+#define RAW_TURB_TOLERANCE  0.002/*V*/
+#define TURB_TOLERANCE      5.0/*NTU*/
+#define RAW_COND_TOLERANCE  1.0/*mV*/
+#define COND_TOLERANCE      0.02/*mS/cm*/
+#define TEMP_TOLERANCE      0.05/*°C*/
+// A value is sent at least every CF_HEARTBEAT samples
+#define CF_HEARTBEAT        60
+
 /************** BUFFERS *****************/
 // Maximum buffer size
 #define MAX_BUFFER_SIZE  100
@@ -114,6 +126,16 @@ enum Devices : uint8_t  {
   TURBIDITY,
   CONDUCTIVITY
 };
+// Channels sent on change
+enum FilteredChannels : uint8_t  {
+
+  F_RAW_TURB = 0,
+  F_TURB,
+  F_RAW_COND,
+  F_COND,
+  F_TEMP,
+  NB_FILTERED
+};
 
 /************** DEBUG *****************/
 // Serial debug
@@ -142,19 +164,24 @@ enum Devices : uint8_t  {
  * #   FUNCTION PROTOTYPES   #
  * ###########################
  */
+// System module types (modules included below)
+struct GnssCoord;
 // Sd card setup
 void setupSDCard(volatile bool& deviceConnected);
 // Log file setup
 void handleLogFile(File& file, String& dirName, String& fileName, TinyGPSPlus& gnss, Metro& logSegCountdown, volatile bool& deviceConnected);
-bool logToSD(File& file, const uint32_t& timeVal, const double& lng_deg, const double& lat_deg, const float& rawTurb, const float& turb, const float& rawCond, const float& cond, const float& temp_C);
+bool logToSD(File& file, const uint32_t& timeVal, const GnssCoord& lng_deg, const GnssCoord& lat_deg, const float* values, const char* markers);
 void dumpFileToSerial(File& file);
 // GNSS setup
 void setupGNSS(TinyGPSPlus& gnss, volatile bool& deviceConnected);
 void gnssRefresh();
 // Bluetooth communication
 void setupBluetooth(String& satelliteID, volatile bool& deviceConnected);
-void sendDataToBluetooth(TinyGPSDate& gnssDate, const uint32_t& timeVal, const double& lng_deg, const double& lat_deg, const float& rawTurb, const float& turb, const float& rawCond, const float& cond, const float& temp_C);
+void sendDataToBluetooth(const String& satelliteID, TinyGPSDate& gnssDate, const uint32_t& timeVal, const GnssCoord& lng_deg, const GnssCoord& lat_deg, const float* values, const char* markers);
 void readBluetoothOrders();
+// Change filters
+void logRecord(File& file, const uint32_t& timeVal, const GnssCoord& lng_deg, const GnssCoord& lat_deg, const float* values);
+void flushRecord(File& file);
 // Sensor reading interrupt
 void readSensors();
 // Digital IO update interrupt
@@ -162,6 +189,13 @@ void handleDigitalIO();
 // Handling errors
 void waitForReboot(const String& msg);
 
+/* ######################
+ * #   SYSTEM MODULES   #
+ * ######################
+ */
+#include "GNSS_fixed.h"
+#include "Change_filter.h"
+
 /* ######################
  * #   SENSOR MODULES   #
  * ######################
@@ -193,6 +227,23 @@ TinyGPSPlus gnss;
 // Bluetooth
 String satelliteID;
 
+// CHANGE FILTERS
+ChangeFilter filters[NB_FILTERED] = {
+  ChangeFilter(CF_DEADBAND, RAW_TURB_TOLERANCE),
+  ChangeFilter(CF_DEADBAND, TURB_TOLERANCE),
+  ChangeFilter(CF_SWINGING_DOOR, RAW_COND_TOLERANCE),
+  ChangeFilter(CF_SWINGING_DOOR, COND_TOLERANCE),
+  ChangeFilter(CF_SWINGING_DOOR, TEMP_TOLERANCE)
+};
+const uint8_t filteredDecimals[NB_FILTERED] = {3, TURB_DECIMALS, 3, COND_DECIMALS, TEMP_DECIMALS};
+// Record waiting for the filter decisions
+bool hasPendingRecord = false;
+uint32_t pendingTime;
+GnssCoord pendingLng, pendingLat;
+// Values to write, marker of the values not sent ('\0' if sent)
+float sentValues[NB_FILTERED];
+char sentMarkers[NB_FILTERED];
+
 // Timer interrputs
 IntervalTimer sensorRead_timer, gnssRefresh_timer, ioRefresh_timer;
 
@@ -268,12 +319,12 @@ void setup() {
 /************** LOOP() GLOBAL VARS *****************/
 // Buffers to store values to log
 RingBuf <uint32_t, MAX_BUFFER_SIZE> time_buf;
-RingBuf <double, MAX_BUFFER_SIZE> lng_buf, lat_buf;
+RingBuf <GnssCoord, MAX_BUFFER_SIZE> lng_buf, lat_buf;
 RingBuf <float, MAX_BUFFER_SIZE> temp_buf, rawTurb_buf, turb_buf, rawCond_buf, cond_buf;
 
 // Variables to store buffer readings
 uint32_t time_ms;
-double lng_deg, lat_deg;
+GnssCoord lng_deg, lat_deg;
 float temp_C, rawTurb, turb, rawCond, cond;
 
 /*
@@ -296,8 +347,12 @@ void loop() {
   // File management and data storage
   // If buffers are empty
   if (time_buf.isEmpty()) {
-    if (!enLog)
+    if (!enLog)  {
+      // Last line of the series
+      if (hasPendingRecord)
+        flushRecord(logFile);
       logFile.close();
+    }
   }
   else {
     // Handling log file management
@@ -312,10 +367,15 @@ void loop() {
     rawCond_buf.pop(rawCond);
     cond_buf.pop(cond);
     // -----------------
-    if ( !logToSD(logFile, time_ms, lng_deg, lat_deg, rawTurb, turb, rawCond, cond, temp_C) )
-      SERIAL_DBG("Logging failed...\n")
-
-    sendDataToBluetooth(satelliteID, gnss.date, time_ms, lng_deg, lat_deg, rawTurb, turb, rawCond, cond, temp_C);
+    // Missing values are NAN for the change filters
+    float values[NB_FILTERED] = {
+      rawTurb,
+      (turb != TURB_NO_VALUE) ? turb : NAN,
+      rawCond,
+      (cond != EC_NO_VALUE) ? cond : NAN,
+      (temp_C != TEMP_NO_VALUE) ? temp_C : NAN
+    };
+    logRecord(logFile, time_ms, lng_deg, lat_deg, values);
   }
 
   // Debug serial output
@@ -388,13 +448,14 @@ void readSensors()  {
         time_buf.lockedPush(gnss.time.value());
       else
         time_buf.push(NO_GNSS_TIME);
+      // Fixed point values as parsed, no double emulation in the interrupt
       if (gnss.location.isUpdated()) {
-        lng_buf.lockedPush(gnss.location.lng());
-        lat_buf.lockedPush(gnss.location.lat());
+        lng_buf.lockedPush(GnssCoord::fromRaw(gnss.location.rawLng()));
+        lat_buf.lockedPush(GnssCoord::fromRaw(gnss.location.rawLat()));
       }
       else  {
-        lng_buf.push(NO_GNSS_LOCATION);
-        lat_buf.push(NO_GNSS_LOCATION);
+        lng_buf.push(GnssCoord::none());
+        lat_buf.push(GnssCoord::none());
       }
 
       // Acquire temperature
@@ -416,6 +477,93 @@ void readSensors()  {
   //Serial.println(millis() - t);
 }
 
+/* ##############   CHANGE FILTERS    ################ */
+/*
+ * @brief:
+ *    Writes the pending record (SD card and Bluetooth) with the values
+ *    and markers of the filter decisions.
+ * @params:
+ *    file: Log file.
+ */
+void writePendingRecord(File& file)  {
+
+  if ( !logToSD(file, pendingTime, pendingLng, pendingLat, sentValues, sentMarkers) )
+    SERIAL_DBG("Logging failed...\n")
+  sendDataToBluetooth(satelliteID, gnss.date, pendingTime, pendingLng, pendingLat, sentValues, sentMarkers);
+}
+
+/*
+ * @brief:
+ *    Adds a record to the change filters, writes the previous one with
+ *    their decisions and keeps this one pending.
+ * @params:
+ *    file: Log file.
+ *    timeVal: Time value of the record.
+ *    lng_deg, lat_deg: Location of the record.
+ *    values: Filtered channels (FilteredChannels), NAN if missing.
+ */
+void logRecord(File& file, const uint32_t& timeVal, const GnssCoord& lng_deg, const GnssCoord& lat_deg, const float* values)  {
+
+  for (uint8_t c = 0; c < NB_FILTERED; c++)  {
+    bool sent = filters[c].add(values[c]);
+    sentValues[c] = filters[c].value();
+    sentMarkers[c] = sent ? '\0' : filters[c].marker();
+  }
+  if (hasPendingRecord)
+    writePendingRecord(file);
+  pendingTime = timeVal;
+  pendingLng = lng_deg;
+  pendingLat = lat_deg;
+  hasPendingRecord = true;
+}
+
+/*
+ * @brief:
+ *    Writes the pending record with all its values and ends the filter
+ *    series: a log file starts and ends with values, it is rebuilt
+ *    without the other files.
+ * @params:
+ *    file: Log file.
+ */
+void flushRecord(File& file)  {
+
+  if (!hasPendingRecord)
+    return;
+  for (uint8_t c = 0; c < NB_FILTERED; c++)  {
+    filters[c].flush();
+    sentValues[c] = filters[c].value();
+    sentMarkers[c] = '\0';
+  }
+  writePendingRecord(file);
+  hasPendingRecord = false;
+}
+
+/*
+ * @brief:
+ *    Appends a filtered value to a log string.
+ * @params:
+ *    str: Log string.
+ *    value: Value, NAN if missing.
+ *    marker: Marker if the value is not sent, '\0' otherwise.
+ *    decimals: Number of decimals.
+ *    noValue: Text of a missing value.
+ *    quoted: Marker written as a JSON string.
+ */
+void appendFiltered(String& str, const float& value, const char& marker, const uint8_t& decimals, const char* noValue, bool quoted)  {
+
+  if (marker)  {
+    if (quoted)
+      str += '"';
+    str += marker;
+    if (quoted)
+      str += '"';
+  }
+  else if (isnan(value))
+    str += noValue;
+  else
+    str += String(value, decimals);
+}
+
 /* ##############   BLUETOOTH    ################ */
 
 bool sendATCommand(const String& cmd, String* pAns = NULL) {
@@ -529,9 +677,10 @@ void setupBluetooth(String& satelliteID)  {
   SERIAL_DBG("Done.\n")
 } 
 
-void json_logStr(String& str, const String& satelliteID, TinyGPSDate& gnssDate, const uint32_t& timeVal, const double& lng_deg, const double& lat_deg, const float& rawTurb, const float& turb, const float& rawCond, const float& cond, const float& temp_C) {
+void json_logStr(String& str, const String& satelliteID, TinyGPSDate& gnssDate, const uint32_t& timeVal, const GnssCoord& lng_deg, const GnssCoord& lat_deg, const float* values, const char* markers) {
 
   String timeVal_str = "", date_str = "";
+  char num_str[GNSS_COORD_STR_LEN];
   str = "" ;
   timeValToStr(timeVal, timeVal_str);
   dateToStr(gnssDate, date_str);
@@ -548,49 +697,35 @@ void json_logStr(String& str, const String& satelliteID, TinyGPSDate& gnssDate,
   str += ',';
   // Inserting longitude
   str += "\"lon\":";
-  if (lng_deg != NO_GNSS_LOCATION)
-    str += String(lng_deg, LOC_DECIMALS);
+  if (lng_deg.isValid())  {
+    lng_deg.format(num_str, LOC_DECIMALS);
+    str += num_str;
+  }
   else
     str += "null";
   str += ',';
   // Inserting latitude
   str += "\"lat\":";
-  if (lat_deg != NO_GNSS_LOCATION)
-    str += String(lat_deg, LOC_DECIMALS);
-  else
-    str += "null";
-  str += ',';
-  // Inserting raw turbidity
-  str += "\"raw_turb\":" + String(rawTurb, 3) + ',';
-  // Inserting turbidity
-  str += "\"turb\":";
-  if (turb != TURB_NO_VALUE)
-    str += String(turb, TURB_DECIMALS);
-  else
-    str += "null";
-  str += ',';
-  // Inserting raw cnductivity
-  str += "\"raw_cond\":" + String(rawCond, 3) + ',';
-  // Inserting turbidity
-  str += "\"cond\":";
-  if (cond != EC_NO_VALUE)
-    str += String(cond, COND_DECIMALS);
+  if (lat_deg.isValid())  {
+    lat_deg.format(num_str, LOC_DECIMALS);
+    str += num_str;
+  }
   else
     str += "null";
   str += ',';
-  // Inserting temperature
-  str += "\"temp\":";
-  if (temp_C != TEMP_NO_VALUE)
-    str += String(temp_C, TEMP_DECIMALS);
-  else
-    str += "null";
-  str += '}';
+  // Inserting filtered channels, markers as strings
+  const char* keys[NB_FILTERED] = {"raw_turb", "turb", "raw_cond", "cond", "temp"};
+  for (uint8_t c = 0; c < NB_FILTERED; c++)  {
+    str += "\"" + String(keys[c]) + "\":";
+    appendFiltered(str, values[c], markers[c], filteredDecimals[c], "null", true);
+    str += (c < NB_FILTERED - 1) ? ',' : '}';
+  }
 }
 
-void sendDataToBluetooth(const String& satelliteID, TinyGPSDate& gnssDate, const uint32_t& timeVal, const double& lng_deg, const double& lat_deg, const float& rawTurb, const float& turb, const float& rawCond, const float& cond, const float& temp_C)  {
+void sendDataToBluetooth(const String& satelliteID, TinyGPSDate& gnssDate, const uint32_t& timeVal, const GnssCoord& lng_deg, const GnssCoord& lat_deg, const float* values, const char* markers)  {
 
   String str = "";
-  json_logStr(str, satelliteID, gnssDate, timeVal, lng_deg, lat_deg, rawTurb, turb, rawCond, cond, temp_C);
+  json_logStr(str, satelliteID, gnssDate, timeVal, lng_deg, lat_deg, values, markers);
   BLUETOOTH_SERIAL.println(str);
 }
 
@@ -809,7 +944,9 @@ void handleLogFile(File& file, String& dirName, String& fileName, TinyGPSPlus& g
     String currDate;
     dateToStr(gnss.date, currDate);
   
+    // The pending line ends the closed file
     if ( !file || dirName != currDate)  {
+      flushRecord(file);
       file.close();
       dirName = currDate;
       timeToStr(gnss.time, fileName);
@@ -817,6 +954,7 @@ void handleLogFile(File& file, String& dirName, String& fileName, TinyGPSPlus& g
     }
     // Create new log segment
     else if (logSegCountdown.check()) {
+      flushRecord(file);
       file.close();
       timeToStr(gnss.time, fileName);
       fileName += ".csv";
@@ -853,13 +991,14 @@ void handleLogFile(File& file, String& dirName, String& fileName, TinyGPSPlus& g
  *    timeVal : Time value to log.
  *    lng_deg : Longitude in ° to log.
  *    lat_deg : Latitude in ° to log.
- *    elv_m : Longitude in cm to log.
- *    turb : Distance in mm to log.
- *    temp_C : Temperature in °C to log.
+ *    values : Filtered channels to log (FilteredChannels), NAN if missing.
+ *    markers : Marker of the values not sent, '\0' otherwise.
  */
-void csv_logStr(String& log_str, const uint32_t& timeVal, const double& lng_deg, const double& lat_deg, const float& rawTurb, const float& turb, const float& rawCond, const float& cond, const float& temp_C)  {
+void csv_logStr(String& log_str, const uint32_t& timeVal, const GnssCoord& lng_deg, const GnssCoord& lat_deg, const float* values, const char* markers)  {
 
   SERIAL_DBG("\n---> csv_logStr()\n") 
+
+  char num_str[GNSS_COORD_STR_LEN];
   
   // Inserting GNSS time into log string
   if (timeVal != NO_GNSS_TIME)
@@ -870,45 +1009,33 @@ void csv_logStr(String& log_str, const uint32_t& timeVal, const double& lng_deg,
   }
   log_str += ',';
   // Inserting GNSS longitude into log string
-  if (lng_deg != NO_GNSS_LOCATION)
-    log_str += String(lng_deg, LOC_DECIMALS);
+  if (lng_deg.isValid())  {
+    lng_deg.format(num_str, LOC_DECIMALS);
+    log_str += num_str;
+  }
   else  {
     SERIAL_DBG("No GNSS location response, check wiring...\n")
     log_str += "NaN";
   }
   log_str += ',';
   // Inserting GNSS latitude into log string
-  if (lat_deg != NO_GNSS_LOCATION)
-    log_str += String(lat_deg, LOC_DECIMALS);
+  if (lat_deg.isValid())  {
+    lat_deg.format(num_str, LOC_DECIMALS);
+    log_str += num_str;
+  }
   else  {
     SERIAL_DBG("No GNSS location response, check wiring...\n")
     log_str += "NaN";
   }
   log_str += ',';
-  // Inserting raw turbidity into log string
-  log_str += String(rawTurb, 3) + ',';
-  // Inserting turbidity into log string
-  if (turb != TURB_NO_VALUE)
-    log_str += String(turb, TURB_DECIMALS);
-  else
-    log_str += "NaN";
-  log_str += ',';
-  // Inserting raw conductivity into log string
-  log_str += String(rawCond, 3) + ',';
-  // Inserting conductivity into log string
-  if (cond != EC_NO_VALUE)
-    log_str += String(cond, COND_DECIMALS);
-  else
-    log_str += "NaN";
-  log_str += ',';
-  
-  // Inserting external temperature into log string
-  if (temp_C != TEMP_NO_VALUE)
-    log_str += String(temp_C, TEMP_DECIMALS);
-  else  {
-    SERIAL_DBG("No temperature response, check wiring...\n")
-    log_str += "NaN";
+  // Inserting filtered channels into log string
+  for (uint8_t i = 0; i < NB_FILTERED; i++)  {
+    appendFiltered(log_str, values[i], markers[i], filteredDecimals[i], "NaN", false);
+    if (i < NB_FILTERED - 1)
+      log_str += ',';
   }
+  if (isnan(values[F_TEMP]) && !markers[F_TEMP])
+    SERIAL_DBG("No temperature response, check wiring...\n")
 }
 
 /*
@@ -919,14 +1046,13 @@ void csv_logStr(String& log_str, const uint32_t& timeVal, const double& lng_deg,
  *    timeVal : Time value to log.
  *    lng_deg : Longitude in ° to log.
  *    lat_deg : Latitude in ° to log.
- *    elv_m : Longitude in cm to log.
- *    turb : Distance in mm to log.
- *    temp_C : Temperature in °C to log.
+ *    values : Filtered channels to log (FilteredChannels), NAN if missing.
+ *    markers : Marker of the values not sent, '\0' otherwise.
  */
-bool logToSD(File& file, const uint32_t& timeVal, const double& lng_deg, const double& lat_deg, const float& rawTurb, const float& turb, const float& rawCond, const float& cond, const float& temp_C) {
+bool logToSD(File& file, const uint32_t& timeVal, const GnssCoord& lng_deg, const GnssCoord& lat_deg, const float* values, const char* markers) {
 
   String log_str;
-  csv_logStr(log_str, timeVal, lng_deg, lat_deg, rawTurb, turb, rawCond, cond, temp_C);
+  csv_logStr(log_str, timeVal, lng_deg, lat_deg, values, markers);
   // Check if log file is open
   if (!file)
     return false;
@@ -28,7 +28,8 @@
  *      DS18B20 Yellow -> Teensy 21
  *      
  * @ports:
- *      Serial (115200 baud)
+ *      Serial (115200 baud) : debug and time orders
+ *      Serial5 (115200 baud) : optional GNSS module NMEA output (time sync)
  *      Serial4 (9600 baud configured in URM14)
  * --------------------------
  */
@@ -37,8 +38,14 @@
  * ##########################
  */
 /************** SERIAL PORTS *****************/
-
-/* Current date & time */
+// Port receiving time orders ({"order":"setTime","time":<UTC ms>})
+// Set to Bluetooth module port if one is wired
+#define ORDER_SERIAL  Serial
+// Port receiving NMEA from an optional GNSS module
+#define GNSS_SERIAL   Serial5
+#define GNSS_BAUDRATE 115200//bauds
+
+/* Fallback date & time, used if RTC is not set (no coin cell) */
 #define YEAR      2023
 #define MONTH     7
 #define DAY       20
@@ -81,7 +88,8 @@ enum Devices : uint8_t  {
   SD_CARD = 0,
   TEMPERATURE,
   TURBIDITY,
-  CONDUCTIVITY
+  CONDUCTIVITY,
+  CLOCK
 };
 
 /************** DEBUG *****************/
@@ -105,6 +113,7 @@ enum Devices : uint8_t  {
 #include <TimeLib.h>
 #include <SD.h>
 #include <Metro.h>
+#include <TinyGPSPlus.h>
 
 /* ###########################
  * #   FUNCTION PROTOTYPES   #
@@ -116,12 +125,20 @@ void waitForReboot(const String& msg);
 void setupSDCard(volatile bool& deviceConnected);
 // Log file setup
 void handleLogFile(File& file, String& dirName, String& fileName, Metro& logSegCountdown, volatile bool& deviceConnected);
-bool logToSD(File& file, const long& timestamp, const float& rawTurb, const float& turb, const float& rawCond, const float& cond, const float& temp_C);
+bool logToSD(File& file, const uint64_t& timestamp, const uint32_t& timeUnc_ms, const float& rawTurb, const float& turb, const float& rawCond, const float& cond, const float& temp_C);
 void dumpFileToSerial(File& file);
 // Sensor reading interrupt
 void readSensors();
 // Digital IO update interrupt
 void handleDigitalIO();
+// Clock sync from GNSS or time orders
+void handleClockSync();
+
+/* ######################
+ * #   SYSTEM MODULES   #
+ * ######################
+ */
+#include "RTC_clock.h"
 
 /* ######################
  * #   SENSOR MODULES   #
@@ -137,7 +154,7 @@ void handleDigitalIO();
  */
 /************** GLOBALS *****************/
 // Array to store devices connection state
-volatile bool connectedDevices[4] = {false, false, false};
+volatile bool connectedDevices[5] = {false};
 
 // LOGGING
 // Log file
@@ -161,6 +178,11 @@ Metro logSegCountdown = Metro(LOG_SEG_INTERVAL);
 // Timer to dump log file every 1s
 Metro fileDumpCountdown = Metro(1000);
 
+// GNSS NMEA parser (time sync)
+TinyGPSPlus gnss;
+// Time order being received
+String order = "";
+
 /*
  *  @brief:
  *    Sets up SD card, distance and temperature sensors.
@@ -192,8 +214,12 @@ void setup() {
   //setupCondSensor(connectedDevices[CONDUCTIVITY]);
   SERIAL_DBG('\n')
   
-  // Setting time
-  setTime(HOURS, MINUTES, SECONDS, DAY, MONTH, YEAR);
+  // Setting up clock
+  tmElements_t fallbackTime = {SECONDS, MINUTES, HOURS, 0, DAY, MONTH, (uint8_t)CalendarYrToTm(YEAR)};
+  setupClock(connectedDevices[CLOCK], makeTime(fallbackTime));
+  SERIAL_DBG('\n')
+  // GNSS serial port (time sync)
+  GNSS_SERIAL.begin(GNSS_BAUDRATE);
   // Setting up timer interrupts
   sensorRead_timer.begin(readSensors, READ_INTERVAL);
   sensorRead_timer.priority(200);
@@ -208,11 +234,13 @@ void setup() {
 
 /************** LOOP() GLOBAL VARS *****************/
 // Buffers to store values to log
-RingBuf <long, MAX_BUFFER_SIZE> timestamp_buf;
+RingBuf <uint64_t, MAX_BUFFER_SIZE> timestamp_buf;
+RingBuf <uint32_t, MAX_BUFFER_SIZE> timeUnc_buf;
 RingBuf <float, MAX_BUFFER_SIZE> temp_buf, rawTurb_buf, turb_buf, rawCond_buf, cond_buf;
 
 // Variables to store buffer readings
-long timestamp;
+uint64_t timestamp;
+uint32_t timeUnc_ms;
 float temp_C, rawTurb, turb, rawCond, cond;
 
 /*
@@ -243,16 +271,20 @@ void loop() {
     handleLogFile(logFile, logDir, logFileName, logSegCountdown, connectedDevices[SD_CARD]);
     // Create function for this
     timestamp_buf.pop(timestamp);
+    timeUnc_buf.pop(timeUnc_ms);
     temp_buf.pop(temp_C);
     rawTurb_buf.pop(rawTurb);
     turb_buf.pop(turb);
     rawCond_buf.pop(rawCond);
     cond_buf.pop(cond);
     // -----------------
-    if ( !logToSD(logFile, timestamp, rawTurb, turb, rawCond, cond, temp_C) )
+    if ( !logToSD(logFile, timestamp, timeUnc_ms, rawTurb, turb, rawCond, cond, temp_C) )
       SERIAL_DBG("Logging failed...\n")
   }
 
+  // Clock sync
+  handleClockSync();
+
   // Debug serial output
   SERIAL_DBG("#### LOOP FUNCTION ####\n\n")
 
@@ -269,6 +301,9 @@ void loop() {
   SERIAL_DBG('\n')
   SERIAL_DBG("CONDUCTIVITY :\t")
   SERIAL_DBG(connectedDevices[CONDUCTIVITY])
+  SERIAL_DBG('\n')
+  SERIAL_DBG("CLOCK :\t")
+  SERIAL_DBG(connectedDevices[CLOCK])
   SERIAL_DBG("\n\n")
 
   // If logging enabled
@@ -318,7 +353,8 @@ void readSensors()  {
     // If buffer not full
     if ( !timestamp_buf.isFull() ) {
 
-      timestamp_buf.lockedPush(millis());
+      timestamp_buf.lockedPush(clockNowMs());
+      timeUnc_buf.push(clockUncertaintyMs());
 
       // Acquire temperature
       temp_buf.push(readTemperature(connectedDevices[TEMPERATURE]));
@@ -339,6 +375,40 @@ void readSensors()  {
   //Serial.println(millis() - t);
 }
 
+/* ##############   CLOCK SYNC    ################ */
+/*
+ * @brief: 
+ *    Syncs clock on GNSS time if a GNSS module is wired,
+ *    and on time orders received on ORDER_SERIAL.
+ */
+void handleClockSync()  {
+
+  // GNSS time
+  while (GNSS_SERIAL.available())
+    gnss.encode(GNSS_SERIAL.read());
+  if (gnss.time.isUpdated() && gnss.time.isValid() && gnss.date.isValid())  {
+    uint32_t age_ms = gnss.time.age();
+    if (clockSyncFromNMEA(gnss.date.value(), gnss.time.value(), age_ms))  {
+      connectedDevices[CLOCK] = true;
+      SERIAL_DBG("Clock synced on GNSS time.\n")
+    }
+  }
+
+  // Time orders
+  while (ORDER_SERIAL.available())  {
+    char c = ORDER_SERIAL.read();
+    if (c != '\n')  {
+      order += c;
+      continue;
+    }
+    if (clockSyncFromOrder(order))  {
+      connectedDevices[CLOCK] = true;
+      SERIAL_DBG("Clock synced on time order.\n")
+    }
+    order = "";
+  }
+}
+
 /* ##############   SD CARD    ################ */
 /*
  * @brief: 
@@ -362,24 +432,21 @@ void setupSDCard( volatile bool& deviceConnected)  {
  * @brief: 
  *    Convert and write timestamp into a string.
  * @params:
- *    timestamp : Timestamp to convert and write.
+ *    timestamp : UTC timestamp (ms since epoch) to convert and write.
  *    str : String to write time into.
  *    add_ms : Should milliseconds be considered in time ?
  */
-void timestampToStr(const long& timestamp , String& str, bool add_ms) {
+void timestampToStr(const uint64_t& timestamp , String& str, bool add_ms) {
 
   uint16_t ms;
   uint32_t s, m, h;
+  time_t t = timestamp/1000;
 
-  // Convert timestamp to different time units
+  // Get hours, minutes, seconds and miliseconds values from timestamp
   ms = timestamp%1000;
-  s = SECONDS + timestamp/1000;
-  m = MINUTES + s/60;
-  h = HOURS + m/60;
-  // Get hours, minutes, seconds and miliseconds values from converted values
-  s%=60;
-  m%=60;
-  h%=24;
+  s = second(t);
+  m = minute(t);
+  h = hour(t);
   // Generate the time String
   str =  ((h < 10) ? '0' + String(h) : String(h)) + ':' +
           ((m < 10) ? '0' + String(m) : String(m)) + ':' +
@@ -457,7 +524,7 @@ bool newLogFile(File& file, const String& dirName, String& fileName)  {
     return false;
   }
   file.print("Date:,"); file.println(dirName);
-  file.println("Time (HH:MM:SS.CCC),Raw Turbidity (V),Turbidity (NTU),Raw Conductivity (mV),Conductivity (mS/cm),Temperature (°C)");
+  file.println("Time (HH:MM:SS.CCC),Time uncertainty (ms),Raw Turbidity (V),Turbidity (NTU),Raw Conductivity (mV),Conductivity (mS/cm),Temperature (°C)");
   return true;
 }
 
@@ -482,14 +549,14 @@ void handleLogFile(File& file, String& dirName, String& fileName, Metro& logSegC
     if ( !file || dirName != currDate)  {
       file.close();
       dirName = currDate;
-      timestampToStr(millis(), fileName, false);
+      timestampToStr(clockNowMs(), fileName, false);
       fileName.replace(':', '_');
       fileName += ".csv";
     }
     // Create new log segment
     else if (logSegCountdown.check()) {
       file.close();
-      timestampToStr(millis(), fileName, false);
+      timestampToStr(clockNowMs(), fileName, false);
       fileName.replace(':', '_');
       fileName += ".csv";
     }
@@ -523,14 +590,21 @@ void handleLogFile(File& file, String& dirName, String& fileName, Metro& logSegC
  * @params:
  *    log_str : String to store the log.
  *    timestamp : Timestamp to log.
+ *    timeUnc_ms : Timestamp uncertainty to log.
  *    turb : Distance in mm to log.
  *    temp_C : Temperature in °C to log.
  */
-void csv_logString(String& log_str, const long& timestamp, const float& rawTurb, const float& turb, const float& rawCond, const float& cond, const float& temp_C)  {
+void csv_logString(String& log_str, const uint64_t& timestamp, const uint32_t& timeUnc_ms, const float& rawTurb, const float& turb, const float& rawCond, const float& cond, const float& temp_C)  {
   
   // Inserting timestamp into log string
   timestampToStr(timestamp, log_str, true);
   log_str += ',';
+  // Inserting timestamp uncertainty into log string
+  if (timeUnc_ms != CLOCK_NO_UNC)
+    log_str += String(timeUnc_ms);
+  else
+    log_str += "NaN";
+  log_str += ',';
   // Inserting raw turbidity into log string
   log_str += String(rawTurb, 3) + ',';
   // Inserting turbidity into log string
@@ -567,13 +641,14 @@ void csv_logString(String& log_str, const long& timestamp, const float& rawTurb,
  * @params:
  *    fileName: Log file name.
  *    timestamp : Timestamp to log.
+ *    timeUnc_ms : Timestamp uncertainty to log.
  *    turb : Distance in mm to log.
  *    temp_C : Temperature in °C to log.
  */
-bool logToSD(File& file, const long& timestamp, const float& rawTurb, const float& turb, const float& rawCond, const float& cond, const float& temp_C) {
+bool logToSD(File& file, const uint64_t& timestamp, const uint32_t& timeUnc_ms, const float& rawTurb, const float& turb, const float& rawCond, const float& cond, const float& temp_C) {
 
   String log_str;
-  csv_logString(log_str, timestamp, rawTurb, turb, rawCond, cond, temp_C);
+  csv_logString(log_str, timestamp, timeUnc_ms, rawTurb, turb, rawCond, cond, temp_C);
   // Check if log file is open
   if (!file)
     return false;
@@ -622,7 +697,7 @@ void handleDigitalIO()  {
 
   // Check for disconnected devices
   bool deviceDisconnected = false;
-  for (uint8_t i = SD_CARD; i <= CONDUCTIVITY; i++) {
+  for (uint8_t i = SD_CARD; i <= CLOCK; i++) {
     deviceDisconnected |= !connectedDevices[i];
   }
   // Logging button
@@ -0,0 +1,166 @@
+/*
+ ****************************
+ *   CHANGE FILTER MODULE   *
+ ****************************
+ * @brief:
+ *    This module is loaded to send the values of a slow varying channel
+ *    (temperature, conductivity, pressure...) only when they change:
+ *      - CF_DEADBAND: a sample is sent when it moves more than the
+ *        tolerance from the last sent value, otherwise it is replaced by
+ *        the hold marker '=' (value of the previous sent sample).
+ *      - CF_SWINGING_DOOR: a sample is sent when the samples since the last
+ *        sent one no longer fit a straight line within the tolerance,
+ *        otherwise it is replaced by the interpolation marker '~' (linear
+ *        interpolation between the sent samples around it).
+ *      - A sample is always sent after heartbeat - 1 markers, at the start
+ *        and the end of a series (first sample, around a missing value,
+ *        flush()).
+ *    The decision needs the next sample: add() decides on the previous
+ *    sample (pending), so lines are written one sample late.
+ *    The gateway rebuilds the markers of each channel (mpcd, series_fill.h)
+ *    within the tolerance.
+ * @note:
+ *    No board specific code. Samples are periodic: the door slopes are per
+ *    sample, the gateway interpolates on sample times. The swinging door
+ *    sends the sample moved into the doors (at most by the tolerance) so
+ *    that every interpolated sample stays within the tolerance.
+ */
+#ifndef CHANGE_FILTER_H
+#define CHANGE_FILTER_H
+
+/*
+ ****************
+ *  LIBRARIES   *
+ ****************
+ */
+#include <stdint.h>
+#include <math.h>
+
+/*
+ *********************
+ *   MODULE CONFIG   *
+ *********************
+ */
+// Longest run of markers + 1 (samples)
+#ifndef CF_HEARTBEAT
+#define CF_HEARTBEAT      60
+#endif
+// Filter modes
+#define CF_DEADBAND       0
+#define CF_SWINGING_DOOR  1
+// Markers of the samples not sent
+#define CF_HOLD_MARKER    '='
+#define CF_INTERP_MARKER  '~'
+
+/*
+ *********************
+ *   CHANGE FILTER   *
+ *********************
+ */
+class ChangeFilter {
+
+public:
+  /*
+   * @params:
+   *    mode: CF_DEADBAND or CF_SWINGING_DOOR.
+   *    tolerance: Largest error of a rebuilt sample (channel unit).
+   *    heartbeat: A sample is sent at least every heartbeat samples.
+   */
+  ChangeFilter(uint8_t mode, float tolerance, uint16_t heartbeat = CF_HEARTBEAT)
+    : mode(mode), tol(tolerance), heartbeat(heartbeat > 0 ? heartbeat : 1) {}
+
+  /*
+   * @brief:
+   *    Adds a sample (NAN if missing) and decides on the pending one.
+   * @params:
+   *    keep: Sends the pending sample whatever its value.
+   * @return:
+   *    True if the pending sample is sent (its value is value()), false
+   *    if it is replaced by marker() or there was no pending sample.
+   */
+  bool add(float v, bool keep = false)  {
+
+    if (!hasPending)  {
+      pendingV = v;
+      hasPending = true;
+      return false;
+    }
+    bool send = keep || !hasPivot || isnan(pendingV) || isnan(v) || k >= heartbeat;
+    float up = 0, lo = 0;
+    if (!send)  {
+      if (mode == CF_DEADBAND)
+        send = fabsf(pendingV - pivotV) > tol;
+      else  {
+        // Doors with the new sample
+        up = fminf(upper, (v + tol - pivotV) / (k + 1));
+        lo = fmaxf(lower, (v - tol - pivotV) / (k + 1));
+        send = lo > up;
+      }
+    }
+    if (!send)  {
+      upper = up;
+      lower = lo;
+      k++;
+      pendingV = v;
+      return false;
+    }
+    out = sentValue();
+    pivotV = out;
+    hasPivot = !isnan(out);
+    k = 1;
+    upper = v + tol - pivotV;
+    lower = v - tol - pivotV;
+    pendingV = v;
+    return true;
+  }
+
+  /*
+   * @brief:
+   *    Sends the pending sample and ends the series (end of logging, new
+   *    log file): the next sample starts a new series.
+   * @return:
+   *    False if there was no pending sample.
+   */
+  bool flush()  {
+
+    if (!hasPending)
+      return false;
+    out = sentValue();
+    hasPending = false;
+    hasPivot = false;
+    return true;
+  }
+
+  // Value of the last sent sample
+  float value() const  { return out; }
+  // Marker of the samples not sent
+  char marker() const  { return mode == CF_DEADBAND ? CF_HOLD_MARKER : CF_INTERP_MARKER; }
+  bool pending() const  { return hasPending; }
+  float tolerance() const  { return tol; }
+
+private:
+  uint8_t mode;
+  float tol;
+  uint16_t heartbeat;
+  // Sample waiting for the decision
+  float pendingV = NAN;
+  bool hasPending = false;
+  // Last sent sample, pending sample index from it
+  float pivotV = NAN;
+  bool hasPivot = false;
+  uint16_t k = 1;
+  // Slopes of the doors (per sample) from the pivot
+  float upper = 0, lower = 0;
+  float out = NAN;
+
+  // Pending sample as sent: moved into the doors by the swinging door
+  float sentValue() const  {
+
+    if (mode == CF_DEADBAND || !hasPivot || isnan(pendingV))
+      return pendingV;
+    float hi = pivotV + upper * k, lo = pivotV + lower * k;
+    return pendingV > hi ? hi : (pendingV < lo ? lo : pendingV);
+  }
+};
+
+#endif
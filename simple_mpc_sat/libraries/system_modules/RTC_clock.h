@@ -0,0 +1,363 @@
+/*
+ ****************************
+ *     RTC CLOCK MODULE     *
+ ****************************
+ * @brief:
+ *    This module is loaded to timestamp samples with a drift corrected
+ *    UTC clock on boards without GNSS time.
+ *    The Teensy RTC (32.768kHz crystal, kept alive by the coin cell) is
+ *    used as raw timebase. Each time a reference time is received (GNSS
+ *    NMEA or Bluetooth time order), the clock is anchored on it. Once two
+ *    anchors are far enough apart, the crystal drift is measured, stored
+ *    in EEPROM and continuously applied between syncs.
+ *    Every timestamp comes with an uncertainty estimate growing with the
+ *    time elapsed since last sync.
+ * @note:
+ *    The RTC counter is not rewritten on each sync so that drift can be
+ *    measured on the raw crystal. It is only reset when it is more than
+ *    CLOCK_RTC_SET_THRESHOLD away from UTC, anchors being shifted accordingly.
+ */
+/*
+ ****************
+ *  LIBRARIES   *
+ ****************
+ */
+#include <TimeLib.h>
+#include <EEPROM.h>
+
+/*
+ **************************
+ *   GLOBAL DEFINITIONS   *
+ **************************
+ */
+// Uncertainty value if clock has never been synced
+#define CLOCK_NO_UNC          UINT32_MAX
+// EEPROM clock calibration record identifier
+#define CLOCK_EEPROM_MAGIC    0x434C4B31 // "CLK1"
+// Parts per billion
+#define PPB                   1000000000LL
+
+/*
+ *********************
+ *   MODULE CONFIG   *
+ *********************
+ */
+// EEPROM address of the clock calibration record
+// Keep clear of sensor calibrations stored at the beginning of EEPROM
+#define CLOCK_EEPROM_ADDR           0x100
+// RTC time under which RTC is considered unset (2023-01-01T00:00:00Z)
+#define CLOCK_MIN_VALID_TIME        1672531200/*s*/
+// Minimum interval between two anchors to measure drift
+#define CLOCK_DRIFT_MIN_PERIOD      6/*h*/ * 3600/*s/h*/ * 1000/*ms/s*/
+// Maximum drift measurement error due to anchors uncertainties
+// Measurement is postponed until anchors are far enough apart
+#define CLOCK_DRIFT_MAX_ERR_PPB     1000/*ppb*/
+// Maximum plausible crystal drift, larger measurements are rejected
+#define CLOCK_MAX_DRIFT_PPB         200000/*ppb*/
+// Drift filter weight (new measurement weighs 1/2^CLOCK_DRIFT_FILTER_SHIFT)
+#define CLOCK_DRIFT_FILTER_SHIFT    2
+// Drift uncertainty before calibration (crystal tolerance)
+#define CLOCK_XTAL_TOL_PPB          30000/*ppb*/
+// Drift uncertainty after calibration (mostly temperature dependence)
+#define CLOCK_CAL_DRIFT_UNC_PPB     2000/*ppb*/
+// Minimum interval between two syncs of same or lower quality
+// Limits re-anchoring when syncing from a 1Hz GNSS stream
+#define CLOCK_SYNC_INTERVAL         1/*h*/ * 3600/*s/h*/ * 1000/*ms/s*/
+// Uncertainty gain over the last sync for a sync within CLOCK_SYNC_INTERVAL
+#define CLOCK_SYNC_MIN_GAIN         100/*ms*/
+// RTC offset from UTC over which RTC counter is reset
+#define CLOCK_RTC_SET_THRESHOLD     2000/*ms*/
+// Uncertainty of a NMEA time (sentence output latency)
+#define CLOCK_NMEA_UNC              150/*ms*/
+// Uncertainty of a Bluetooth time order (transmission latency)
+#define CLOCK_ORDER_UNC             500/*ms*/
+// Uncertainty of the time set when uploading the program or by hand
+#define CLOCK_MANUAL_UNC            60/*s*/ * 1000/*ms/s*/
+
+/*
+ ***********************
+ *   GLOBAL VARIBLES   *
+ ***********************
+ */
+// Clock calibration record, stored in EEPROM
+struct ClockCalib {
+  uint32_t magic;
+  // Measured crystal drift (positive if RTC runs fast)
+  int32_t drift_ppb;
+  // Drift has been measured at least once
+  uint32_t calibrated;
+  // Last sync anchor (raw RTC time and UTC time)
+  uint64_t syncRaw_ms;
+  uint64_t syncUtc_ms;
+  uint32_t syncUnc_ms;
+  // Drift measurement reference anchor
+  uint64_t refRaw_ms;
+  uint64_t refUtc_ms;
+  uint32_t refUnc_ms;
+};
+
+ClockCalib clockCalib;
+// Clock has a valid anchor
+bool clockAnchored = false;
+
+/*
+ ***************************
+ *   FUNCTION PROTOTYPES   *
+ ***************************
+ */
+void setupClock(volatile bool& deviceConnected, const time_t& fallbackTime);
+uint64_t clockRawMs();
+uint64_t clockNowMs();
+uint32_t clockUncertaintyMs();
+time_t clockNowSec();
+bool clockSync(const uint64_t& utc_ms, const uint32_t& unc_ms);
+bool clockSyncFromNMEA(const uint32_t& dateVal, const uint32_t& timeVal, const uint32_t& age_ms);
+bool clockSyncFromOrder(const String& order);
+
+/*
+ ****************************
+ *   FUNCTION DEFINITIONS   *
+ ****************************
+ */
+/*
+ * @brief:
+ *    Loads clock calibration from EEPROM and checks RTC.
+ *    If RTC is not set, it is set to fallbackTime with a manual uncertainty.
+ *    Sets clock as TimeLib time provider.
+ * @params:
+ *    deviceConnected: Bool to store if RTC was running or not.
+ *    fallbackTime: Time to use if RTC is not set.
+ */
+void setupClock(volatile bool& deviceConnected, const time_t& fallbackTime)  {
+
+  SERIAL_DBG("RTC clock setup... ")
+  EEPROM.get(CLOCK_EEPROM_ADDR, clockCalib);
+  // No calibration record
+  if (clockCalib.magic != CLOCK_EEPROM_MAGIC)  {
+    memset(&clockCalib, 0, sizeof(clockCalib));
+    clockCalib.magic = CLOCK_EEPROM_MAGIC;
+  }
+
+  uint64_t raw_ms = clockRawMs();
+  deviceConnected = raw_ms / 1000 >= CLOCK_MIN_VALID_TIME;
+  // RTC lost its time (no coin cell), anchors are meaningless
+  if (!deviceConnected)  {
+    SERIAL_DBG("RTC not set, using fallback time... ")
+    Teensy3Clock.set(fallbackTime);
+    raw_ms = clockRawMs();
+    clockCalib.syncRaw_ms = clockCalib.refRaw_ms = 0;
+  }
+
+  // Check stored anchor is in the past of the RTC
+  clockAnchored = clockCalib.syncRaw_ms != 0 && clockCalib.syncRaw_ms <= raw_ms;
+  if (!clockAnchored)  {
+    // Anchor on RTC as is (set on upload or by fallback)
+    clockCalib.syncRaw_ms = clockCalib.syncUtc_ms = raw_ms;
+    clockCalib.syncUnc_ms = CLOCK_MANUAL_UNC;
+    clockCalib.refRaw_ms = 0;
+    clockAnchored = true;
+  }
+
+  setSyncProvider(clockNowSec);
+  setSyncInterval(60);
+  SERIAL_DBG("Done (drift: ")
+  SERIAL_DBG(clockCalib.calibrated ? String(clockCalib.drift_ppb) + "ppb" : "not calibrated")
+  SERIAL_DBG(").\n")
+}
+
+/*
+ * @brief:
+ *    Reads raw RTC time with millisecond resolution.
+ * @return:
+ *    Raw RTC time in ms since epoch.
+ */
+uint64_t clockRawMs()  {
+
+  uint32_t s, tpr;
+  // Read seconds and prescaler coherently
+  do {
+    s = RTC_TSR;
+    tpr = RTC_TPR;
+  } while (s != RTC_TSR);
+
+  return (uint64_t)s * 1000 + (((tpr & 0x7FFF) * 1000) >> 15);
+}
+
+/*
+ * @brief:
+ *    Returns drift corrected UTC time.
+ * @return:
+ *    UTC time in ms since epoch.
+ */
+uint64_t clockNowMs()  {
+
+  int64_t elapsed_ms = clockRawMs() - clockCalib.syncRaw_ms;
+  if (clockCalib.calibrated)
+    elapsed_ms -= elapsed_ms * clockCalib.drift_ppb / PPB;
+
+  return clockCalib.syncUtc_ms + elapsed_ms;
+}
+
+/*
+ * @brief:
+ *    Returns current time uncertainty.
+ *    Sync uncertainty plus drift uncertainty accumulated since last sync.
+ * @return:
+ *    Uncertainty in ms, CLOCK_NO_UNC if never synced.
+ */
+uint32_t clockUncertaintyMs()  {
+
+  if (!clockAnchored)
+    return CLOCK_NO_UNC;
+
+  uint64_t elapsed_ms = clockRawMs() - clockCalib.syncRaw_ms;
+  uint32_t driftUnc_ppb = clockCalib.calibrated ? CLOCK_CAL_DRIFT_UNC_PPB : CLOCK_XTAL_TOL_PPB;
+
+  // +1ms for timestamp resolution
+  return clockCalib.syncUnc_ms + elapsed_ms * driftUnc_ppb / PPB + 1;
+}
+
+/*
+ * @brief:
+ *    TimeLib time provider.
+ * @return:
+ *    UTC time in s since epoch.
+ */
+time_t clockNowSec()  {
+
+  return clockNowMs() / 1000;
+}
+
+/*
+ * @brief:
+ *    Anchors the clock on a reference time.
+ *    Measures crystal drift if reference anchor is old enough. The
+ *    calibration is stored in EEPROM only when the reference anchor, the
+ *    drift or the RTC counter change (not on every sync).
+ * @params:
+ *    utc_ms: Reference UTC time in ms since epoch.
+ *    unc_ms: Reference time uncertainty.
+ * @return:
+ *    False if sync has been ignored.
+ */
+bool clockSync(const uint64_t& utc_ms, const uint32_t& unc_ms)  {
+
+  uint64_t raw_ms = clockRawMs();
+
+  // Rate limit syncs that do not improve the last sync uncertainty
+  if (raw_ms - clockCalib.syncRaw_ms < CLOCK_SYNC_INTERVAL && unc_ms + CLOCK_SYNC_MIN_GAIN > clockCalib.syncUnc_ms)
+    return false;
+  // Calibration record to write in EEPROM
+  bool store = false;
+
+  // Reset RTC counter if too far from UTC
+  int64_t offset_ms = (int64_t)(utc_ms - raw_ms);
+  if (offset_ms > CLOCK_RTC_SET_THRESHOLD || offset_ms < -CLOCK_RTC_SET_THRESHOLD)  {
+    Teensy3Clock.set(utc_ms / 1000);
+    uint64_t newRaw_ms = clockRawMs();
+    // Shift anchors by RTC jump
+    clockCalib.syncRaw_ms += newRaw_ms - raw_ms;
+    if (clockCalib.refRaw_ms != 0)
+      clockCalib.refRaw_ms += newRaw_ms - raw_ms;
+    raw_ms = newRaw_ms;
+    store = true;
+  }
+
+  // Measure drift against reference anchor
+  if (clockCalib.refRaw_ms == 0)  {
+    clockCalib.refRaw_ms = raw_ms;
+    clockCalib.refUtc_ms = utc_ms;
+    clockCalib.refUnc_ms = unc_ms;
+    store = true;
+  }
+  else if (utc_ms - clockCalib.refUtc_ms >= CLOCK_DRIFT_MIN_PERIOD &&
+           (int64_t)(clockCalib.refUnc_ms + unc_ms) * PPB / (int64_t)(utc_ms - clockCalib.refUtc_ms) < CLOCK_DRIFT_MAX_ERR_PPB)  {
+    int64_t elapsedUtc_ms = utc_ms - clockCalib.refUtc_ms;
+    int64_t elapsedRaw_ms = raw_ms - clockCalib.refRaw_ms;
+    int64_t drift_ppb = (elapsedRaw_ms - elapsedUtc_ms) * PPB / elapsedUtc_ms;
+
+    // Reject implausible drift (RTC reset, wrong reference time)
+    if (drift_ppb < CLOCK_MAX_DRIFT_PPB && drift_ppb > -CLOCK_MAX_DRIFT_PPB)  {
+      if (clockCalib.calibrated)
+        clockCalib.drift_ppb += (drift_ppb - clockCalib.drift_ppb) >> CLOCK_DRIFT_FILTER_SHIFT;
+      else
+        clockCalib.drift_ppb = drift_ppb;
+      clockCalib.calibrated = 1;
+      SERIAL_DBG("Clock drift measured: ")
+      SERIAL_DBG((int32_t)drift_ppb)
+      SERIAL_DBG("ppb\n")
+    }
+    clockCalib.refRaw_ms = raw_ms;
+    clockCalib.refUtc_ms = utc_ms;
+    clockCalib.refUnc_ms = unc_ms;
+    store = true;
+  }
+
+  // Anchor clock (read from sensor reading interrupt)
+  noInterrupts();
+  clockCalib.syncRaw_ms = raw_ms;
+  clockCalib.syncUtc_ms = utc_ms;
+  clockCalib.syncUnc_ms = unc_ms;
+  clockAnchored = true;
+  interrupts();
+  // The anchor stored with the record stays valid between writes
+  if (store)
+    EEPROM.put(CLOCK_EEPROM_ADDR, clockCalib);
+  // Update TimeLib
+  setTime(utc_ms / 1000);
+
+  return true;
+}
+
+/*
+ * @brief:
+ *    Syncs the clock on a TinyGPSPlus date and time.
+ * @params:
+ *    dateVal: TinyGPSPlus date value (DDMMYY).
+ *    timeVal: TinyGPSPlus time value (HHMMSSCC).
+ *    age_ms: Time elapsed since NMEA sentence was parsed.
+ * @return:
+ *    False if date/time invalid or sync ignored.
+ */
+bool clockSyncFromNMEA(const uint32_t& dateVal, const uint32_t& timeVal, const uint32_t& age_ms)  {
+
+  tmElements_t tm;
+  tm.Day = dateVal / 10000;
+  tm.Month = (dateVal / 100) % 100;
+  tm.Year = CalendarYrToTm(2000 + dateVal % 100);
+  tm.Hour = timeVal / 1000000;
+  tm.Minute = (timeVal / 10000) % 100;
+  tm.Second = (timeVal / 100) % 100;
+  if (tm.Day == 0 || tm.Month == 0 || tm.Month > 12)
+    return false;
+
+  uint64_t utc_ms = (uint64_t)makeTime(tm) * 1000 + (timeVal % 100) * 10 + age_ms;
+  if (utc_ms / 1000 < CLOCK_MIN_VALID_TIME)
+    return false;
+
+  return clockSync(utc_ms, CLOCK_NMEA_UNC);
+}
+
+/*
+ * @brief:
+ *    Syncs the clock on a Bluetooth time order.
+ *    Order format: {"order":"setTime","time":<UTC ms since epoch>}
+ * @params:
+ *    order: Received order.
+ * @return:
+ *    False if order is not a valid time order or sync ignored.
+ */
+bool clockSyncFromOrder(const String& order)  {
+
+  if (order.indexOf("\"setTime\"") < 0)
+    return false;
+  int idx = order.indexOf("\"time\":");
+  if (idx < 0)
+    return false;
+
+  uint64_t utc_ms = strtoull(order.c_str() + idx + 7, NULL, 10);
+  if (utc_ms / 1000 < CLOCK_MIN_VALID_TIME)
+    return false;
+
+  return clockSync(utc_ms, CLOCK_ORDER_UNC);
+}